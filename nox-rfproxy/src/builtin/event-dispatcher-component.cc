@@ -41,6 +41,7 @@
 #include "barrier-reply.hh"
 #include "openflow-msg-in.hh"
 
+#include "event-dispatcher.hh"
 #include "nox.hh"
 #include "vlog.hh"
 #include "json_object.hh"
@@ -54,6 +55,88 @@ using namespace vigil::container;
 
 static Vlog_module lg("event-dispatcher-c");
 
+static bool
+parse_priority(const string& s, Event_dispatcher::Priority& prio)
+{
+    if (s == "control") {
+        prio = Event_dispatcher::PRIO_CONTROL;
+    } else if (s == "result") {
+        prio = Event_dispatcher::PRIO_RESULT;
+    } else if (s == "default") {
+        prio = Event_dispatcher::PRIO_DEFAULT;
+    } else if (s == "packet_in") {
+        prio = Event_dispatcher::PRIO_PACKET_IN;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* Applies the optional "event_queues" and "event_priorities" sections of
+ * the "nox" configuration to the core event dispatcher, e.g.:
+ *
+ *   "event_queues": {
+ *       "packet_in": { "weight": 4, "limit": 65536, "drop": "oldest" }
+ *   },
+ *   "event_priorities": { "Flow_removed_event": "default" }
+ */
+static void
+configure_event_queues(json_object* nox_conf)
+{
+    Event_dispatcher* ed = nox::get_event_dispatcher();
+    if (!ed) {
+        return;
+    }
+
+    json_object* queues = json::get_dict_value(nox_conf, "event_queues");
+    if (queues && queues->type == json_object::JSONT_DICT) {
+        json_dict* queuesDict = (json_dict*) queues->object;
+        for (json_dict::iterator qi = queuesDict->begin();
+             qi != queuesDict->end(); ++qi) {
+            Event_dispatcher::Priority prio;
+            if (!parse_priority(qi->first, prio)
+                || qi->second->type != json_object::JSONT_DICT) {
+                lg.warn("ignoring unknown event queue \"%s\"",
+                        qi->first.c_str());
+                continue;
+            }
+
+            json_object* weight = json::get_dict_value(qi->second, "weight");
+            if (weight && weight->type == json_object::JSONT_INTEGER
+                && *(int*) weight->object > 0) {
+                ed->set_weight(prio, *(int*) weight->object);
+            }
+
+            json_object* limit = json::get_dict_value(qi->second, "limit");
+            json_object* drop = json::get_dict_value(qi->second, "drop");
+            if (limit && limit->type == json_object::JSONT_INTEGER
+                && *(int*) limit->object >= 0) {
+                Event_dispatcher::Drop_policy policy
+                    = Event_dispatcher::DROP_NEWEST;
+                if (drop && drop->get_string(true) == "oldest") {
+                    policy = Event_dispatcher::DROP_OLDEST;
+                }
+                ed->set_limit(prio, *(int*) limit->object, policy);
+            }
+        }
+    }
+
+    json_object* prios = json::get_dict_value(nox_conf, "event_priorities");
+    if (prios && prios->type == json_object::JSONT_DICT) {
+        json_dict* priosDict = (json_dict*) prios->object;
+        for (json_dict::iterator pi = priosDict->begin();
+             pi != priosDict->end(); ++pi) {
+            Event_dispatcher::Priority prio;
+            if (!parse_priority(pi->second->get_string(true), prio)) {
+                lg.warn("ignoring unknown priority for event \"%s\"",
+                        pi->first.c_str());
+                continue;
+            }
+            ed->set_priority(pi->first, prio);
+        }
+    }
+}
+
 EventDispatcherComponent::EventDispatcherComponent(const Context* c,
                                                    const json_object*
                                                    platformconf)  
@@ -81,6 +164,8 @@ EventDispatcherComponent::EventDispatcherComponent(const Context* c,
 	filter_chains[event_name] = chain;
     }
 
+    configure_event_queues(nox);
+
     // Register the system events
     register_event<Datapath_join_event>();
     register_event<Datapath_leave_event>();
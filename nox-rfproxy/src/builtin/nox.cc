@@ -19,19 +19,30 @@
 #include "nox.hh"
 
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/shared_array.hpp>
+#include <deque>
 #include <errno.h>
+#include <fcntl.h>
 #include <map>
 #include <signal.h>
+#include <unistd.h>
 #include "kernel.hh" 
+#include "aggregate-stats-in.hh"
 #include "assert.hh"
+#include "barrier-reply.hh"
 #include "buffer.hh"
 #include "cfg.hh"
 #include "datapath-join.hh"
 #include "datapath-leave.hh"
+#include "desc-stats-in.hh"
 #include "echo-request.hh"
+#include "errno_exception.hh"
+#include "error-event.hh"
 #include "event-dispatcher.hh"
 #include "flow-mod-event.hh"
+#include "flow-removed.hh"
+#include "flow-stats-in.hh"
 #include "ofmp-config-update.hh"
 #include "ofmp-config-update-ack.hh"
 #include "ofmp-resources-update.hh"
@@ -39,12 +50,20 @@
 #include "openflow/nicira-ext.h"
 #include "openflow/openflow-mgmt.h"
 #include "openflow-event.hh"
+#include "packet-in.hh"
 #include "poll-loop.hh"
+#include "port-stats-in.hh"
+#include "port-status.hh"
+#include "queue-config-in.hh"
+#include "queue-stats-in.hh"
 #include "shutdown-event.hh"
+#include "spsc_queue.hh"
 #include "string.hh"
 #include "switch-mgr.hh"
 #include "switch-mgr-join.hh"
 #include "switch-mgr-leave.hh"
+#include "table-stats-in.hh"
+#include "threads/native.hh"
 #include "threads/signals.hh"
 #include "timeval.hh"
 #include "vlog.hh"
@@ -63,6 +82,8 @@ static Event_dispatcher event_dispatcher;
 static Timer_dispatcher timer_dispatcher;
 static Switch_Auth *switch_authenticator = NULL; 
 
+class Io_shard;
+
 class Conn
     : public Pollable {
 public:
@@ -70,7 +91,7 @@ public:
     Co_sema* disconnected;
 
     Conn(boost::shared_ptr<Openflow_connection> oconn_,
-         Co_sema* disconnected_);
+         Co_sema* disconnected_, Io_shard* shard_ = NULL);
     ~Conn();
 
     bool poll();
@@ -78,12 +99,142 @@ public:
     
     void close();
 private:
+    friend class Io_shard;
+
     bool closing;
     int poll_cnt;
 
+    /* I/O shard that polls this connection, or null if 'main_loop' does.
+     * 'in_shard' is only accessed by the shard's thread group and tells
+     * whether the shard is still polling us; 'shard_done' is only accessed
+     * by the main thread group and tells whether the shard has told us that
+     * it stopped. */
+    Io_shard* shard;
+    bool in_shard;
+    bool shard_done;
+
+    /* Maximum number of messages dispatched by a single poll(). */
+    static const int max_msgs_per_poll = 256;
+
     bool do_poll();
 };
 
+/* Switch connections are normally polled by 'main_loop', in the thread group
+ * that also dispatches their events.  With I/O threads enabled, each TCP
+ * connection is instead polled by the Io_shard chosen by its datapath id.
+ * Every shard runs its own Poll_loop in its own thread group, in parallel
+ * with the other shards and with the main thread group.  It reads and
+ * parses messages and passes the resulting events, in order, to the main
+ * thread group through a lock-free queue, which the main loop drains by
+ * polling the shard.
+ *
+ * Connections are still closed and destroyed only in the main thread group.
+ * A shard stops polling a connection when reading from it fails or when the
+ * main thread group releases it, and then queues a "detached" notice (a null
+ * event).  The Conn is destroyed only once that notice has been received,
+ * after all of the connection's events. */
+class Io_shard
+    : public Pollable {
+public:
+    Io_shard();
+
+    /* Called in the main thread group. */
+    void adopt(Conn*);
+    void release(Conn*);
+    bool poll();
+    void wait();
+
+    /* Called in the shard's thread group. */
+    void deliver(Conn*, Event*);
+    void detach(Conn*);
+
+private:
+    struct Item {
+        Conn* conn;
+        Event* event;           /* Null for a "detached" notice. */
+    };
+
+    /* Pollable run by the shard's Poll_loop to pick up connections adopted
+     * and released by the main thread group. */
+    class Control
+        : public Pollable {
+    public:
+        Control(Io_shard* shard_) : shard(shard_) { }
+        bool poll();
+        void wait();
+    private:
+        Io_shard* shard;
+    };
+
+    co_group* group;
+    Poll_loop* loop;
+    Control control;
+
+    /* Connections adopted (true) and released (false) by the main thread
+     * group, not yet processed by the shard, with a pipe to wake it. */
+    Native_mutex requests_mutex;
+    std::deque<std::pair<Conn*, bool> > requests;
+    int requests_pipe[2];
+
+    /* Events from the shard to the main thread group, with a pipe to wake
+     * the main loop once it has gone to sleep waiting on an empty queue. */
+    Spsc_queue<Item> inbox;
+    int inbox_pipe[2];
+    volatile int inbox_sleeping;
+
+    /* Capacity of 'inbox'.  A shard that fills it stops reading from its
+     * switches until the main thread group catches up. */
+    static const size_t inbox_size = 64 * 1024;
+
+    /* Maximum number of events dispatched by a single poll(). */
+    static const int max_events_per_poll = 1024;
+
+    static void make_pipe(int fds[2]);
+    static void drain_pipe(int fd);
+    static void wake_pipe(int fd);
+};
+
+static std::vector<Io_shard*> io_shards;
+
+static bool
+is_packet_in_from(const Event& event, Event_type_id packet_in_id,
+                  datapathid datapath_id)
+{
+    return (event.get_type_id() == packet_in_id
+            && static_cast<const Packet_in_event&>(event).datapath_id
+               == datapath_id);
+}
+
+/* Dispatches the packet-ins still queued from 'datapath_id', so that the
+ * switch's leave event, which is queued with higher priority, is not handled
+ * ahead of them.  Scans the whole packet-in queue, so it is only done when a
+ * switch leaves. */
+static void
+flush_packet_ins(datapathid datapath_id)
+{
+    static const Event_type_id packet_in_id
+        = Event::get_type_id(Packet_in_event::static_get_name());
+    event_dispatcher.flush(Event_dispatcher::PRIO_PACKET_IN,
+                           boost::bind(is_packet_in_from, _1, packet_in_id,
+                                       datapath_id));
+}
+
+/* Handles 'event', received from a switch.  Packet-ins are queued, so that a
+ * flood of them cannot hold up keepalives and status changes from the same
+ * or other switches, and may be dropped once their queue is full.  Anything
+ * else is dispatched right away, even ahead of the switch's own queued
+ * packet-ins; only its leave waits for them (see Conn::close()). */
+static void
+handle_switch_event(std::auto_ptr<Event> event)
+{
+    if (event_dispatcher.get_priority(event->get_type_id())
+        == Event_dispatcher::PRIO_PACKET_IN) {
+        event_dispatcher.post(event.release());
+    } else {
+        event_dispatcher.dispatch(*event);
+    }
+}
+
 // DPID to connection mappings 
 typedef std::map<datapathid, Conn*> chashmap;
 static chashmap connection_map;
@@ -98,13 +249,20 @@ static swmhashmap swm_map;
 
 
 Conn::Conn(boost::shared_ptr<Openflow_connection> oconn_,
-           Co_sema* disconnected_)
+           Co_sema* disconnected_, Io_shard* shard_)
     : oconn(oconn_),
       disconnected(disconnected_),
       closing(false),
-      poll_cnt(0)
+      poll_cnt(0),
+      shard(shard_),
+      in_shard(false),
+      shard_done(false)
 {
-    main_loop->add_pollable(this);
+    if (shard) {
+        shard->adopt(this);
+    } else {
+        main_loop->add_pollable(this);
+    }
 }
 
 Conn::~Conn()
@@ -215,6 +373,12 @@ handle_ofmp_resources_update(const Event &e)
 bool
 Conn::poll()
 {
+    if (shard) {
+        /* The main thread group may destroy us as soon as do_poll() detaches
+         * us from the shard, so we must not touch ourselves afterward. */
+        return do_poll();
+    }
+
     ++poll_cnt;
     bool retval = do_poll();
     int p = --poll_cnt;
@@ -231,6 +395,9 @@ Conn::close()
         closing = true;
         datapathid dp_id = oconn->get_datapath_id();
         datapathid mgmt_id = oconn->get_mgmt_id();
+        /* The leave event is queued with higher priority than packet-ins,
+         * so it would otherwise overtake the switch's last ones. */
+        flush_packet_ins(dp_id);
         if (dp_id == mgmt_id) {
             Switch_mgr_leave_event* swmle = new Switch_mgr_leave_event(mgmt_id);
             swm_map.erase(mgmt_id);
@@ -241,49 +408,79 @@ Conn::close()
         }
         connection_map.erase(dp_id);
         mgmt_map.erase(dp_id);
-        main_loop->remove_pollable(this);
-        if (!poll_cnt) {
-            delete this;
+        if (shard) {
+            if (shard_done) {
+                delete this;
+            } else {
+                shard->release(this);
+            }
+        } else {
+            main_loop->remove_pollable(this);
+            if (!poll_cnt) {
+                delete this;
+            }
         }
     }
 }
 
+/* Dispatches the messages that have arrived on the connection.  A single
+ * read usually brings in many messages, so keep going until the connection
+ * has nothing more for us, but no further than 'max_msgs_per_poll' so that
+ * one busy switch cannot starve the rest. */
 bool
 Conn::do_poll()
 {
-    int error;
-    std::auto_ptr<Buffer> b(oconn->recv_openflow(error, false));
-    switch (error) {
-    case 0: {
-        std::auto_ptr<Buffer> msgB(new Array_buffer(b.get()->size()));
-        memcpy(msgB.get()->data(), b.get()->data(), b.get()->size());
-
-        std::auto_ptr<Event> event(openflow_packet_to_event(oconn, b));
-        if (event.get()) {
-            event_dispatcher.dispatch(*event);
-        }
+    for (int i = 0; i < max_msgs_per_poll; i++) {
+        int error;
+        std::auto_ptr<Buffer> b(oconn->recv_openflow(error, false));
+        switch (error) {
+        case 0: {
+            std::auto_ptr<Buffer> msgB(new Array_buffer(b.get()->size()));
+            memcpy(msgB.get()->data(), b.get()->data(), b.get()->size());
+
+            std::auto_ptr<Event> event(openflow_packet_to_event(oconn, b));
+            if (shard) {
+                if (event.get()) {
+                    shard->deliver(this, event.release());
+                }
+                event.reset(openflow_msg_to_event(oconn, msgB));
+                if (event.get()) {
+                    shard->deliver(this, event.release());
+                }
+                break;
+            }
 
-        event.reset(openflow_msg_to_event(oconn, msgB));
-	if (event.get())
-	    event_dispatcher.dispatch(*event);
+            if (event.get()) {
+                handle_switch_event(event);
+            }
 
-        return true;
-    }
+            event.reset(openflow_msg_to_event(oconn, msgB));
+            if (event.get())
+                handle_switch_event(event);
+
+            if (closing) {
+                return true;
+            }
+            break;
+        }
 
-    case EAGAIN:
-        return false;
+        case EAGAIN:
+            return i > 0;
 
-    case EOF:
-        lg.warn("%s: connection closed by peer", oconn->to_string().c_str());
-        close();
-        return true;
- 
-    default:
-        lg.warn("%s: disconnected (%s)",
-                oconn->to_string().c_str(), strerror(error));
-        close();
-        return true;
-   }
+        case EOF:
+            lg.warn("%s: connection closed by peer",
+                    oconn->to_string().c_str());
+            shard ? shard->detach(this) : close();
+            return true;
+
+        default:
+            lg.warn("%s: disconnected (%s)",
+                    oconn->to_string().c_str(), strerror(error));
+            shard ? shard->detach(this) : close();
+            return true;
+        }
+    }
+    return true;
 }
 
 void
@@ -292,6 +489,173 @@ Conn::wait()
     oconn->recv_openflow_wait();
 }
 
+Io_shard::Io_shard()
+    : loop(new Poll_loop(1)),
+      control(this),
+      inbox(inbox_size),
+      inbox_sleeping(0)
+{
+    make_pipe(requests_pipe);
+    make_pipe(inbox_pipe);
+
+    /* 'loop' is not started until the new thread group runs it, so it is
+     * safe to add to it from here. */
+    loop->add_pollable(&control);
+    co_group_create(&group);
+    co_thread_create(group, boost::bind(&Poll_loop::run, loop));
+}
+
+void
+Io_shard::make_pipe(int fds[2])
+{
+    if (pipe(fds) == -1) {
+        throw errno_exception(errno, "pipe");
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+}
+
+void
+Io_shard::drain_pipe(int fd)
+{
+    char buf[128];
+    while (read(fd, buf, sizeof buf) > 0) {
+        continue;
+    }
+}
+
+/* Writes a byte to 'fd' to wake up its reader.  A full pipe already holds a
+ * wakeup that the reader has yet to drain, so EAGAIN is not an error. */
+void
+Io_shard::wake_pipe(int fd)
+{
+    ssize_t n;
+    do {
+        n = ::write(fd, "", 1);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1 && errno != EAGAIN) {
+        lg.err("failed to wake up I/O shard (%s)", strerror(errno));
+    }
+}
+
+/* Hands 'conn' over to the shard, which starts polling it. */
+void
+Io_shard::adopt(Conn* conn)
+{
+    Scoped_native_mutex lock(&requests_mutex);
+    requests.push_back(std::make_pair(conn, true));
+    wake_pipe(requests_pipe[1]);
+}
+
+/* Asks the shard to stop polling 'conn'.  The shard answers with a
+ * "detached" notice, unless it has already sent one. */
+void
+Io_shard::release(Conn* conn)
+{
+    Scoped_native_mutex lock(&requests_mutex);
+    requests.push_back(std::make_pair(conn, false));
+    wake_pipe(requests_pipe[1]);
+}
+
+/* Queues 'event', received on 'conn', for dispatch by the main thread group.
+ * Blocks while the queue is full. */
+void
+Io_shard::deliver(Conn* conn, Event* event)
+{
+    Item item = { conn, event };
+    while (!inbox.push(item)) {
+        co_timer_wait(do_gettimeofday() + make_timeval(0, 1000), NULL);
+        co_block();
+    }
+    __sync_synchronize();
+    if (inbox_sleeping) {
+        inbox_sleeping = 0;
+        wake_pipe(inbox_pipe[1]);
+    }
+}
+
+/* Stops polling 'conn' and tells the main thread group that we did. */
+void
+Io_shard::detach(Conn* conn)
+{
+    if (conn->in_shard) {
+        conn->in_shard = false;
+        loop->remove_pollable(conn);
+        deliver(conn, NULL);
+    }
+}
+
+bool
+Io_shard::Control::poll()
+{
+    drain_pipe(shard->requests_pipe[0]);
+
+    std::deque<std::pair<Conn*, bool> > todo;
+    {
+        Scoped_native_mutex lock(&shard->requests_mutex);
+        todo.swap(shard->requests);
+    }
+
+    typedef std::pair<Conn*, bool> Request;
+    BOOST_FOREACH (const Request& r, todo) {
+        Conn* conn = r.first;
+        if (r.second) {
+            conn->in_shard = true;
+            shard->loop->add_pollable(conn);
+        } else {
+            shard->detach(conn);
+        }
+    }
+    return !todo.empty();
+}
+
+void
+Io_shard::Control::wait()
+{
+    co_fd_read_wait(shard->requests_pipe[0], NULL);
+}
+
+/* Dispatches the events queued by the shard. */
+bool
+Io_shard::poll()
+{
+    inbox_sleeping = 0;
+    drain_pipe(inbox_pipe[0]);
+
+    int n;
+    Item item;
+    for (n = 0; n < max_events_per_poll && inbox.pop(item); n++) {
+        Conn* conn = item.conn;
+        if (item.event) {
+            std::auto_ptr<Event> event(item.event);
+            if (!conn->closing) {
+                handle_switch_event(event);
+            }
+        } else {
+            conn->shard_done = true;
+            if (conn->closing) {
+                delete conn;
+            } else {
+                conn->close();
+            }
+        }
+    }
+    return n > 0;
+}
+
+void
+Io_shard::wait()
+{
+    inbox_sleeping = 1;
+    __sync_synchronize();
+    if (!inbox.empty()) {
+        co_immediate_wake(1, NULL);
+    } else {
+        co_fd_read_wait(inbox_pipe[0], NULL);
+    }
+}
+
 class Signal_handler {
 public:
     Signal_handler();
@@ -347,7 +711,7 @@ handle_echo_request(const Event& e)
 }
 
 void
-init()
+init(unsigned int n_io_threads)
 {
     classifier.register_packet_in();
     register_handler(Echo_request_event::static_get_name(),
@@ -358,9 +722,61 @@ init()
                      handle_ofmp_config_ack, 100);
     register_handler(Ofmp_resources_update_event::static_get_name(),
                      handle_ofmp_resources_update, 100);
+
+    /* Event queue defaults, which may be overridden through the
+     * "event_queues" and "event_priorities" configuration. */
+    const Event_dispatcher::Priority control = Event_dispatcher::PRIO_CONTROL;
+    event_dispatcher.set_priority(Echo_request_event::static_get_name(),
+                                  control);
+    event_dispatcher.set_priority(Port_status_event::static_get_name(),
+                                  control);
+    event_dispatcher.set_priority(Datapath_join_event::static_get_name(),
+                                  control);
+    event_dispatcher.set_priority(Datapath_leave_event::static_get_name(),
+                                  control);
+    event_dispatcher.set_priority(Switch_mgr_join_event::static_get_name(),
+                                  control);
+    event_dispatcher.set_priority(Switch_mgr_leave_event::static_get_name(),
+                                  control);
+
+    const Event_dispatcher::Priority result = Event_dispatcher::PRIO_RESULT;
+    event_dispatcher.set_priority(Barrier_reply_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Error_event::static_get_name(), result);
+    event_dispatcher.set_priority(Flow_removed_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Flow_stats_in_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Port_stats_in_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Table_stats_in_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Aggregate_stats_in_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Desc_stats_in_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Queue_stats_in_event::static_get_name(),
+                                  result);
+    event_dispatcher.set_priority(Queue_config_in_event::static_get_name(),
+                                  result);
+
+    event_dispatcher.set_priority(Packet_in_event::static_get_name(),
+                                  Event_dispatcher::PRIO_PACKET_IN);
+
+    event_dispatcher.set_weight(Event_dispatcher::PRIO_CONTROL, 64);
+    event_dispatcher.set_weight(Event_dispatcher::PRIO_RESULT, 16);
+    event_dispatcher.set_weight(Event_dispatcher::PRIO_DEFAULT, 8);
+    event_dispatcher.set_weight(Event_dispatcher::PRIO_PACKET_IN, 4);
+    event_dispatcher.set_limit(Event_dispatcher::PRIO_PACKET_IN, 65536,
+                               Event_dispatcher::DROP_OLDEST);
+
     main_loop = new Poll_loop(N_THREADS);
     main_loop->add_pollable(&event_dispatcher);
     main_loop->add_pollable(&timer_dispatcher);
+    for (unsigned int i = 0; i < n_io_threads; i++) {
+        io_shards.push_back(new Io_shard);
+        main_loop->add_pollable(io_shards.back());
+    }
     new Signal_handler;
 }
 
@@ -369,6 +785,11 @@ get_poll_loop() {
     return main_loop;
 }
 
+Event_dispatcher*
+get_event_dispatcher() {
+    return &event_dispatcher;
+}
+
 void
 register_handler(const Event_name& name,
                  boost::function<Disposition(const Event&)> handler, int order)
@@ -1419,9 +1840,17 @@ register_conn(Openflow_connection* oconn, Co_sema* disconnected)
 {
     datapathid dp_id = oconn->get_datapath_id();
 
+    /* SSL sessions cannot be read and written from different threads at
+     * once, so only plain TCP connections go to the I/O shards. */
+    Io_shard* shard = NULL;
+    if (!io_shards.empty()
+        && oconn->get_conn_type() == Openflow_connection::TYPE_TCP) {
+        shard = io_shards[dp_id.as_host() % io_shards.size()];
+    }
+
     chashmap::iterator i;
     Conn* conn = new Conn(boost::shared_ptr<Openflow_connection>(oconn),
-                          disconnected);
+                          disconnected, shard);
     std::pair<chashmap::iterator, bool> pair
         = connection_map.insert(chashmap::value_type(dp_id, conn));
     if (!pair.second) {
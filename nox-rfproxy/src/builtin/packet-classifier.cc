@@ -36,23 +36,13 @@ Disposition
 Packet_classifier::handle_packet_in(const Event& e)
 {
     const Packet_in_event& pi = assert_cast<const Packet_in_event&>(e);
-    const Rule<Packet_expr, Pexpr_action> *match;
     Flow flow(pi.in_port, *(pi.get_buffer()));
 
-    result.set_data(&flow);
-    get_rules(result);
-    match = result.next();
-    if (match == NULL) {
-        result.clear();
-        return CONTINUE;
+    Lookup_result rules;
+    lookup(flow, rules);
+    for (size_t i = 0; i < rules.size(); i++) {
+        rules[i].action(pi);
     }
-    int top_priority = match->priority;
-    do {
-        match->action(pi);
-        match = result.next();
-    } while (match != NULL && (match->priority == top_priority));
-
-    result.clear();
     return CONTINUE;
 }
 
@@ -19,6 +19,7 @@
 #define ASYNC_IO_HH 1
 
 #include <memory>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace vigil {
@@ -43,6 +44,7 @@ public:
     ssize_t write(const Buffer&, bool block);
     int read_fully(Buffer&, ssize_t *bytes_read, bool block);
     int write_fully(const Buffer&, ssize_t *bytes_written, bool block);
+    ssize_t writev(const struct iovec*, int iovcnt, bool block);
     virtual void read_wait() = 0;
     virtual void write_wait() = 0;
     virtual void connect_wait() = 0;
@@ -50,6 +52,7 @@ public:
 protected:
     virtual ssize_t do_read(Buffer&) = 0;
     virtual ssize_t do_write(const Buffer&) = 0;
+    virtual ssize_t do_writev(const struct iovec*, int iovcnt);
 };
 
 class Async_datagram
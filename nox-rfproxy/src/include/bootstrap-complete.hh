@@ -26,7 +26,7 @@ struct Bootstrap_complete_event
     : public Event
 {
     Bootstrap_complete_event()
-        : Event(static_get_name()) { }
+        : Event(event_type<Bootstrap_complete_event>()) { }
 
     static const Event_name static_get_name() {
         return "Bootstrap_complete_event";
@@ -18,6 +18,7 @@
 #ifndef BUFFER_HH
 #define BUFFER_HH 1
 
+#include <boost/shared_ptr.hpp>
 #include <cassert>
 #include <cstdlib>
 #include <stdint.h>
@@ -195,6 +196,9 @@ public:
     uint8_t* push(size_t n);
     uint8_t* put(size_t n);
 
+    /* Number of bytes that put() can add without reallocating. */
+    size_t tailroom() const { return (base + capacity) - (data() + size()); }
+
 protected:    
     Array_buffer() : Buffer() { }
 
@@ -299,6 +303,40 @@ inline void Nonowning_buffer::reinit(uint8_t* data_, size_t size_)
     m_size = size_;
 }
 
+/* A buffer whose content is a slice of an Array_buffer that is shared, by
+ * reference count, with other Shared_subbuffers, e.g. one of several messages
+ * received with a single read.  The shared storage is released when the last
+ * slice that refers to it is destroyed.
+ *
+ * Extending a Shared_subbuffer first copies its content into storage of its
+ * own, so that it never overwrites a neighboring slice. */
+class Shared_subbuffer
+    : public Buffer
+{
+public:
+    Shared_subbuffer(const boost::shared_ptr<Array_buffer>&,
+                     size_t offset, size_t length);
+    ~Shared_subbuffer() { }
+
+    uint8_t* push(size_t n);
+    uint8_t* put(size_t n);
+
+private:
+    boost::shared_ptr<Array_buffer> storage;
+
+    void unshare();
+};
+
+/* Constructs a Shared_subbuffer whose contents are the 'length' bytes that
+ * start 'offset' bytes into 'storage_'. */
+inline Shared_subbuffer::Shared_subbuffer(
+    const boost::shared_ptr<Array_buffer>& storage_,
+    size_t offset, size_t length)
+    : Buffer(storage_->data() + offset, length), storage(storage_)
+{
+    assert(offset + length <= storage_->size());
+}
+
 } // namespace vigil
 
 #endif /* buffer.hh */
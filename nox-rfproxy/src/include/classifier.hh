@@ -20,11 +20,13 @@
 
 #include <errno.h>
 #include <stdint.h>
-#include <boost/scoped_ptr.hpp>
+#include <memory>
+#include <vector>
 //#include <boost/shared_ptr.hpp>
 
 #include "cnode.hh"
 #include "errno_exception.hh"
+#include "flat-classifier.hh"
 #include "hash_map.hh"
 #include "rule.hh"
 
@@ -40,6 +42,17 @@
  * (instead of requiring a search of the entire tree).
  *
  * Expr should follow the model described by the example in "expr.hh".
+ *
+ * Also keeps a Flat_classifier copy of the rules, which lookup() searches.
+ * Unlike get_rules(), lookup() needs no per-caller state and may be called
+ * from any thread.
+ *
+ * Rules are added to and removed from the tree incrementally.  Once build()
+ * has been called, leaves that grow too long are split as rules are added, so
+ * the tree stays built.  Changes made between begin_update() and
+ * commit_update() are applied copy-on-write to the nodes they touch:
+ * get_rules() and lookup() keep seeing the rules as they were when the update
+ * began until it is committed, when the new tree replaces the old at once.
  */
 
 namespace vigil {
@@ -51,6 +64,7 @@ public:
     typedef Expr Expr_type;
     typedef Rule<Expr, Action>* Rule_ptr;
     typedef hash_map<uint32_t, Rule_ptr> Id_map;
+    typedef typename Flat_classifier<Expr, Action>::Result Lookup_result;
 
     Classifier(uint32_t, int);
     Classifier();
@@ -66,14 +80,23 @@ public:
     uint32_t delete_rules(const Data*);
     void build();
     void unbuild();
-    void clean() { root->clean(); } /* deletes empty subtrees */
+    void clean();   /* deletes empty subtrees */
+    void begin_update();
+    void commit_update();
 
     template<typename Data>
     void get_rules(Cnode_result<Expr, Action, Data>&);
+    template<typename Data>
+    void lookup(const Data& data, Lookup_result& result) const
+        { flat.lookup(data, result); }
     void print() const;
 
 private:
-    boost::scoped_ptr<Cnode<Expr, Action> > root;
+    Cnode<Expr, Action> *root;          // Tree that changes are made to.
+    Cnode<Expr, Action> *published;     // Tree seen by get_rules() in update.
+    Cnode_batch<Expr, Action> batch;
+    std::vector<Rule_ptr> retired_rules;    // Deleted during the update.
+    Flat_classifier<Expr, Action> flat;
     std::vector<Cnode<Expr, Action>*> to_traverse;
     Id_map rules;
     uint32_t id_counter;
@@ -94,7 +117,7 @@ template<class Expr, typename Action>
 Classifier<Expr, Action>::Classifier(uint32_t split_field, int n_buckets)
     : id_counter(1)
 {
-    root.reset(new Cnode<Expr, Action>(split_field, n_buckets));
+    root = published = new Cnode<Expr, Action>(split_field, n_buckets);
 }
 
 
@@ -106,7 +129,7 @@ template<class Expr, typename Action>
 Classifier<Expr, Action>::Classifier()
     : id_counter(1)
 {
-    root.reset(new Cnode<Expr, Action>());
+    root = published = new Cnode<Expr, Action>();
 }
 
 
@@ -116,7 +139,8 @@ Classifier<Expr, Action>::Classifier()
 template<class Expr, typename Action>
 Classifier<Expr, Action>::~Classifier()
 {
-    root.reset();
+    commit_update();
+    delete root;
     for (typename Id_map::const_iterator id = rules.begin();
          id != rules.end(); ++id)
     {
@@ -132,7 +156,13 @@ template<class Expr, typename Action>
 void
 Classifier<Expr, Action>::reset(uint32_t split_field, int n_buckets)
 {
-    root.reset(new Cnode<Expr, Action>(split_field, n_buckets));
+    Cnode<Expr, Action> *new_root
+        = new Cnode<Expr, Action>(split_field, n_buckets);
+    commit_update();
+    delete root;
+    root = published = new_root;
+    batch.split_leaves = false;
+    flat.clear();
     for (typename Id_map::const_iterator id = rules.begin();
          id != rules.end(); ++id)
     {
@@ -151,7 +181,12 @@ template<class Expr, typename Action>
 void
 Classifier<Expr, Action>::reset()
 {
-    root.reset(new Cnode<Expr, Action>());
+    Cnode<Expr, Action> *new_root = new Cnode<Expr, Action>();
+    commit_update();
+    delete root;
+    root = published = new_root;
+    batch.split_leaves = false;
+    flat.clear();
     for (typename Id_map::const_iterator id = rules.begin();
          id != rules.end(); ++id)
     {
@@ -212,12 +247,13 @@ Classifier<Expr, Action>::add_rule(uint32_t priority, const Expr& expr,
     inserted = rules.insert(entry);
     if (inserted.second == true) {
         try {
-            root->add_rule(entry.second, 0);
+            Cnode<Expr, Action>::insert_rule(root, entry.second, 0, batch);
         } catch (...) {
             rules.erase(inserted.first);
             delete entry.second;
             throw;
         }
+        flat.add_rule(new_id, priority, expr, action);
     } else {
         delete entry.second;
         throw errno_exception(ENOMEM, "classifier::add_rule");
@@ -237,12 +273,34 @@ Classifier<Expr, Action>::change_rule_priority(uint32_t id, uint32_t priority)
         return false;
     }
 
-    Cnode<Expr, Action> *node = entry->second->get_node();
+    Rule_ptr rule = entry->second;
+    Cnode<Expr, Action> *node = rule->get_node();
     if (node == NULL) {
         return false;
     }
 
-    return node->change_rule_priority(id, priority);
+    if (!batch.is_active()) {
+        if (!node->change_rule_priority(id, priority)) {
+            return false;
+        }
+    } else {
+        /* The published tree is ordered by the old priority, so replace the
+         * rule with a copy rather than change it.  Once the copy is in,
+         * erasing the original from the same path cannot throw. */
+        std::auto_ptr<Rule<Expr, Action> > copy(new Rule<Expr, Action>(*rule));
+        copy->priority = priority;
+        retired_rules.push_back(rule);
+        try {
+            Cnode<Expr, Action>::insert_rule(root, copy.get(), 0, batch);
+        } catch (...) {
+            retired_rules.pop_back();
+            throw;
+        }
+        Cnode<Expr, Action>::erase_rule(root, rule, 0, batch);
+        entry->second = copy.release();
+    }
+    flat.change_rule_priority(id, priority);
+    return true;
 }
 
 template<class Expr, typename Action>
@@ -261,9 +319,7 @@ Classifier<Expr, Action>::get_rule(uint32_t id)
 /*
  * Deletes from the classifier the rules with id 'id'.  Returns 'true' if the
  * rule was found and deleted from the tree, 'false' if the rule was not found.
- * SHOULD ONLY BE CALLED IF CLASSIFIER IS IN A CONSISTENT STATE, ELSE RULE'S
- * NODE PTR MAY POINT INVALID MEMORY (only need to worry bout this if exception
- * thrown during classifier build())
+ * Within an update, the rule itself is freed when the update is committed.
  */
 
 template<class Expr, typename Action>
@@ -276,12 +332,22 @@ Classifier<Expr, Action>::delete_rule(uint32_t id)
         return false;
     }
 
-    Cnode<Expr, Action> *node = entry->second->get_node();
-    if (node != NULL) {
-        node->remove_rule(entry->first);
+    Rule_ptr rule = entry->second;
+    if (batch.is_active()) {
+        /* The published tree may still hold the rule. */
+        retired_rules.push_back(rule);
+        try {
+            Cnode<Expr, Action>::erase_rule(root, rule, 0, batch);
+        } catch (...) {
+            retired_rules.pop_back();
+            throw;
+        }
+    } else {
+        Cnode<Expr, Action>::erase_rule(root, rule, 0, batch);
+        delete rule;
     }
+    flat.remove_rule(entry->first);
 
-    delete entry->second;
     rules.erase(entry);
     return true;
 }
@@ -317,28 +383,95 @@ Classifier<Expr, Action>::delete_rules(const Data *data)
 }
 
 /*
- * Builds the tree.
+ * Builds the tree and publishes the rules to lookup().  Commits any update in
+ * progress first.  Rules added afterward keep the tree built.
  */
 
 template<class Expr, typename Action>
 void
 Classifier<Expr, Action>::build()
 {
+    commit_update();
     Cnode<Expr, Action> *tmp = root->build(0, false);
-    if (tmp != root.get()) {
-        root.reset(tmp);
+    if (tmp != root) {
+        delete root;
+        root = published = tmp;
     }
+    batch.split_leaves = true;
+    flat.publish();
 }
 
 
+/*
+ * Unbuilds the tree, committing any update in progress first.
+ */
+
 template<class Expr, typename Action>
 void
 Classifier<Expr, Action>::unbuild()
 {
+    commit_update();
     Cnode<Expr, Action> *tmp = root->unbuild();
-    if (tmp != root.get()) {
-        root.reset(tmp);
+    if (tmp != root) {
+        delete root;
+        root = published = tmp;
+    }
+    batch.split_leaves = false;
+}
+
+
+/*
+ * Deletes empty subtrees, committing any update in progress first.
+ */
+
+template<class Expr, typename Action>
+void
+Classifier<Expr, Action>::clean()
+{
+    commit_update();
+    root->clean();
+}
+
+
+/*
+ * Begins an update.  Until commit_update(), rule changes are made to a
+ * copy-on-write version of the tree and held back from lookup(), while
+ * get_rules() and lookup() keep seeing the rules as they are now.
+ */
+
+template<class Expr, typename Action>
+void
+Classifier<Expr, Action>::begin_update()
+{
+    if (batch.is_active()) {
+        return;
+    }
+    published = root;
+    Cnode<Expr, Action>::begin_batch(batch);
+    flat.hold();
+}
+
+
+/*
+ * Makes the changes made since begin_update() visible to get_rules() and
+ * lookup(), and frees the nodes and rules that they replaced.  Does nothing
+ * if no update is in progress.
+ */
+
+template<class Expr, typename Action>
+void
+Classifier<Expr, Action>::commit_update()
+{
+    if (!batch.is_active()) {
+        return;
+    }
+    published = root;
+    Cnode<Expr, Action>::end_batch(batch);
+    for (size_t i = 0; i < retired_rules.size(); i++) {
+        delete retired_rules[i];
     }
+    retired_rules.clear();
+    flat.publish();
 }
 
 /*
@@ -355,7 +488,8 @@ template<typename Data>
 void
 Classifier<Expr, Action>::get_rules(Cnode_result<Expr, Action, Data>& result)
 {
-    root->traverse(result, to_traverse);
+    const Cnode<Expr, Action> *top = batch.is_active() ? published : root;
+    top->traverse(result, to_traverse);
     while (!to_traverse.empty()) {
         Cnode<Expr, Action> *node = to_traverse.back();
         to_traverse.pop_back();
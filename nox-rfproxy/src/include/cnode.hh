@@ -19,6 +19,7 @@
 #define  CNODE_HH
 
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
 #include <assert.h>
@@ -32,10 +33,18 @@
  *
  * Basic building block of classifier, encompassing all of the classifier's
  * "smarts."
+ *
+ * insert_rule() and erase_rule() change only the nodes on the path to a
+ * rule.  Within a Cnode_batch they copy those nodes rather than modify them,
+ * so that the tree as it stood when the batch began remains intact for
+ * lookups until the batch ends.
  */
 
 namespace vigil {
 
+template<class Expr, typename Action>
+class Cnode_batch;
+
 template<class Expr, typename Action>
 class Cnode {
 
@@ -59,10 +68,18 @@ public:
 
     void print(std::string&, bool) const;
 
+    static void insert_rule(Cnode<Expr, Action>*&, const Rule_ptr&, uint32_t,
+                            Cnode_batch<Expr, Action>&);
+    static bool erase_rule(Cnode<Expr, Action>*&, const Rule_ptr&, uint32_t,
+                           Cnode_batch<Expr, Action>&);
+    static void begin_batch(Cnode_batch<Expr, Action>&);
+    static void end_batch(Cnode_batch<Expr, Action>&);
+
     static const uint32_t MASKS[];
 
 private:
     uint32_t value;
+    uint32_t generation;            // Batch that created or copied the node.
 
     Rule_list rules;
 
@@ -82,13 +99,47 @@ private:
     uint32_t best_split(uint32_t, uint32_t&, int&) const;
     uint32_t exp_rules_with_split(uint32_t, std::vector<bool>&,
                                   int, int&) const;
+    Cnode<Expr, Action> *writable(Cnode_batch<Expr, Action>&);
+    Cnode<Expr, Action> **find_child(uint32_t, Cnode_batch<Expr, Action>&);
 
+    static void split_leaf(Cnode<Expr, Action>*&, uint32_t, uint32_t);
+    void set_generation(uint32_t);
+    static void free_node(Cnode<Expr, Action> *);
     static int get_bucket(uint32_t, int);
 
     Cnode(const Cnode&);
     Cnode& operator=(const Cnode&);
 };
 
+/*
+ * A batch of copy-on-write changes to a Cnode tree, begun and ended by
+ * Cnode::begin_batch() and Cnode::end_batch().  Outside a batch the same
+ * object makes insert_rule() and erase_rule() change nodes in place.
+ */
+
+template<class Expr, typename Action>
+class Cnode_batch {
+
+public:
+    Cnode_batch() : split_leaves(false), generation(0), active(false) { }
+
+    bool is_active() const { return active; }
+
+    /* If true, a leaf that grows past Expr::LEAF_THRESHOLD rules is split as
+     * build() would split it. */
+    bool split_leaves;
+
+private:
+    friend class Cnode<Expr, Action>;
+
+    uint32_t generation;
+    bool active;
+
+    /* Nodes replaced during the batch, freed (without their children) when
+     * it ends. */
+    std::vector<Cnode<Expr, Action>*> retired;
+};
+
 template<class Expr, typename Action>
 const uint32_t Cnode<Expr, Action>::MASKS[] = {
     1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4,
@@ -112,8 +163,8 @@ const uint32_t Cnode<Expr, Action>::MASKS[] = {
 
 template<class Expr, typename Action>
 Cnode<Expr, Action>::Cnode(uint32_t field, int n_buckets, uint32_t value_)
-    : value(value_), bucket_mask(n_buckets - 1), split_field(field),
-      any_node(NULL), next(NULL)
+    : value(value_), generation(0), bucket_mask(n_buckets - 1),
+      split_field(field), any_node(NULL), next(NULL)
 {
     assert(split_field < 32);
     assert(n_buckets > 0 && ((n_buckets & (n_buckets - 1)) == 0));
@@ -131,7 +182,8 @@ Cnode<Expr, Action>::Cnode(uint32_t field, int n_buckets, uint32_t value_)
 
 template<class Expr, typename Action>
 Cnode<Expr, Action>::Cnode(uint32_t value_)
-    : value(value_), bucket_mask(-1), buckets(NULL), any_node(NULL), next(NULL)
+    : value(value_), generation(0), bucket_mask(-1), buckets(NULL),
+      any_node(NULL), next(NULL)
 { }
 
 
@@ -141,7 +193,8 @@ Cnode<Expr, Action>::Cnode(uint32_t value_)
 
 template<class Expr, typename Action>
 Cnode<Expr, Action>::Cnode()
-    : value(0), bucket_mask(-1), buckets(NULL), any_node(NULL), next(NULL)
+    : value(0), generation(0), bucket_mask(-1), buckets(NULL),
+      any_node(NULL), next(NULL)
 { }
 
 
@@ -306,6 +359,314 @@ Cnode<Expr, Action>::remove_rule(uint32_t id)
 }
 
 
+/*
+ * Adds 'rule' to the sub-tree that 'node' points to, touching only the nodes
+ * on the path to the node that should hold it, as add_rule() would place it.
+ * 'path' denotes the fields that were branched on to reach 'node'.  Within an
+ * active 'batch', each node on the path that the batch has not copied yet is
+ * copied first and the copy replaces it, in 'node' or in its parent; the
+ * originals stay intact until the batch ends.  If 'batch' splits leaves, a
+ * leaf that has grown too long is split here, so that a built tree stays
+ * built without another build().
+ *
+ * If an exception is thrown, 'rule' has not been added, though the nodes
+ * copied so far remain in place of the originals.
+ */
+
+template<class Expr, typename Action>
+void
+Cnode<Expr, Action>::insert_rule(Cnode<Expr, Action>*& node,
+                                 const Rule_ptr& rule, uint32_t path,
+                                 Cnode_batch<Expr, Action>& batch)
+{
+    Cnode<Expr, Action> *self = node = node->writable(batch);
+    const Expr& expr = rule->expr;
+
+    if (self->bucket_mask < 0 || !expr.splittable(path)) {
+        self->add_rule_to_list(rule);
+        rule->node = self;
+        if (self->bucket_mask < 0 && batch.split_leaves) {
+            try {
+                split_leaf(node, path, batch.generation);
+            } catch (...) {
+                self->remove_rule(rule->id);
+                throw;
+            }
+        }
+        return;
+    }
+
+    Cnode<Expr, Action> **slot;
+    uint32_t rule_value;
+
+    if (expr.get_field(self->split_field, rule_value)) {
+        slot = self->find_child(rule_value, batch);
+        if (slot == NULL) {
+            int bucket = get_bucket(rule_value, self->bucket_mask);
+            Cnode<Expr, Action> *child = new Cnode(rule_value);
+            child->generation = batch.generation;
+            child->next = self->buckets[bucket];
+            self->buckets[bucket] = child;
+            slot = &self->buckets[bucket];
+        }
+    } else {
+        if (self->any_node == NULL) {
+            self->any_node = new Cnode();
+            self->any_node->generation = batch.generation;
+        }
+        slot = &self->any_node;
+    }
+
+    insert_rule(*slot, rule, path | MASKS[self->split_field], batch);
+}
+
+
+/*
+ * Removes 'rule' from the sub-tree that 'node' points to, following the path
+ * that insert_rule() would take and copying nodes on it within an active
+ * 'batch' as insert_rule() does.  Right after insert_rule() for an equal
+ * expression, the whole path is writable and nothing is allocated.  Leaves left without rules are unlinked from
+ * their parents; other empty nodes are left for clean().  Returns 'true' if
+ * the rule was found and removed, else 'false'.
+ */
+
+template<class Expr, typename Action>
+bool
+Cnode<Expr, Action>::erase_rule(Cnode<Expr, Action>*& node,
+                                const Rule_ptr& rule, uint32_t path,
+                                Cnode_batch<Expr, Action>& batch)
+{
+    Cnode<Expr, Action> *self = node = node->writable(batch);
+    const Expr& expr = rule->expr;
+
+    if (self->bucket_mask < 0 || !expr.splittable(path)) {
+        for (typename Rule_list::iterator iter = self->rules.begin();
+             iter != self->rules.end(); ++iter)
+        {
+            if (*iter == rule) {
+                if (rule->node == self) {
+                    rule->node = NULL;
+                }
+                self->rules.erase(iter);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Cnode<Expr, Action> **slot;
+    uint32_t rule_value;
+
+    if (expr.get_field(self->split_field, rule_value)) {
+        slot = self->find_child(rule_value, batch);
+    } else {
+        slot = self->any_node != NULL ? &self->any_node : NULL;
+    }
+    if (slot == NULL
+        || !erase_rule(*slot, rule, path | MASKS[self->split_field], batch))
+    {
+        return false;
+    }
+
+    Cnode<Expr, Action> *child = *slot;
+    if (child->bucket_mask < 0 && child->rules.empty()) {
+        /* Being writable, 'child' is not part of the batch's original tree. */
+        *slot = slot == &self->any_node ? NULL : child->next;
+        free_node(child);
+    }
+    return true;
+}
+
+
+/*
+ * Begins a batch of changes on 'batch'.  Until end_batch(), insert_rule() and
+ * erase_rule() leave every node that exists now unchanged.
+ */
+
+template<class Expr, typename Action>
+void
+Cnode<Expr, Action>::begin_batch(Cnode_batch<Expr, Action>& batch)
+{
+    assert(!batch.active);
+    batch.generation++;
+    batch.active = true;
+}
+
+
+/*
+ * Ends 'batch', freeing the nodes that its changes replaced.  The caller
+ * must have stopped using the tree that those nodes belonged to.
+ */
+
+template<class Expr, typename Action>
+void
+Cnode<Expr, Action>::end_batch(Cnode_batch<Expr, Action>& batch)
+{
+    for (size_t i = 0; i < batch.retired.size(); i++) {
+        free_node(batch.retired[i]);
+    }
+    batch.retired.clear();
+    batch.active = false;
+}
+
+
+/*
+ * Returns a node that 'batch' may change in place of the current one: the
+ * node itself outside a batch or if the batch already made it, else a copy
+ * sharing its children.  A copy takes over the Cnode pointers of the node's
+ * rules, and the node is retired until the batch ends.  The caller must
+ * replace its pointer to the node with the result.
+ */
+
+template<class Expr, typename Action>
+Cnode<Expr, Action> *
+Cnode<Expr, Action>::writable(Cnode_batch<Expr, Action>& batch)
+{
+    if (!batch.active || generation == batch.generation) {
+        return this;
+    }
+
+    /* The copy must not own the shared children until nothing can throw. */
+    std::auto_ptr<Cnode<Expr, Action> > copy(new Cnode<Expr, Action>(value));
+    copy->rules = rules;
+    Cnode<Expr, Action> **copy_buckets = NULL;
+    if (bucket_mask >= 0) {
+        copy_buckets = new Cnode<Expr, Action>*[bucket_mask + 1];
+        memcpy(copy_buckets, buckets, (bucket_mask + 1) * (sizeof *buckets));
+    }
+    try {
+        batch.retired.push_back(this);
+    } catch (...) {
+        delete [] copy_buckets;
+        throw;
+    }
+
+    if (copy_buckets != NULL) {
+        copy->buckets = copy_buckets;
+        copy->bucket_mask = bucket_mask;
+        copy->split_field = split_field;
+        copy->any_node = any_node;
+    }
+    copy->next = next;
+    copy->generation = batch.generation;
+
+    for (typename Rule_list::iterator iter = copy->rules.begin();
+         iter != copy->rules.end(); ++iter)
+    {
+        if ((*iter)->node == this) {
+            (*iter)->node = copy.get();
+        }
+    }
+    return copy.release();
+}
+
+
+/*
+ * Returns a pointer to the link that points to the child with 'value', or
+ * NULL if there is none.  Within a batch, the children that precede it in its
+ * bucket's chain are made writable first, so the link can be changed.  The
+ * node itself must already be writable.
+ */
+
+template<class Expr, typename Action>
+Cnode<Expr, Action> **
+Cnode<Expr, Action>::find_child(uint32_t value,
+                                Cnode_batch<Expr, Action>& batch)
+{
+    Cnode<Expr, Action> **slot = &buckets[get_bucket(value, bucket_mask)];
+    Cnode<Expr, Action> *child = *slot;
+
+    while (child != NULL && child->value != value) {
+        child = child->next;
+    }
+    if (child == NULL) {
+        return NULL;
+    }
+
+    while (*slot != child) {
+        *slot = (*slot)->writable(batch);
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+
+/*
+ * Splits the writable leaf that 'node' points to, as build() would, if it
+ * holds too many rules.  'path' denotes the fields split on to reach the leaf.
+ * If an exception is thrown, the leaf is left as it was.  A leaf
+ * that cannot usefully be split would otherwise be re-examined on every
+ * insertion, so the split is tried only when the number of rules beyond
+ * Expr::LEAF_THRESHOLD reaches a power of 2.  The new nodes are marked as
+ * made by the batch with 'generation'.
+ */
+
+template<class Expr, typename Action>
+void
+Cnode<Expr, Action>::split_leaf(Cnode<Expr, Action>*& node, uint32_t path,
+                                uint32_t generation)
+{
+    size_t n_rules = node->rules.size();
+    if (n_rules <= Expr::LEAF_THRESHOLD) {
+        return;
+    }
+    size_t excess = n_rules - Expr::LEAF_THRESHOLD;
+    if ((excess & (excess - 1)) != 0) {
+        return;
+    }
+
+    Cnode<Expr, Action> *leaf = node;
+    Cnode<Expr, Action> *built = leaf->build(path, false);
+    if (built != leaf) {
+        built->set_generation(generation);
+        node = built;
+        free_node(leaf);
+    }
+}
+
+
+template<class Expr, typename Action>
+void
+Cnode<Expr, Action>::set_generation(uint32_t generation_)
+{
+    generation = generation_;
+
+    if (bucket_mask < 0) {
+        return;
+    }
+
+    for (int i = 0; i <= bucket_mask; i++) {
+        for (Cnode<Expr, Action> *child = buckets[i]; child != NULL;
+             child = child->next)
+        {
+            child->set_generation(generation_);
+        }
+    }
+
+    if (any_node != NULL) {
+        any_node->set_generation(generation_);
+    }
+}
+
+
+/*
+ * Frees 'node' without its children, which belong to other nodes.
+ */
+
+template<class Expr, typename Action>
+void
+Cnode<Expr, Action>::free_node(Cnode<Expr, Action> *node)
+{
+    if (node->bucket_mask >= 0) {
+        delete [] node->buckets;
+        node->buckets = NULL;
+        node->bucket_mask = -1;
+    }
+    node->any_node = NULL;
+    delete node;
+}
+
+
 /*
  * Builds the node.  'path' denotes the fields that were split on to reach the
  * node, to avoid attempts to check for optimal splitting on redundant fields.
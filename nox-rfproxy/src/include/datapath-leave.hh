@@ -34,10 +34,11 @@ struct Datapath_leave_event
     : public Event
 {
     Datapath_leave_event(datapathid datapath_id_)
-        : Event(static_get_name()), datapath_id(datapath_id_) { }
+        : Event(event_type<Datapath_leave_event>()),
+          datapath_id(datapath_id_) { }
 
     // -- only for use within python
-    Datapath_leave_event() : Event(static_get_name()) { }
+    Datapath_leave_event() : Event(event_type<Datapath_leave_event>()) { }
 
     static const Event_name static_get_name() {
         return "Datapath_leave_event";
@@ -37,7 +37,7 @@ struct Echo_request_event
 {
     Echo_request_event(datapathid datapath_id_,
                        const ofp_header *oh, std::auto_ptr<Buffer> buf_)
-        : Event(static_get_name()), Ofp_msg_event(oh, buf_),
+        : Event(event_type<Echo_request_event>()), Ofp_msg_event(oh, buf_),
           datapath_id(datapath_id_)
         {}
 
@@ -19,6 +19,10 @@
 #define EVENT_DISPATCHER_HH 1
 
 #include <boost/function.hpp>
+#include <stdint.h>
+#include <sys/time.h>
+#include <utility>
+#include <vector>
 #include "event.hh"
 #include "poll-loop.hh"
 
@@ -42,6 +46,12 @@ struct Event_dispatcher_impl;
  * One convenient feature of this event dispatcher is that event handlers may
  * block without holding up processing of further events: they will be
  * dispatched by the Poll_loop in another thread.
+ *
+ * Pending events are kept in one queue per priority class.  Each poll
+ * serves the queues in weighted round-robin order, highest priority first,
+ * so that a flood of low-priority events such as packet-ins cannot hold up
+ * keepalives and port status changes.  A queue may also be limited in
+ * length, beyond which events are dropped.
  */
 class Event_dispatcher
     : public Pollable
@@ -57,12 +67,56 @@ public:
     typedef boost::function<Handler_signature> Handler;
     void add_handler(const Event_name&, const Handler&, int order);
 
+    /* Priority classes of queued events, highest priority first. */
+    enum Priority {
+        PRIO_CONTROL,           /* Keepalives, port and switch status. */
+        PRIO_RESULT,            /* Replies and errors from switches. */
+        PRIO_DEFAULT,           /* Anything not otherwise classified. */
+        PRIO_PACKET_IN,         /* Packet-ins. */
+        N_PRIORITIES
+    };
+
+    /* What to drop when an event is posted to a full queue. */
+    enum Drop_policy {
+        DROP_NEWEST,            /* Drop the event being posted. */
+        DROP_OLDEST             /* Drop the event at the head of the queue. */
+    };
+
+    /* Configuration of the queues.  Events of each 'type' go into the
+     * PRIO_DEFAULT queue unless assigned otherwise.  Each poll dispatches up
+     * to 'weight' events from a queue before moving to the next one.  A
+     * 'max_events' of 0 means that a queue is unlimited, which is the
+     * default. */
+    void set_priority(const Event_name& type, Priority);
+    Priority get_priority(const Event_name& type) const;
+    Priority get_priority(Event_type_id) const;
+    void set_weight(Priority, unsigned int weight);
+    void set_limit(Priority, size_t max_events, Drop_policy);
+
+    /* Statistics for queued events of a given type. */
+    struct Stats {
+        uint64_t dispatched;    /* Events dispatched from the queue. */
+        uint64_t dropped;       /* Events dropped because of a full queue. */
+        timeval total_latency;  /* Sum of times from post to dispatch. */
+        timeval max_latency;    /* Maximum time from post to dispatch. */
+    };
+    void get_stats(std::vector<std::pair<Event_name, Stats> >&) const;
+
     /* Appends 'event' to the list of events to be handled in the main loop. */
     void post(Event* event);
 
     /* Dispatches 'event' immediately, bypassing the event queue. */
     void dispatch(const Event& event);
 
+    /* Dispatches immediately, in the order they were posted, the events
+     * queued with 'priority' for which 'filter' returns true.  Lets an event
+     * that is about to be dispatched (or posted to a higher priority queue)
+     * keep its place behind related events, e.g. a switch's packet-ins
+     * ahead of its leave.  Takes time linear in the length of the queue, so
+     * it is meant for rare events. */
+    typedef boost::function<bool(const Event&)> Filter;
+    void flush(Priority priority, const Filter& filter);
+
     /* Pollable implementation.  Processes pending events when polled.  */
     bool poll();
     void wait();
@@ -28,6 +28,19 @@ enum Disposition { CONTINUE, STOP };
 
 typedef std::string Event_name;
 
+/* A small integer that stands for an Event_name within this process.  Ids
+ * are handed out densely, starting from 0, the first time a name is seen, so
+ * they may be used to index arrays. */
+typedef unsigned int Event_type_id;
+
+/* An interned event name: its type id, and the copy of the name kept for the
+ * life of the process. */
+struct Event_type
+{
+    Event_type_id id;
+    const Event_name* name;
+};
+
 /** @defgroup noxevents NOX Events
  *
  * An Event represents a low-level or high-level event in the network.  The
@@ -55,7 +68,17 @@ public:
     virtual ~Event();
     
     /* Get event name */
-    Event_name get_name() const;
+    const Event_name& get_name() const;
+
+    /* Get the type id corresponding to the event name. */
+    Event_type_id get_type_id() const { return type_id; }
+
+    /* Returns the type id for 'name', assigning a new one if 'name' has not
+     * been seen before.  Thread-safe. */
+    static Event_type_id get_type_id(const Event_name& name);
+
+    /* Interns 'name' as get_type_id() does.  Thread-safe. */
+    static Event_type intern(const Event_name& name);
 
     /* For debugging purposes only. */
     std::string get_class_name() const; 
@@ -63,12 +86,29 @@ public:
 protected:
     Event(const Event_name&);
 
+    /* Constructs an event of an already interned type, without copying or
+     * looking up its name.  Event classes with a fixed name pass
+     * event_type<Class>(). */
+    explicit Event(const Event_type&);
+
     void set_name(const Event_name&);
 
 private:
-    Event_name name;
+    const Event_name* name;
+    Event_type_id type_id;
 };
 
+/* Returns the interned type of event class T, whose events are named
+ * T::static_get_name().  The name is interned by the first call only, so
+ * constructing events of class T does not take the interning lock. */
+template <class T>
+const Event_type&
+event_type()
+{
+    static const Event_type type = Event::intern(T::static_get_name());
+    return type;
+}
+
 } // namespace vigil
 
 #endif /* event.hh */
@@ -0,0 +1,646 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FLAT_CLASSIFIER_HH
+#define FLAT_CLASSIFIER_HH 1
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+
+#include "hash_map.hh"
+#include "threads/native.hh"
+
+/*
+ * Flattened classifier for lookups.
+ *
+ * Holds copies of a Classifier's rules compiled for tuple space search: rules
+ * are grouped by the set of fields (the "tuple") on which their expressions
+ * are not wildcarded, and each group is a hash table over the rules' values
+ * for those fields.  A lookup probes each tuple's table once with the data's
+ * values for the tuple's fields, visiting tuples in order of their best
+ * rule's priority so that it can stop as soon as no remaining tuple can beat
+ * the best match found.  Expr's matches() still confirms each candidate, so
+ * that fields that Expr does not let Cnode split on are honored.
+ *
+ * A tuple's table is split by key hash into shards of a few dozen rules, each
+ * compiled into a chained hash table kept in a few contiguous arrays.  The
+ * compiled shards and tuples form an immutable snapshot shared by reference
+ * count.  Lookups take a reference to the current snapshot, so any number of
+ * threads may look up concurrently with each other and with rule changes.
+ * Adding, removing or reprioritizing a rule only marks its shard dirty; the
+ * next publish() or lookup recompiles the dirty shards and shares everything
+ * else with the previous snapshot, so that its cost does not grow with the
+ * number of rules.  After hold(), lookups leave changes unpublished
+ * until the next publish(), so that a batch of changes appears at once.
+ *
+ * Data is matched on its first value for each field (get_field() with index
+ * 0).
+ */
+
+namespace vigil {
+
+template<class Expr, typename Data>
+bool get_field(uint32_t, const Data&, uint32_t, uint32_t&);
+
+template<class Expr, typename Data>
+bool matches(uint32_t, const Expr&, const Data&);
+
+template<class Expr, typename Action>
+class Flat_classifier {
+
+public:
+    /* A compiled copy of a rule. */
+    struct Entry {
+        uint32_t id;
+        uint32_t priority;
+        Expr expr;
+        Action action;
+    };
+
+private:
+    struct Tuple;
+    struct Snapshot;
+
+public:
+    /*
+     * Rules returned by lookup().  Holds a reference to the snapshot that
+     * the rules belong to, so they stay valid for as long as the result does.
+     */
+    class Result {
+    public:
+        size_t size() const { return entries.size(); }
+        bool empty() const { return entries.empty(); }
+        const Entry& operator[](size_t i) const { return *entries[i]; }
+        void clear() { entries.clear(); snapshot.reset(); }
+
+    private:
+        friend class Flat_classifier;
+        boost::shared_ptr<const Snapshot> snapshot;
+        std::vector<const Entry*> entries;
+    };
+
+    Flat_classifier();
+
+    void add_rule(uint32_t id, uint32_t priority, const Expr&, const Action&);
+    void remove_rule(uint32_t id);
+    void change_rule_priority(uint32_t id, uint32_t priority);
+    void clear();
+    void hold();
+    void publish();
+
+    template<typename Data>
+    void lookup(const Data&, Result&) const;
+
+private:
+    static const uint32_t NONE = ~(uint32_t)0;
+
+    /* A tuple gets twice as many shards whenever it averages more than
+     * SHARD_SIZE rules per shard. */
+    static const size_t SHARD_SIZE = 32;
+
+    /* Compiled, read-only form of the rules in one shard of a tuple. */
+    struct Shard {
+        uint32_t min_priority;          // Best priority in 'entries'.
+        std::vector<Entry> entries;     // In increasing priority order.
+        std::vector<uint32_t> keys;     // Tuple's fields' values per entry.
+        std::vector<uint32_t> next;     // Next entry in the same bucket.
+        std::vector<uint32_t> buckets;  // First entry in each bucket.
+    };
+
+    typedef boost::shared_ptr<const Shard> Shard_ptr;
+
+    /* Compiled, read-only form of the rules in one tuple. */
+    struct Tuple {
+        uint32_t mask;                  // Bit i set if field i is matched.
+        std::vector<uint32_t> fields;   // Fields in 'mask'.
+        uint32_t min_priority;          // Best priority in 'shards'.
+        int shard_bits;                 // log2(shards.size()).
+        std::vector<Shard_ptr> shards;  // Null if empty.
+    };
+
+    struct Snapshot {
+        std::vector<boost::shared_ptr<const Tuple> > tuples;
+    };
+
+    /* Mutable rules of one shard. */
+    struct Shard_rules {
+        Shard_rules() : dirty(false) { }
+        hash_map<uint32_t, Entry> rules;
+        Shard_ptr compiled;
+        bool dirty;
+    };
+
+    /* Mutable rules of one tuple, with the last compiled form. */
+    struct Tuple_rules {
+        Tuple_rules() : n_rules(0), shard_bits(0), shards(1), dirty(false) { }
+        size_t n_rules;
+        int shard_bits;
+        std::vector<Shard_rules> shards;
+        boost::shared_ptr<const Tuple> compiled;
+        bool dirty;
+    };
+
+    /* Where a rule is kept: its tuple and the hash of its key. */
+    struct Rule_place {
+        uint32_t mask;
+        uint32_t hash;
+    };
+
+    typedef hash_map<uint32_t, Tuple_rules> Tuple_map;
+
+    Tuple_map tuples;
+    hash_map<uint32_t, Rule_place> places;      // By rule id.
+    bool dirty;
+    bool held;                                  // Set by hold().
+    boost::shared_ptr<const Snapshot> snapshot;
+    mutable Native_mutex mutex;
+
+    void publish_locked();
+    Shard_rules& get_shard(const Rule_place&);
+    static void reshard(Tuple_rules&);
+    static void add_match(const Entry&, uint32_t& best, Result&);
+    static Tuple* compile(uint32_t mask, Tuple_rules&);
+    static Shard* compile(const uint32_t* fields, size_t n_fields,
+                          const Shard_rules&);
+    static uint32_t get_mask(const Expr&);
+    static uint32_t get_key(const Expr&, uint32_t mask, uint32_t* key);
+    static uint32_t hash(const uint32_t* values, size_t n);
+    static size_t shard_index(uint32_t hash, int shard_bits)
+        { return shard_bits ? hash >> (32 - shard_bits) : 0; }
+    static bool compare_entries(const Entry*, const Entry*);
+    static bool compare_tuples(const boost::shared_ptr<const Tuple>&,
+                               const boost::shared_ptr<const Tuple>&);
+
+    Flat_classifier(const Flat_classifier&);
+    Flat_classifier& operator=(const Flat_classifier&);
+};
+
+
+template<class Expr, typename Action>
+const uint32_t Flat_classifier<Expr, Action>::NONE;
+
+template<class Expr, typename Action>
+const size_t Flat_classifier<Expr, Action>::SHARD_SIZE;
+
+template<class Expr, typename Action>
+Flat_classifier<Expr, Action>::Flat_classifier()
+    : dirty(false), held(false), snapshot(new Snapshot)
+{ }
+
+
+/*
+ * Returns the set of fields, as a bit mask, on which 'expr' is not
+ * wildcarded.
+ */
+
+template<class Expr, typename Action>
+uint32_t
+Flat_classifier<Expr, Action>::get_mask(const Expr& expr)
+{
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < Expr::NUM_FIELDS; i++) {
+        if (!expr.is_wildcard(i)) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+/*
+ * Stores in 'key' the values of 'expr' for the fields in 'mask', in field
+ * order, and returns their number.
+ */
+
+template<class Expr, typename Action>
+uint32_t
+Flat_classifier<Expr, Action>::get_key(const Expr& expr, uint32_t mask,
+                                       uint32_t* key)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < Expr::NUM_FIELDS; i++) {
+        if (mask & (1u << i)) {
+            key[n] = 0;
+            expr.get_field(i, key[n]);
+            n++;
+        }
+    }
+    return n;
+}
+
+template<class Expr, typename Action>
+uint32_t
+Flat_classifier<Expr, Action>::hash(const uint32_t* values, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ values[i]) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+template<class Expr, typename Action>
+bool
+Flat_classifier<Expr, Action>::compare_entries(const Entry* a, const Entry* b)
+{
+    return (a->priority != b->priority
+            ? a->priority < b->priority
+            : a->id < b->id);
+}
+
+template<class Expr, typename Action>
+bool
+Flat_classifier<Expr, Action>::compare_tuples(
+    const boost::shared_ptr<const Tuple>& a,
+    const boost::shared_ptr<const Tuple>& b)
+{
+    return a->min_priority < b->min_priority;
+}
+
+
+/*
+ * Adds a copy of the rule to the classifier.  The rule becomes visible to
+ * lookups at the next publish() or lookup().
+ */
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::add_rule(uint32_t id, uint32_t priority,
+                                        const Expr& expr, const Action& action)
+{
+    Entry entry;
+    entry.id = id;
+    entry.priority = priority;
+    entry.expr = expr;
+    entry.action = action;
+
+    Rule_place place;
+    uint32_t key[Expr::NUM_FIELDS];
+    place.mask = get_mask(expr);
+    place.hash = hash(key, get_key(expr, place.mask, key));
+
+    Scoped_native_mutex lock(&mutex);
+    Tuple_rules& t = tuples[place.mask];
+    Shard_rules& shard = t.shards[shard_index(place.hash, t.shard_bits)];
+    shard.rules[id] = entry;
+    shard.dirty = true;
+    t.dirty = true;
+    places[id] = place;
+    dirty = true;
+
+    if (++t.n_rules > (t.shards.size() * SHARD_SIZE)) {
+        reshard(t);
+    }
+}
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::remove_rule(uint32_t id)
+{
+    Scoped_native_mutex lock(&mutex);
+    typename hash_map<uint32_t, Rule_place>::iterator p = places.find(id);
+    if (p == places.end()) {
+        return;
+    }
+    Tuple_rules& t = tuples[p->second.mask];
+    Shard_rules& shard = get_shard(p->second);
+    shard.rules.erase(id);
+    shard.dirty = true;
+    t.n_rules--;
+    t.dirty = true;
+    places.erase(p);
+    dirty = true;
+}
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::change_rule_priority(uint32_t id,
+                                                   uint32_t priority)
+{
+    Scoped_native_mutex lock(&mutex);
+    typename hash_map<uint32_t, Rule_place>::iterator p = places.find(id);
+    if (p == places.end()) {
+        return;
+    }
+    Shard_rules& shard = get_shard(p->second);
+    shard.rules[id].priority = priority;
+    shard.dirty = true;
+    tuples[p->second.mask].dirty = true;
+    dirty = true;
+}
+
+template<class Expr, typename Action>
+typename Flat_classifier<Expr, Action>::Shard_rules&
+Flat_classifier<Expr, Action>::get_shard(const Rule_place& place)
+{
+    Tuple_rules& t = tuples[place.mask];
+    return t.shards[shard_index(place.hash, t.shard_bits)];
+}
+
+/*
+ * Doubles the number of shards of 't', moving each rule to the shard that
+ * the next bit of its key's hash selects.
+ */
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::reshard(Tuple_rules& t)
+{
+    int shard_bits = t.shard_bits + 1;
+    std::vector<Shard_rules> shards(t.shards.size() * 2);
+    uint32_t key[Expr::NUM_FIELDS];
+
+    for (size_t i = 0; i < t.shards.size(); i++) {
+        const hash_map<uint32_t, Entry>& rules = t.shards[i].rules;
+        for (typename hash_map<uint32_t, Entry>::const_iterator r
+                 = rules.begin(); r != rules.end(); ++r) {
+            const Expr& expr = r->second.expr;
+            uint32_t h = hash(key, get_key(expr, get_mask(expr), key));
+            shards[shard_index(h, shard_bits)].rules.insert(*r);
+        }
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        shards[i].dirty = true;
+    }
+    t.shards.swap(shards);
+    t.shard_bits = shard_bits;
+}
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::clear()
+{
+    Scoped_native_mutex lock(&mutex);
+    tuples.clear();
+    places.clear();
+    snapshot.reset(new Snapshot);
+    dirty = false;
+    held = false;
+}
+
+
+/*
+ * Keeps rule changes from being published by lookup() until publish() is
+ * next called.
+ */
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::hold()
+{
+    Scoped_native_mutex lock(&mutex);
+    held = true;
+}
+
+
+/*
+ * Makes all rule changes so far visible to lookups.
+ */
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::publish()
+{
+    Scoped_native_mutex lock(&mutex);
+    held = false;
+    if (dirty) {
+        publish_locked();
+    }
+}
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::publish_locked()
+{
+    Snapshot* s = new Snapshot;
+    for (typename Tuple_map::iterator i = tuples.begin(); i != tuples.end(); ) {
+        Tuple_rules& t = i->second;
+        if (t.n_rules == 0) {
+            tuples.erase(i++);
+            continue;
+        }
+        if (t.dirty) {
+            t.compiled.reset(compile(i->first, t));
+            t.dirty = false;
+        }
+        s->tuples.push_back(t.compiled);
+        ++i;
+    }
+    std::sort(s->tuples.begin(), s->tuples.end(), compare_tuples);
+    snapshot.reset(s);
+    dirty = false;
+}
+
+
+/*
+ * Compiles the rules of the tuple with 'mask', recompiling its dirty shards
+ * and sharing the others with its previous compiled form.
+ */
+
+template<class Expr, typename Action>
+typename Flat_classifier<Expr, Action>::Tuple*
+Flat_classifier<Expr, Action>::compile(uint32_t mask, Tuple_rules& rules)
+{
+    Tuple* t = new Tuple;
+    t->mask = mask;
+    for (uint32_t i = 0; i < Expr::NUM_FIELDS; i++) {
+        if (mask & (1u << i)) {
+            t->fields.push_back(i);
+        }
+    }
+    t->min_priority = NONE;
+    t->shard_bits = rules.shard_bits;
+    t->shards.resize(rules.shards.size());
+
+    const uint32_t* fields = t->fields.empty() ? NULL : &t->fields[0];
+    for (size_t i = 0; i < rules.shards.size(); i++) {
+        Shard_rules& shard = rules.shards[i];
+        if (shard.dirty) {
+            shard.compiled.reset(shard.rules.empty()
+                                 ? NULL
+                                 : compile(fields, t->fields.size(), shard));
+            shard.dirty = false;
+        }
+        t->shards[i] = shard.compiled;
+        if (shard.compiled && shard.compiled->min_priority < t->min_priority) {
+            t->min_priority = shard.compiled->min_priority;
+        }
+    }
+    return t;
+}
+
+
+/*
+ * Compiles the rules of a shard into a hash table with chains sorted by
+ * priority.  The shard's rules must match on the 'n_fields' 'fields'.
+ */
+
+template<class Expr, typename Action>
+typename Flat_classifier<Expr, Action>::Shard*
+Flat_classifier<Expr, Action>::compile(const uint32_t* fields, size_t n_fields,
+                                       const Shard_rules& rules)
+{
+    /* Sort pointers, so that each Entry is copied only once. */
+    std::vector<const Entry*> sorted;
+    sorted.reserve(rules.rules.size());
+    for (typename hash_map<uint32_t, Entry>::const_iterator i
+             = rules.rules.begin(); i != rules.rules.end(); ++i) {
+        sorted.push_back(&i->second);
+    }
+    std::sort(sorted.begin(), sorted.end(), compare_entries);
+
+    Shard* s = new Shard;
+    s->entries.reserve(sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        s->entries.push_back(*sorted[i]);
+    }
+    s->min_priority = s->entries.front().priority;
+
+    size_t n_buckets = 1;
+    while (n_buckets < s->entries.size() * 2) {
+        n_buckets <<= 1;
+    }
+    s->keys.resize(s->entries.size() * n_fields);
+    s->next.resize(s->entries.size());
+    s->buckets.assign(n_buckets, NONE);
+
+    /* Push entries onto their chains from lowest to highest priority, so that
+     * every chain ends up in increasing priority order. */
+    for (size_t i = s->entries.size(); i-- > 0; ) {
+        uint32_t* key = n_fields ? &s->keys[i * n_fields] : NULL;
+        for (size_t f = 0; f < n_fields; f++) {
+            key[f] = 0;
+            s->entries[i].expr.get_field(fields[f], key[f]);
+        }
+        uint32_t& bucket = s->buckets[hash(key, n_fields) & (n_buckets - 1)];
+        s->next[i] = bucket;
+        bucket = i;
+    }
+    return s;
+}
+
+
+template<class Expr, typename Action>
+void
+Flat_classifier<Expr, Action>::add_match(const Entry& entry, uint32_t& best,
+                                         Result& result)
+{
+    if (entry.priority < best) {
+        best = entry.priority;
+        result.entries.clear();
+    }
+    result.entries.push_back(&entry);
+}
+
+
+/*
+ * Stores in 'result' the rules of the highest priority (lowest value) that
+ * match 'data'.  Thread-safe.
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Flat_classifier<Expr, Action>::lookup(const Data& data, Result& result) const
+{
+    {
+        Scoped_native_mutex lock(&mutex);
+        if (dirty && !held) {
+            const_cast<Flat_classifier*>(this)->publish_locked();
+        }
+        /* A Result reused across lookups usually already holds the current
+         * snapshot, which saves touching its reference count. */
+        if (result.snapshot != snapshot) {
+            result.snapshot = snapshot;
+        }
+    }
+    result.entries.clear();
+
+    /* Values of 'data's fields, fetched as tuples need them. */
+    uint32_t values[Expr::NUM_FIELDS];
+    uint32_t fetched = 0;
+    uint32_t present = 0;
+
+    uint32_t best = NONE;
+    uint32_t key[Expr::NUM_FIELDS];
+    const std::vector<boost::shared_ptr<const Tuple> >& ts
+        = result.snapshot->tuples;
+    for (size_t i = 0; i < ts.size(); i++) {
+        const Tuple& t = *ts[i];
+        if (t.min_priority > best) {
+            break;
+        }
+
+        size_t n_fields = t.fields.size();
+        bool have_key = true;
+        for (size_t f = 0; f < n_fields && have_key; f++) {
+            uint32_t field = t.fields[f];
+            uint32_t bit = 1u << field;
+            if (!(fetched & bit)) {
+                values[field] = 0;
+                if (get_field<Expr, Data>(field, data, 0, values[field])) {
+                    present |= bit;
+                }
+                fetched |= bit;
+            }
+            have_key = present & bit;
+            key[f] = values[field];
+        }
+
+        if (!have_key) {
+            /* 'data' has no value for one of the tuple's fields, so hashing
+             * cannot help (this happens when 'data' is itself a wildcarded
+             * Expr).  Leave it to matches(), in priority order. */
+            for (size_t i = 0; i < t.shards.size(); i++) {
+                const Shard* s = t.shards[i].get();
+                for (size_t e = 0; s && e < s->entries.size(); e++) {
+                    const Entry& entry = s->entries[e];
+                    if (entry.priority > best) {
+                        break;
+                    }
+                    if (matches(entry.id, entry.expr, data)) {
+                        add_match(entry, best, result);
+                    }
+                }
+            }
+            continue;
+        }
+
+        uint32_t h = hash(key, n_fields);
+        const Shard* s = t.shards[shard_index(h, t.shard_bits)].get();
+        if (s == NULL || s->min_priority > best) {
+            continue;
+        }
+        uint32_t e = s->buckets[h & (s->buckets.size() - 1)];
+        for (; e != NONE; e = s->next[e]) {
+            const Entry& entry = s->entries[e];
+            if (entry.priority > best) {
+                break;
+            }
+            if ((!n_fields
+                 || std::equal(key, key + n_fields, &s->keys[e * n_fields]))
+                && matches(entry.id, entry.expr, data)) {
+                add_match(entry, best, result);
+            }
+        }
+    }
+}
+
+} // namespace vigil
+
+#endif /* flat-classifier.hh */
@@ -38,11 +38,12 @@ struct Flow_mod_event
 {
     Flow_mod_event(datapathid datapath_id_, const ofp_flow_mod *fme,
                    std::auto_ptr<Buffer> buf)
-        : Event(static_get_name()), Ofp_msg_event(&fme->header, buf),
+        : Event(event_type<Flow_mod_event>()),
+          Ofp_msg_event(&fme->header, buf),
           datapath_id(datapath_id_) { ; }
 
     // -- only for use within python
-    Flow_mod_event() : Event(static_get_name()) { }
+    Flow_mod_event() : Event(event_type<Flow_mod_event>()) { }
 
     datapathid datapath_id;
 
@@ -48,7 +48,7 @@ struct Flow_removed_event
 		       uint16_t idle_timeout_,
                        uint64_t packet_count_, uint64_t byte_count_,
 		       uint64_t cookie_)
-        : Event(static_get_name()), datapath_id(datapath_id_), 
+        : Event(event_type<Flow_removed_event>()), datapath_id(datapath_id_), 
           duration_sec(duration_sec_), duration_nsec(duration_nsec_),
 	  idle_timeout(idle_timeout_),
           packet_count(packet_count_), byte_count(byte_count_),
@@ -60,7 +60,7 @@ struct Flow_removed_event
                        std::auto_ptr<Buffer> buf);
 
     // -- only for use within python
-    Flow_removed_event() : Event(static_get_name()) { ; }
+    Flow_removed_event() : Event(event_type<Flow_removed_event>()) { ; }
 
     //! ID of switch sending the Flow Removed message 
     datapathid datapath_id;
@@ -91,7 +91,8 @@ inline
 Flow_removed_event::Flow_removed_event(datapathid datapath_id_,
                                        const ofp_flow_removed *ofr,
                                        std::auto_ptr<Buffer> buf)
-    : Event(static_get_name()), Ofp_msg_event(&ofr->header, buf),
+    : Event(event_type<Flow_removed_event>()),
+      Ofp_msg_event(&ofr->header, buf),
       datapath_id(datapath_id_)
 {
     cookie  = ntohll(ofr->cookie);
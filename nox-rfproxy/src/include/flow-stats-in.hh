@@ -46,7 +46,7 @@ struct Flow_stats_in_event
                         std::auto_ptr<Buffer> buf);
 
     // -- only for use within python
-    Flow_stats_in_event() : Event(static_get_name()) { }
+    Flow_stats_in_event() : Event(event_type<Flow_stats_in_event>()) { }
 
     static const Event_name static_get_name() {
         return "Flow_stats_in_event";
@@ -72,7 +72,7 @@ private:
 inline
 Ofmp_resources_update_event::Ofmp_resources_update_event(datapathid id_,
             const ofmp_resources_update *oru, int msg_len)
-        : Event(static_get_name()), mgmt_id(id_) 
+        : Event(event_type<Ofmp_resources_update_event>()), mgmt_id(id_) 
 {
     int data_len;
     uint8_t *ptr = (uint8_t *)oru->data;
@@ -54,7 +54,7 @@ namespace vigil
      *
      *  Only for use within python
      */
-    Openflow_msg_event() : Event(static_get_name()) { }
+    Openflow_msg_event() : Event(event_type<Openflow_msg_event>()) { }
 
     /** \brief Return static name for event.
      *
@@ -72,7 +72,7 @@ namespace vigil
 inline
 Openflow_msg_event::Openflow_msg_event(const datapathid& dpid, const ofp_header* ofp_msg_,
 				       std::auto_ptr<Buffer> buf)
-  : Event(static_get_name()), Ofp_msg_event(ofp_msg_, buf)
+  : Event(event_type<Openflow_msg_event>()), Ofp_msg_event(ofp_msg_, buf)
 {
     datapath_id = dpid;
 }
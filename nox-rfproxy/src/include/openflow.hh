@@ -20,6 +20,7 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <deque>
 #include <inttypes.h>
 #include <list>
 #include <memory>
@@ -30,6 +31,7 @@
 #include "netinet++/ipaddr.hh"
 #include "netinet++/ethernetaddr.hh"
 #include "threads/cooperative.hh"
+#include "threads/native.hh"
 #include "openflow/openflow.h"
 #include "tcp-socket.hh"
 #include "ssl-socket.hh"
@@ -39,6 +41,7 @@
 namespace vigil {
 
 class Buffer;
+class Array_buffer;
 class Async_stream;
 class Async_datagram;
 class Openflow_connection_factory;
@@ -131,6 +134,11 @@ protected:
     virtual void do_send_openflow_wait() = 0;
     virtual void do_recv_openflow_wait() = 0;
 
+    /* Serializes sending, receiving, and the connection state machine, so
+     * that a connection may be received from in one thread group while other
+     * thread groups send on it.  Never held while blocking. */
+    Native_recursive_mutex io_mutex;
+
 private:
     datapathid datapath_id;
     datapathid mgmt_id;
@@ -174,6 +182,7 @@ public:
     Openflow_stream_connection(std::auto_ptr<Async_stream>);
 
     Openflow_stream_connection(std::auto_ptr<Async_stream>, Connection_type t);
+    ~Openflow_stream_connection();
     int get_connect_error();
     void connect_wait();
     void send_openflow_wait();
@@ -184,6 +193,7 @@ public:
     std::string get_ssl_fingerprint();
     uint32_t get_local_ip();  
     uint32_t get_remote_ip();  
+    size_t get_tx_queued_bytes() const { return tx_queued_bytes; }
 private:
     virtual int do_connect();
     virtual int do_send_openflow(const ofp_header*);
@@ -194,18 +204,45 @@ private:
 
     Auto_fsm tx_fsm;
     void tx_run();
-    int send_tx_buf();
+    int send_tx_queue();
+    void enqueue_tx(const ofp_header*);
 
-    int do_read(void *, size_t);
+    int fill_rx_ring();
+    bool rx_message_ready() const;
 
     std::auto_ptr<Async_stream> stream;
 
-    size_t rx_bytes;
-    ofp_header rx_header;
-    std::auto_ptr<Buffer> rx_buf;
-
-    std::auto_ptr<Buffer> tx_buf;
+    /* Received data is read into 'rx_ring' as many bytes at a time as the
+     * stream will give us, and complete messages are handed out as
+     * Shared_subbuffers of it.  Bytes [rx_head, rx_tail) have been read but
+     * not yet handed out. */
+    boost::shared_ptr<Array_buffer> rx_ring;
+    size_t rx_head;
+    size_t rx_tail;
+
+    /* Outgoing messages are copied back-to-back into a queue of large
+     * chunks, so that a burst of sends is flushed to the stream with a few
+     * gather writes instead of one write per message. */
+    std::deque<Array_buffer*> tx_queue;
+    size_t tx_queued_bytes;
     Connection_type conn_type; 
+
+    /* Size of 'rx_ring', which must hold the largest possible message. */
+    static const size_t rx_ring_size;
+
+    /* Smallest read worth issuing into an 'rx_ring' still shared with
+     * messages handed out earlier; with less room, a new ring is started. */
+    static const size_t rx_min_read;
+
+    /* Size of each chunk in 'tx_queue'. */
+    static const size_t tx_chunk_size;
+
+    /* Queued bytes beyond which a send flushes immediately instead of
+     * waiting for the transmit thread. */
+    static const size_t tx_flush_threshold;
+
+    /* Queued bytes beyond which sends are refused with EAGAIN. */
+    static const size_t tx_queue_limit;
 };
 
 /* Wrapper class that reconnects, with exponential backoff, when an underlying
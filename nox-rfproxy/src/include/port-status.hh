@@ -40,17 +40,18 @@ struct Port_status_event
 {
     Port_status_event(datapathid datapath_id_, uint8_t reason_,
                       const Port& port_)
-        : Event(static_get_name()), reason(reason_), port(port_),
+        : Event(event_type<Port_status_event>()), reason(reason_), port(port_),
           datapath_id(datapath_id_) {}
 
     Port_status_event(datapathid datapath_id_, const ofp_port_status *ops,
                       std::auto_ptr<Buffer> buf)
-        : Event(static_get_name()), Ofp_msg_event(&ops->header, buf),
+        : Event(event_type<Port_status_event>()),
+          Ofp_msg_event(&ops->header, buf),
           reason(ops->reason), port(&ops->desc), datapath_id(datapath_id_)
         {}
 
     // -- only for use within python
-    Port_status_event() : Event(static_get_name()) { ; }
+    Port_status_event() : Event(event_type<Port_status_event>()) { ; }
 
     static const Event_name static_get_name() {
         return "Port_status_event";
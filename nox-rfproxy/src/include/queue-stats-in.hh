@@ -62,7 +62,7 @@ namespace vigil
     /** \brief Empty constructor
      * Only for use within python
      */
-    Queue_stats_in_event() : Event(static_get_name()) { }
+    Queue_stats_in_event() : Event(event_type<Queue_stats_in_event>()) { }
 
     /** Static name of event
      * @return name of event
@@ -32,7 +32,7 @@ class Shutdown_event
     : public Event
 {
 public:
-    Shutdown_event() : Event(static_get_name()) { } 
+    Shutdown_event() : Event(event_type<Shutdown_event>()) { } 
 
     /* Currently we don't provide any information on the reason for the
      * shutdown.  FIXME? */
@@ -0,0 +1,126 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SPSC_QUEUE_HH
+#define SPSC_QUEUE_HH 1
+
+#include <boost/noncopyable.hpp>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace vigil {
+
+/*
+ * Spsc_queue
+ *
+ *  Bounded FIFO that one thread may push to while another thread pops from
+ *  it, without any locking.  "Thread" here may equally be a thread group:
+ *  all the cooperative threads of one group count as a single thread, since
+ *  they never run at the same time.
+ *
+ *  The capacity is rounded up to a power of 2.
+ */
+template <class T>
+class Spsc_queue
+    : boost::noncopyable
+{
+public:
+    Spsc_queue(size_t capacity);
+
+    /* Producer side.  Returns false, without pushing, if the queue is
+     * full. */
+    bool push(const T&);
+    bool full() const;
+
+    /* Consumer side.  Returns false, without popping, if the queue is
+     * empty. */
+    bool pop(T&);
+    bool empty() const;
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    /* 'head' is only written by the consumer, 'tail' only by the producer.
+     * Both increase forever and are reduced modulo the capacity on use. */
+    volatile size_t head;
+    volatile size_t tail;
+};
+
+template <class T>
+Spsc_queue<T>::Spsc_queue(size_t capacity)
+    : head(0), tail(0)
+{
+    size_t n = 1;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    slots.resize(n);
+    mask = n - 1;
+}
+
+template <class T>
+bool
+Spsc_queue<T>::push(const T& x)
+{
+    size_t t = tail;
+    if (t - head > mask) {
+        return false;
+    }
+    slots[t & mask] = x;
+
+    /* Publish the slot before the new tail. */
+    __sync_synchronize();
+    tail = t + 1;
+    return true;
+}
+
+template <class T>
+bool
+Spsc_queue<T>::full() const
+{
+    return tail - head > mask;
+}
+
+template <class T>
+bool
+Spsc_queue<T>::pop(T& x)
+{
+    size_t h = head;
+    if (h == tail) {
+        return false;
+    }
+    __sync_synchronize();
+    x = slots[h & mask];
+
+    /* Finish reading the slot before handing it back to the producer. */
+    __sync_synchronize();
+    head = h + 1;
+    return true;
+}
+
+template <class T>
+bool
+Spsc_queue<T>::empty() const
+{
+    return head == tail;
+}
+
+} // namespace vigil
+
+#endif /* spsc_queue.hh */
@@ -54,7 +54,7 @@ struct Table_stats_in_event
                          std::auto_ptr<Buffer> buf);
 
     // -- only for use within python
-    Table_stats_in_event() : Event(static_get_name()) { }
+    Table_stats_in_event() : Event(event_type<Table_stats_in_event>()) { }
 
     static const Event_name static_get_name() {
         return "Table_stats_in_event";
@@ -75,7 +75,8 @@ inline
 Table_stats_in_event::Table_stats_in_event(const datapathid& dpid,
                                            const ofp_stats_reply *osr,
                                            std::auto_ptr<Buffer> buf)
-    : Event(static_get_name()), Ofp_msg_event(&osr->header, buf)
+    : Event(event_type<Table_stats_in_event>()),
+      Ofp_msg_event(&osr->header, buf)
 {
     datapath_id  = dpid;
 }
@@ -59,6 +59,7 @@ private:
 
     ssize_t do_read(Buffer&);
     ssize_t do_write(const Buffer&);
+    ssize_t do_writev(const struct iovec*, int iovcnt);
 
     int setsockopt(int level, int option, bool value);
 
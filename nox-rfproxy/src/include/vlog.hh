@@ -21,7 +21,10 @@
  * logging infrastructure or as interface to the classic vlog
  * implementation.
  *
- * Not thread safe.
+ * Messages may be logged from any thread.  Once start_writer() has been
+ * called, they are handed to a background thread that writes them out, and
+ * a thread that logs only formats its message into a buffer of its own.
+ * Configuring log levels is not thread safe.
  */
 
 #ifndef VLOG_HH
@@ -109,6 +112,22 @@ public:
     Level min_loggable_level(Module);
     void output(Module, Level, const char*);
 
+    /* Asynchronous output.
+     *
+     * Until start_writer() is called, output() writes each message before it
+     * returns.  Afterward, messages are written in batches by a background
+     * thread, except that emergency messages are still written at once, and
+     * messages that do not fit in the logging thread's buffer are dropped and
+     * counted.  start_writer() must not be called before fork(), since the
+     * writer would not survive it. */
+    void start_writer();
+    void flush();
+    unsigned long int get_n_dropped();
+
+    /* Also write messages logged to the console facility to 'file_name',
+     * with a timestamp.  Returns false, setting errno, on failure. */
+    bool set_log_file(const char* file_name);
+
     /* Level caching. */
     void register_cache(Vlog::Module, Level* cached_min_level);
     void unregister_cache(Level*);
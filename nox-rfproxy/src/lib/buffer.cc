@@ -62,4 +62,35 @@ uint8_t* Array_buffer::put(size_t n)
     return p;
 }
 
+/* Replaces 'storage' by a private copy of this buffer's current content. */
+void Shared_subbuffer::unshare()
+{
+    boost::shared_ptr<Array_buffer> copy(new Array_buffer(size()));
+    std::memcpy(copy->data(), data(), size());
+    storage = copy;
+    m_data = storage->data();
+}
+
+/* Adds 'n' bytes to the front of the buffer and returns the first byte of the
+ * added storage. */
+uint8_t* Shared_subbuffer::push(size_t n)
+{
+    unshare();
+    uint8_t* p = storage->push(n);
+    m_data = storage->data();
+    m_size = storage->size();
+    return p;
+}
+
+/* Adds 'n' bytes to the end of the buffer and returns the first byte of the
+ * added storage. */
+uint8_t* Shared_subbuffer::put(size_t n)
+{
+    unshare();
+    uint8_t* p = storage->put(n);
+    m_data = storage->data();
+    m_size = storage->size();
+    return p;
+}
+
 } // namespace vigil
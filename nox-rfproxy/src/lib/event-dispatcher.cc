@@ -17,97 +17,331 @@
  */
 #include "event-dispatcher.hh"
 
-#include <map>
+#include <algorithm>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
-#include <boost/ptr_container/ptr_list.hpp>
 
-#include "hash_map.hh"
 #include "threads/cooperative.hh"
+#include "timeval.hh"
 #include "vlog.hh"
 
 namespace vigil {
 
 static Vlog_module lg("event-dispatcher");
 
-typedef std::multimap<int, Event_dispatcher::Handler> Signal;
+/* Handlers for one event type, in increasing order of 'order'. */
+typedef std::vector<std::pair<int, Event_dispatcher::Handler> > Signal;
+
+/* Everything the dispatcher knows about one event type, indexed by its
+ * Event_type_id so that posting and dispatching an event never needs to hash
+ * its name. */
+struct Event_type_entry
+{
+    Event_name name;
+    const Signal* handlers;     /* Never modified once installed. */
+    Event_dispatcher::Priority priority;
+    Event_dispatcher::Stats stats;
+};
+
+struct Queued_event
+{
+    Event* event;
+    timeval posted;
+};
+
+struct Event_queue
+{
+    std::deque<Queued_event> events;
+    unsigned int weight;
+    size_t limit;
+    Event_dispatcher::Drop_policy drop;
+};
 
 struct Event_dispatcher_impl
 {
-    hash_map<Event_name, Signal> table;
-    boost::ptr_list<Event> queue;
+    std::vector<Event_type_entry> types;
+    Event_queue queues[Event_dispatcher::N_PRIORITIES];
+    size_t n_queued;
     Co_cond nonempty_queue;
     unsigned int serial;
+
+    /* Handler lists replaced while a dispatch was in progress, freed when
+     * the last dispatch finishes. */
+    std::vector<const Signal*> retired;
+    unsigned int n_dispatching;
+
+    Event_type_entry& get_type(Event_type_id, const Event_name&);
 };
 
+Event_type_entry&
+Event_dispatcher_impl::get_type(Event_type_id id, const Event_name& name)
+{
+    if (id >= types.size()) {
+        Event_type_entry e;
+        e.handlers = NULL;
+        e.priority = Event_dispatcher::PRIO_DEFAULT;
+        e.stats.dispatched = e.stats.dropped = 0;
+        e.stats.total_latency = e.stats.max_latency = make_timeval(0, 0);
+        types.resize(id + 1, e);
+    }
+    Event_type_entry& e = types[id];
+    if (e.name.empty()) {
+        e.name = name;
+    }
+    return e;
+}
+
 Event_dispatcher::Event_dispatcher()
     : p(new Event_dispatcher_impl())
 {
     p->serial = 0;
+    p->n_queued = 0;
+    p->n_dispatching = 0;
+    for (int i = 0; i < N_PRIORITIES; i++) {
+        p->queues[i].weight = 1;
+        p->queues[i].limit = 0;
+        p->queues[i].drop = DROP_NEWEST;
+    }
 }
 
 Event_dispatcher::~Event_dispatcher()
 {
+    for (int i = 0; i < N_PRIORITIES; i++) {
+        BOOST_FOREACH (Queued_event& qe, p->queues[i].events) {
+            delete qe.event;
+        }
+    }
+    BOOST_FOREACH (Event_type_entry& e, p->types) {
+        delete e.handlers;
+    }
+    BOOST_FOREACH (const Signal* s, p->retired) {
+        delete s;
+    }
     delete p;
 }
 
+void
+Event_dispatcher::set_priority(const Event_name& name, Priority priority)
+{
+    p->get_type(Event::get_type_id(name), name).priority = priority;
+}
+
+Event_dispatcher::Priority
+Event_dispatcher::get_priority(const Event_name& name) const
+{
+    return get_priority(Event::get_type_id(name));
+}
+
+Event_dispatcher::Priority
+Event_dispatcher::get_priority(Event_type_id id) const
+{
+    return id < p->types.size() ? p->types[id].priority : PRIO_DEFAULT;
+}
+
+void
+Event_dispatcher::set_weight(Priority priority, unsigned int weight)
+{
+    p->queues[priority].weight = std::max(weight, 1u);
+}
+
+void
+Event_dispatcher::set_limit(Priority priority, size_t max_events,
+                            Drop_policy drop)
+{
+    p->queues[priority].limit = max_events;
+    p->queues[priority].drop = drop;
+}
+
+void
+Event_dispatcher::get_stats(std::vector<std::pair<Event_name, Stats> >& v)
+    const
+{
+    v.clear();
+    BOOST_FOREACH (const Event_type_entry& e, p->types) {
+        if (e.stats.dispatched || e.stats.dropped) {
+            v.push_back(std::make_pair(e.name, e.stats));
+        }
+    }
+}
+
+static bool
+order_less(int order, const Signal::value_type& handler)
+{
+    return order < handler.first;
+}
+
 void
 Event_dispatcher::add_handler(const Event_name& name, 
                               const Handler& handler,
                               int order)
 {
-    p->table[name].insert(Signal::value_type(order, handler));
+    /* Handler lists are copied on write, so that a handler registered while
+     * an event of the same type is being dispatched does not disturb it. */
+    Event_type_entry& e = p->get_type(Event::get_type_id(name), name);
+    Signal* s = e.handlers ? new Signal(*e.handlers) : new Signal;
+    s->insert(std::upper_bound(s->begin(), s->end(), order, order_less),
+              Signal::value_type(order, handler));
+    if (e.handlers) {
+        if (p->n_dispatching) {
+            p->retired.push_back(e.handlers);
+        } else {
+            delete e.handlers;
+        }
+    }
+    e.handlers = s;
 }
 
 void
 Event_dispatcher::post(Event* event)
 {
-    if (p->queue.empty()) {
+    Event_type_entry& e = p->get_type(event->get_type_id(),
+                                      event->get_name());
+    Event_queue& q = p->queues[e.priority];
+    if (q.limit && q.events.size() >= q.limit) {
+        if (q.drop == DROP_NEWEST) {
+            e.stats.dropped++;
+            delete event;
+            return;
+        }
+        Event* oldest = q.events.front().event;
+        p->types[oldest->get_type_id()].stats.dropped++;
+        delete oldest;
+        q.events.pop_front();
+        p->n_queued--;
+    }
+
+    if (!p->n_queued) {
         p->nonempty_queue.broadcast();
     }
-    p->queue.push_back(event);
+    Queued_event qe = { event, do_gettimeofday() };
+    q.events.push_back(qe);
+    p->n_queued++;
 }
 
 void
 Event_dispatcher::dispatch(const Event& e)
 {
-    const Event_name& name = e.get_name();
-    if (p->table.find(name) != p->table.end()) {
-        BOOST_FOREACH (Signal::value_type& i, p->table[name]) {
-            try {
-                if (i.second(e) == STOP) {
-                    break;
-                }
-            } catch (const std::exception& e) {
-                lg.err("Event %s processing leaked an exception: %s", 
-		       name.c_str(), e.what());
+    Event_type_id id = e.get_type_id();
+    if (id >= p->types.size() || !p->types[id].handlers) {
+        return;
+    }
+
+    const Signal& handlers = *p->types[id].handlers;
+    p->n_dispatching++;
+    for (Signal::const_iterator i = handlers.begin(); i != handlers.end();
+         ++i) {
+        try {
+            if (i->second(e) == STOP) {
                 break;
             }
+        } catch (const std::exception& ex) {
+            lg.err("Event %s processing leaked an exception: %s", 
+                   e.get_name().c_str(), ex.what());
+            break;
+        }
+    }
+    if (!--p->n_dispatching && !p->retired.empty()) {
+        BOOST_FOREACH (const Signal* s, p->retired) {
+            delete s;
+        }
+        p->retired.clear();
+    }
+}
+
+/* Accounts for the dispatch of a queued event posted at 'posted'. */
+static void
+count_dispatch(Event_dispatcher::Stats& stats, const timeval& posted)
+{
+    timeval now = do_gettimeofday();
+    stats.dispatched++;
+    if (now > posted) {
+        /* timeval subtraction complains when time stands still or goes
+         * backward, so only account forward progress. */
+        timeval latency = now - posted;
+        stats.total_latency += latency;
+        if (latency > stats.max_latency) {
+            stats.max_latency = latency;
         }
     }
 }
 
+void
+Event_dispatcher::flush(Priority priority, const Filter& filter)
+{
+    Event_queue& q = p->queues[priority];
+    if (q.events.empty()) {
+        return;
+    }
+
+    /* Take the events out of the queue before dispatching any, since a
+     * handler may post more or block and let poll() run. */
+    std::vector<Queued_event> flushed;
+    std::deque<Queued_event>::iterator out = q.events.begin();
+    for (std::deque<Queued_event>::iterator i = q.events.begin();
+         i != q.events.end(); ++i) {
+        if (filter(*i->event)) {
+            flushed.push_back(*i);
+        } else {
+            *out++ = *i;
+        }
+    }
+    q.events.erase(out, q.events.end());
+    p->n_queued -= flushed.size();
+
+    for (size_t i = 0; i < flushed.size(); i++) {
+        std::auto_ptr<Event> event(flushed[i].event);
+        count_dispatch(p->types[event->get_type_id()].stats,
+                       flushed[i].posted);
+        dispatch(*event);
+    }
+}
+
 bool
 Event_dispatcher::poll()
 {
-    /* Dispatch all the events initially in the queue, but not any events
+    /* Dispatch all the events initially in the queues, but not any events
      * queued by processing those events, to avoid starving other Pollables.
-     *
-     * XXX We need a scheme for prioritizing event dispatch above other
-     * Pollables.
-     */
-    size_t max = p->queue.size();
+     * Take up to 'weight' events from each queue in turn, highest priority
+     * first, until all of them have been dispatched. */
+    size_t remaining[N_PRIORITIES];
+    size_t max = 0;
+    for (int i = 0; i < N_PRIORITIES; i++) {
+        remaining[i] = p->queues[i].events.size();
+        max += remaining[i];
+    }
+
     unsigned int serial = ++p->serial;
-    for (size_t i = 0; i < max; ++i) {
-        std::auto_ptr<Event> event(p->queue.pop_front().release());
-        dispatch(*event);
+    for (size_t left = max; left > 0; ) {
+        for (int i = 0; i < N_PRIORITIES; i++) {
+            Event_queue& q = p->queues[i];
+            for (unsigned int j = 0; j < q.weight && remaining[i]; j++) {
+                if (q.events.empty()) {
+                    /* Dropped to make room for newer events. */
+                    left -= remaining[i];
+                    remaining[i] = 0;
+                    break;
+                }
+                Queued_event qe = q.events.front();
+                q.events.pop_front();
+                p->n_queued--;
+                remaining[i]--;
+                left--;
 
-        if (serial != p->serial) {
-            /* dispatch(*event) blocked and Event_dispatcher::poll() was
-             * eventually re-entered in another thread.  That other call
-             * already dispatched our events, so we are done. */
-            break;
+                std::auto_ptr<Event> event(qe.event);
+                count_dispatch(p->types[event->get_type_id()].stats,
+                               qe.posted);
+                dispatch(*event);
+
+                if (serial != p->serial) {
+                    /* dispatch(*event) blocked and Event_dispatcher::poll()
+                     * was eventually re-entered in another thread.  That
+                     * other call already dispatched our events, so we are
+                     * done. */
+                    return true;
+                }
+            }
         }
     }
     return max > 0;
@@ -116,7 +350,7 @@ Event_dispatcher::poll()
 void
 Event_dispatcher::wait()
 {
-    if (!p->queue.empty()) {
+    if (p->n_queued) {
         co_immediate_wake(1, NULL);
     } else {
         p->nonempty_queue.wait();
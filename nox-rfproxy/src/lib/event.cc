@@ -19,6 +19,8 @@
 #include <typeinfo>
 #include <vector>
 #include <string>
+#include "hash_map.hh"
+#include "threads/native.hh"
 
 /* Following are for Event::get_name below.
  * Not portable outside GCC's C++ ABI.
@@ -28,9 +30,41 @@
 
 namespace vigil {
 
-Event::Event(const Event_name& name_) : 
-    name(name_) { 
+/* Event names are interned once per process.  Events may be constructed in
+ * any thread group, so the table is protected by a native mutex.  Both are
+ * function-local statics so that they are usable during static
+ * initialization.  The table never shrinks and its nodes never move, so
+ * interned names stay valid. */
+Event_type
+Event::intern(const Event_name& name)
+{
+    static Native_mutex mutex;
+    static hash_map<Event_name, Event_type_id> ids;
+
+    Scoped_native_mutex lock(&mutex);
+    hash_map<Event_name, Event_type_id>::iterator i = ids.find(name);
+    if (i == ids.end()) {
+        Event_type_id id = ids.size();
+        i = ids.insert(std::make_pair(name, id)).first;
+    }
+    Event_type type = { i->second, &i->first };
+    return type;
+}
+
+Event_type_id
+Event::get_type_id(const Event_name& name)
+{
+    return intern(name).id;
+}
 
+Event::Event(const Event_name& name_)
+{
+    set_name(name_);
+}
+
+Event::Event(const Event_type& type)
+    : name(type.name), type_id(type.id)
+{
 }
 
 Event::~Event() { 
@@ -39,12 +73,14 @@ Event::~Event() {
 
 void
 Event::set_name(const Event_name& name_) {
-    name = name_;
+    Event_type type = intern(name_);
+    name = type.name;
+    type_id = type.id;
 }
 
-Event_name 
+const Event_name& 
 Event::get_name() const { 
-    return name; 
+    return *name; 
 }
 
 std::string Event::get_class_name() const
@@ -13,7 +13,7 @@ Flow_stats::Flow_stats(const ofp_flow_stats* ofs)
 Flow_stats_in_event::Flow_stats_in_event(const datapathid& dpid,
                                          const ofp_stats_reply *osr,
                                          std::auto_ptr<Buffer> buf)
-    : Event(static_get_name()),
+    : Event(event_type<Flow_stats_in_event>()),
       Ofp_msg_event(&osr->header, buf),
       more((osr->flags & htons(OFPSF_REPLY_MORE)) != 0)
 {
@@ -25,8 +25,10 @@
 #include <boost/tokenizer.hpp>
 #include "assert.hh"
 #include <cerrno>
+#include <climits>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 #include "async_io.hh"
 #include "buffer.hh"
 #include "datapath.hh"
@@ -50,6 +52,11 @@ static Vlog_module log("openflow");
 
 const int Reliable_openflow_connection::backoff_limit = 60;
 const int Openflow_connection::probe_interval = 15;
+const size_t Openflow_stream_connection::rx_ring_size = 64 * 1024;
+const size_t Openflow_stream_connection::rx_min_read = 4 * 1024;
+const size_t Openflow_stream_connection::tx_chunk_size = 64 * 1024;
+const size_t Openflow_stream_connection::tx_flush_threshold = 256 * 1024;
+const size_t Openflow_stream_connection::tx_queue_limit = 4 * 1024 * 1024;
 
 Openflow_connection::Openflow_connection()
     : ext_data_xid(UINT32_MAX),
@@ -227,9 +234,13 @@ int Openflow_connection::send_openflow(const ofp_header* oh, bool block)
 {
     co_might_yield_if(block);
     for (;;) {
-        int error = connect(block);
-        if (!error) {
-            error = call_send_openflow(oh);
+        int error;
+        {
+            Scoped_native_recursive_mutex lock(&io_mutex);
+            error = connect(block);
+            if (!error) {
+                error = call_send_openflow(oh);
+            }
         }
         if (block && error == EAGAIN) {
             co_might_yield();
@@ -271,6 +282,7 @@ Openflow_connection::call_recv_openflow(int& error)
 void
 Openflow_connection::run()
 {
+    Scoped_native_recursive_mutex lock(&io_mutex);
     if (state == S_CONNECTED || state == S_IDLE) {
         if (do_gettimeofday() >= timeout) {
             if (state == S_CONNECTED) {
@@ -305,6 +317,7 @@ Openflow_connection::run()
 
         }
     }
+    lock.unlock();
     co_fsm_block();
 }
 
@@ -323,6 +336,7 @@ Openflow_connection::recv_openflow(int& error, bool block)
 {
     co_might_yield_if(block);
     for (;;) {
+        Scoped_native_recursive_mutex lock(&io_mutex);
         error = connect(false);
         if (error) {
             return std::auto_ptr<Buffer>();
@@ -331,6 +345,7 @@ Openflow_connection::recv_openflow(int& error, bool block)
         if (block && error == EAGAIN) {
             co_might_yield();
             recv_openflow_wait();
+            lock.unlock();
             co_block();
         } else if (error != EINTR) {
             if (!error) {
@@ -373,6 +388,7 @@ bool Openflow_connection::need_to_wait_for_connect()
 
 void Openflow_connection::connect_wait()
 {
+    Scoped_native_recursive_mutex lock(&io_mutex);
     if (!need_to_wait_for_connect()) {
         co_immediate_wake(1, NULL);
     }
@@ -380,6 +396,7 @@ void Openflow_connection::connect_wait()
 
 void Openflow_connection::send_openflow_wait()
 {
+    Scoped_native_recursive_mutex lock(&io_mutex);
     if (!need_to_wait_for_connect()) {
         do_send_openflow_wait();
     }
@@ -387,6 +404,7 @@ void Openflow_connection::send_openflow_wait()
 
 void Openflow_connection::recv_openflow_wait()
 {
+    Scoped_native_recursive_mutex lock(&io_mutex);
     if (!need_to_wait_for_connect()) {
         do_recv_openflow_wait();
     }
@@ -776,10 +794,17 @@ Openflow_connection::send_remote_command(const std::string& command,
 Openflow_stream_connection::Openflow_stream_connection(
     std::auto_ptr<Async_stream> stream_,Connection_type t)
     : tx_fsm(boost::bind(&Openflow_stream_connection::tx_run, this)),
-      stream(stream_), rx_bytes(0), conn_type(t)
+      stream(stream_), rx_head(0), rx_tail(0), tx_queued_bytes(0), conn_type(t)
 {
 }
 
+Openflow_stream_connection::~Openflow_stream_connection()
+{
+    BOOST_FOREACH (Array_buffer* chunk, tx_queue) {
+        delete chunk;
+    }
+}
+
 /* Close the stream associated with this connection */
 int
 Openflow_stream_connection::close()
@@ -802,67 +827,138 @@ Openflow_stream_connection::do_connect_wait()
 void
 Openflow_stream_connection::tx_run()
 {
-    if (tx_buf.get() && send_tx_buf() == EAGAIN) {
+    if (tx_queued_bytes && send_tx_queue() == EAGAIN) {
         do_send_openflow_wait();
     }
     co_fsm_block();
 }
 
-int Openflow_stream_connection::send_tx_buf()
-{
-    ssize_t bytes_written;
-    int error = stream->write_fully(*tx_buf, &bytes_written, false);
-    tx_buf->pull(bytes_written);
+/* Writes as much of 'tx_queue' to the stream as it will accept, gathering
+ * up to IOV_MAX chunks into each write.  Returns 0 if the queue was emptied,
+ * EAGAIN if the stream stopped accepting data, otherwise a positive errno
+ * value. */
+int Openflow_stream_connection::send_tx_queue()
+{
+    /* 'tx_fsm' gets here without going through send_openflow(), and a shard
+     * thread may be closing the stream meanwhile. */
+    Scoped_native_recursive_mutex lock(&io_mutex);
+    while (tx_queued_bytes) {
+        struct iovec iov[IOV_MAX];
+        int iovcnt = 0;
+        for (std::deque<Array_buffer*>::iterator i = tx_queue.begin();
+             i != tx_queue.end() && iovcnt < IOV_MAX; ++i) {
+            iov[iovcnt].iov_base = (*i)->data();
+            iov[iovcnt].iov_len = (*i)->size();
+            iovcnt++;
+        }
 
-    if (error) {
-        if (error != EAGAIN) {
-            stream->close(); 
+        ssize_t n = stream->writev(iov, iovcnt, false);
+        if (n <= 0) {
+            int error = n ? -n : EAGAIN;
+            if (error != EAGAIN) {
+                stream->close();
+            }
+            return error;
+        }
+
+        tx_queued_bytes -= n;
+        while (n > 0) {
+            Array_buffer* chunk = tx_queue.front();
+            size_t pulled = std::min(size_t(n), chunk->size());
+            chunk->pull(pulled);
+            n -= pulled;
+
+            /* Keep the last chunk around for reuse by the next send, unless
+             * it is an oversized one holding a single large message. */
+            if (!chunk->size()
+                && (tx_queue.size() > 1 || chunk->tailroom() < 1024)) {
+                tx_queue.pop_front();
+                delete chunk;
+            }
         }
-        return error;
     }
+    return 0;
+}
 
-    if (!tx_buf->size()) {
-        tx_buf.reset();
-        return 0;
-    } else {
-        return EAGAIN;
+/* Copies 'oh' to the end of 'tx_queue', starting a new chunk if the last one
+ * does not have room for it. */
+void Openflow_stream_connection::enqueue_tx(const ofp_header* oh)
+{
+    size_t length = ntohs(oh->length);
+    if (tx_queue.empty() || tx_queue.back()->tailroom() < length) {
+        Array_buffer* chunk = new Array_buffer(std::max(length,
+                                                        tx_chunk_size));
+        chunk->trim(0);
+        tx_queue.push_back(chunk);
     }
+    memcpy(tx_queue.back()->put(length), oh, length);
+    tx_queued_bytes += length;
 }
 
+/* Queues 'oh' for transmission.  The queue is normally flushed by 'tx_fsm'
+ * once the calling thread yields, so that messages sent back-to-back are
+ * coalesced into large writes.  Once 'tx_flush_threshold' bytes are queued,
+ * the queue is flushed synchronously; once 'tx_queue_limit' bytes are queued
+ * and the stream will not take any more, returns EAGAIN so that callers
+ * back off (or block, in send_openflow()) until the peer catches up. */
 int Openflow_stream_connection::do_send_openflow(const ofp_header* oh)
 {
-    if (tx_buf.get()) {
-        int error = send_tx_buf();
-        if (error) {
+    if (tx_queued_bytes >= tx_queue_limit) {
+        int error = send_tx_queue();
+        if (error && error != EAGAIN) {
             return error;
+        } else if (tx_queued_bytes >= tx_queue_limit) {
+            return EAGAIN;
         }
     }
 
-    /* FIXME: shouldn't need a copy here in most cases */
-    tx_buf.reset(new Array_buffer(ntohs(oh->length)));
-    memcpy(tx_buf->data(), oh, ntohs(oh->length));
-    int error = send_tx_buf();
-    if (error == EAGAIN) {
+    enqueue_tx(oh);
+    if (tx_queued_bytes >= tx_flush_threshold) {
+        int error = send_tx_queue();
+        if (error && error != EAGAIN) {
+            return error;
+        }
+    }
+    if (tx_queued_bytes) {
         tx_fsm.wake();
-        return 0;
-    } else {
-        return error;
     }
+    return 0;
 }
 
-int Openflow_stream_connection::do_read(void *p, size_t need_bytes)
+/* Reads as much data into 'rx_ring' as the stream has available and the ring
+ * has room for, first moving any partially received message to the front of
+ * the ring or, if earlier messages still refer to the ring, into a new one.
+ * Returns 0 if some data was read, otherwise a positive errno value or EOF. */
+int Openflow_stream_connection::fill_rx_ring()
 {
-    Nonowning_buffer b(p, need_bytes);
+    size_t pending = rx_tail - rx_head;
+    if (rx_ring.unique()) {
+        if (rx_head) {
+            memmove(rx_ring->data(), rx_ring->data() + rx_head, pending);
+            rx_head = 0;
+            rx_tail = pending;
+        }
+    } else if (!rx_ring || rx_ring_size - rx_tail < rx_min_read) {
+        boost::shared_ptr<Array_buffer> ring(new Array_buffer(rx_ring_size));
+        if (pending) {
+            memcpy(ring->data(), rx_ring->data() + rx_head, pending);
+        }
+        rx_ring = ring;
+        rx_head = 0;
+        rx_tail = pending;
+    }
+
+    Nonowning_buffer b(rx_ring->data() + rx_tail, rx_ring_size - rx_tail);
     ssize_t n = stream->read(b, false);
     if (n > 0) {
-        rx_bytes += n;
-        return n < need_bytes ? EAGAIN : 0;
+        rx_tail += n;
+        return 0;
     } else if (n == -EAGAIN) {
         return EAGAIN;
     } else {
         stream->close();
         if (n == 0) {
-            if (!rx_bytes) {
+            if (!pending) {
                 return EOF;
             } else {
                 log.warn("%s: unexpected connection drop in middle "
@@ -875,38 +971,47 @@ int Openflow_stream_connection::do_read(void *p, size_t need_bytes)
     }
 }
 
-std::auto_ptr<Buffer> Openflow_stream_connection::do_recv_openflow(int& error)
+/* Returns true if 'rx_ring' holds at least one complete message. */
+bool Openflow_stream_connection::rx_message_ready() const
 {
-    if (rx_bytes < sizeof rx_header) {
-        error = do_read((char *) &rx_header + rx_bytes,
-                        sizeof rx_header - rx_bytes);
-        if (error) {
-            return std::auto_ptr<Buffer>(0);
-        }
+    size_t pending = rx_tail - rx_head;
+    if (pending < sizeof(ofp_header)) {
+        return false;
+    }
+    const ofp_header* oh
+        = reinterpret_cast<const ofp_header*>(rx_ring->data() + rx_head);
+    return pending >= ntohs(oh->length);
+}
 
-        size_t length = ntohs(rx_header.length);
-        if (length < sizeof rx_header) {
-            log.warn("%s: received length (%zu) claims to be shorter than "
-                     "header", to_string().c_str(), length);
-            stream->close();
-            error = EPROTO;
-            return std::auto_ptr<Buffer>(0);
+std::auto_ptr<Buffer> Openflow_stream_connection::do_recv_openflow(int& error)
+{
+    for (;;) {
+        size_t pending = rx_tail - rx_head;
+        if (pending >= sizeof(ofp_header)) {
+            const ofp_header* oh
+                = reinterpret_cast<ofp_header*>(rx_ring->data() + rx_head);
+            size_t length = ntohs(oh->length);
+            if (length < sizeof *oh) {
+                log.warn("%s: received length (%zu) claims to be shorter "
+                         "than header", to_string().c_str(), length);
+                stream->close();
+                error = EPROTO;
+                return std::auto_ptr<Buffer>(0);
+            }
+            if (pending >= length) {
+                std::auto_ptr<Buffer> b(new Shared_subbuffer(rx_ring, rx_head,
+                                                             length));
+                rx_head += length;
+                error = 0;
+                return b;
+            }
         }
-        rx_buf.reset(new Array_buffer(length));
-        memcpy(rx_buf->data(), &rx_header, sizeof rx_header);
-    }
 
-    if (size_t need_bytes = ntohs(rx_header.length) - rx_bytes) {
-        error = do_read(rx_buf->data() + rx_bytes, need_bytes);
+        error = fill_rx_ring();
         if (error) {
             return std::auto_ptr<Buffer>(0);
         }
-    } else {
-        /* OpenFlow packet is exactly sizeof(ofp_header) bytes long. */
-        error = 0;
     }
-    rx_bytes = 0;
-    return rx_buf;
 }
 
 void
@@ -918,7 +1023,11 @@ Openflow_stream_connection::do_send_openflow_wait()
 void
 Openflow_stream_connection::do_recv_openflow_wait()
 {
-    stream->read_wait();
+    if (rx_message_ready()) {
+        co_immediate_wake(1, NULL);
+    } else {
+        stream->read_wait();
+    }
 }
 
 std::string Openflow_stream_connection::to_string()
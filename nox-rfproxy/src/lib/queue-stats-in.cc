@@ -14,7 +14,7 @@ namespace vigil
   Queue_stats_in_event::Queue_stats_in_event(const datapathid& dpid,
 					     const ofp_stats_reply *osr,
 					     std::auto_ptr<Buffer> buf)
-    : Event(static_get_name()),
+    : Event(event_type<Queue_stats_in_event>()),
       Ofp_msg_event(&osr->header, buf)
   {
     datapath_id = dpid;
@@ -17,10 +17,10 @@
  */
 #include "timer-dispatcher.hh"
 
-#include <boost/foreach.hpp>
-#include <set>
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
 
-#include "hash_set.hh"
 #include "threads/cooperative.hh"
 #include "vlog.hh"
 
@@ -28,14 +28,38 @@ namespace vigil {
 
 static Vlog_module lg("timer-dispatcher");
 
+/* Active timers are kept in a hierarchical timing wheel with a resolution of
+ * one millisecond, in the style of the Linux kernel's timer wheel.  Level 0
+ * has one slot per tick for the next 256 ticks; each of the higher levels has
+ * 64 slots, each covering 64 times as many ticks as a slot in the level
+ * below.  Timers due beyond the range of the top level, about 49 days out,
+ * are filed as if due at the end of that range and are placed again when
+ * their slot is cascaded.
+ *
+ * Posting, canceling and rescheduling a timer only link or unlink it from a
+ * slot's list.  As time passes, the slots of the higher levels are cascaded
+ * into the lower levels, and expired timers are collected from level 0 into
+ * a batch that is sorted by expiration time, so that they fire in the same
+ * order as before: by time, then in the order they were posted.
+ *
+ * Timer_impl nodes are allocated in blocks and recycled through a free list.
+ * They are never returned to the heap while the dispatcher exists, so a
+ * stale Timer facade can always safely compare its generation against the
+ * node's. */
+
+static const int LEVEL0_BITS = 8;
+static const int LEVEL0_SIZE = 1 << LEVEL0_BITS;
+static const int LEVELN_BITS = 6;
+static const int LEVELN_SIZE = 1 << LEVELN_BITS;
+static const int N_LEVELS = 5;
+static const uint64_t MAX_DELTA = (uint64_t(1)
+                                   << (LEVEL0_BITS
+                                       + (N_LEVELS - 1) * LEVELN_BITS)) - 1;
+
+static const size_t NODES_PER_BLOCK = 256;
+
 class Timer_impl {
 public:
-    Timer_impl(Timer_dispatcher* dispatcher_, timeval time_, 
-               const unsigned int generation_, const Callback& f)
-        : dispatcher(dispatcher_), func(f), time(time_), admitted(false),
-          generation(generation_) {
-    }
-
     void cancel();
     void delay(bool neg, long sec, long usec);
     void reset(long sec, long usec);
@@ -44,63 +68,344 @@ public:
 
 private:
     friend class Timer_dispatcher;
-    friend struct Compare_timer;
+    friend struct Timer_dispatcher_impl;
+
+    enum State {
+        FREE,                   /* In the free list. */
+        PENDING,                /* Linked into a slot of the wheel. */
+        EXPIRED,                /* In the batch of timers about to fire. */
+        FIRING                  /* Callback running. */
+    };
 
     Timer_dispatcher* dispatcher;
     Callback func;
     timeval time;
-    bool admitted;
     unsigned int generation;
+    State state;
+
+    /* Slot list linkage while PENDING, free list linkage while FREE. */
+    Timer_impl** slot;
+    Timer_impl* prev;
+    Timer_impl* next;
 
-    Timer_impl() { }
     void set_timeout(const timeval&);
 };
 
-/* Timers. */
-struct Compare_timer {
-    bool operator()(const Timer_impl* lhs, const Timer_impl* rhs) {
-        timeval lhs_time = lhs->get_time();
-        timeval rhs_time = rhs->get_time();
-        if (lhs_time != rhs_time) {
-            return lhs_time < rhs_time;
+/* An entry in the batch of expired timers.  The sort key is copied out of
+ * the timer so that sorting a large batch does not chase pointers. */
+struct Expired_timer {
+    timeval time;
+    unsigned int generation;
+    Timer_impl* timer;
+
+    bool operator<(const Expired_timer& rhs) const {
+        if (time != rhs.time) {
+            return time < rhs.time;
         } else {
-            return lhs->generation < rhs->generation;
+            return generation < rhs.generation;
         }
     }
 };
 
-typedef std::set<Timer_impl*, Compare_timer> Timer_queue;
-typedef hash_set<Timer_impl*> Timer_set;
-
 struct Timer_dispatcher_impl
 {
-    Timer_queue timers;         /* Active timers. */
-    Timer_set applicants;       /* Timers waiting for admission to 'timers'. */
-    Timer_set all_timers;       /* Every timer instance in either of above. */
+    /* Wheel slots.  Each is the head of a doubly linked list. */
+    Timer_impl* level0[LEVEL0_SIZE];
+    Timer_impl* levels[N_LEVELS - 1][LEVELN_SIZE];
+    uint64_t cur_tick;          /* First tick not yet fully expired. */
+    size_t n_pending;           /* Number of timers in the wheel. */
+    size_t n_level0;            /* Number of those in level 0. */
+
+    /* Expired timers in the order to fire them.  Entries whose timer was
+     * since canceled or rescheduled are skipped when they come up. */
+    std::vector<Expired_timer> expired;
+    size_t next_expired;
+
+    /* Node pool. */
+    std::vector<Timer_impl*> blocks;
+    Timer_impl* free_list;
+    size_t n_nodes;
+
     Co_cond new_timers;         /* Signaled to wake up dispatcher. */
     unsigned int serial;        /* Detects timer dispatch that blocked. */
+
+    Timer_impl* alloc();
+    void release(Timer_impl*);
+
+    bool in_level0(Timer_impl** slot) const;
+    void link(Timer_impl*);
+    void unlink(Timer_impl*);
+    void cascade(int level);
+    void expire_slot(Timer_impl*& slot, const timeval& now, bool all);
+    void collect_expired(const timeval& now);
+    bool next_wakeup(timeval&) const;
 };
 
+static uint64_t
+to_tick(const timeval& tv)
+{
+    return tv.tv_sec < 0 ? 0 : uint64_t(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+static timeval
+from_tick(uint64_t tick)
+{
+    return make_timeval(tick / 1000, (tick % 1000) * 1000);
+}
+
+static int
+level_shift(int level)
+{
+    return LEVEL0_BITS + (level - 1) * LEVELN_BITS;
+}
+
+Timer_impl*
+Timer_dispatcher_impl::alloc()
+{
+    if (!free_list) {
+        Timer_impl* block = new Timer_impl[NODES_PER_BLOCK];
+        blocks.push_back(block);
+        for (size_t i = 0; i < NODES_PER_BLOCK; i++) {
+            block[i].state = Timer_impl::FREE;
+            block[i].generation = 0;
+            block[i].next = i + 1 < NODES_PER_BLOCK ? &block[i + 1] : NULL;
+        }
+        free_list = block;
+        n_nodes += NODES_PER_BLOCK;
+    }
+    Timer_impl* t = free_list;
+    free_list = t->next;
+    return t;
+}
+
+void
+Timer_dispatcher_impl::release(Timer_impl* t)
+{
+    t->func = Callback();
+    t->state = Timer_impl::FREE;
+    t->generation = 0;
+    t->next = free_list;
+    free_list = t;
+}
+
+bool
+Timer_dispatcher_impl::in_level0(Timer_impl** slot) const
+{
+    return slot >= level0 && slot < level0 + LEVEL0_SIZE;
+}
+
+/* Links PENDING timer 't' into the slot of the wheel for its expiration. */
+void
+Timer_dispatcher_impl::link(Timer_impl* t)
+{
+    uint64_t expires = std::max(to_tick(t->time), cur_tick);
+    uint64_t delta = expires - cur_tick;
+    if (delta > MAX_DELTA) {
+        delta = MAX_DELTA;
+        expires = cur_tick + delta;
+    }
+
+    Timer_impl** slot;
+    if (delta < LEVEL0_SIZE) {
+        slot = &level0[expires & (LEVEL0_SIZE - 1)];
+    } else {
+        int level = 1;
+        while (delta >= uint64_t(1) << level_shift(level + 1)) {
+            level++;
+        }
+        slot = &levels[level - 1][(expires >> level_shift(level))
+                                  & (LEVELN_SIZE - 1)];
+    }
+
+    t->slot = slot;
+    t->prev = NULL;
+    t->next = *slot;
+    if (*slot) {
+        (*slot)->prev = t;
+    }
+    *slot = t;
+    n_pending++;
+    n_level0 += in_level0(slot);
+}
+
+void
+Timer_dispatcher_impl::unlink(Timer_impl* t)
+{
+    if (t->next) {
+        t->next->prev = t->prev;
+    }
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        *t->slot = t->next;
+    }
+    n_pending--;
+    n_level0 -= in_level0(t->slot);
+}
+
+/* Moves the timers in the current slot of 'level' down into lower levels. */
+void
+Timer_dispatcher_impl::cascade(int level)
+{
+    Timer_impl*& slot = levels[level - 1][(cur_tick >> level_shift(level))
+                                          & (LEVELN_SIZE - 1)];
+    Timer_impl* t = slot;
+    slot = NULL;
+    while (t) {
+        Timer_impl* next = t->next;
+        n_pending--;
+        link(t);
+        t = next;
+    }
+}
+
+/* Moves the timers in level 0 'slot' into the expired batch, in firing order:
+ * all of them if 'all' is true, otherwise only those due by 'now'.  A timer
+ * posted with no delay is thus due at the next poll even if the clock has not
+ * moved since; it still cannot fire in the poll that posted it because the
+ * batch is collected before any timer fires.
+ *
+ * A level 0 slot only holds timers for a single tick, except that timers that
+ * were already due when they were linked share the current tick's slot, so
+ * sorting each slot separately sorts the whole batch. */
+void
+Timer_dispatcher_impl::expire_slot(Timer_impl*& slot, const timeval& now,
+                                   bool all)
+{
+    size_t start = expired.size();
+    Timer_impl* next;
+    for (Timer_impl* t = slot; t; t = next) {
+        next = t->next;
+        if (all || now >= t->time) {
+            t->state = Timer_impl::EXPIRED;
+            Expired_timer e = { t->time, t->generation, t };
+            expired.push_back(e);
+            if (!all) {
+                unlink(t);
+            }
+        }
+    }
+    if (all) {
+        n_pending -= expired.size() - start;
+        n_level0 -= expired.size() - start;
+        slot = NULL;
+    }
+    if (expired.size() - start > 1) {
+        std::sort(expired.begin() + start, expired.end());
+    }
+}
+
+/* Advances the wheel to 'now', appending the timers due by 'now' to the
+ * expired batch in firing order. */
+void
+Timer_dispatcher_impl::collect_expired(const timeval& now)
+{
+    uint64_t now_tick = to_tick(now);
+    while (n_pending && cur_tick < now_tick) {
+        if (n_level0) {
+            expire_slot(level0[cur_tick & (LEVEL0_SIZE - 1)], now, true);
+            cur_tick++;
+        } else {
+            /* Skip ahead to the next cascade. */
+            cur_tick = std::min((cur_tick | (LEVEL0_SIZE - 1)) + 1, now_tick);
+        }
+        if (!(cur_tick & (LEVEL0_SIZE - 1))) {
+            for (int level = 1; level < N_LEVELS; level++) {
+                cascade(level);
+                if ((cur_tick >> level_shift(level)) & (LEVELN_SIZE - 1)) {
+                    break;
+                }
+            }
+        }
+    }
+    if (cur_tick < now_tick) {
+        /* The wheel is empty, so there is nothing to cascade. */
+        cur_tick = now_tick;
+    }
+    expire_slot(level0[cur_tick & (LEVEL0_SIZE - 1)], now, false);
+}
+
+/* Stores in 'when' a time no later than the next expiration in the wheel.
+ * Returns false if the wheel is empty. */
+bool
+Timer_dispatcher_impl::next_wakeup(timeval& when) const
+{
+    if (!n_pending) {
+        return false;
+    }
+
+    /* The first nonempty slot in level 0 gives the earliest expiration among
+     * the timers in level 0. */
+    bool found = false;
+    for (int i = 0; n_level0 && i < LEVEL0_SIZE; i++) {
+        const Timer_impl* t = level0[(cur_tick + i) & (LEVEL0_SIZE - 1)];
+        if (t) {
+            when = t->time;
+            for (t = t->next; t; t = t->next) {
+                if (t->time < when) {
+                    when = t->time;
+                }
+            }
+            found = true;
+            break;
+        }
+    }
+
+    /* Timers in higher levels may expire earlier than that, so also wake up
+     * when the first nonempty slot in each level will be cascaded.  Waking up
+     * early is harmless. */
+    for (int level = 1; level < N_LEVELS; level++) {
+        int shift = level_shift(level);
+        uint64_t base = cur_tick >> shift;
+        for (int i = 1; i <= LEVELN_SIZE; i++) {
+            if (levels[level - 1][(base + i) & (LEVELN_SIZE - 1)]) {
+                timeval boundary = from_tick((base + i) << shift);
+                if (!found || boundary < when) {
+                    when = boundary;
+                    found = true;
+                }
+                break;
+            }
+        }
+    }
+    return found;
+}
+
 Timer_dispatcher::Timer_dispatcher()
     : p(new Timer_dispatcher_impl), next_generation(0)
 {
-    do_gettimeofday(true);
+    std::fill(p->level0, p->level0 + LEVEL0_SIZE, (Timer_impl*) NULL);
+    for (int i = 0; i < N_LEVELS - 1; i++) {
+        std::fill(p->levels[i], p->levels[i] + LEVELN_SIZE,
+                  (Timer_impl*) NULL);
+    }
+    p->cur_tick = to_tick(do_gettimeofday(true));
+    p->n_pending = 0;
+    p->n_level0 = 0;
+    p->next_expired = 0;
+    p->free_list = NULL;
+    p->n_nodes = 0;
     p->serial = 0;
 }
 
 Timer_dispatcher::~Timer_dispatcher()
 {
+    for (size_t i = 0; i < p->blocks.size(); i++) {
+        delete[] p->blocks[i];
+    }
     delete p;
 }
 
 Timer
 Timer_dispatcher::post(const Callback& callback, const timeval& duration)
 {
-    Timer_impl* t = 
-        new Timer_impl(this, do_gettimeofday() + duration, ++next_generation,
-                       callback);
-    p->applicants.insert(t);
-    p->all_timers.insert(t);
+    Timer_impl* t = p->alloc();
+    t->dispatcher = this;
+    t->func = callback;
+    t->time = do_gettimeofday() + duration;
+    t->generation = ++next_generation;
+    t->state = Timer_impl::PENDING;
+    p->link(t);
     p->new_timers.signal();
     return Timer(this, t, t->generation);
 }
@@ -114,8 +419,8 @@ Timer_dispatcher::post(const Callback& callback)
 
 void
 Timer_dispatcher::debug() const {
-    lg.dbg("statistics: all timers = %d, applicants = %d, timers = %d", 
-           p->all_timers.size(), p->applicants.size(), p->timers.size());
+    lg.dbg("statistics: pending timers = %zu, expired = %zu, nodes = %zu",
+           p->n_pending, p->expired.size() - p->next_expired, p->n_nodes);
 }
 
 bool
@@ -124,46 +429,47 @@ Timer_dispatcher::poll()
     /* Update the time of day for this iteration. */
     timeval now = do_gettimeofday(true);
 
-    /* Admit new timers. */
-    BOOST_FOREACH (Timer_impl* t, p->applicants) {
-        t->admitted = true;
-    }
-    p->timers.insert(p->applicants.begin(), p->applicants.end());
-    p->applicants.clear();
-
-    /* Execute all expired timers initially in the queue, but no new or
+    /* Execute all timers that were due when this poll began, but no new or
      * modified timers, to avoid starving other Pollables.
      *
      * XXX We need a scheme for prioritizing timer dispatch above other
      * Pollables.
      */
+    p->collect_expired(now);
+
     bool progress = false;
     unsigned int serial = ++p->serial;
-    while (!p->timers.empty()) {
-        /* Check whether we should fire this timer. */
-        Timer_impl* t = *p->timers.begin();
-        if (now <= t->get_time()) {
-            break;
+    while (p->next_expired < p->expired.size()) {
+        const Expired_timer& e = p->expired[p->next_expired++];
+        Timer_impl* t = e.timer;
+        if (t->state != Timer_impl::EXPIRED
+            || t->generation != e.generation) {
+            /* Canceled or rescheduled after it expired.  (A timer that was
+             * rescheduled and then expired again in a poll re-entered while
+             * this one blocked fires at its first entry and the later entry
+             * is skipped.) */
+            continue;
         }
 
         /* Fire it. */
         progress = true;
-        p->timers.erase(p->timers.begin());
-        p->all_timers.erase(t);
+        t->state = Timer_impl::FIRING;
         try {
             t->func();
         } catch (const std::exception& e) {
             lg.err("Timer leaked an exception: %s", e.what());
         }
-        delete t;
+        p->release(t);
 
         if (serial != p->serial) {
-            /* t->call() blocked and Timer_dispatcher::poll() was eventually
-             * re-entered in another thread.  That other call already admitted
-             * and fired our timers, so we are done. */
-            break;
+            /* t->func() blocked and Timer_dispatcher::poll() was eventually
+             * re-entered in another thread.  That other call already fired
+             * the rest of our timers, so we are done. */
+            return progress;
         }
     }
+    p->expired.clear();
+    p->next_expired = 0;
     return progress;
 }
 
@@ -173,9 +479,11 @@ Timer_dispatcher::wait()
    /* Figure the amount of time left for a next callback or timer.  Moreover,
     * prepare the time adding condition variable to detect new timers while
     * dispatcher is being blocked. */
-    if (!p->timers.empty()) {
-        Timer_impl* t = *p->timers.begin();
-        co_timer_wait(t->get_time(), NULL);
+    timeval when;
+    if (p->next_expired < p->expired.size()) {
+        co_immediate_wake(1, NULL);
+    } else if (p->next_wakeup(when)) {
+        co_timer_wait(when, NULL);
     }
     p->new_timers.wait();
 }
@@ -183,34 +491,33 @@ Timer_dispatcher::wait()
 bool
 Timer_dispatcher::check_validity(Timer_impl* impl, 
                                  const unsigned int generation) const {
-    const Timer_set& all_timers = p->all_timers;
-    Timer_set::const_iterator i = all_timers.find(impl);
-    return i != all_timers.end() && (*i)->generation == generation;
+    return (impl->generation == generation
+            && (impl->state == Timer_impl::PENDING
+                || impl->state == Timer_impl::EXPIRED));
 }
 
-
+
 /* Timer implementation. */
 
 void
 Timer_impl::cancel()
 {
-    if (admitted) {
-        dispatcher->p->timers.erase(this);
-        admitted = false;
-    } else {
-        dispatcher->p->applicants.erase(this);
+    if (state == PENDING) {
+        dispatcher->p->unlink(this);
     }
-
-    dispatcher->p->all_timers.erase(this);
+    dispatcher->p->release(this);
 }
 
 void
 Timer_impl::set_timeout(const timeval& when)
 {
-    cancel();
+    if (state == PENDING) {
+        dispatcher->p->unlink(this);
+    }
     time = when;
-    dispatcher->p->applicants.insert(this);
-    dispatcher->p->all_timers.insert(this);
+    state = PENDING;
+    dispatcher->p->link(this);
+    dispatcher->p->new_timers.signal();
 }
 
 void
@@ -239,7 +546,6 @@ void
 Timer::cancel() {
     if (dispatcher && dispatcher->check_validity(impl, generation)) {
         impl->cancel();
-        delete impl;
         dispatcher = 0; 
         impl = 0;
     }
@@ -20,9 +20,16 @@
 #include <boost/foreach.hpp>
 #include <boost/tokenizer.hpp>
 #include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
 #include <string>
 #include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
 #include <syslog.h>
+#include <time.h>
 #include <vector>
 #include "hash_map.hh"
 #include "string.hh"
@@ -53,6 +60,16 @@ static const int MAX_MSG_LEN = LINE_MAX - MAX_MODULE_NAME_LEN - \
 */ 
 static const int MAX_MSG_LEN = 900; 
 
+// each thread that logs buffers its messages for the writer thread in a ring
+// of this many bytes, which must be a power of 2
+static const uint32_t RING_SIZE = 1 << 18;
+
+// longer messages are truncated
+static const size_t MAX_RECORD_MSG_LEN = RING_SIZE / 4;
+
+// the writer thread writes out buffered messages at least this often
+static const int WRITER_INTERVAL_MS = 20;
+
 // NOTE: no names in this list should be longer than MAX_LEVEL_DESC_LEN
 static const char* level_names[Vlog::N_LEVELS] = {
     "EMER",
@@ -113,9 +130,73 @@ vlog()
 typedef hash_map<std::string, Vlog::Module> Name_to_module;
 typedef hash_map<Vlog::Level*, Vlog::Module> Cache_map;
 
+/* A message in a Log_ring.  The module name and the message follow it, each
+ * null-terminated.  A record flagged RECORD_SKIP only pads the ring to its
+ * end, and only its first two members are valid. */
+struct Log_record
+{
+    uint32_t size;              /* Bytes taken in the ring, header included. */
+    uint16_t flags;             /* RECORD_*. */
+    int16_t level;
+    int32_t msg_num;
+    int32_t name_len;
+    int32_t msg_len;
+    int32_t pad;
+    timeval when;
+
+    const char* name() const { return reinterpret_cast<const char*>(this + 1); }
+    const char* msg() const { return name() + name_len + 1; }
+};
+
+enum {
+    RECORD_CONSOLE = 1 << 0,    /* Write to the console facility. */
+    RECORD_SYSLOG = 1 << 1,     /* Write to the syslog facility. */
+    RECORD_SKIP = 1 << 2        /* Padding to the end of the ring. */
+};
+
+/* Messages that one thread has logged, waiting to be written.  The thread
+ * appends records without locking, and whichever thread writes out messages
+ * consumes them. */
+struct Log_ring
+{
+    char* buffer;
+
+    /* 'head' is only written by the consumer, 'tail' only by the producer.
+     * Both increase forever and are reduced modulo RING_SIZE on use. */
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    /* RING_*.  Rings stay on the list, so that producers can walk it without
+     * locking, and the ring of a thread that exits is taken over by the next
+     * thread that logs.  Until then, the writer frees its buffer once it has
+     * written out what is in it, and the thread that takes it over allocates
+     * a new one. */
+    volatile int state;
+    Log_ring* next;
+};
+
+enum {
+    RING_FREE,                  /* No thread is producing into it. */
+    RING_IN_USE,                /* A thread is producing into it. */
+    RING_RECLAIMING             /* The writer is freeing its buffer. */
+};
+
+/* Where the writer has got to in a ring, and the message there. */
+struct Ring_cursor
+{
+    const Log_ring* ring;
+    uint32_t pos;
+    uint32_t tail;
+    const Log_record* record;
+
+    bool find_message();
+};
+
+static __thread Log_ring* thread_ring;
+
 struct Vlog_impl
 {
-    int msg_num;
+    volatile int msg_num;
 
     /* Module names. */
     Name_to_module name_to_module;
@@ -136,8 +217,325 @@ struct Vlog_impl
     Cache_map min_level_caches;
     void revalidate_cache_entry(const Cache_map::value_type&);
     void revalidate_cache();
+
+    /* Producer side, called by any thread that logs. */
+    Log_ring* volatile rings;
+    pthread_key_t ring_key;
+    volatile unsigned long int n_dropped;
+    Log_ring* get_ring();
+    bool enqueue(Vlog::Module, Vlog::Level, int flags, const char* msg);
+
+    /* Consumer side, serialized by 'write_mutex'. */
+    pthread_mutex_t write_mutex;
+    FILE* log_file;
+    unsigned long int n_reported_dropped;
+    std::vector<Ring_cursor> cursors;
+    std::string console_buffer;
+    std::string file_buffer;
+    void drain();
+    void write_record(const Log_record*);
+    void write_dropped(unsigned long int n);
+
+    /* Writer thread. */
+    bool writer_started;
+    sem_t writer_wakeup;
+    static void* writer_main(void*);
 };
 
+/* Hands back the ring of a thread that exits, for another thread to use. */
+static void
+release_ring(void* ring)
+{
+    __sync_synchronize();
+    static_cast<Log_ring*>(ring)->state = RING_FREE;
+}
+
+/* Returns the calling thread's ring, taking over an unused one or adding a
+ * new one on its first call. */
+Log_ring*
+Vlog_impl::get_ring()
+{
+    if (thread_ring) {
+        return thread_ring;
+    }
+
+    Log_ring* ring;
+    for (ring = rings; ring; ring = ring->next) {
+        if (ring->state == RING_FREE
+            && __sync_bool_compare_and_swap(&ring->state, RING_FREE,
+                                            RING_IN_USE)) {
+            if (!ring->buffer) {
+                ring->buffer = new char[RING_SIZE];
+            }
+            break;
+        }
+    }
+    if (!ring) {
+        ring = new Log_ring;
+        ring->buffer = new char[RING_SIZE];
+        ring->head = ring->tail = 0;
+        ring->state = RING_IN_USE;
+        do {
+            ring->next = rings;
+        } while (!__sync_bool_compare_and_swap(&rings, ring->next, ring));
+    }
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+/* Appends 'msg' to the calling thread's ring, to be written to the facilities
+ * in 'flags'.  Returns false, counting the message as dropped, if the ring is
+ * full. */
+bool
+Vlog_impl::enqueue(Vlog::Module module, Vlog::Level level, int flags,
+                   const char* msg)
+{
+    Log_ring* ring = get_ring();
+    const std::string& name = module_to_name[module];
+    size_t msg_len = strnlen(msg, MAX_RECORD_MSG_LEN);
+    uint32_t size = (sizeof(Log_record) + name.size() + msg_len + 2 + 7) & ~7u;
+
+    /* A record does not wrap around: if it does not fit before the end of
+     * the ring, the rest of the ring is skipped. */
+    uint32_t tail = ring->tail;
+    uint32_t used = tail - ring->head;
+    uint32_t offset = tail & (RING_SIZE - 1);
+    uint32_t skip = RING_SIZE - offset < size ? RING_SIZE - offset : 0;
+    if (RING_SIZE - used < skip + size) {
+        __sync_fetch_and_add(&n_dropped, 1);
+        return false;
+    }
+    if (skip) {
+        Log_record* padding = reinterpret_cast<Log_record*>(ring->buffer
+                                                            + offset);
+        padding->size = skip;
+        padding->flags = RECORD_SKIP;
+        offset = 0;
+    }
+
+    Log_record* record = reinterpret_cast<Log_record*>(ring->buffer + offset);
+    record->size = size;
+    record->flags = flags;
+    record->level = level;
+    record->msg_num = __sync_add_and_fetch(&msg_num, 1);
+    record->name_len = name.size();
+    record->msg_len = msg_len;
+    ::gettimeofday(&record->when, NULL);
+    char* p = reinterpret_cast<char*>(record + 1);
+    memcpy(p, name.c_str(), name.size() + 1);
+    memcpy(p + name.size() + 1, msg, msg_len);
+    p[name.size() + 1 + msg_len] = '\0';
+
+    /* Publish the record before the new tail. */
+    __sync_synchronize();
+    ring->tail = tail + skip + size;
+
+    /* Don't wait for the writer's next round if the ring is filling up. */
+    if (writer_started && used < RING_SIZE / 2
+        && used + skip + size >= RING_SIZE / 2) {
+        sem_post(&writer_wakeup);
+    }
+    return true;
+}
+
+/* Moves the cursor on to the first message at or after 'pos', skipping
+ * padding.  Returns false if there is none before 'tail'. */
+bool
+Ring_cursor::find_message()
+{
+    while (pos != tail) {
+        record = reinterpret_cast<const Log_record*>
+            (ring->buffer + (pos & (RING_SIZE - 1)));
+        if (!(record->flags & RECORD_SKIP)) {
+            return true;
+        }
+        pos += record->size;
+    }
+    return false;
+}
+
+/* Orders cursors for a heap whose top is the earliest message. */
+static bool
+cursor_after(const Ring_cursor& a, const Ring_cursor& b)
+{
+    return a.record->msg_num > b.record->msg_num;
+}
+
+static int
+syslog_priority(Vlog::Level level)
+{
+    return (level == Vlog::LEVEL_EMER ? LOG_EMERG
+            : level == Vlog::LEVEL_ERR ? LOG_ERR
+            : level == Vlog::LEVEL_WARN ? LOG_WARNING
+            : level == Vlog::LEVEL_INFO ? LOG_INFO
+            : LOG_DEBUG);
+}
+
+/* Writes out the messages in every ring, in the order they were logged.
+ * Each ring is in that order already, so the rings are merged.  Console
+ * output is gathered into a single write per facility. */
+void
+Vlog_impl::drain()
+{
+    std::vector<std::pair<Log_ring*, uint32_t> > ends;
+    cursors.clear();
+    for (Log_ring* ring = rings; ring; ring = ring->next) {
+        uint32_t tail = ring->tail;
+        __sync_synchronize();
+        Ring_cursor cursor = { ring, ring->head, tail, 0 };
+        if (cursor.find_message()) {
+            cursors.push_back(cursor);
+        }
+        ends.push_back(std::make_pair(ring, tail));
+    }
+    std::make_heap(cursors.begin(), cursors.end(), cursor_after);
+
+    console_buffer.clear();
+    file_buffer.clear();
+    while (!cursors.empty()) {
+        std::pop_heap(cursors.begin(), cursors.end(), cursor_after);
+        Ring_cursor& cursor = cursors.back();
+        write_record(cursor.record);
+        cursor.pos += cursor.record->size;
+        if (cursor.find_message()) {
+            std::push_heap(cursors.begin(), cursors.end(), cursor_after);
+        } else {
+            cursors.pop_back();
+        }
+    }
+    unsigned long int dropped = n_dropped;
+    if (dropped != n_reported_dropped) {
+        write_dropped(dropped - n_reported_dropped);
+        n_reported_dropped = dropped;
+    }
+    if (!console_buffer.empty()) {
+        ::fwrite(console_buffer.data(), 1, console_buffer.size(), stderr);
+    }
+    if (log_file && !file_buffer.empty()) {
+        ::fwrite(file_buffer.data(), 1, file_buffer.size(), log_file);
+        ::fflush(log_file);
+    }
+
+    /* Finish reading the records before handing them back to producers. */
+    __sync_synchronize();
+    for (size_t i = 0; i < ends.size(); ++i) {
+        ends[i].first->head = ends[i].second;
+    }
+
+    /* Free the buffers of the rings whose threads have exited, now that
+     * they are written out. */
+    for (Log_ring* ring = rings; ring; ring = ring->next) {
+        if (ring->buffer && ring->state == RING_FREE
+            && __sync_bool_compare_and_swap(&ring->state, RING_FREE,
+                                            RING_RECLAIMING)) {
+            if (ring->head == ring->tail) {
+                delete[] ring->buffer;
+                ring->buffer = 0;
+            }
+            __sync_synchronize();
+            ring->state = RING_FREE;
+        }
+    }
+}
+
+/* Formats 'record' into the console and file buffers and writes it to
+ * syslog, as its flags say. */
+void
+Vlog_impl::write_record(const Log_record* record)
+{
+    const char* level_name = Vlog::get_level_name(record->level);
+    const char* msg = record->msg();
+    int msg_len = record->msg_len;
+    bool needs_new_line = !msg_len || msg[msg_len - 1] != '\n';
+
+    if (record->flags & RECORD_CONSOLE) {
+        char prefix[64];
+        ::snprintf(prefix, sizeof prefix, "%05d|", record->msg_num);
+        size_t start = console_buffer.size();
+        console_buffer += prefix;
+        console_buffer.append(record->name(), record->name_len);
+        console_buffer += '|';
+        console_buffer += level_name;
+        console_buffer += ':';
+        console_buffer.append(msg, msg_len);
+        if (needs_new_line) {
+            console_buffer += '\n';
+        }
+
+        if (log_file) {
+            struct tm tm;
+            ::localtime_r(&record->when.tv_sec, &tm);
+            size_t n = ::strftime(prefix, sizeof prefix, "%Y-%m-%d %H:%M:%S",
+                                  &tm);
+            ::snprintf(prefix + n, sizeof prefix - n, ".%03d|",
+                       (int) (record->when.tv_usec / 1000));
+            file_buffer += prefix;
+            file_buffer.append(console_buffer, start, std::string::npos);
+        }
+    }
+
+    if (record->flags & RECORD_SYSLOG) {
+        /* Long messages are split into several calls to syslog, each of
+         * length <= MAX_MSG_LEN. */
+        int priority = syslog_priority(record->level);
+        int start = 0;
+        do {
+            ::syslog(priority, "%05d|%s:%s %.*s",
+                     record->msg_num, record->name(), level_name,
+                     std::min(msg_len - start, MAX_MSG_LEN), msg + start);
+            start += MAX_MSG_LEN;
+        } while (start < msg_len);
+    }
+}
+
+/* Reports that 'n' messages were dropped because their thread's ring was
+ * full. */
+void
+Vlog_impl::write_dropped(unsigned long int n)
+{
+    char msg[64];
+    ::snprintf(msg, sizeof msg, "dropped %lu log messages", n);
+
+    Log_record* record = static_cast<Log_record*>
+        (::operator new(sizeof(Log_record) + sizeof "vlog" + sizeof msg));
+    record->flags = RECORD_CONSOLE | RECORD_SYSLOG;
+    record->level = Vlog::LEVEL_WARN;
+    record->msg_num = __sync_add_and_fetch(&msg_num, 1);
+    record->name_len = strlen("vlog");
+    record->msg_len = strlen(msg);
+    ::gettimeofday(&record->when, NULL);
+    memcpy(record + 1, "vlog", sizeof "vlog");
+    memcpy(reinterpret_cast<char*>(record + 1) + sizeof "vlog", msg,
+           record->msg_len + 1);
+    write_record(record);
+    ::operator delete(record);
+}
+
+void*
+Vlog_impl::writer_main(void* pimpl_)
+{
+    Vlog_impl* pimpl = static_cast<Vlog_impl*>(pimpl_);
+    for (;;) {
+        timespec deadline;
+        ::clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WRITER_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (::sem_timedwait(&pimpl->writer_wakeup, &deadline)
+               && errno == EINTR) {
+            continue;
+        }
+
+        pthread_mutex_lock(&pimpl->write_mutex);
+        pimpl->drain();
+        pthread_mutex_unlock(&pimpl->write_mutex);
+    }
+    return 0;
+}
+
 /* Returns the minimum logging level necessary for a message to the given
  * 'module' to yield output on any logging facility. */
 Vlog::Level
@@ -261,6 +659,13 @@ Vlog::Vlog()
     ::openlog("nox", LOG_NDELAY, 0);
 
     pimpl->msg_num = 0;
+    pimpl->rings = 0;
+    pimpl->n_dropped = 0;
+    pthread_key_create(&pimpl->ring_key, release_ring);
+    pthread_mutex_init(&pimpl->write_mutex, NULL);
+    pimpl->log_file = 0;
+    pimpl->n_reported_dropped = 0;
+    pimpl->writer_started = false;
     for (Facility facility = 0; facility < N_FACILITIES; ++facility) {
         pimpl->default_levels[facility] = LEVEL_WARN;
     }
@@ -392,55 +797,93 @@ Vlog::get_levels()
 void
 Vlog::output(Module module, Level level, const char* log_msg)
 {
-    pimpl->msg_num++;
-
     int save_errno = errno;
 
-    const char* module_name = get_module_name(module);
-    const char* level_name = get_level_name(level);
+    int flags = 0;
     if (pimpl->levels[FACILITY_CONSOLE][module] >= level) {
-        size_t length = strlen(log_msg);
-        bool needs_new_line = !length || log_msg[length - 1] != '\n';
-        ::fprintf(stderr, "%05d|%s|%s:%s%s",
-                  pimpl->msg_num, module_name, level_name, log_msg,
-                  needs_new_line ? "\n" : "");
+        flags |= RECORD_CONSOLE;
     }
-
     if (pimpl->levels[FACILITY_SYSLOG][module] >= level) {
-        int priority
-            = (level == LEVEL_EMER ? LOG_EMERG
-               : level == LEVEL_ERR ? LOG_ERR
-               : level == LEVEL_WARN ? LOG_WARNING
-               : level == LEVEL_INFO ? LOG_INFO
-               : LOG_DEBUG);
-        if(strlen(log_msg) < MAX_MSG_LEN) { 
-          ::syslog(priority, "%05d|%s:%s %s",
-                 pimpl->msg_num, module_name, level_name, log_msg);
-        } else {
-          // this is a long message, so we will need to split it into multiple calls
-          // to syslog, each of length <= MAX_MSG_LEN
-          // Do this in a separate branch to avoid copies on short log messages
-          std::string long_str = std::string(log_msg); 
-          int start_index = 0; 
-          while(start_index < long_str.length()) {
-            std::string sub = long_str.substr(start_index, MAX_MSG_LEN);  
-            ::syslog(priority, "%05d|%s:%s %s",
-                 pimpl->msg_num, module_name, level_name, sub.c_str());
-            start_index += MAX_MSG_LEN; 
-          }  
-        } 
-    }
-/* 
-    // Send log msg to socket 
-    char pWrite[MAX_MSG_LEN];
-    snprintf(pWrite, MAX_MSG_LEN, "%05d|%s|%s:%s\n",pimpl->msg_num,module_name,level_name,log_msg);
-    sendto(hSock,pWrite,strlen(pWrite),0,(sockaddr*)&addr,sizeof(addr));
-*/
+        flags |= RECORD_SYSLOG;
+    }
+    if (flags && pimpl->enqueue(module, level, flags, log_msg)
+        && (!pimpl->writer_started || level == LEVEL_EMER)) {
+        flush();
+    }
+
     /* Restore errno (it's pretty unfriendly for a log function to change
      * errno). */
     errno = save_errno;
 }
 
+static void
+flush_at_exit()
+{
+    vlog().flush();
+}
+
+/* Starts the background thread that writes out logged messages. */
+void
+Vlog::start_writer()
+{
+    if (pimpl->writer_started) {
+        return;
+    }
+    sem_init(&pimpl->writer_wakeup, 0, 0);
+
+    /* Leave signals to the other threads. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t writer;
+    int error = pthread_create(&writer, &attr, Vlog_impl::writer_main, pimpl);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (!error) {
+        pimpl->writer_started = true;
+        ::atexit(flush_at_exit);
+    }
+}
+
+/* Writes out every message logged so far. */
+void
+Vlog::flush()
+{
+    pthread_mutex_lock(&pimpl->write_mutex);
+    pimpl->drain();
+    pthread_mutex_unlock(&pimpl->write_mutex);
+}
+
+/* Returns the number of messages dropped because the logging thread's buffer
+ * was full. */
+unsigned long int
+Vlog::get_n_dropped()
+{
+    return pimpl->n_dropped;
+}
+
+bool
+Vlog::set_log_file(const char* file_name)
+{
+    FILE* file = ::fopen(file_name, "a");
+    if (!file) {
+        return false;
+    }
+
+    pthread_mutex_lock(&pimpl->write_mutex);
+    if (pimpl->log_file) {
+        ::fclose(pimpl->log_file);
+    }
+    pimpl->log_file = file;
+    pthread_mutex_unlock(&pimpl->write_mutex);
+    return true;
+}
+
 /* Sets up '*cached_min_level' so that it will always be assigned the minimum
  * logging level for output to 'module' to actually log to at least one
  * facility.  'cached_min_level' must not already be in use as a level
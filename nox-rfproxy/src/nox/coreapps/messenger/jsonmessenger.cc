@@ -12,7 +12,7 @@ namespace vigil
   static const std::string app_name("jsonmessenger");
 
   JSONMsg_event::JSONMsg_event(const core_message* cmsg):
-    Event(static_get_name())
+    Event(event_type<JSONMsg_event>())
   {
     set_name(static_get_name());
     sock = cmsg->sock;
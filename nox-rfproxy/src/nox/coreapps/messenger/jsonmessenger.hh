@@ -53,7 +53,7 @@ namespace vigil
 
     /** For use within python.
      */
-    JSONMsg_event() : Event(static_get_name()) 
+    JSONMsg_event() : Event(event_type<JSONMsg_event>()) 
     { }
 
     /** Static name required in NOX.
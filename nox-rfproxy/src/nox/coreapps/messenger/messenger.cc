@@ -13,7 +13,7 @@ namespace vigil
 
   Msg_event::Msg_event(messenger_msg* message, Msg_stream* socket, 
 		       ssize_t size):
-    Event(static_get_name())
+    Event(event_type<Msg_event>())
   {
     sock = socket;
 
@@ -28,7 +28,7 @@ namespace vigil
   }
 
   Msg_event::Msg_event(const core_message* cmsg):
-    Event(static_get_name())
+    Event(event_type<Msg_event>())
   {
     sock = cmsg->sock;
     len = cmsg->len;
@@ -115,7 +115,7 @@ namespace vigil
     /** Empty constructor.
      * For use within python.
      */
-    Msg_event() : Event(static_get_name()) 
+    Msg_event() : Event(event_type<Msg_event>()) 
     { }
 
     /** Static name required in NOX.
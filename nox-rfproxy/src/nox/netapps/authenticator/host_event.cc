@@ -73,7 +73,8 @@ Host_auth_event::Host_auth_event(datapathid datapath_id_, uint16_t port_,
                                  int64_t hostname_, int64_t host_netid_,
                                  uint32_t idle_timeout_, uint32_t hard_timeout_,
                                  Host_event::Reason reason_)
-    : Event(static_get_name()), action(AUTHENTICATE), datapath_id(datapath_id_),
+    : Event(event_type<Host_auth_event>()),
+      action(AUTHENTICATE), datapath_id(datapath_id_),
       port(port_), dladdr(dladdr_), nwaddr(nwaddr_), hostname(hostname_),
       host_netid(host_netid_), idle_timeout(idle_timeout_),
       hard_timeout(hard_timeout_), reason(reason_), to_post(NULL)
@@ -84,7 +85,7 @@ Host_auth_event::Host_auth_event(datapathid datapath_id_, uint16_t port_,
                                  ethernetaddr dladdr_, uint32_t nwaddr_,
                                  int64_t hostname_, int64_t host_netid_,
                                  uint32_t enabled_fields_, Host_event::Reason reason_)
-    : Event(static_get_name()), action(DEAUTHENTICATE),
+    : Event(event_type<Host_auth_event>()), action(DEAUTHENTICATE),
       datapath_id(datapath_id_), port(port_), dladdr(dladdr_), nwaddr(nwaddr_),
       hostname(hostname_), host_netid(host_netid_),
       enabled_fields(enabled_fields_), reason(reason_), to_post(NULL)
@@ -95,7 +96,8 @@ Host_bind_event::Host_bind_event(Action action_, datapathid datapath_id_,
                                  int64_t locname_, ethernetaddr dladdr_,
                                  int64_t hostname_, int64_t host_netid_,
                                  Host_event::Reason reason_)
-    : Event(static_get_name()), action(action_), datapath_id(datapath_id_),
+    : Event(event_type<Host_bind_event>()),
+      action(action_), datapath_id(datapath_id_),
       port(port_), switchname(switchname_), locname(locname_),
       dladdr(dladdr_), nwaddr(0), hostname(hostname_),
       host_netid(host_netid_), reason(reason_)
@@ -105,7 +107,7 @@ Host_bind_event::Host_bind_event(Action action_, ethernetaddr dladdr_,
                                  uint32_t nwaddr_, int64_t hostname_,
                                  int64_t host_netid_,
                                  Host_event::Reason reason_)
-    : Event(static_get_name()), action(action_),
+    : Event(event_type<Host_bind_event>()), action(action_),
       datapath_id(datapathid::from_host(0)), port(0), switchname(0),
       locname(0), dladdr(dladdr_),
       nwaddr(nwaddr_), hostname(hostname_), host_netid(host_netid_),
@@ -114,7 +116,8 @@ Host_bind_event::Host_bind_event(Action action_, ethernetaddr dladdr_,
 
 Host_join_event::Host_join_event(Action action_, int64_t hostname_,
                                  Host_event::Reason reason_)
-    : Event(static_get_name()), action(action_), hostname(hostname_),
+    : Event(event_type<Host_join_event>()),
+      action(action_), hostname(hostname_),
       reason(reason_)
 {}
 
@@ -22,7 +22,7 @@ namespace vigil {
 
 Switch_bind_event::Switch_bind_event(Action action_, const datapathid& dp,
                                      int64_t switchname_)
-    : Event(static_get_name()), action(action_), datapath_id(dp),
+    : Event(event_type<Switch_bind_event>()), action(action_), datapath_id(dp),
       switchname(switchname_)
 {}
 
@@ -49,7 +49,7 @@ struct Switch_bind_event
                       int64_t switchname_);
 
     // -- only for use within python
-    Switch_bind_event() : Event(static_get_name()) { }
+    Switch_bind_event() : Event(event_type<Switch_bind_event>()) { }
 
     static const Event_name static_get_name() {
         return "Switch_bind_event";
@@ -67,7 +67,7 @@ struct User_auth_event
                     User_event::Reason reason_);
 
     // -- only for use within python
-    User_auth_event() : Event(static_get_name()) { }
+    User_auth_event() : Event(event_type<User_auth_event>()) { }
 
     static const Event_name static_get_name() {
         return "User_auth_event";
@@ -101,7 +101,7 @@ struct User_join_event
                     User_event::Reason reason_);
 
     // -- only for use within python
-    User_join_event() : Event(static_get_name()) { }
+    User_join_event() : Event(event_type<User_join_event>()) { }
 
     static const Event_name static_get_name() {
         return "User_join_event";
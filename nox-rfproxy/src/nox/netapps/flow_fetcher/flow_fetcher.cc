@@ -17,6 +17,8 @@
  */
 #include "flow_fetcher.hh"
 #include <boost/bind.hpp>
+#include <deque>
+#include <stdlib.h>
 #include <tr1/unordered_map>
 #include "assert.hh"
 #include "component.hh"
@@ -38,7 +40,8 @@ struct Flow_fetcher_app
     /* Application interface. */
     Flow_fetcher_app(const container::Context* c,
                      const json_object*)
-        : Component(c) { }
+        : Component(c), max_in_flight(DEFAULT_MAX_IN_FLIGHT),
+          dispatch_posted(false) { }
 
     static void getInstance(const container::Context*, Flow_fetcher_app*&);
 
@@ -50,9 +53,23 @@ struct Flow_fetcher_app
         Fetcher_map;
     Fetcher_map active_fetchers;
 
+    /* Fetches beyond 'max_in_flight' wait in 'queued', in the order they were
+     * asked for, and are sent as earlier ones complete.  Each reply can be
+     * tens of kilobytes, and a fetch across hundreds of switches would
+     * otherwise have all of them replying at once. */
+    static const size_t DEFAULT_MAX_IN_FLIGHT = 32;
+    size_t max_in_flight;
+    std::deque<boost::shared_ptr<Flow_fetcher> > queued;
+    bool dispatch_posted;
+
     boost::shared_ptr<Flow_fetcher>
     start_fetch(datapathid dpid, const ofp_flow_stats_request& request,
-                const boost::function<void()>& cb);
+                const Flow_fetcher::Chunk_callback& chunk_cb,
+                const boost::function<void()>& cb,
+                const Flow_fetcher::Filter& filter);
+    void post_dispatch();
+    void dispatch();
+    void send_request(const boost::shared_ptr<Flow_fetcher>&);
 
     Fetcher_map::iterator lookup_xid(uint32_t xid);
     Disposition handle_flow_stats_in(const Event&);
@@ -100,15 +117,17 @@ Flow_fetcher_app::handle_flow_stats_in(const Event& e)
         return CONTINUE;
     }
 
-    /* Append the new flows.  Unless there are more flows to come, declare
+    /* Hand over the new flows.  Unless there are more flows to come, declare
      * it a success. */
     boost::shared_ptr<Flow_fetcher> ff(i->second);
-    ff->flows.insert(ff->flows.end(), fsie.flows.begin(), fsie.flows.end());
     if (fsie.more) {
         ff->touch();
+        ff->receive(fsie);
     } else {
-        ff->complete(0);
         active_fetchers.erase(i);
+        post_dispatch();
+        ff->receive(fsie);
+        ff->complete(0);
     }
     return STOP;
 }
@@ -128,6 +147,7 @@ Flow_fetcher_app::handle_datapath_leave(const Event& e)
             lg.warn("flow fetching canceled due to datapath connection drop");
             ff->complete(ENOTCONN);
             i = active_fetchers.erase(i);
+            post_dispatch();
         } else {
             ++i;
         }
@@ -148,8 +168,9 @@ Flow_fetcher_app::handle_error(const Event& e)
 
     lg.warn("flow fetching canceled due to received error type=%"PRIu16" "
             "code=%"PRIu16, ee.type, ee.code);
-    ff->complete(EREMOTE);
     active_fetchers.erase(i);
+    post_dispatch();
+    ff->complete(EREMOTE);
     return STOP;
 }
 
@@ -163,6 +184,7 @@ Flow_fetcher_app::expire()
             lg.warn("flow fetching canceled due to timeout");
             ff->complete(ETIMEDOUT);
             i = active_fetchers.erase(i);
+            post_dispatch();
         } else {
             ++i;
         }
@@ -174,10 +196,50 @@ Flow_fetcher_app::expire()
 boost::shared_ptr<Flow_fetcher>
 Flow_fetcher_app::start_fetch(datapathid dpid,
                               const ofp_flow_stats_request& request,
-                              const boost::function<void()>& cb)
+                              const Flow_fetcher::Chunk_callback& chunk_cb,
+                              const boost::function<void()>& cb,
+                              const Flow_fetcher::Filter& filter)
+{
+    boost::shared_ptr<Flow_fetcher> ff(
+        new Flow_fetcher(this, dpid, request, chunk_cb, cb, filter));
+    queued.push_back(ff);
+    post_dispatch();
+    return ff;
+}
+
+/* Sends queued requests from a timer of their own, rather than from within
+ * the completion of another fetch, whose callback could be fetching again. */
+void
+Flow_fetcher_app::post_dispatch()
+{
+    if (!dispatch_posted && !queued.empty()) {
+        dispatch_posted = true;
+        nox::post_timer(boost::bind(&Flow_fetcher_app::dispatch, this));
+    }
+}
+
+void
+Flow_fetcher_app::dispatch()
+{
+    dispatch_posted = false;
+    while (!queued.empty() && active_fetchers.size() < max_in_flight) {
+        boost::shared_ptr<Flow_fetcher> ff(queued.front());
+        queued.pop_front();
+        if (ff->canceled) {
+            /* Canceled before it was sent: nobody is waiting for it. */
+            ff->complete(ECANCELED);
+        } else {
+            send_request(ff);
+        }
+    }
+}
+
+void
+Flow_fetcher_app::send_request(const boost::shared_ptr<Flow_fetcher>& ff)
 {
-    uint32_t xid = nox::allocate_openflow_xid();
-    boost::shared_ptr<Flow_fetcher> ff(new Flow_fetcher(this, dpid, xid, cb));
+    const ofp_flow_stats_request& request = ff->request;
+    ff->xid = nox::allocate_openflow_xid();
+    ff->touch();
 
     /* Compose the ofp_stats_request header. */
     Array_buffer b(0);
@@ -201,18 +263,25 @@ Flow_fetcher_app::start_fetch(datapathid dpid,
     /* Send. */
     ofp_header& oh = b.at<ofp_header>(0);
     oh.length = htons(b.size());
-    int error = send_openflow_command(dpid, &oh, false);
+    int error = send_openflow_command(ff->datapath_id, &oh, false);
     if (!error) {
         active_fetchers.insert(std::make_pair(ff->xid, ff)); 
     } else {
-        nox::post_timer(boost::bind(&Flow_fetcher::complete, ff, error));
+        ff->complete(error);
     }
-    return ff;
 }
 
 void
-Flow_fetcher_app::configure(const container::Configuration*)
+Flow_fetcher_app::configure(const container::Configuration* conf)
 {
+    const hash_map<std::string, std::string> argmap
+        = conf->get_arguments_list();
+    hash_map<std::string, std::string>::const_iterator i
+        = argmap.find("max_in_flight");
+    if (i != argmap.end() && atoi(i->second.c_str()) > 0) {
+        max_in_flight = atoi(i->second.c_str());
+    }
+
     register_handler<Flow_stats_in_event>
         (boost::bind(&Flow_fetcher_app::handle_flow_stats_in, this, _1));
     register_handler<Datapath_leave_event>
@@ -226,7 +295,12 @@ Flow_fetcher_app::configure(const container::Configuration*)
  * satisfying the predicate in 'request' will be fetched from the switch with
  * datapath id 'dpid'.  When the fetch completes (either successfully or with
  * an error), 'cb' will be invoked.  (But 'cb' will not be invoked before
- * fetch() returns.)
+ * fetch() returns.)  'cb' may be empty, for a caller that polls
+ * get_status() instead.  If 'filter' is given, only the flows for which it
+ * returns true are kept; see Flow_match_filter for one on match and table.
+ *
+ * At most 'max_in_flight' fetches (a configuration argument, 32 by default)
+ * are outstanding at once, across all switches; others wait their turn.
  *
  * Returns a flow fetcher object whose state may be queried to find out the
  * results of the fetch operation or to cancel the operation.  A call to the
@@ -235,34 +309,82 @@ Flow_fetcher_app::configure(const container::Configuration*)
 boost::shared_ptr<Flow_fetcher>
 Flow_fetcher::fetch(const container::Context* ctx,
                     datapathid dpid, const ofp_flow_stats_request& request,
-                    const boost::function<void()>& cb)
+                    const boost::function<void()>& cb, const Filter& filter)
+{
+    Flow_fetcher_app* app;
+    Flow_fetcher_app::getInstance(ctx, app);
+    return app->start_fetch(dpid, request, Chunk_callback(), cb, filter);
+}
+
+/* Like fetch(), but instead of collecting the flows, passes those of each
+ * reply to 'chunk_cb' as it arrives, then calls 'cb' once the fetch is
+ * complete.  get_flows() stays empty, so that fetching from a switch with a
+ * large flow table takes memory for one reply at a time. */
+boost::shared_ptr<Flow_fetcher>
+Flow_fetcher::stream(const container::Context* ctx,
+                     datapathid dpid, const ofp_flow_stats_request& request,
+                     const Chunk_callback& chunk_cb,
+                     const boost::function<void()>& cb, const Filter& filter)
 {
     Flow_fetcher_app* app;
     Flow_fetcher_app::getInstance(ctx, app);
-    return app->start_fetch(dpid, request, cb);
+    return app->start_fetch(dpid, request, chunk_cb, cb, filter);
 }
 
 Flow_fetcher::Flow_fetcher(Flow_fetcher_app* app_,
                            datapathid datapath_id_,
-                           uint32_t xid_,
-                           const boost::function<void()>& cb_)
+                           const ofp_flow_stats_request& request_,
+                           const Chunk_callback& chunk_cb_,
+                           const boost::function<void()>& cb_,
+                           const Filter& filter_)
     : app(app_),
       status(-1),
+      canceled(false),
       datapath_id(datapath_id_),
-      xid(xid_),
-      cb(cb_)
+      xid(0),
+      request(request_),
+      chunk_cb(chunk_cb_),
+      cb(cb_),
+      filter(filter_)
 {
     touch();
 }
 
-/* Cancels fetching the flows, by preventing the callback from being
- * invoked. */
+/* Cancels fetching the flows, by preventing the callbacks from being
+ * invoked.  A fetch that is still waiting for its turn is not sent, and flows
+ * that still arrive are not kept. */
 void
 Flow_fetcher::cancel()
 {
+    canceled = true;
+    chunk_cb = Chunk_callback();
     cb = boost::function<void()>();
 }
 
+/* Takes in the flows of a reply: without a filter or a chunk callback, the
+ * flows already parsed by the event; otherwise, views of the flows in the
+ * reply's buffer, which are only copied if they are to be kept. */
+void
+Flow_fetcher::receive(const Flow_stats_in_event& fsie)
+{
+    if (canceled) {
+        return;
+    }
+    if (filter.empty() && chunk_cb.empty()) {
+        flows.insert(flows.end(), fsie.flows.begin(), fsie.flows.end());
+        return;
+    }
+
+    Flow_stats_chunk chunk(fsie, filter);
+    if (!chunk_cb.empty()) {
+        chunk_cb(chunk);
+    } else {
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            flows.push_back(Flow_stats(&chunk[i]));
+        }
+    }
+}
+
 /* Returns the flow fetch status, which is -1 if flow fetching is not
  * complete, 0 if flow fetching succeeded, and otherwise a positive Unix errno
  * value that hints at the error that occurred.  If the return value is 0,
@@ -290,9 +412,10 @@ Flow_fetcher::complete(int status_)
     assert(status < 0);
     assert(status_ >= 0);
     status = status_;
+    chunk_cb = Chunk_callback();
     if (!cb.empty()) {
         boost::function<void()> save_cb = cb;
-        cancel();
+        cb = boost::function<void()>();
         save_cb();
     }
 }
@@ -22,23 +22,69 @@
 #include <boost/shared_ptr.hpp>
 #include <stdint.h>
 #include <vector>
+#include "buffer.hh"
 #include "component.hh"
 #include "flow-stats-in.hh"
 #include "netinet++/datapathid.hh"
-
-struct ofp_flow_stats_request;
-struct ofp_flow_stats;
+#include "openflow/openflow.h"
 
 namespace vigil {
 namespace applications {
 
 class Flow_fetcher_app;
 
+/* The flows of one flow stats reply, as pointers into the reply's buffer
+ * rather than copies.  The buffer is shared with the reply event and lives as
+ * long as any chunk that refers to it, so a chunk may be kept beyond the
+ * callback that it is passed to.  The flows are in network byte order, as the
+ * switch sent them. */
+class Flow_stats_chunk {
+public:
+    Flow_stats_chunk(const Flow_stats_in_event&,
+                     const boost::function<bool(const ofp_flow_stats&)>&);
+
+    size_t size() const { return flows.size(); }
+    const ofp_flow_stats& operator[](size_t i) const { return *flows[i]; }
+    size_t n_actions(size_t i) const;
+
+    datapathid datapath_id;
+    bool more;                  // Whether more chunks are to come.
+
+private:
+    boost::shared_ptr<Buffer> buf;
+    std::vector<const ofp_flow_stats*> flows;
+};
+
+/* A filter that keeps the flows in table 'table_id' (any table, if 0xff)
+ * that match only packets that 'match' matches too, the same way that a
+ * switch selects flows for a flow stats request.  That is, each field that
+ * 'match' does not wildcard, the flow must match exactly with the same value;
+ * and the flow may wildcard no more of nw_src and nw_dst than 'match' does,
+ * and must agree with it on the rest. */
+class Flow_match_filter {
+public:
+    Flow_match_filter(const ofp_match& match, uint8_t table_id);
+    bool operator()(const ofp_flow_stats&) const;
+
+private:
+    ofp_match match;
+    uint8_t table_id;
+};
+
 class Flow_fetcher {
 public:
+    typedef boost::function<void(const Flow_stats_chunk&)> Chunk_callback;
+    typedef boost::function<bool(const ofp_flow_stats&)> Filter;
+
     static boost::shared_ptr<Flow_fetcher>
     fetch(const container::Context*, datapathid, const ofp_flow_stats_request&,
-          const boost::function<void()>& cb);
+          const boost::function<void()>& cb,
+          const Filter& filter = Filter());
+    static boost::shared_ptr<Flow_fetcher>
+    stream(const container::Context*, datapathid,
+           const ofp_flow_stats_request&, const Chunk_callback& chunk_cb,
+           const boost::function<void()>& cb,
+           const Filter& filter = Filter());
 
     void cancel();
     int get_status() const;
@@ -48,17 +94,24 @@ private:
 
     Flow_fetcher(Flow_fetcher_app* app, 
                  datapathid datapath_id_,
-                 uint32_t xid_,
-                 const boost::function<void()>& cb);
+                 const ofp_flow_stats_request& request_,
+                 const Chunk_callback& chunk_cb_,
+                 const boost::function<void()>& cb,
+                 const Filter& filter_);
+    void receive(const Flow_stats_in_event&);
     void complete(int status);
     void touch();
 
     Flow_fetcher_app* app;
     int status;
+    bool canceled;
     datapathid datapath_id;
     uint32_t xid;
+    ofp_flow_stats_request request;
     std::vector<Flow_stats> flows;
+    Chunk_callback chunk_cb;
     boost::function<void()> cb;
+    Filter filter;
     long long int expires;
 };
 
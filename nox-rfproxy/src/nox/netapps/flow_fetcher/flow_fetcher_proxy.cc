@@ -38,26 +38,59 @@ namespace vigil {
 namespace applications {
 
 Flow_fetcher_proxy::Flow_fetcher_proxy(PyObject* ctxt_, PyObject* dpid_,
-                                       PyObject* request_, PyObject* cb_)
+                                       PyObject* request_, PyObject* cb_,
+                                       PyObject* chunk_cb_, PyObject* filter_)
+    : cb(NULL), chunk_cb(NULL)
 {
     const container::Context* ctxt
         = from_python<const container::Context*>(ctxt_);
     datapathid dpid = from_python<datapathid>(dpid_);
     ofp_flow_stats_request request
         = from_python<ofp_flow_stats_request>(request_);
+    /* Nothing is fetched if a callback is unusable.  The wrapper raises the
+     * error set here (see pyflow_fetcher.i). */
     if (!cb_ || !PyCallable_Check(cb_)) {
         PyErr_SetString(PyExc_TypeError, "'f' object is not callable");
+        return;
+    }
+    if (chunk_cb_ && chunk_cb_ != Py_None && !PyCallable_Check(chunk_cb_)) {
+        PyErr_SetString(PyExc_TypeError, "'chunk_cb' is not callable");
+        return;
+    }
+    /* The filter takes the same form as the request. */
+    Flow_fetcher::Filter filter;
+    if (filter_ && filter_ != Py_None) {
+        if (!PyDict_Check(filter_)) {
+            PyErr_SetString(PyExc_TypeError, "'filter' is not a dict");
+            return;
+        }
+        ofp_flow_stats_request fsr
+            = from_python<ofp_flow_stats_request>(filter_);
+        filter = Flow_match_filter(fsr.match, fsr.table_id);
     }
     cb = cb_;
-    Py_XINCREF(cb);
-    ff = Flow_fetcher::fetch(ctxt, dpid, request,
-                             boost::bind(&Flow_fetcher_proxy::thunk, this));
+    Py_INCREF(cb);
+    if (chunk_cb_ && chunk_cb_ != Py_None) {
+        chunk_cb = chunk_cb_;
+        Py_INCREF(chunk_cb);
+        ff = Flow_fetcher::stream(
+            ctxt, dpid, request,
+            boost::bind(&Flow_fetcher_proxy::chunk_thunk, this, _1),
+            boost::bind(&Flow_fetcher_proxy::thunk, this), filter);
+    } else {
+        ff = Flow_fetcher::fetch(ctxt, dpid, request,
+                                 boost::bind(&Flow_fetcher_proxy::thunk, this),
+                                 filter);
+    }
 }
 
 Flow_fetcher_proxy::~Flow_fetcher_proxy()
 {
-    ff->cancel();
+    if (ff) {
+        ff->cancel();
+    }
     Py_CLEAR(cb);
+    Py_CLEAR(chunk_cb);
 }
 
 void
@@ -69,6 +102,21 @@ Flow_fetcher_proxy::thunk()
     Py_XDECREF(retval);
 }
 
+/* Passes the flows of one reply to Python as a tuple, converted straight from
+ * the reply's buffer.  As with ofp_flow_stats in general, actions are not
+ * included. */
+void
+Flow_fetcher_proxy::chunk_thunk(const Flow_stats_chunk& chunk)
+{
+    PyObject* pyflows = PyTuple_New(chunk.size());
+    for (size_t i = 0; i < chunk.size(); ++i) {
+        PyTuple_SET_ITEM(pyflows, i, to_python(chunk[i]));
+    }
+    PyObject* retval = PyObject_CallFunctionObjArgs(chunk_cb, pyflows, NULL);
+    Py_XDECREF(retval);
+    Py_DECREF(pyflows);
+}
+
 void
 Flow_fetcher_proxy::cancel()
 {
@@ -36,7 +36,8 @@ namespace applications {
 class Flow_fetcher_proxy {
 public:
     Flow_fetcher_proxy(PyObject* ctxt, PyObject* dpid, PyObject* request,
-                       PyObject* cb);
+                       PyObject* cb, PyObject* chunk_cb = NULL,
+                       PyObject* filter = NULL);
     ~Flow_fetcher_proxy();
 
     void cancel();
@@ -45,9 +46,11 @@ public:
 
 protected:
     PyObject* cb;
+    PyObject* chunk_cb;
     boost::shared_ptr<Flow_fetcher> ff;
 
     void thunk();
+    void chunk_thunk(const Flow_stats_chunk&);
 }; // class Flow_fetcher_proxy
 
 } // namespace applications
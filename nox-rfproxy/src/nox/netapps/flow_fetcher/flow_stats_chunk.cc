@@ -0,0 +1,119 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Views of the flows in flow stats replies, and filters on them, kept apart
+ * from the fetcher component so they can be built and tested on their own. */
+
+#include "flow_fetcher.hh"
+#include <algorithm>
+#include <string.h>
+
+namespace vigil {
+namespace applications {
+
+/* Collects the flows in the reply of 'fsie' for which 'filter', if it is
+ * set, returns true.  A flow whose length runs past the end of the reply
+ * ends the chunk. */
+Flow_stats_chunk::Flow_stats_chunk(
+    const Flow_stats_in_event& fsie,
+    const boost::function<bool(const ofp_flow_stats&)>& filter)
+    : datapath_id(fsie.datapath_id), more(fsie.more), buf(fsie.buf)
+{
+    const ofp_stats_reply* osr = (const ofp_stats_reply*) fsie.get_ofp_msg();
+    size_t flow_len = ntohs(osr->header.length) - sizeof *osr;
+    const ofp_flow_stats* ofs = (const ofp_flow_stats*) osr->body;
+    while (flow_len >= sizeof *ofs) {
+        size_t length = ntohs(ofs->length);
+        if (length < sizeof *ofs || length > flow_len) {
+            break;
+        }
+        if (filter.empty() || filter(*ofs)) {
+            flows.push_back(ofs);
+        }
+        ofs = (const ofp_flow_stats*)((const char*) ofs + length);
+        flow_len -= length;
+    }
+}
+
+/* Returns the number of actions of the 'i'th flow. */
+size_t
+Flow_stats_chunk::n_actions(size_t i) const
+{
+    return ((ntohs(flows[i]->length) - sizeof *flows[i])
+            / sizeof(ofp_action_header));
+}
+
+Flow_match_filter::Flow_match_filter(const ofp_match& match_,
+                                     uint8_t table_id_)
+    : match(match_), table_id(table_id_)
+{
+}
+
+/* Returns whether a field whose wildcard bit is 'bit' is matched by a flow
+ * with 'flow_wildcards', given that the values are 'equal'. */
+static bool
+field_matches(uint32_t wildcards, uint32_t flow_wildcards, uint32_t bit,
+              bool equal)
+{
+    return (wildcards & bit) || (!(flow_wildcards & bit) && equal);
+}
+
+/* Likewise for an IP address field, whose wildcards are a count of low-order
+ * bits at 'shift'. */
+static bool
+nw_matches(uint32_t wildcards, uint32_t flow_wildcards, int shift,
+           uint32_t nw, uint32_t flow_nw)
+{
+    uint32_t n_wild = std::min((wildcards >> shift) & 0x3f, 32u);
+    uint32_t flow_n_wild = std::min((flow_wildcards >> shift) & 0x3f, 32u);
+    if (flow_n_wild > n_wild) {
+        return false;
+    }
+    uint32_t mask = n_wild >= 32 ? 0 : ~0u << n_wild;
+    return !((ntohl(nw) ^ ntohl(flow_nw)) & mask);
+}
+
+bool
+Flow_match_filter::operator()(const ofp_flow_stats& fs) const
+{
+    if (table_id != 0xff && fs.table_id != table_id) {
+        return false;
+    }
+
+    const ofp_match& m = fs.match;
+    uint32_t w = ntohl(match.wildcards);
+    uint32_t fw = ntohl(m.wildcards);
+    return (field_matches(w, fw, OFPFW_IN_PORT, m.in_port == match.in_port)
+            && field_matches(w, fw, OFPFW_DL_VLAN, m.dl_vlan == match.dl_vlan)
+            && field_matches(w, fw, OFPFW_DL_SRC,
+                             !memcmp(m.dl_src, match.dl_src, OFP_ETH_ALEN))
+            && field_matches(w, fw, OFPFW_DL_DST,
+                             !memcmp(m.dl_dst, match.dl_dst, OFP_ETH_ALEN))
+            && field_matches(w, fw, OFPFW_DL_TYPE, m.dl_type == match.dl_type)
+            && field_matches(w, fw, OFPFW_NW_PROTO,
+                             m.nw_proto == match.nw_proto)
+            && field_matches(w, fw, OFPFW_TP_SRC, m.tp_src == match.tp_src)
+            && field_matches(w, fw, OFPFW_TP_DST, m.tp_dst == match.tp_dst)
+            && field_matches(w, fw, OFPFW_DL_VLAN_PCP,
+                             m.dl_vlan_pcp == match.dl_vlan_pcp)
+            && field_matches(w, fw, OFPFW_NW_TOS, m.nw_tos == match.nw_tos)
+            && nw_matches(w, fw, OFPFW_NW_SRC_SHIFT, match.nw_src, m.nw_src)
+            && nw_matches(w, fw, OFPFW_NW_DST_SHIFT, match.nw_dst, m.nw_dst));
+}
+
+} // namespace applications
+} // namespace vigil
@@ -25,6 +25,16 @@ using namespace vigil;
 using namespace vigil::applications;
 %}
 
+/* The constructor sets a Python error, and starts no fetch, if a callback
+ * is not callable.  Raise it rather than return the unusable proxy. */
+%exception vigil::applications::Flow_fetcher_proxy::Flow_fetcher_proxy {
+    $action
+    if (PyErr_Occurred()) {
+        delete result;
+        SWIG_fail;
+    }
+}
+
 %include "flow_fetcher_proxy.hh"
 
 %pythoncode
@@ -85,13 +95,25 @@ using namespace vigil::applications;
     # Component subclass's install method:
     #   ffa = self.resolve(flow_fetcher_app)
     #
+    # If 'chunk_cb' is given, the flows are not collected: instead, each
+    # reply's flows are passed to 'chunk_cb' as a tuple as soon as it
+    # arrives, and get_flows() returns nothing.  This keeps switches with
+    # large flow tables from being held in memory all at once.
+    #
+    # If 'filter' is given, only the flows it selects are kept or passed
+    # to 'chunk_cb'.  It takes the same form as 'request', e.g.
+    #   {'table_id': 0, 'match': {'dl_type': 0x0800, 'nw_proto': 6}}
+    # and selects the flows that the switch would select for it, so that
+    # a broad request can be narrowed down without another round trip.
+    #
     # See test.py in this directory for example usage.
-    def fetch(self, dpid, request, cb):
-      return flow_fetcher(self.ctxt, dpid, request, cb)
+    def fetch(self, dpid, request, cb, chunk_cb=None, filter=None):
+      return flow_fetcher(self.ctxt, dpid, request, cb, chunk_cb, filter)
 
   class flow_fetcher:
-    def __init__(self, ctxt, dpid, request, cb):
-      self.pff = Flow_fetcher_proxy(ctxt, dpid, request, cb)
+    def __init__(self, ctxt, dpid, request, cb, chunk_cb=None, filter=None):
+      self.pff = Flow_fetcher_proxy(ctxt, dpid, request, cb, chunk_cb,
+                                    filter)
 
     def cancel(self):
       self.pff.cancel()
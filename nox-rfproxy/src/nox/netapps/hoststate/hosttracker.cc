@@ -8,7 +8,7 @@ namespace vigil
   Host_location_event::Host_location_event(const ethernetaddr host_,
 					   const list<hosttracker::location> loc_,
 					   enum type type_):
-    Event(static_get_name()), host(host_), eventType(type_)
+    Event(event_type<Host_location_event>()), host(host_), eventType(type_)
   {
     for (list<hosttracker::location>::const_iterator i = loc_.begin();
 	 i != loc_.end(); i++)
@@ -247,7 +247,7 @@ namespace vigil
 
     /** For use within python.
      */
-    Host_location_event() : Event(static_get_name()) 
+    Host_location_event() : Event(event_type<Host_location_event>()) 
     { }
 
     /** Static name required in NOX.
@@ -14,6 +14,7 @@
  *   limitations under the License.
  */
 #include <boost/bind.hpp>
+#include <algorithm>
 #include <map>
 #include "assert.hh"
 #include "component.hh"
@@ -25,6 +26,8 @@
 #include "jsonmessenger.hh"
 #include "timeval.hh"
 #include "netinet++/datapathid.hh"
+#include "networkstate/linkload.hh"
+#include "networkstate/switchrtt.hh"
 #include "stats_stream.hh"
 #include <sys/types.h>
 #include <stdlib.h>
@@ -46,6 +49,10 @@ using std::string;
 Vlog_module lg("jsonstats");
 
 const uint32_t DEFAULT_RESPONSE_TIMEOUT = 500; /* milliseconds */
+const time_t DEFAULT_HISTORY_WINDOW = 3600; /* seconds */
+const time_t MAX_HISTORY_WINDOW = 7 * 24 * 3600; /* seconds */
+const size_t HISTORY_MAX_BUCKETS = 60; /* per tier of a series */
+const double HISTORY_PERCENTILE = 99;
 
 /*
  * This NOX app recieves requests for statistics using jsonmessenger.
@@ -56,8 +63,11 @@ class JSONStats: public Component {
   int response_timeout_;
   hash_map<datapathid,vector<Port> > datapaths_;
   Stats_stream *streams_[SPRT_MAX];
+  linkload *linkload_;
+  switchrtt *switchrtt_;
 public:
-  JSONStats(const Context *c, const json_object*) : Component(c) {
+  JSONStats(const Context *c, const json_object*)
+      : Component(c), linkload_(NULL), switchrtt_(NULL) {
     int i;
     for (i = 0; i < SPRT_MAX; ++i)
       streams_[i] = NULL;
@@ -72,6 +82,8 @@ public:
   void request_port_stats();
   void finalise_stream(int request);
   void add_client(stats_pkt_request_type request, Msg_stream *sock);
+  void send_history(stats_pkt_request_type request, Msg_stream *sock,
+                    time_t window);
   void copy_port_information(struct vector<Port> &ports,
                              const Datapath_join_event& dj);
 
@@ -81,18 +93,6 @@ public:
   Disposition handle_json_event(const Event& e);
 };
 
-void create_port_stats_request(ofp_stats_request *osr, size_t size) {
-  osr->header.type = OFPT_STATS_REQUEST;
-  osr->header.version = OFP_VERSION;
-  osr->header.length = htons(size);
-  osr->header.xid = htonl(0);
-  osr->type = htons(OFPST_PORT);
-  osr->flags = htons(0);
-
-  struct ofp_port_stats_request *psr = (ofp_port_stats_request *)(osr->body);
-  psr->port_no = htons(OFPP_NONE);
-}
-
 /**
  * TODO: Extract configuration items from config object
  *
@@ -101,6 +101,8 @@ void create_port_stats_request(ofp_stats_request *osr, size_t size) {
  * - response timeout value
  */
 void JSONStats::configure(const Configuration* config) {
+  resolve(linkload_);
+  resolve(switchrtt_);
 }
 
 void JSONStats::install() {
@@ -117,18 +119,16 @@ void JSONStats::install() {
 
 /**
  * Note: We don't check to see if each datapath will support the stats request.
+ *
+ * Requests go through linkload, which does not send one to a datapath that
+ * has a request in flight already (e.g. its own periodic probe); the reply to
+ * that request serves us too.
  */
 void JSONStats::request_port_stats() {
-  size_t msize = sizeof(ofp_stats_request) + sizeof(ofp_port_stats_request);
-  boost::shared_array<uint8_t> raw_sr(new uint8_t[msize]);
-  ofp_stats_request *osr = (ofp_stats_request *)raw_sr.get();
-  create_port_stats_request(osr, msize);
-
-  /* Send OpenFlow Stats Request to all registered datapaths. */
   hash_map<datapathid,vector<Port> >::iterator iter;
   for (iter = datapaths_.begin(); iter != datapaths_.end(); ++iter) {
-    VLOG_DBG(lg, "Sent ofp_stats-request to 0x%lx", iter->first.as_host());
-    send_openflow_command(iter->first, &osr->header, false);
+    VLOG_DBG(lg, "Requesting ofp_port_stats from 0x%lx", iter->first.as_host());
+    linkload_->request_port_stats(iter->first);
   }
 }
 
@@ -347,6 +347,111 @@ void JSONStats::add_client(stats_pkt_request_type request,
   streams_[request]->add(sock);
 }
 
+/**
+ * get_window():
+ *
+ * Returns the "window" of a history request, or the default if it has none,
+ * at most MAX_HISTORY_WINDOW.
+ */
+time_t get_window(json_dict *jdict) {
+  json_dict::iterator i = jdict->find("window");
+  if (i != jdict->end() && i->second->type == json_object::JSONT_INTEGER &&
+      *(int *)i->second->object > 0)
+    return std::min((time_t) *(int *)i->second->object, MAX_HISTORY_WINDOW);
+  return DEFAULT_HISTORY_WINDOW;
+}
+
+/**
+ * write_series():
+ *
+ * Writes the min/avg/max and 99th percentile of a series over the window,
+ * if it has values in it, followed by its latest HISTORY_MAX_BUCKETS buckets
+ * of each tier.
+ */
+template<typename Key>
+void write_series(std::ostream& oss, const timeseries<Key>& series,
+                  const Key& key, time_t now, time_t window) {
+  typename timeseries<Key>::summary s;
+  oss << "{";
+  if (series.summarize(key, now, window, HISTORY_PERCENTILE, s)) {
+    oss << "\"count\":" << s.count << ",";
+    oss << "\"min\":" << s.min << ",";
+    oss << "\"avg\":" << s.avg << ",";
+    oss << "\"max\":" << s.max << ",";
+    oss << "\"p99\":" << s.percentile << ",";
+  }
+  oss << "\"history\":";
+  series.write_json(key, oss, now, window, HISTORY_MAX_BUCKETS);
+  oss << "}";
+}
+
+/**
+ * send_history():
+ *
+ * Replies at once with the history of switch RTT (in ms), or of the load of
+ * each port (in bytes/s), over the last 'window' seconds.  Nothing needs to
+ * be fetched from the datapaths, so the reply is not shared with other
+ * clients, which may ask for other windows.  The whole reply is built in
+ * memory and then sent in one message, as for the other requests; the caps
+ * on window and buckets per series keep it to a bounded size per series.
+ */
+void JSONStats::send_history(stats_pkt_request_type request,
+                             Msg_stream *sock, time_t window) {
+  Stats_stream stream(0, request);
+  std::ostringstream& oss = stream.msg;
+  time_t now = time(NULL);
+
+  if (request == SPRT_SWITCH_RTT) {
+    timeseries<uint64_t>::const_iterator iter;
+    for (iter = switchrtt_->rttHistory.begin();
+         iter != switchrtt_->rttHistory.end(); ++iter) {
+      if (stream.appending)
+        oss << ",";
+      else
+        stream.appending = 1;
+
+      oss << "{\"datapath_id\":\"" << iter->first << "\",\"rtt\":";
+      write_series(oss, switchrtt_->rttHistory, iter->first, now, window);
+      oss << "}";
+    }
+  } else {
+    hash_map<datapathid,vector<Port> >::iterator map_iter;
+    for (map_iter = datapaths_.begin(); map_iter != datapaths_.end();
+         ++map_iter) {
+      if (stream.appending)
+        oss << ",";
+      else
+        stream.appending = 1;
+
+      oss << "{\"datapath_id\":\"" << map_iter->first.as_host() << "\",";
+      oss << "\"ports\":[";
+
+      int appending_port = 0;
+      vector<Port>::iterator port_iter = map_iter->second.begin();
+      for (; port_iter != map_iter->second.end(); ++port_iter) {
+        if (port_iter->port_no >= OFPP_MAX)
+          continue;
+
+        if (appending_port)
+          oss << ",";
+        else
+          appending_port = 1;
+
+        linkload::switchport sp(map_iter->first, port_iter->port_no);
+        oss << "{\"port_no\":" << port_iter->port_no << ",\"tx\":";
+        write_series(oss, linkload_->txHistory, sp, now, window);
+        oss << ",\"rx\":";
+        write_series(oss, linkload_->rxHistory, sp, now, window);
+        oss << "}";
+      }
+      oss << "]}";
+    }
+  }
+
+  stream.add(sock);
+  stream.send_to_clients();
+}
+
 /**
  * handle_json_event():
  *
@@ -357,6 +462,10 @@ void JSONStats::add_client(stats_pkt_request_type request,
  *   "command":"features_request"
  *   // OR
  *   "command":"port_stats_request"
+ *   // OR, with an optional "window" in seconds (default 3600, at most a week)
+ *   "command":"switch_rtt_request"
+ *   // OR, likewise
+ *   "command":"link_load_request"
  * }
  */
 Disposition JSONStats::handle_json_event(const Event& e) {
@@ -388,6 +497,12 @@ Disposition JSONStats::handle_json_event(const Event& e) {
       } else if (strncmp(((string *)i->second->object)->c_str(),
                  "port_stats_request", strlen("port_stats_request")) == 0) {
         add_client(SPRT_PORT_STATS, jme.sock);
+      } else if (strncmp(((string *)i->second->object)->c_str(),
+                 "switch_rtt_request", strlen("switch_rtt_request")) == 0) {
+        send_history(SPRT_SWITCH_RTT, jme.sock, get_window(jdict));
+      } else if (strncmp(((string *)i->second->object)->c_str(),
+                 "link_load_request", strlen("link_load_request")) == 0) {
+        send_history(SPRT_LINK_LOAD, jme.sock, get_window(jdict));
       }
     }
   }
@@ -28,6 +28,12 @@ Stats_stream::Stats_stream(int num_datapaths, stats_pkt_request_type type) {
     case SPRT_PORT_STATS:
       response_string = "port_stats";
       break;
+    case SPRT_SWITCH_RTT:
+      response_string = "switch_rtt";
+      break;
+    case SPRT_LINK_LOAD:
+      response_string = "link_load";
+      break;
     default:
       response_string = "unexpected_type";
       break;
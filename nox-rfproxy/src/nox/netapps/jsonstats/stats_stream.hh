@@ -21,6 +21,8 @@
 enum stats_pkt_request_type {
   SPRT_FEATURES,
   SPRT_PORT_STATS,
+  SPRT_SWITCH_RTT,
+  SPRT_LINK_LOAD,
   SPRT_MAX
 };
 
@@ -69,29 +69,26 @@ namespace vigil
 
   void lavi_swlinks::send_list(const Msg_stream& stream, const link_filters& filters)
   {
-    swlink* link;
     list<swlink> linklist;
+    Topology::SnapshotPtr snapshot = topo->get_snapshot();
 
     hash_map<uint64_t, Datapath_join_event>::const_iterator i = dpm->dp_events.begin();
     //Loop through switches
     while (i != dpm->dp_events.end())
     {
-      const Topology::DatapathLinkMap dlm = topo->get_outlinks(i->second.datapath_id);
-      Topology::DatapathLinkMap::const_iterator j = dlm.begin();
-      //Loop through switch on the other end
-      while (j != dlm.end())
+      uint32_t src;
+      if (snapshot->find(i->second.datapath_id, src))
       {
-	Topology::LinkSet::const_iterator k = j->second.begin();
-	//Loop through links between switches
-	while( k != j->second.end())
+	Topology::Snapshot::LinkRange links = snapshot->get_outlinks(src);
+	//Loop through links to switches on the other end
+	for (Topology::Snapshot::LinkIterator k = links.first;
+	     k != links.second; k++)
 	{
-	  link = new swlink("switch", i->second.datapath_id, k->src, 
-			    "switch", j->first, k->dst);
-	  if (match(filters, *link))
-	    linklist.push_back(*link);
-	  k++;
+	  swlink link("switch", i->second.datapath_id, k->ports.src,
+		      "switch", snapshot->get_datapath(k->dst), k->ports.dst);
+	  if (match(filters, link))
+	    linklist.push_back(link);
 	}
-	j++;
       }
       i++;
     }
@@ -0,0 +1,87 @@
+#include "linkload.hh"
+#include <algorithm>
+#include <math.h>
+
+namespace vigil
+{
+  bool linkload::history::add_sample(const Port_stats& newstat,
+				     const timeval& now)
+  {
+    timeval elapsed = now;
+    elapsed -= lastTime;
+    long int msecs = timeval_to_ms(elapsed);
+    if (msecs <= 0)
+      return false;
+
+    //Counters going back mean the port was reset: start over from them
+    bool added = false;
+    if (newstat.tx_bytes >= txBytes && newstat.rx_bytes >= rxBytes &&
+	newstat.tx_packets >= txPackets && newstat.rx_packets >= rxPackets)
+    {
+      sample& s = ring[next];
+      s.txBytes = newstat.tx_bytes - txBytes;
+      s.rxBytes = newstat.rx_bytes - rxBytes;
+      s.txPackets = min(newstat.tx_packets - txPackets,
+			(uint64_t) UINT32_MAX);
+      s.rxPackets = min(newstat.rx_packets - rxPackets,
+			(uint64_t) UINT32_MAX);
+      s.msecs = msecs;
+
+      next = (next + 1) % LINKLOAD_HISTORY;
+      if (count < LINKLOAD_HISTORY)
+	count++;
+      added = true;
+    }
+
+    txBytes = newstat.tx_bytes;
+    rxBytes = newstat.rx_bytes;
+    txPackets = newstat.tx_packets;
+    rxPackets = newstat.rx_packets;
+    lastTime = now;
+    return added;
+  }
+
+  void linkload::history::get_rate(time_t window, double& txRate,
+				   double& rxRate) const
+  {
+    //Samples that end within window, and at least the latest
+    uint64_t txSum = 0, rxSum = 0, msecs = 0;
+    for (uint32_t j = 0; j < count; j++)
+    {
+      if (j != 0 && msecs >= (uint64_t) window * 1000)
+	break;
+      const sample& s = latest(j);
+      txSum += s.txBytes;
+      rxSum += s.rxBytes;
+      msecs += s.msecs;
+    }
+
+    txRate = (double) txSum * 1000 / msecs;
+    rxRate = (double) rxSum * 1000 / msecs;
+  }
+
+  double linkload::history::get_rate_percentile(time_t window,
+						double percentile,
+						bool tx) const
+  {
+    vector<double> rates;
+    uint64_t msecs = 0;
+    for (uint32_t j = 0; j < count; j++)
+    {
+      if (j != 0 && msecs >= (uint64_t) window * 1000)
+	break;
+      const sample& s = latest(j);
+      rates.push_back((double) (tx ? s.txBytes : s.rxBytes) * 1000 / s.msecs);
+      msecs += s.msecs;
+    }
+
+    //Nearest rank
+    sort(rates.begin(), rates.end());
+    double rank = ceil(percentile / 100 * rates.size());
+    if (rank < 1)
+      rank = 1;
+    else if (rank > rates.size())
+      rank = rates.size();
+    return rates[(size_t) rank - 1];
+  }
+}
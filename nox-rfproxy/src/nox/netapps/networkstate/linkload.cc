@@ -4,6 +4,7 @@
 #include "datapath-leave.hh"
 #include "openflow-pack.hh"
 #include <boost/bind.hpp>
+#include <stdlib.h>
 
 namespace vigil
 {
@@ -33,8 +34,6 @@ namespace vigil
   
   void linkload::install()
   {
-    dpi = dpmem->dp_events.begin();
-
     post(boost::bind(&linkload::stat_probe, this), get_next_time());
   }
 
@@ -42,20 +41,42 @@ namespace vigil
   {
     if (dpmem->dp_events.size() != 0)
     {
-      if (dpi == dpmem->dp_events.end())
+      //Go on from switch probed last, which may have left since
+      hash_map<uint64_t,Datapath_join_event>::const_iterator dpi = \
+	dpmem->dp_events.find(lastProbed);
+      if (dpi == dpmem->dp_events.end() || ++dpi == dpmem->dp_events.end())
 	dpi = dpmem->dp_events.begin();
-      
+      lastProbed = dpi->first;
+
       VLOG_DBG(lg, "Send probe to %"PRIx64"",
 	       dpi->second.datapath_id.as_host());
 
-      send_stat_req(dpi->second.datapath_id);
-
-      dpi++;
+      request_port_stats(dpi->second.datapath_id);
     }
 
     post(boost::bind(&linkload::stat_probe, this), get_next_time());
   }
 
+  void linkload::request_port_stats(const datapathid& dpid)
+  {
+    timeval now = do_gettimeofday();
+    hash_map<datapathid, timeval>::iterator i = requests.find(dpid);
+    if (i != requests.end())
+    {
+      timeval age = now;
+      age -= i->second;
+      if (age < make_timeval(LINKLOAD_REQUEST_TIMEOUT, 0))
+      {
+	VLOG_DBG(lg, "Port stats request to %"PRIx64" already in flight",
+		 dpid.as_host());
+	return;
+      }
+    }
+
+    requests[dpid] = now;
+    send_stat_req(dpid);
+  }
+
   float linkload::get_link_load_ratio(datapathid dpid, uint16_t port, bool tx)
   {
     uint32_t speed = dpmem->get_link_speed(dpid, port);
@@ -75,12 +96,39 @@ namespace vigil
 
   linkload::load linkload::get_link_load(datapathid dpid, uint16_t port)
   {
-    hash_map<switchport, load>::iterator i = \
-      loadmap.find(switchport(dpid, port));
-    if (i == loadmap.end())
+    hash_map<switchport, history>::iterator i = \
+      histories.find(switchport(dpid, port));
+    if (i == histories.end() || i->second.count == 0)
       return load(0,0,0);
-    else
-      return i->second;
+
+    const sample& s = i->second.latest(0);
+    time_t interval = (s.msecs + 500) / 1000;
+    return load(s.txBytes, s.rxBytes, interval == 0 ? 1 : interval);
+  }
+
+  bool linkload::get_rate(datapathid dpid, uint16_t port, time_t window,
+			  double& txRate, double& rxRate)
+  {
+    hash_map<switchport, history>::iterator i = \
+      histories.find(switchport(dpid, port));
+    if (i == histories.end() || i->second.count == 0)
+      return false;
+
+    i->second.get_rate(window, txRate, rxRate);
+    return true;
+  }
+
+  bool linkload::get_rate_percentile(datapathid dpid, uint16_t port,
+				     time_t window, double percentile,
+				     double& rate, bool tx)
+  {
+    hash_map<switchport, history>::iterator i = \
+      histories.find(switchport(dpid, port));
+    if (i == histories.end() || i->second.count == 0)
+      return false;
+
+    rate = i->second.get_rate_percentile(window, percentile, tx);
+    return true;
   }
 
   void linkload::send_stat_req(const datapathid& dpid, uint16_t port)
@@ -91,25 +139,29 @@ namespace vigil
     of_stats_request osr(openflow_pack::header(OFPT_STATS_REQUEST, size),
 			 OFPST_PORT, 0); 
     of_port_stats_request opsr;
-    opsr.port_no = OFPP_NONE;
+    opsr.port_no = port;
 
     osr.pack((ofp_stats_request*) openflow_pack::get_pointer(of_raw));
     opsr.pack((ofp_port_stats_request*) openflow_pack::get_pointer(of_raw, sizeof(ofp_stats_request)));
 
-    send_openflow_command(dpi->second.datapath_id,of_raw, false);
+    send_openflow_command(dpid, of_raw, false);
   }
 
   timeval linkload::get_next_time()
   {
-    timeval tv = {0,0};
-    if (dpmem->dp_events.size() == 0)
-      tv.tv_sec = load_interval;
-    else
-      tv.tv_sec = load_interval/dpmem->dp_events.size();
+    //Spread probes evenly over interval, jittered either way
+    double spacing = (double) load_interval;
+    if (dpmem->dp_events.size() != 0)
+      spacing /= dpmem->dp_events.size();
+    double jitter = (double) rand() / RAND_MAX;
+    spacing *= 1 + (2 * jitter - 1) * LINKLOAD_JITTER / 100;
 
-    if (tv.tv_sec == 0)
-      tv.tv_sec = 1;
+    if (spacing < 0.001)
+      spacing = 0.001;
 
+    timeval tv;
+    tv.tv_sec = (time_t) spacing;
+    tv.tv_usec = (suseconds_t) ((spacing - tv.tv_sec) * 1000000);
     return tv;
   }
 
@@ -117,17 +169,13 @@ namespace vigil
   {
     const Port_status_event& pse = assert_cast<const Port_status_event&>(e);
 
-    hash_map<switchport, Port_stats>::iterator swstat = \
-      statmap.find(switchport(pse.datapath_id, pse.port.port_no));
-    if (swstat != statmap.end() &&
-	pse.reason == OFPPR_DELETE)
-      statmap.erase(swstat);
-
-    hash_map<switchport, load>::iterator swload = \
-      loadmap.find(switchport(pse.datapath_id, pse.port.port_no));
-    if (swload != loadmap.end() &&
-	pse.reason == OFPPR_DELETE)
-      loadmap.erase(swload);
+    if (pse.reason == OFPPR_DELETE)
+    {
+      switchport sp(pse.datapath_id, pse.port.port_no);
+      histories.erase(sp);
+      txHistory.erase(sp);
+      rxHistory.erase(sp);
+    }
 
     return CONTINUE;
   }
@@ -136,23 +184,20 @@ namespace vigil
   {
     const Datapath_leave_event& dle = assert_cast<const Datapath_leave_event&>(e);
 
-    hash_map<switchport, Port_stats>::iterator swstat = statmap.begin();
-    while (swstat != statmap.end())
+    hash_map<switchport, history>::iterator swhist = histories.begin();
+    while (swhist != histories.end())
     {
-      if (swstat->first.dpid == dle.datapath_id)
-	swstat = statmap.erase(swstat);
+      if (swhist->first.dpid == dle.datapath_id)
+      {
+	txHistory.erase(swhist->first);
+	rxHistory.erase(swhist->first);
+	swhist = histories.erase(swhist);
+      }
       else
-	swstat++;
+	swhist++;
     }
 
-    hash_map<switchport, load>::iterator swload = loadmap.begin();
-    while (swload != loadmap.end())
-    {
-      if (swload->first.dpid == dle.datapath_id)
-	swload = loadmap.erase(swload);
-      else
-	swload++;
-    }
+    requests.erase(dle.datapath_id);
 
     return CONTINUE;
   }
@@ -162,42 +207,37 @@ namespace vigil
   {
     const Port_stats_in_event& psie = assert_cast<const Port_stats_in_event&>(e);
 
+    //Request is answered with its last reply
+    const ofp_stats_reply* osr = (const ofp_stats_reply*) psie.get_ofp_msg();
+    if (osr == NULL || !(ntohs(osr->flags) & OFPSF_REPLY_MORE))
+      requests.erase(psie.datapath_id);
+
+    timeval now = do_gettimeofday();
     vector<Port_stats>::const_iterator i = psie.ports.begin();
     while (i != psie.ports.end())
     {
-      hash_map<switchport, Port_stats>::iterator swstat = \
-	statmap.find(switchport(psie.datapath_id, i->port_no));
-      if (swstat != statmap.end())
+      hash_map<switchport, history>::iterator swhist = \
+	histories.find(switchport(psie.datapath_id, i->port_no));
+      if (swhist != histories.end())
       {
-	updateLoad(psie.datapath_id, i->port_no,
-		   swstat->second, *i);
-	statmap.erase(swstat);
+	if (swhist->second.add_sample(*i, now))
+	{
+	  const sample& s = swhist->second.latest(0);
+	  txHistory.record(swhist->first, now.tv_sec,
+			   (double) s.txBytes * 1000 / s.msecs);
+	  rxHistory.record(swhist->first, now.tv_sec,
+			   (double) s.rxBytes * 1000 / s.msecs);
+	}
       }
-      statmap.insert(make_pair(switchport(psie.datapath_id, i->port_no),
-			       Port_stats(*i)));
+      else
+	histories.insert(make_pair(switchport(psie.datapath_id, i->port_no),
+				   history(*i, now)));
       i++;
     }
 
     return CONTINUE;
   }
 
-
-  void linkload::updateLoad(const datapathid& dpid, uint16_t port,
-			    const Port_stats& oldstat,
-			    const Port_stats& newstat)
-  {
-    hash_map<switchport, load>::iterator i = \
-      loadmap.find(switchport(dpid, port));
-    
-    if (i != loadmap.end())
-      loadmap.erase(i);
-
-    loadmap.insert(make_pair(switchport(dpid, port),
-			     load(newstat.tx_bytes-oldstat.tx_bytes,
-				  newstat.rx_bytes-oldstat.rx_bytes,
-				  load_interval)));
-  }
-
   void linkload::getInstance(const Context* c,
 				  linkload*& component)
   {
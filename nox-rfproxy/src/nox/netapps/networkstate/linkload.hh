@@ -25,7 +25,10 @@
 #include "network_graph.hh"
 #include "netinet++/datapathid.hh"
 #include "datapathmem.hh"
+#include "timeseries.hh"
+#include "timeval.hh"
 #include <boost/shared_array.hpp>
+#include <vector>
 
 #ifdef LOG4CXX_ENABLED
 #include <boost/format.hpp>
@@ -38,6 +41,23 @@
  */
 #define LINKLOAD_DEFAULT_INTERVAL 60
 
+/**  Number of samples kept per port
+ */
+#define LINKLOAD_HISTORY 64
+
+/**  Spread of probe times around their schedule (in % of probe spacing)
+ */
+#define LINKLOAD_JITTER 20
+
+/**  Time after which a port stats request is assumed lost (in s)
+ */
+#define LINKLOAD_REQUEST_TIMEOUT 5
+
+/**  Number of 1 min and 1 h buckets of rate history kept per port
+ */
+#define LINKLOAD_HISTORY_MINUTES 180
+#define LINKLOAD_HISTORY_HOURS 168
+
 namespace vigil
 {
   using namespace std;
@@ -51,6 +71,19 @@ namespace vigil
    * interval, e.g.,
    * ./nox_core -i ptcp:6633 linkload=interval=10
    *
+   * Switches are probed one at a time, spread evenly over the
+   * interval with some jitter, so that polling hundreds of switches
+   * does not come in bursts.  Other components that want port stats
+   * should ask through request_port_stats(), which does not send a
+   * request to a switch that has one in flight: every requester sees
+   * the same reply as a Port_stats_in_event.
+   *
+   * For each port, the increase of its counters over each interval
+   * is kept as a fixed-size sample, in a ring of the last
+   * LINKLOAD_HISTORY samples.  The rates of the samples are also
+   * kept per minute and per hour in txHistory and rxHistory, which
+   * go back days in fixed memory.
+   *
    * @author ykk
    * @date February 2010
    */
@@ -62,10 +95,6 @@ namespace vigil
      */
     typedef vigil::network::switch_port switchport;
 
-    /** Hash map of switch/port to stats
-     */
-    hash_map<switchport, Port_stats> statmap;
-
     /** Load of switch/port (in bytes)
      */
     struct load
@@ -85,9 +114,108 @@ namespace vigil
       {}
     };
 
-    /** Hash map of switch/port to load
+    /** Increase of port counters over one interval
      */
-    hash_map<switchport, load> loadmap;
+    struct sample
+    {
+      /** Bytes transmitted
+       */
+      uint64_t txBytes;
+      /** Bytes received
+       */
+      uint64_t rxBytes;
+      /** Packets transmitted
+       */
+      uint32_t txPackets;
+      /** Packets received
+       */
+      uint32_t rxPackets;
+      /** Length of interval (in ms)
+       */
+      uint32_t msecs;
+    };
+
+    /** Counters of switch/port and ring of latest samples
+     */
+    struct history
+    {
+      /** Bytes transmitted at last reply
+       */
+      uint64_t txBytes;
+      /** Bytes received at last reply
+       */
+      uint64_t rxBytes;
+      /** Packets transmitted at last reply
+       */
+      uint64_t txPackets;
+      /** Packets received at last reply
+       */
+      uint64_t rxPackets;
+      /** Time of last reply
+       */
+      timeval lastTime;
+      /** Samples, oldest first from index next (when full)
+       */
+      sample ring[LINKLOAD_HISTORY];
+      /** Index of next sample to write
+       */
+      uint32_t next;
+      /** Number of samples
+       */
+      uint32_t count;
+
+      history(const Port_stats& last, const timeval& lastTime_):
+	txBytes(last.tx_bytes), rxBytes(last.rx_bytes),
+	txPackets(last.tx_packets), rxPackets(last.rx_packets),
+	lastTime(lastTime_), next(0), count(0)
+      {}
+
+      /** Get i-th latest sample (0 is latest)
+       */
+      const sample& latest(uint32_t i) const
+      {
+	return ring[(next + LINKLOAD_HISTORY - 1 - i) % LINKLOAD_HISTORY];
+      }
+
+      /** Add sample of increase of counters since last reply.
+       *
+       * Counters going back mean the port was reset: no sample is
+       * added, and the next one starts from the new counters.
+       *
+       * @param newstat new port stats
+       * @param now time of new port stats
+       * @return true if a sample was added (as latest(0))
+       */
+      bool add_sample(const Port_stats& newstat, const timeval& now);
+
+      /** Get average rate of samples that end within window,
+       * and at least of the latest (count must not be 0).
+       * @param window length of window, back from latest sample (in s)
+       * @param txRate transmit rate (in bytes/s)
+       * @param rxRate receive rate (in bytes/s)
+       */
+      void get_rate(time_t window, double& txRate, double& rxRate) const;
+
+      /** Get nearest-rank percentile of rates of samples in window
+       * (count must not be 0).
+       * @param window length of window, back from latest sample (in s)
+       * @param percentile percentile (0 to 100)
+       * @param tx transmit rate (else receive rate)
+       * @return rate (in bytes/s)
+       */
+      double get_rate_percentile(time_t window, double percentile,
+				 bool tx) const;
+    };
+
+    /** Hash map of switch/port to history
+     */
+    hash_map<switchport, history> histories;
+    /** History of transmit rate of switch/port (in bytes/s)
+     */
+    timeseries<switchport> txHistory;
+    /** History of receive rate of switch/port (in bytes/s)
+     */
+    timeseries<switchport> rxHistory;
 
     /** Interval to query for load
      */
@@ -99,7 +227,10 @@ namespace vigil
      * @param node configuration (JSON object) 
      */
     linkload(const Context* c, const json_object* node)
-      : Component(c)
+      : Component(c),
+	txHistory(0, LINKLOAD_HISTORY_MINUTES, LINKLOAD_HISTORY_HOURS),
+	rxHistory(0, LINKLOAD_HISTORY_MINUTES, LINKLOAD_HISTORY_HOURS),
+	lastProbed(0)
     {}
     
     /** \brief Configure linkload.
@@ -115,6 +246,15 @@ namespace vigil
      */
     void stat_probe();
 
+    /** \brief Request port stats of all ports of switch.
+     *
+     * Does nothing if a request to the switch is in flight already.
+     * The reply comes as a Port_stats_in_event.
+     *
+     * @param dpid datapath id of switch
+     */
+    void request_port_stats(const datapathid& dpid);
+
     /** Get link load ratio.
      * @param dpid datapath id of switch
      * @param port port number
@@ -130,6 +270,33 @@ namespace vigil
      */
     load get_link_load(datapathid dpid, uint16_t port);
 
+    /** Get average rate over a window.
+     * @param dpid datapath id of switch
+     * @param port port number
+     * @param window length of window, back from latest sample (in s)
+     * @param txRate transmit rate (in bytes/s)
+     * @param rxRate receive rate (in bytes/s)
+     * @return false if port has no sample
+     */
+    bool get_rate(datapathid dpid, uint16_t port, time_t window,
+		  double& txRate, double& rxRate);
+
+    /** Get percentile of rate over a window.
+     *
+     * Percentile of the rates of the samples in the window, e.g.,
+     * 95 for the rate that 95% of the samples do not exceed.
+     *
+     * @param dpid datapath id of switch
+     * @param port port number
+     * @param window length of window, back from latest sample (in s)
+     * @param percentile percentile (0 to 100)
+     * @param rate rate (in bytes/s)
+     * @param tx transmit rate (else receive rate)
+     * @return false if port has no sample
+     */
+    bool get_rate_percentile(datapathid dpid, uint16_t port, time_t window,
+			     double percentile, double& rate, bool tx=true);
+
     /** \brief Handle port stats in
      * @param e port stats in event
      * @return CONTINUE
@@ -166,15 +333,19 @@ namespace vigil
     /** \brief Reference to datapath memory
      */
     datapathmem* dpmem;
-    /** Iterator for probing
+    /** Switch probed last (probing goes on from the next)
+     */
+    uint64_t lastProbed;
+
+    /** Hash map of switch to time of request in flight
      */
-    hash_map<uint64_t,Datapath_join_event>::const_iterator dpi;
+    hash_map<datapathid, timeval> requests;
 
     /** \brief Send port stats request for switch and port
      * @param dpid switch to send port stats request to
      * @param port port to request stats for
      */
-    void send_stat_req(const datapathid& dpid, uint16_t port=OFPP_ALL);
+    void send_stat_req(const datapathid& dpid, uint16_t port=OFPP_NONE);
 
     /** \brief Get next time to send probe
      *
@@ -184,16 +355,6 @@ namespace vigil
     /** \brief Memory for OpenFlow packet
      */
     boost::shared_array<uint8_t> of_raw;
-    /** \brief Update load map
-     * @param dpid switch to send port stats request to
-     * @param port port to request stats for
-     * @param oldstat old port stats
-     * @param newstat new port stats
-     */
-    void updateLoad(const datapathid& dpid, uint16_t port,
-		    const Port_stats& oldstat,
-		    const Port_stats& newstat);
-		    
   };
 }
 
@@ -12,7 +12,9 @@ namespace vigil
   static Vlog_module lg("switchrtt");
 
   switchrtt::switchrtt(const Context* c, const json_object* node)
-    : Component(c)
+    : Component(c), rttHistory(SWITCHRTT_HISTORY_SECONDS,
+			       SWITCHRTT_HISTORY_MINUTES,
+			       SWITCHRTT_HISTORY_HOURS)
   {
     of_raw.reset(new uint8_t[sizeof(ofp_header)]);
     openflow_pack::header(OFPT_ECHO_REQUEST, 
@@ -75,6 +77,16 @@ namespace vigil
     if (j != rtt.end())
       rtt.erase(j);
 
+    //Keep RTT history of the latest switches to leave only
+    departed.remove(dle.datapath_id.as_host());
+    departed.push_back(dle.datapath_id.as_host());
+    while (departed.size() > SWITCHRTT_HISTORY_DEPARTED)
+    {
+      if (dpmem->dp_events.find(departed.front()) == dpmem->dp_events.end())
+	rttHistory.erase(departed.front());
+      departed.pop_front();
+    }
+
     return CONTINUE;
   }
 
@@ -109,6 +121,8 @@ namespace vigil
 	    rtt.insert(make_pair(ome.datapath_id.as_host(),diff));
 	  else
 	    j->second = diff;
+	  rttHistory.record(ome.datapath_id.as_host(), now.tv_sec,
+			    diff.tv_sec*1000.0 + diff.tv_usec/1000.0);
 	  VLOG_DBG(lg, "Received echo reply (xid %"PRIx32\
 		   ") from switch %"PRIx64"",
 		   ofph.xid, ome.datapath_id.as_host());
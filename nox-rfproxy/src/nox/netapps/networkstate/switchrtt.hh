@@ -21,8 +21,10 @@
 #include "component.hh"
 #include "config.h"
 #include "networkstate/datapathmem.hh"
+#include "networkstate/timeseries.hh"
 #include "openflow/openflow.h"
 #include <boost/shared_array.hpp>
+#include <list>
 #include <time.h>
 
 #ifdef LOG4CXX_ENABLED
@@ -36,6 +38,16 @@
  */
 #define SWITCHRTT_DEFAULT_PROBE_INTERVAL 120 //2 mins
 
+/** Number of 1 s, 1 min and 1 h buckets of RTT history kept per switch
+ */
+#define SWITCHRTT_HISTORY_SECONDS 300
+#define SWITCHRTT_HISTORY_MINUTES 180
+#define SWITCHRTT_HISTORY_HOURS 168
+
+/** Number of departed switches whose RTT history is kept
+ */
+#define SWITCHRTT_HISTORY_DEPARTED 64
+
 namespace vigil
 {
   using namespace std;
@@ -64,6 +76,13 @@ namespace vigil
      * Indexed by datapath id in host order.
      */
     hash_map<uint64_t,timeval> rtt;
+    /** \brief History of RTT of switches (in ms)
+     *
+     * Indexed by datapath id in host order.  Kept after a switch
+     * leaves, for a look at what led up to it, for the last
+     * SWITCHRTT_HISTORY_DEPARTED switches to leave.
+     */
+    timeseries<uint64_t> rttHistory;
 
     /** \brief Constructor of switchrtt.
      *
@@ -100,7 +119,9 @@ namespace vigil
 
     /** \brief Handle datapath leave event.
      * 
-     * Remove state of departing datapath.
+     * Remove state of departing datapath, except its RTT history,
+     * and forget the RTT history of the switch that left longest ago
+     * (unless it has come back) beyond SWITCHRTT_HISTORY_DEPARTED.
      *
      * @param e datapath leave event
      * @return CONTINUE
@@ -124,6 +145,12 @@ namespace vigil
      * Tracks xid and send time.
      */
     hash_map<uint64_t,pair<uint32_t,timeval> > echoSent;
+    /** \brief Switches that left, oldest first
+     *
+     * Datapath ids in host order, of the switches whose RTT history
+     * is kept after they left.
+     */
+    list<uint64_t> departed;
     /** \brief Memory for OpenFlow packet
      */
     boost::shared_array<uint8_t> of_raw;
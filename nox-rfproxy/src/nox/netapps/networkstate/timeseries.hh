@@ -0,0 +1,296 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef timeseries_HH
+#define timeseries_HH
+
+#include "hash_map.hh"
+#include <algorithm>
+#include <math.h>
+#include <ostream>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+namespace vigil
+{
+  /** \brief timeseries: fixed-memory history of values, by key
+   *
+   * Each key (e.g., a datapath or a switch port) has one series of
+   * values, kept in three tiers of buckets of 1 s, 1 min and 1 h.
+   * A bucket holds the number, sum, minimum and maximum of the
+   * values recorded in its time; each tier is a ring of a fixed
+   * number of buckets, indexed by time, so that a series takes the
+   * same memory however many values are recorded.  A tier of no
+   * buckets is not kept.
+   *
+   * Percentiles are computed over bucket maxima, which is exact in a
+   * tier that records at most one value per bucket, and otherwise
+   * errs on the side of spikes.
+   */
+  template<typename Key>
+  class timeseries
+  {
+  public:
+    /** Number of tiers
+     */
+    static const int TIERS = 3;
+
+    /** Values recorded in one bucket's time
+     */
+    struct bucket
+    {
+      /** Start of bucket (in s since epoch, 0 if unused)
+       */
+      time_t start;
+      /** Number of values
+       */
+      uint32_t count;
+      /** Minimum value
+       */
+      float min;
+      /** Maximum value
+       */
+      float max;
+      /** Sum of values
+       */
+      double sum;
+    };
+
+    /** Summary of values over a window
+     */
+    struct summary
+    {
+      /** Number of values
+       */
+      uint32_t count;
+      /** Minimum value
+       */
+      double min;
+      /** Average value
+       */
+      double avg;
+      /** Maximum value
+       */
+      double max;
+      /** Requested percentile of (bucket maxima of) values
+       */
+      double percentile;
+      /** Resolution of tier summarized (in s)
+       */
+      time_t resolution;
+    };
+
+    typedef typename hash_map<Key, std::vector<bucket> >::const_iterator
+      const_iterator;
+
+    /** \brief Constructor.
+     * @param seconds number of 1 s buckets
+     * @param minutes number of 1 min buckets
+     * @param hours number of 1 h buckets
+     */
+    timeseries(size_t seconds, size_t minutes, size_t hours)
+    {
+      sizes[0] = seconds;
+      sizes[1] = minutes;
+      sizes[2] = hours;
+    }
+
+    /** Get resolution of tier (in s)
+     */
+    static time_t resolution(int tier)
+    {
+      return tier == 0 ? 1 : tier == 1 ? 60 : 3600;
+    }
+
+    /** \brief Record value.
+     * @param key key of series
+     * @param when time of value (in s since epoch)
+     * @param value value
+     */
+    void record(const Key& key, time_t when, double value)
+    {
+      std::vector<bucket>& buckets = series[key];
+      if (buckets.empty())
+      {
+	bucket empty = { 0, 0, 0, 0, 0 };
+	buckets.resize(sizes[0] + sizes[1] + sizes[2], empty);
+      }
+
+      size_t offset = 0;
+      for (int tier = 0; tier < TIERS; offset += sizes[tier++])
+      {
+	if (sizes[tier] == 0)
+	  continue;
+	time_t start = when - when % resolution(tier);
+	bucket& b = buckets[offset + (start / resolution(tier)) % sizes[tier]];
+	if (b.start != start)
+	{
+	  b.start = start;
+	  b.count = 0;
+	  b.sum = 0;
+	  b.min = b.max = value;
+	}
+	b.count++;
+	b.sum += value;
+	b.min = std::min(b.min, (float) value);
+	b.max = std::max(b.max, (float) value);
+      }
+    }
+
+    /** \brief Forget series.
+     * @param key key of series
+     */
+    void erase(const Key& key)
+    {
+      series.erase(key);
+    }
+
+    /** \brief Summarize values over a window.
+     *
+     * Uses the finest tier that spans the window, else the coarsest.
+     *
+     * @param key key of series
+     * @param now end of window (in s since epoch)
+     * @param window length of window (in s)
+     * @param percentile percentile to compute (0 to 100)
+     * @param s summary
+     * @return false if no value was recorded in window
+     */
+    bool summarize(const Key& key, time_t now, time_t window,
+		   double percentile, summary& s) const
+    {
+      const_iterator i = series.find(key);
+      if (i == series.end())
+	return false;
+
+      int tier = -1;
+      size_t offset = 0, tierOffset = 0;
+      for (int t = 0; t < TIERS; offset += sizes[t++])
+      {
+	if (sizes[t] == 0)
+	  continue;
+	tier = t;
+	tierOffset = offset;
+	if ((time_t) sizes[t] * resolution(t) >= window)
+	  break;
+      }
+      if (tier < 0)
+	return false;
+
+      std::vector<float> maxima;
+      double sum = 0;
+      s.count = 0;
+      s.resolution = resolution(tier);
+      for (size_t j = 0; j < sizes[tier]; j++)
+      {
+	const bucket& b = i->second[tierOffset + j];
+	if (b.count == 0 || !in_window(b, tier, now, window))
+	  continue;
+	if (s.count == 0 || b.min < s.min)
+	  s.min = b.min;
+	if (s.count == 0 || b.max > s.max)
+	  s.max = b.max;
+	s.count += b.count;
+	sum += b.sum;
+	maxima.push_back(b.max);
+      }
+      if (s.count == 0)
+	return false;
+
+      s.avg = sum / s.count;
+      std::sort(maxima.begin(), maxima.end());
+      size_t rank = (size_t) ceil(percentile / 100 * maxima.size());
+      s.percentile = maxima[rank == 0 ? 0 : std::min(rank, maxima.size()) - 1];
+      return true;
+    }
+
+    /** \brief Write series as JSON.
+     *
+     * Appends the buckets of each tier that fall in the window, oldest
+     * first and at most the latest maxBuckets of a tier, as
+     * <PRE>[{"resolution":1,"buckets":[[start,count,min,avg,max],...]},...]</PRE>
+     * to the text in 'os'.
+     *
+     * @param key key of series
+     * @param os output to append to
+     * @param now end of window (in s since epoch)
+     * @param window length of window (in s)
+     * @param maxBuckets maximum number of buckets written per tier
+     */
+    void write_json(const Key& key, std::ostream& os, time_t now,
+		    time_t window, size_t maxBuckets) const
+    {
+      const_iterator i = series.find(key);
+      os << "[";
+      size_t offset = 0;
+      bool appendingTier = false;
+      for (int tier = 0; tier < TIERS; offset += sizes[tier++])
+      {
+	if (sizes[tier] == 0)
+	  continue;
+	if (appendingTier)
+	  os << ",";
+	appendingTier = true;
+	os << "{\"resolution\":" << resolution(tier) << ",\"buckets\":[";
+
+	//Oldest bucket is the one after the current one
+	time_t current = now / resolution(tier);
+	size_t first = 1;
+	if (maxBuckets < sizes[tier])
+	  first = sizes[tier] - maxBuckets + 1;
+	bool appending = false;
+	for (size_t j = first; i != series.end() && j <= sizes[tier]; j++)
+	{
+	  const bucket& b = i->second[offset + (current + j) % sizes[tier]];
+	  if (b.count == 0 || !in_window(b, tier, now, window))
+	    continue;
+	  if (appending)
+	    os << ",";
+	  appending = true;
+	  os << "[" << b.start << "," << b.count << "," << b.min << ","
+	     << b.sum / b.count << "," << b.max << "]";
+	}
+	os << "]}";
+      }
+      os << "]";
+    }
+
+    /** Iterate over series (key is first)
+     */
+    const_iterator begin() const { return series.begin(); }
+    const_iterator end() const { return series.end(); }
+
+  private:
+    /** Number of buckets in each tier
+     */
+    size_t sizes[TIERS];
+    /** Buckets of each series, tier after tier
+     */
+    hash_map<Key, std::vector<bucket> > series;
+
+    /** Check if bucket overlaps window, i.e., (now - window, now]
+     */
+    static bool in_window(const bucket& b, int tier, time_t now,
+			  time_t window)
+    {
+      return b.start <= now && b.start + resolution(tier) > now - window + 1;
+    }
+  };
+}
+
+#endif
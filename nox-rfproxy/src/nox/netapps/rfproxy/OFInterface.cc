@@ -82,6 +82,7 @@ int add_action(uint8_t *buf, const Action& action) {
         case RFAT_PUSH_MPLS:
         case RFAT_POP_MPLS:
         case RFAT_SWAP_MPLS:
+        case RFAT_GOTO_TABLE:
             /* Not implemented in OpenFlow 1.0. */
         default:
             error = -1;
@@ -112,6 +113,8 @@ int add_option(ofp_flow_mod *ofm, const Option& option) {
         case RFOT_CT_ID:
             /* Ignore. */
             break;
+        case RFOT_TABLE:
+            /* OpenFlow 1.0 has a single table. */
         default:
             /* Unsupported Option. */
             error = -1;
@@ -146,6 +149,7 @@ size_t ofp_len(const Action& action) {
         case RFAT_PUSH_MPLS:
         case RFAT_POP_MPLS:
         case RFAT_SWAP_MPLS:
+        case RFAT_GOTO_TABLE:
             /* Not implemented in OpenFlow 1.0. */
         default:
             break;
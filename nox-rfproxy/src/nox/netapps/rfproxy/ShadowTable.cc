@@ -0,0 +1,281 @@
+/* Copyright 2012 (C) Victoria University of Waikato.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "fnv_hash.hh"
+#include "rfofmsg.hh"
+#include "ShadowTable.hh"
+
+/**
+ * Returns a mask of the bits of an IPv4 address that a match wildcard of
+ * 'bits' bits leaves to be matched, in host byte-order.
+ */
+static uint32_t nw_mask(uint32_t bits) {
+    return bits >= 32 ? 0 : ~((UINT32_C(1) << bits) - 1);
+}
+
+/**
+ * Build the key of a flow, keeping only the fields that its wildcards leave
+ * to be matched, so that the same flow hashes alike whether it comes from a
+ * FlowMod or from flow stats.
+ */
+ShadowTable::FlowKey ShadowTable::make_key(const ofp_match& match,
+                                           uint16_t priority) {
+    FlowKey key;
+    memset(&key, 0, sizeof key);
+
+    uint32_t wildcards = ntohl(match.wildcards) & OFPFW_ALL;
+    uint32_t src_bits = (wildcards & OFPFW_NW_SRC_MASK) >> OFPFW_NW_SRC_SHIFT;
+    uint32_t dst_bits = (wildcards & OFPFW_NW_DST_MASK) >> OFPFW_NW_DST_SHIFT;
+    src_bits = src_bits > 32 ? 32 : src_bits;
+    dst_bits = dst_bits > 32 ? 32 : dst_bits;
+    wildcards &= ~(OFPFW_NW_SRC_MASK | OFPFW_NW_DST_MASK);
+    wildcards |= src_bits << OFPFW_NW_SRC_SHIFT;
+    wildcards |= dst_bits << OFPFW_NW_DST_SHIFT;
+
+    ofp_match& m = key.match;
+    m.wildcards = htonl(wildcards);
+    if (!(wildcards & OFPFW_IN_PORT))
+        m.in_port = match.in_port;
+    if (!(wildcards & OFPFW_DL_SRC))
+        memcpy(m.dl_src, match.dl_src, OFP_ETH_ALEN);
+    if (!(wildcards & OFPFW_DL_DST))
+        memcpy(m.dl_dst, match.dl_dst, OFP_ETH_ALEN);
+    if (!(wildcards & OFPFW_DL_VLAN))
+        m.dl_vlan = match.dl_vlan;
+    if (!(wildcards & OFPFW_DL_VLAN_PCP))
+        m.dl_vlan_pcp = match.dl_vlan_pcp;
+    if (!(wildcards & OFPFW_DL_TYPE))
+        m.dl_type = match.dl_type;
+    if (!(wildcards & OFPFW_NW_TOS))
+        m.nw_tos = match.nw_tos;
+    if (!(wildcards & OFPFW_NW_PROTO))
+        m.nw_proto = match.nw_proto;
+    m.nw_src = match.nw_src & htonl(nw_mask(src_bits));
+    m.nw_dst = match.nw_dst & htonl(nw_mask(dst_bits));
+    if (!(wildcards & OFPFW_TP_SRC))
+        m.tp_src = match.tp_src;
+    if (!(wildcards & OFPFW_TP_DST))
+        m.tp_dst = match.tp_dst;
+
+    key.priority = priority;
+    return key;
+}
+
+bool ShadowTable::FlowKey::operator==(const FlowKey& other) const {
+    return memcmp(this, &other, sizeof *this) == 0;
+}
+
+size_t ShadowTable::FlowKeyHash::operator()(const FlowKey& key) const {
+    return vigil::fnv_hash(&key, sizeof key);
+}
+
+/**
+ * Build a FlowMod that deletes exactly the flow with the given key.
+ */
+ShadowTable::FlowMod ShadowTable::make_delete(const FlowKey& key) {
+    FlowMod raw(new uint8_t[sizeof(ofp_flow_mod)]);
+    ofp_flow_mod* ofm = reinterpret_cast<ofp_flow_mod*>(raw.get());
+    ofm_init(ofm, sizeof *ofm);
+    ofm->match = key.match;
+    ofm->priority = key.priority;
+    ofm_set_command(ofm, OFPFC_DELETE_STRICT);
+    return raw;
+}
+
+/**
+ * Start shadowing a datapath that has joined, keeping the shadow it had if it
+ * joined before.
+ */
+void ShadowTable::join(uint64_t dp_id) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    datapaths[dp_id].present = true;
+    departed.remove(dp_id);
+}
+
+/**
+ * Keep the shadow of a datapath that has left for when it joins again, and
+ * drop that of the datapath that left first if too many are kept.
+ *
+ * A reconcile still in progress for it is abandoned.
+ */
+void ShadowTable::leave(uint64_t dp_id) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vigil::hash_map<uint64_t, Datapath>::iterator dpi = datapaths.find(dp_id);
+    if (dpi == datapaths.end() || !dpi->second.present)
+        return;
+
+    Datapath& dp = dpi->second;
+    dp.present = false;
+    if (dp.reconciling) {
+        dp.reconciling = false;
+        ++dp.generation;
+    }
+
+    departed.push_back(dp_id);
+    while (departed.size() > max_departed) {
+        datapaths.erase(departed.front());
+        departed.pop_front();
+    }
+}
+
+/**
+ * Update the shadow of a datapath with a FlowMod that was sent to it.
+ *
+ * Only OFPFC_ADD and OFPFC_DELETE_STRICT, which are all that rfproxy sends,
+ * are shadowed, and only for datapaths that are shadowed already: a FlowMod
+ * that was sent just before its datapath was forgotten does not bring the
+ * shadow back with that single flow in it.
+ */
+void ShadowTable::record(uint64_t dp_id, const ofp_flow_mod* ofm) {
+    FlowKey key = make_key(ofm->match, ofm->priority);
+    uint16_t command = ntohs(ofm->command);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vigil::hash_map<uint64_t, Datapath>::iterator dpi = datapaths.find(dp_id);
+    if (dpi == datapaths.end())
+        return;
+
+    Datapath& dp = dpi->second;
+    if (command == OFPFC_ADD && ofm->idle_timeout == 0
+            && ofm->hard_timeout == 0) {
+        size_t length = ntohs(ofm->header.length);
+        Entry& entry = dp.flows[key];
+        entry.ofm.reset(new uint8_t[length]);
+        memcpy(entry.ofm.get(), ofm, length);
+        entry.generation = dp.generation;
+        dp.installed = true;
+    } else if (command == OFPFC_ADD || command == OFPFC_DELETE_STRICT) {
+        dp.flows.erase(key);
+    }
+}
+
+/**
+ * Start reconciling a datapath.
+ *
+ * Returns false if it has not joined or is being reconciled already.
+ */
+bool ShadowTable::begin_reconcile(uint64_t dp_id) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vigil::hash_map<uint64_t, Datapath>::iterator dpi = datapaths.find(dp_id);
+    if (dpi == datapaths.end() || !dpi->second.present
+            || dpi->second.reconciling)
+        return false;
+
+    Datapath& dp = dpi->second;
+
+    dp.reconciling = true;
+    ++dp.generation;
+    return true;
+}
+
+/**
+ * Check one flow from the flow stats of a datapath against its shadow.
+ *
+ * A shadowed flow whose actions differ is added again; a flow that is not
+ * shadowed is deleted, if rfproxy has added flows to the datapath.
+ */
+void ShadowTable::check_flow(uint64_t dp_id, const ofp_flow_stats* ofs,
+                             Delta& delta) {
+    FlowKey key = make_key(ofs->match, ofs->priority);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vigil::hash_map<uint64_t, Datapath>::iterator dpi = datapaths.find(dp_id);
+    if (dpi == datapaths.end())
+        return;
+
+    Datapath& dp = dpi->second;
+    if (!dp.reconciling)
+        return;
+
+    FlowMap::iterator it = dp.flows.find(key);
+    if (it == dp.flows.end()) {
+        if (dp.installed && ofs->idle_timeout == 0
+                && ofs->hard_timeout == 0)
+            delta.remove.push_back(make_delete(key));
+        return;
+    }
+
+    Entry& entry = it->second;
+    const ofp_flow_mod* ofm = reinterpret_cast<ofp_flow_mod*>(entry.ofm.get());
+    size_t actions_len = ntohs(ofm->header.length) - sizeof *ofm;
+    if (ntohs(ofs->length) - sizeof *ofs != actions_len
+            || memcmp(ofs->actions, ofm->actions, actions_len) != 0)
+        delta.install.push_back(entry.ofm);
+    entry.generation = dp.generation;
+}
+
+/**
+ * Finish reconciling a datapath.
+ *
+ * If its flow stats were complete, the shadowed flows that were not among
+ * them are added again.
+ */
+void ShadowTable::end_reconcile(uint64_t dp_id, bool complete, Delta& delta) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vigil::hash_map<uint64_t, Datapath>::iterator dpi = datapaths.find(dp_id);
+    if (dpi == datapaths.end())
+        return;
+
+    Datapath& dp = dpi->second;
+    if (!dp.reconciling)
+        return;
+
+    dp.reconciling = false;
+    if (!complete)
+        return;
+
+    FlowMap::iterator it;
+    for (it = dp.flows.begin(); it != dp.flows.end(); ++it) {
+        if (it->second.generation != dp.generation)
+            delta.install.push_back(it->second.ofm);
+    }
+}
+
+/**
+ * Drop the shadow of a datapath, for when RFServer says that the flows
+ * installed on it are gone.
+ *
+ * A datapath that is still there is shadowed afresh, and no extra flows are
+ * deleted from it until flows are added again.  A reconcile still in
+ * progress for it yields no FlowMods.
+ */
+void ShadowTable::forget(uint64_t dp_id) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vigil::hash_map<uint64_t, Datapath>::iterator dpi = datapaths.find(dp_id);
+    if (dpi == datapaths.end())
+        return;
+
+    if (dpi->second.present) {
+        dpi->second = Datapath();
+        dpi->second.present = true;
+    } else {
+        datapaths.erase(dpi);
+        departed.remove(dp_id);
+    }
+}
+
+/**
+ * Return the number of flows shadowed for a datapath.
+ */
+size_t ShadowTable::size(uint64_t dp_id) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vigil::hash_map<uint64_t, Datapath>::iterator it = datapaths.find(dp_id);
+    return it == datapaths.end() ? 0 : it->second.flows.size();
+}
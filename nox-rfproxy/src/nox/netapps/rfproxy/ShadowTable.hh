@@ -0,0 +1,121 @@
+/* Copyright 2012 (C) Victoria University of Waikato.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SHADOWTABLE_HH__
+#define __SHADOWTABLE_HH__
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <boost/shared_array.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "hash_map.hh"
+#include "openflow/openflow.h"
+
+/* Number of departed datapaths whose shadows are kept */
+#define SHADOW_DEPARTED 64
+
+/**
+ * The flows that rfproxy has installed on each datapath, as the FlowMods that
+ * installed them, indexed by match and priority.
+ *
+ * Reconciling a datapath compares its flow stats against the shadow, one flow
+ * at a time as they arrive, and yields only the FlowMods that bring the switch
+ * back in line: flows that are missing or whose actions differ are added
+ * again, and flows that rfproxy did not install are deleted.
+ *
+ * Flows with an idle or hard timeout are not shadowed, as the switch is
+ * expected to remove them by itself.  Only datapaths that have joined are
+ * shadowed, and the shadow of one that leaves is kept, so that a switch that
+ * reconnects with its flows is only sent what changed while it was away, and
+ * the flows that RFServer has yet to send again are not taken for extra
+ * ones.  Up to SHADOW_DEPARTED departed datapaths are kept, the one that left
+ * first being dropped to make room.  Extra flows are only deleted from a
+ * datapath that rfproxy has installed flows on, so that a switch is not wiped
+ * before RFServer has sent its routes.
+ *
+ * Shadowing and reconciling may happen in different threads.
+ */
+class ShadowTable {
+    public:
+        typedef boost::shared_array<uint8_t> FlowMod;
+
+        /* FlowMods that reconciling found to be needed. */
+        struct Delta {
+            std::vector<FlowMod> install;
+            std::vector<FlowMod> remove;
+        };
+
+        ShadowTable(size_t max_departed = SHADOW_DEPARTED)
+            : max_departed(max_departed) {}
+
+        void join(uint64_t dp_id);
+        void leave(uint64_t dp_id);
+        void record(uint64_t dp_id, const ofp_flow_mod* ofm);
+
+        bool begin_reconcile(uint64_t dp_id);
+        void check_flow(uint64_t dp_id, const ofp_flow_stats* ofs,
+                        Delta& delta);
+        void end_reconcile(uint64_t dp_id, bool complete, Delta& delta);
+
+        void forget(uint64_t dp_id);
+        size_t size(uint64_t dp_id);
+
+    private:
+        struct FlowKey {
+            ofp_match match;
+            uint16_t priority;
+            uint16_t pad;       /* Hashed and compared, so kept zeroed. */
+
+            bool operator==(const FlowKey& other) const;
+        };
+
+        struct FlowKeyHash {
+            size_t operator()(const FlowKey& key) const;
+        };
+
+        struct Entry {
+            FlowMod ofm;
+            uint32_t generation; /* Last reconcile that found it in place. */
+        };
+
+        typedef vigil::hash_map<FlowKey, Entry, FlowKeyHash> FlowMap;
+
+        struct Datapath {
+            FlowMap flows;
+            uint32_t generation;
+            bool reconciling;
+            bool installed;     /* Whether any flow was ever added. */
+            bool present;       /* Whether it has joined and not left. */
+
+            Datapath()
+                : generation(0), reconciling(false), installed(false),
+                  present(false) {}
+        };
+
+        boost::mutex mutex;
+        vigil::hash_map<uint64_t, Datapath> datapaths;
+        std::list<uint64_t> departed;   /* In the order they left. */
+        size_t max_departed;
+
+        static FlowKey make_key(const ofp_match& match, uint16_t priority);
+        static FlowMod make_delete(const FlowKey& key);
+};
+
+#endif /* __SHADOWTABLE_HH__ */
@@ -10,12 +10,15 @@
 #include "packet-in.hh"
 #include "datapath-join.hh"
 #include "datapath-leave.hh"
+#include "timeval.hh"
 #include "buffer.hh"
 #include "flow.hh"
 #include "netinet++/ethernet.hh"
 #include "packets.h"
 
-#include "ipc/MongoIPC.h"
+#include "ipc/IPCService.h"
+#include "metrics/Metrics.h"
+#include "metrics/Trace.h"
 #include "ipc/RFProtocol.h"
 #include "ipc/RFProtocolFactory.h"
 #include "OFInterface.hh"
@@ -34,6 +37,21 @@ static Vlog_module lg("rfproxy");
 
 boost::mutex sendPacketMutex;
 
+static Counter& packetsIn = Metrics::counter("rfproxy_packet_in_total",
+    "Packets received from datapaths and RFVS");
+static Counter& mappingPackets = Metrics::counter(
+    "rfproxy_mapping_packets_total", "Mapping packets received from RFVS");
+static Counter& unmappedPackets = Metrics::counter(
+    "rfproxy_unmapped_packets_total",
+    "Packets dropped because their port is not mapped");
+static Counter& flowModsSent = Metrics::counter("rfproxy_flow_mods_sent_total",
+    "FlowMods sent for RouteMods");
+static Counter& flowModErrors = Metrics::counter(
+    "rfproxy_flow_mod_errors_total",
+    "RouteMods that could not be turned into FlowMods or sent");
+static Histogram& routeModTime = Metrics::histogram(
+    "rfproxy_route_mod_seconds", "Time to turn a RouteMod into a FlowMod and send it");
+
 // Base functions
 bool rfproxy::send_of_msg(uint64_t dp_id, uint8_t* msg) {
     boost::lock_guard<boost::mutex> lock(sendPacketMutex);
@@ -56,6 +74,14 @@ bool rfproxy::send_packet_out(uint64_t dp_id, uint32_t port, Buffer& data) {
 Disposition rfproxy::on_datapath_up(const Event& e) {
     const Datapath_join_event& dj = assert_cast<const Datapath_join_event&> (e);
 
+    // Once RFServer has had time to send its routes, bring the switch in
+    // line with the flows shadowed for it, which a switch that reconnects
+    // keeps from before it left
+    datapaths.insert(dj.datapath_id.as_host());
+    shadow.join(dj.datapath_id.as_host());
+    post(boost::bind(&rfproxy::reconcile, this, dj.datapath_id.as_host()),
+         make_timeval(reconcile_delay, 0));
+
     for (int i = 0; i < dj.ports.size(); i++) {
         if (dj.ports[i].port_no <= OFPP_MAX) {
             DatapathPortRegister msg(ID, dj.datapath_id.as_host(), dj.ports[i].port_no);
@@ -79,12 +105,24 @@ Disposition rfproxy::on_datapath_down(const Event& e) {
         "Datapath is down (dp_id=%0#"PRIx64")",
         dp_id);
 
-    // Delete internal entry
+    // Delete internal entry, and keep the shadow of its flows for when it
+    // reconnects
     table.delete_dp(dp_id);
+    datapaths.erase(dp_id);
+    shadow.leave(dp_id);
+    hash_map<uint64_t, Reconcile>::iterator it = reconciles.find(dp_id);
+    if (it != reconciles.end()) {
+        it->second.fetcher->cancel();
+        reconciles.erase(it);
+    }
 
     // Notify RFServer
     DatapathDown dd(ID, dp_id);
     ipc->send(RFSERVER_RFPROXY_CHANNEL, RFSERVER_ID, dd);
+
+    // Drop the RouteMods still queued for it, they would only fail
+    ipc->discard(RFSERVER_RFPROXY_CHANNEL, to_string<uint64_t>(ID),
+                 ROUTE_MOD, "id", to_string<uint64_t>(dp_id));
     return CONTINUE;
 }
 
@@ -95,6 +133,8 @@ Disposition rfproxy::on_packet_in(const Event& e) {
     uint64_t vs_id = pi.datapath_id.as_host();
     uint32_t vs_port = pi.in_port;
 
+    packetsIn.inc();
+
     Nonowning_buffer orig_buf(*pi.get_buffer());
     Buffer *buf = &orig_buf;
     Flow orig_flow(in_port, *buf);
@@ -108,6 +148,7 @@ Disposition rfproxy::on_packet_in(const Event& e) {
     // If we have a mapping packet, inform RFServer through a Map message
     if (flow->dl_type == htons(RF_ETH_PROTO)) {
         const eth_data* data = buf->try_pull<eth_data> ();
+        mappingPackets.inc();
         VLOG_INFO(lg,
             "Received mapping packet (vm_id=%0#"PRIx64", vm_port=%d, vs_id=%0#"PRIx64", vs_port=%d)",
             data->vm_id,
@@ -131,18 +172,22 @@ Disposition rfproxy::on_packet_in(const Event& e) {
         PORT dp_port = table.vs_port_to_dp_port(dp_id, in_port);
         if (dp_port != NONE)
             send_packet_out(dp_port.first, dp_port.second, *buf);
-        else
+        else {
+            unmappedPackets.inc();
             VLOG_DBG(lg, "Unmapped RFVS port (vs_id=%0#"PRIx64", vs_port=%d)",
                      dp_id, in_port);
+        }
     }
     // If the packet came from a switch, redirect it to the right RFVS port
     else {
         PORT vs_port = table.dp_port_to_vs_port(dp_id, in_port);
         if (vs_port != NONE)
             send_packet_out(vs_port.first, vs_port.second, *buf);
-        else
+        else {
+            unmappedPackets.inc();
             VLOG_DBG(lg, "Unmapped datapath port (vs_id=%0#"PRIx64", vs_port=%d)",
                      dp_id, in_port);
+        }
     }
 
     return CONTINUE;
@@ -153,17 +198,31 @@ bool rfproxy::process(const string &from, const string &to,
                       const string &channel, IPCMessage& msg) {
     int type = msg.get_type();
     if (type == ROUTE_MOD) {
+        ScopedTimer timer(routeModTime);
         RouteMod* rmmsg = static_cast<RouteMod*>(&msg);
+        rmmsg->trace.stamp(TRACE_RFPROXY_PROCESS);
         boost::shared_array<uint8_t> ofmsg = create_flow_mod(rmmsg->get_mod(),
                                     rmmsg->get_matches(),
                                     rmmsg->get_actions(),
                                     rmmsg->get_options());
+        rmmsg->trace.stamp(TRACE_CREATE_FLOW_MOD);
         if (ofmsg.get() == NULL) {
             VLOG_DBG(lg, "Failed to create OpenFlow FlowMod");
+            flowModErrors.inc();
+        } else if (send_of_msg(rmmsg->get_id(), ofmsg.get()) == SUCCESS) {
+            rmmsg->trace.stamp(TRACE_SEND_OPENFLOW);
+            rmmsg->trace.finish();
+            shadow.record(rmmsg->get_id(), (ofp_flow_mod*) ofmsg.get());
+            flowModsSent.inc();
         } else {
-            send_of_msg(rmmsg->get_id(), ofmsg.get());
+            flowModErrors.inc();
         }
     }
+    else if (type == DATAPATH_DOWN) {
+        // RFServer has let go of the datapath, and of the flows on it
+        DatapathDown* ddmsg = static_cast<DatapathDown*>(&msg);
+        shadow.forget(ddmsg->get_dp_id());
+    }
     else if (type == DATA_PLANE_MAP) {
         DataPlaneMap* dpmmsg = dynamic_cast<DataPlaneMap*>(&msg);
         table.update_dp_port(dpmmsg->get_dp_id(), dpmmsg->get_dp_port(),
@@ -172,13 +231,111 @@ bool rfproxy::process(const string &from, const string &to,
     return true;
 }
 
+// Flow table reconciliation
+void rfproxy::reconcile(uint64_t dp_id) {
+    if (datapaths.find(dp_id) == datapaths.end()
+        || reconciles.find(dp_id) != reconciles.end()
+        || !shadow.begin_reconcile(dp_id))
+        return;
+
+    ofp_flow_stats_request request;
+    memset(&request, 0, sizeof request);
+    request.match.wildcards = htonl(OFPFW_ALL);
+    request.table_id = 0xff;
+    request.out_port = htons(OFPP_NONE);
+
+    Reconcile& r = reconciles[dp_id];
+    r.installed = r.removed = 0;
+    r.fetcher = Flow_fetcher::stream(ctxt,
+        datapathid::from_host(dp_id), request,
+        boost::bind(&rfproxy::on_flow_stats, this, dp_id, _1),
+        boost::bind(&rfproxy::on_flow_stats_done, this, dp_id));
+
+    VLOG_DBG(lg, "Reconciling datapath (dp_id=%0#"PRIx64", flows=%zu)",
+             dp_id, shadow.size(dp_id));
+}
+
+void rfproxy::reconcile_all() {
+    hash_set<uint64_t>::iterator it;
+    for (it = datapaths.begin(); it != datapaths.end(); ++it)
+        reconcile(*it);
+
+    post(boost::bind(&rfproxy::reconcile_all, this),
+         make_timeval(reconcile_interval, 0));
+}
+
+void rfproxy::on_flow_stats(uint64_t dp_id, const Flow_stats_chunk& chunk) {
+    ShadowTable::Delta delta;
+    for (size_t i = 0; i < chunk.size(); i++)
+        shadow.check_flow(dp_id, &chunk[i], delta);
+    send_delta(dp_id, delta);
+}
+
+void rfproxy::on_flow_stats_done(uint64_t dp_id) {
+    hash_map<uint64_t, Reconcile>::iterator it = reconciles.find(dp_id);
+    if (it == reconciles.end())
+        return;
+
+    int status = it->second.fetcher->get_status();
+    ShadowTable::Delta delta;
+    shadow.end_reconcile(dp_id, status == 0, delta);
+    send_delta(dp_id, delta);
+
+    if (status == 0) {
+        VLOG_INFO(lg,
+            "Reconciled datapath (dp_id=%0#"PRIx64", installed=%zu, removed=%zu)",
+            dp_id, it->second.installed, it->second.removed);
+    } else {
+        VLOG_WARN(lg,
+            "Failed to fetch flows to reconcile (dp_id=%0#"PRIx64", error=%d)",
+            dp_id, status);
+    }
+    reconciles.erase(it);
+}
+
+void rfproxy::send_delta(uint64_t dp_id, const ShadowTable::Delta& delta) {
+    vector<ShadowTable::FlowMod>::const_iterator ofm;
+    for (ofm = delta.remove.begin(); ofm != delta.remove.end(); ++ofm)
+        send_of_msg(dp_id, ofm->get());
+    for (ofm = delta.install.begin(); ofm != delta.install.end(); ++ofm)
+        send_of_msg(dp_id, ofm->get());
+
+    hash_map<uint64_t, Reconcile>::iterator it = reconciles.find(dp_id);
+    if (it != reconciles.end()) {
+        it->second.removed += delta.remove.size();
+        it->second.installed += delta.install.size();
+    }
+}
+
 // Initialization
 void rfproxy::configure(const Configuration* c) {
     lg.dbg("Configure called");
+
+    const hash_map<string, string> argmap = c->get_arguments_list();
+    hash_map<string, string>::const_iterator i;
+    i = argmap.find("reconcile_delay");
+    if (i != argmap.end())
+        reconcile_delay = atoi(i->second.c_str());
+    i = argmap.find("reconcile_interval");
+    if (i != argmap.end())
+        reconcile_interval = atoi(i->second.c_str());
+    i = argmap.find("metrics");
+    if (i != argmap.end())
+        metrics_address = i->second;
+    // Log one in every trace_sample traced RouteMods; which route updates
+    // are traced is up to rfclient
+    i = argmap.find("trace_sample");
+    if (i != argmap.end())
+        Trace::setLogSample(atoi(i->second.c_str()));
 }
 
 void rfproxy::install() {
-    ipc = new MongoIPCMessageService(MONGO_ADDRESS, MONGO_DB_NAME, to_string<uint64_t>(ID));
+    // Serve counters in Prometheus format on a TCP port or "unix:<path>"
+    if (!metrics_address.empty() && !Metrics::serve(metrics_address))
+        VLOG_ERR(lg, "Failed to serve metrics (address=%s): %s",
+                 metrics_address.c_str(), strerror(errno));
+
+    ipc = createIPCMessageService(defaultIPCAddress(), MONGO_DB_NAME, to_string<uint64_t>(ID));
     factory = new RFProtocolFactory();
     ipc->listen(RFSERVER_RFPROXY_CHANNEL, factory, this, false);
 
@@ -188,6 +345,11 @@ void rfproxy::install() {
         (boost::bind(&rfproxy::on_datapath_up, this, _1));
     register_handler<Datapath_leave_event>
         (boost::bind(&rfproxy::on_datapath_down, this, _1));
+
+    // A reconcile_interval of 0 leaves reconciling to datapath joins
+    if (reconcile_interval > 0)
+        post(boost::bind(&rfproxy::reconcile_all, this),
+             make_timeval(reconcile_interval, 0));
 }
 
 void rfproxy::getInstance(const Context* c, rfproxy*& component) {
@@ -21,10 +21,14 @@
 
 #include "component.hh"
 #include "config.h"
+#include "hash_map.hh"
+#include "hash_set.hh"
+#include "flow_fetcher/flow_fetcher.hh"
 #include "ipc/IPC.h"
 #include "ipc/RFProtocolFactory.h"
 #include "types/IPAddress.h"
 #include "types/MACAddress.h"
+#include "ShadowTable.hh"
 
 #ifdef LOG4CXX_ENABLED
 #include <boost/format.hpp>
@@ -33,9 +37,16 @@
 #include "vlog.hh"
 #endif
 
+/* Default delay before reconciling a datapath that has joined (in s) */
+#define RFPROXY_RECONCILE_DELAY 2
+/* Default interval between reconciliations of all datapaths (in s) */
+#define RFPROXY_RECONCILE_INTERVAL 300
+
 namespace vigil {
 using namespace std;
 using namespace vigil::container;
+using applications::Flow_fetcher;
+using applications::Flow_stats_chunk;
 
 // Map message struct
 struct eth_data {
@@ -114,6 +125,21 @@ class rfproxy : public Component, private IPCMessageProcessor
         RFProtocolFactory *factory;
         Table table;
 
+        // Flow table reconciliation
+        struct Reconcile {
+            boost::shared_ptr<Flow_fetcher> fetcher;
+            size_t installed;
+            size_t removed;
+        };
+        ShadowTable shadow;
+        hash_map<uint64_t, Reconcile> reconciles;
+        hash_set<uint64_t> datapaths;
+        time_t reconcile_delay;
+        time_t reconcile_interval;
+
+        // Where to serve metrics, if anywhere
+        string metrics_address;
+
         // Base methods
         bool send_of_msg(uint64_t dp_id, uint8_t* msg);
         bool send_packet_out(uint64_t dp_id, uint32_t port, Buffer& data);
@@ -127,6 +153,13 @@ class rfproxy : public Component, private IPCMessageProcessor
         void flow_delete(uint64_t dp_id, 
                          IPAddress address, IPAddress netmask, 
                          MACAddress src_hwaddress);
+
+        // Flow table reconciliation methods
+        void reconcile(uint64_t dp_id);
+        void reconcile_all();
+        void on_flow_stats(uint64_t dp_id, const Flow_stats_chunk& chunk);
+        void on_flow_stats_done(uint64_t dp_id);
+        void send_delta(uint64_t dp_id, const ShadowTable::Delta& delta);
         
         // Event handlers
         Disposition on_datapath_up(const Event& e);
@@ -138,7 +171,9 @@ class rfproxy : public Component, private IPCMessageProcessor
 
     public:
         // Initialization
-        rfproxy(const Context* c, const json_object* node) : Component(c) {}
+        rfproxy(const Context* c, const json_object* node)
+            : Component(c), reconcile_delay(RFPROXY_RECONCILE_DELAY),
+              reconcile_interval(RFPROXY_RECONCILE_INTERVAL) {}
         void configure(const Configuration* c);
         void install();
         static void getInstance(const container::Context* c, rfproxy*& component);
@@ -0,0 +1,170 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Measures the routing module's shortest path maintenance on a k-ary fat-tree
+ * (k = 28 gives 980 switches) and on a random graph of as many switches with
+ * four links per switch on average.  For each, reports the time to build the
+ * paths from scratch, one link at a time as discovery reports them, then the
+ * time per link-down and link-up event on randomly chosen links, and the time
+ * to read a path.
+ *
+ * Usage: bench-shortest-paths [K [N_EVENTS]] */
+
+#include "shortest-paths.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+#include <vector>
+
+using namespace vigil;
+using namespace vigil::applications;
+
+struct Bench_link {
+    uint32_t src;
+    uint16_t sport;
+    uint32_t dst;
+    uint16_t dport;
+};
+
+static std::vector<Bench_link> links;
+static std::vector<uint16_t> n_ports;
+
+static double
+now()
+{
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+report(const char* what, double elapsed, unsigned long int n,
+       const char* unit)
+{
+    printf("%-32s %10.1f us/%s\n", what, elapsed * 1e6 / n, unit);
+}
+
+/* Connects switches 'a' and 'b' on their next free ports, in both
+ * directions. */
+static void
+connect(uint32_t a, uint32_t b)
+{
+    Bench_link link = { a, ++n_ports[a], b, ++n_ports[b] };
+    links.push_back(link);
+    Bench_link reverse = { b, link.dport, a, link.sport };
+    links.push_back(reverse);
+}
+
+static void
+fat_tree(uint32_t k)
+{
+    uint32_t n_core = k * k / 4;
+    uint32_t n_pod = k / 2;
+    n_ports.assign(n_core + 2 * k * n_pod, 0);
+    links.clear();
+
+    for (uint32_t pod = 0; pod < k; ++pod) {
+        uint32_t aggr = n_core + pod * 2 * n_pod;
+        uint32_t edge = aggr + n_pod;
+        for (uint32_t i = 0; i < n_pod; ++i) {
+            for (uint32_t j = 0; j < n_pod; ++j) {
+                connect(edge + i, aggr + j);
+                connect(aggr + i, i * n_pod + j);
+            }
+        }
+    }
+}
+
+static void
+random_graph(uint32_t n)
+{
+    n_ports.assign(n, 0);
+    links.clear();
+
+    // A random spanning tree, so that the graph is connected, then random
+    // links up to twice as many as switches.
+    for (uint32_t i = 1; i < n; ++i) {
+        connect(rand() % i, i);
+    }
+    while (links.size() < 4 * n) {
+        uint32_t a = rand() % n, b = rand() % n;
+        if (a != b) {
+            connect(a, b);
+        }
+    }
+}
+
+static void
+run(const char* name, unsigned long int n_events)
+{
+    uint32_t n = n_ports.size();
+    printf("%s: %u switches, %zu links\n", name, n, links.size() / 2);
+
+    Shortest_paths paths;
+    double start = now();
+    for (size_t i = 0; i < links.size(); ++i) {
+        const Bench_link& l = links[i];
+        paths.add_link(datapathid::from_host(l.src), l.sport,
+                       datapathid::from_host(l.dst), l.dport);
+    }
+    report("  build, per link event", now() - start, links.size(), "event");
+
+    // Both directions of a link go down, then come back up.
+    double down = 0, up = 0;
+    for (unsigned long int i = 0; i < n_events; ++i) {
+        const Bench_link& l = links[(rand() % (links.size() / 2)) * 2];
+        datapathid a = datapathid::from_host(l.src);
+        datapathid b = datapathid::from_host(l.dst);
+
+        start = now();
+        paths.remove_link(a, l.sport, b, l.dport);
+        paths.remove_link(b, l.dport, a, l.sport);
+        down += now() - start;
+
+        start = now();
+        paths.add_link(a, l.sport, b, l.dport);
+        paths.add_link(b, l.dport, a, l.sport);
+        up += now() - start;
+    }
+    report("  link down, per link event", down, n_events * 2, "event");
+    report("  link up, per link event", up, n_events * 2, "event");
+
+    std::vector<Shortest_paths::Hop> path;
+    unsigned long int n_hops = 0;
+    start = now();
+    for (unsigned long int i = 0; i < n_events * 100; ++i) {
+        paths.get_path(datapathid::from_host(rand() % n),
+                       datapathid::from_host(rand() % n), path);
+        n_hops += path.size();
+    }
+    report("  get_path", now() - start, n_events * 100, "path");
+    printf("  %.2f hops per path\n", (double) n_hops / (n_events * 100));
+}
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t k = argc > 1 ? atoi(argv[1]) : 28;
+    unsigned long int n_events = argc > 2 ? atol(argv[2]) : 1000;
+
+    srand(1);
+    fat_tree(k);
+    run("fat-tree", n_events);
+    random_graph(n_ports.size());
+    run("random", n_events);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "install-batches.hh"
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "openflow-pack.hh"
+#include "vlog.hh"
+
+namespace vigil {
+namespace applications {
+
+static Vlog_module lg("routing");
+
+Install_batches::Install_batches(const Sender& send_)
+    : send(send_), open(false)
+{ }
+
+void
+Install_batches::begin()
+{
+    open = true;
+}
+
+void
+Install_batches::queue(const datapathid& dp, const ofp_header* oh)
+{
+    std::vector<uint8_t>& msgs = queued[dp];
+    const uint8_t* msg = (const uint8_t*) oh;
+    msgs.insert(msgs.end(), msg, msg + ntohs(oh->length));
+}
+
+bool
+Install_batches::commit(const Callback& done)
+{
+    if (!open) {
+        return false;
+    }
+    open = false;
+
+    if (queued.empty()) {
+        done(true);
+        return true;
+    }
+
+    uint32_t xid = openflow_pack::get_xid();
+    Pending::iterator p = pending.insert(std::make_pair(xid, Batch())).first;
+    Batch& batch = p->second;
+    batch.done = done;
+    batch.ok = true;
+
+    ofp_header barrier;
+    barrier.version = OFP_VERSION;
+    barrier.type = OFPT_BARRIER_REQUEST;
+    barrier.length = htons(sizeof barrier);
+    barrier.xid = xid;
+
+    for (Queue::iterator q = queued.begin(); q != queued.end(); ++q) {
+        const datapathid& dp = q->first;
+        std::vector<uint8_t>& msgs = q->second;
+        int err = 0;
+        for (size_t i = 0; !err && i < msgs.size(); ) {
+            ofp_header* oh = (ofp_header*) &msgs[i];
+            oh->xid = xid;
+            i += ntohs(oh->length);
+            err = send(dp, oh);
+        }
+        if (!err) {
+            err = send(dp, &barrier);
+        }
+
+        if (!err) {
+            batch.waiting.insert(dp);
+        } else {
+            VLOG_ERR(lg, "Install batch to dp:%"PRIx64" failed with %d:%s.",
+                     dp.as_host(), err, strerror(err));
+            batch.ok = false;
+        }
+    }
+    queued.clear();
+
+    finish(p);
+    return true;
+}
+
+// Calls back and forgets 'p' if it waits on no more barrier replies.
+
+void
+Install_batches::finish(Pending::iterator p)
+{
+    if (!p->second.waiting.empty()) {
+        return;
+    }
+    Callback done = p->second.done;
+    bool ok = p->second.ok;
+    pending.erase(p);
+    done(ok);
+}
+
+void
+Install_batches::barrier_reply(const datapathid& dp, uint32_t xid)
+{
+    Pending::iterator p = pending.find(xid);
+    if (p != pending.end() && p->second.waiting.erase(dp)) {
+        finish(p);
+    }
+}
+
+// An error carrying a batch's xid reports an entry of the batch that its
+// switch rejected.  The barrier reply still follows.
+
+bool
+Install_batches::error(const datapathid& dp, uint32_t xid)
+{
+    Pending::iterator p = pending.find(xid);
+    if (p == pending.end() || !p->second.waiting.count(dp)) {
+        return false;
+    }
+    p->second.ok = false;
+    return true;
+}
+
+void
+Install_batches::datapath_leave(const datapathid& dp)
+{
+    // Callbacks may commit new batches, so do not hold iterators across them.
+    std::vector<uint32_t> xids;
+    for (Pending::const_iterator p = pending.begin(); p != pending.end(); ++p) {
+        if (p->second.waiting.count(dp)) {
+            xids.push_back(p->first);
+        }
+    }
+
+    for (std::vector<uint32_t>::const_iterator xid = xids.begin();
+         xid != xids.end(); ++xid)
+    {
+        Pending::iterator p = pending.find(*xid);
+        if (p != pending.end()) {
+            p->second.waiting.erase(dp);
+            p->second.ok = false;
+            finish(p);
+        }
+    }
+}
+
+}
+}
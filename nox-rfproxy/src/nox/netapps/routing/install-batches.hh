@@ -0,0 +1,101 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef INSTALL_BATCHES_HH
+#define INSTALL_BATCHES_HH 1
+
+#include <boost/function.hpp>
+#include <stdint.h>
+#include <vector>
+
+#include "hash_map.hh"
+#include "hash_set.hh"
+#include "netinet++/datapathid.hh"
+#include "openflow/openflow.h"
+
+namespace vigil {
+namespace applications {
+
+/*
+ * Batches of flow entries installed together, as done by the routing
+ * module's begin_install() and commit_install().
+ *
+ * While a batch is open, entries are queued by datapath.  Committing it
+ * sends each datapath its entries back to back, followed by a barrier
+ * request, all under one new xid, and the batch completes once every
+ * datapath has answered its barrier.
+ *
+ * Xids are opaque, as elsewhere in NOX: the batch's xid is written into the
+ * headers as is, and replies are matched on the xid field of their header as
+ * received (Ofp_msg_event::xid()), so that neither side converts its byte
+ * order.
+ */
+
+class Install_batches {
+
+public:
+    typedef boost::function<void(bool)> Callback;
+
+    /* Sends 'oh' to the datapath, returning 0 or an errno value. */
+    typedef boost::function<int(const datapathid&, const ofp_header*)> Sender;
+
+    explicit Install_batches(const Sender&);
+
+    void begin();
+    bool is_open() const { return open; }
+
+    /* Queues a copy of 'oh' for the datapath in the open batch. */
+    void queue(const datapathid&, const ofp_header* oh);
+
+    /* Sends the open batch and calls 'done' once it completes - with 'true'
+     * if all entries are in place, or 'false' if any could not be sent, was
+     * rejected by its switch, or its switch left before answering.  'done'
+     * is called before commit() returns if nothing was queued.  Returns
+     * 'false' if no batch was open. */
+    bool commit(const Callback& done);
+
+    /* Take in what happened to the switches.  error() returns true if the
+     * error was for an entry of a pending batch, which fails it. */
+    void barrier_reply(const datapathid&, uint32_t xid);
+    bool error(const datapathid&, uint32_t xid);
+    void datapath_leave(const datapathid&);
+
+    size_t get_n_pending() const { return pending.size(); }
+
+private:
+    /* A committed batch, waiting on the barrier replies of 'waiting'. */
+    struct Batch {
+        Callback done;
+        hash_set<datapathid> waiting;
+        bool ok;
+    };
+
+    typedef hash_map<datapathid, std::vector<uint8_t> > Queue;
+    typedef hash_map<uint32_t, Batch> Pending;
+
+    Sender send;
+    bool open;
+    Queue queued;
+    Pending pending;
+
+    void finish(Pending::iterator);
+};
+
+}
+}
+
+#endif
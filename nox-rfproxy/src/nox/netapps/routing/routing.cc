@@ -22,6 +22,9 @@
 #include <inttypes.h>
 
 #include "assert.hh"
+#include "barrier-reply.hh"
+#include "datapath-leave.hh"
+#include "error-event.hh"
 #include "openflow/nicira-ext.h"
 #include "vlog.hh"
 #include "openflow-pack.hh"
@@ -44,40 +47,6 @@ Routing_module::rideq::operator()(const RouteId& a, const RouteId& b) const
     return (a.src == b.src && a.dst == b.dst);
 }
 
-std::size_t
-Routing_module::routehash::operator()(const RoutePtr& rte) const
-{
-    return (ridhash()(rte->id)
-            ^ HASH_NAMESPACE::hash<uint32_t>()(rte->path.size()));
-}
-
-bool
-Routing_module::routeq::operator()(const RoutePtr& a, const RoutePtr& b) const
-{
-    if (a->id.src != b->id.src || a->id.dst != b->id.dst
-        || a->path.size() != b->path.size())
-    {
-        return false;
-    }
-    std::list<Link>::const_iterator aiter, biter;
-    for (aiter = a->path.begin(), biter = b->path.begin();
-         aiter != a->path.end(); ++aiter, ++biter)
-    {
-        if (aiter->dst != biter->dst || aiter->outport != biter->outport
-            || aiter->inport != biter->inport)
-        {
-            return false;
-        }
-    }
-    return true;
-}
-
-bool
-Routing_module::ruleptrcmp::operator()(const RoutePtr& a, const RoutePtr& b) const
-{
-    return (a->path.size() > b->path.size());
-}
-
 static
 inline
 uint32_t
@@ -92,8 +61,9 @@ get_max_action_len() {
 
 Routing_module::Routing_module(const container::Context* c,
                                const json_object* d)
-    : container::Component(c), topology(0), nat(0), len_flow_actions(0),
-      num_actions(0), ofm(0)
+    : container::Component(c), topology(0), nat(0),
+      batches(boost::bind(&Routing_module::send_batched, this, _1, _2)),
+      len_flow_actions(0), num_actions(0), ofm(0)
 {
     max_output_action_len = get_max_action_len();
 }
@@ -115,6 +85,12 @@ Routing_module::configure(const container::Configuration*)
     resolve(nat);
     register_handler<Link_event>
         (boost::bind(&Routing_module::handle_link_change, this, _1));
+    register_handler<Barrier_reply_event>
+        (boost::bind(&Routing_module::handle_barrier_reply, this, _1));
+    register_handler<Error_event>
+        (boost::bind(&Routing_module::handle_error, this, _1));
+    register_handler<Datapath_leave_event>
+        (boost::bind(&Routing_module::handle_datapath_leave, this, _1));
 }
 
 void
@@ -125,17 +101,40 @@ Routing_module::install()
 bool
 Routing_module::get_route(const RouteId& id, RoutePtr& route) const
 {
-    RouteMap::const_iterator rte = shortest.find(id);
-    if (rte == shortest.end()) {
-        if (id.src == id.dst) {
-            route.reset(new Route());
-            route->id = id;
-            return true;
+    uint32_t version;
+    if (id.src == id.dst) {
+        route.reset(new Route());
+        route->id = id;
+        return true;
+    } else if (!paths.get_version(id.src, version)) {
+        return false;
+    }
+
+    RouteCache::iterator cached = routes.find(id);
+    if (cached != routes.end() && cached->second.version == version) {
+        route = cached->second.route;
+        return true;
+    }
+
+    if (!paths.get_path(id.src, id.dst, hops)) {
+        if (cached != routes.end()) {
+            routes.erase(cached);
         }
         return false;
     }
 
-    route = rte->second;
+    route.reset(new Route());
+    route->id = id;
+    for (std::vector<Shortest_paths::Hop>::const_iterator hop = hops.begin();
+         hop != hops.end(); ++hop)
+    {
+        Link link = { hop->dst, hop->outport, hop->inport };
+        route->path.push_back(link);
+    }
+
+    CachedRoute& entry = routes[id];
+    entry.route = route;
+    entry.version = version;
     return true;
 }
 
@@ -166,33 +165,18 @@ Routing_module::is_on_path_location(const RouteId& id, uint16_t src_port,
             && rte->path.back().inport == dst_port);
 }
 
-// Updates shortests paths on link change based on algorithm in "A New Approach
-// to Dynamic All Pairs Shortest Paths" - C. Demetrescu
+// Updates shortest paths on link change.  Routes cached by get_route() are
+// rebuilt when next asked for.
 
 Disposition
 Routing_module::handle_link_change(const Event& e)
 {
     const Link_event& le = assert_cast<const Link_event&>(e);
 
-    RouteQueue new_candidates;
-    RoutePtr route(new Route());
-    Link tmp = { le.dpdst, le.sport, le.dport };
-    route->id.src = le.dpsrc;
-    route->id.dst = le.dpdst;
-    route->path.push_back(tmp);
     if (le.action == Link_event::REMOVE) {
-        cleanup(route, true);
-        fixup(new_candidates, true);
+        paths.remove_link(le.dpsrc, le.sport, le.dpdst, le.dport);
     } else if (le.action == Link_event::ADD) {
-        RoutePtr left_subpath(new Route());
-        RoutePtr right_subpath(new Route());
-        left_subpath->id.src = left_subpath->id.dst = le.dpsrc;
-        right_subpath->id.src = right_subpath->id.dst = le.dpdst;
-        add(local_routes, route);
-        add(left_local, route, right_subpath);
-        add(right_local, route, left_subpath);
-        new_candidates.push(route);
-        fixup(new_candidates, false);
+        paths.add_link(le.dpsrc, le.sport, le.dpdst, le.dport);
     } else {
         VLOG_ERR(lg, "Unknown link event action %u", le.action);
     }
@@ -201,346 +185,6 @@ Routing_module::handle_link_change(const Event& e)
 }
 
 
-void
-Routing_module::cleanup(RoutePtr route, bool delete_route)
-{
-    bool is_short = remove(shortest, route);
-    if (delete_route) {
-        remove(local_routes, route);
-    }
-
-    RoutePtr subpath(new Route());
-    *subpath = *route;
-    set_subpath(subpath, true);
-    if (delete_route) {
-        remove(right_local, route, subpath);
-    }
-    if (is_short) {
-        remove(right_shortest, route, subpath);
-    }
-
-    *subpath = *route;
-    set_subpath(subpath, false);
-    if (delete_route) {
-        remove(left_local, route, subpath);
-    }
-    if (is_short) {
-        remove(left_shortest, route, subpath);
-    }
-
-    RouteSet to_clean;
-    subpath = route;
-    while (true) {
-        RouteList left, right;
-        ExtensionMap::iterator rtes = left_local.find(subpath);
-        if (rtes != left_local.end()) {
-            left_shortest.erase(subpath);
-            left.swap(rtes->second);
-            left_local.erase(rtes);
-        }
-        rtes = right_local.find(subpath);
-        if (rtes != right_local.end()) {
-            right_shortest.erase(subpath);
-            right.swap(rtes->second);
-            right_local.erase(rtes);
-        }
-
-        clean_subpath(subpath, left, to_clean, true);
-        clean_subpath(subpath, right, to_clean, false);
-
-        if (to_clean.empty())
-            break;
-        subpath = *(to_clean.begin());
-        to_clean.erase(to_clean.begin());
-    }
-}
-
-
-void
-Routing_module::clean_subpath(RoutePtr& subpath, const RouteList& extensions,
-                              RouteSet& to_clean, bool is_left_extension)
-{
-    datapathid tmpdp;
-    Link tmplink;
-
-    if (is_left_extension) {
-        tmplink = subpath->path.back();
-        subpath->path.pop_back();
-        if (subpath->path.empty()) {
-            subpath->id.dst = subpath->id.src;
-        } else {
-            subpath->id.dst = subpath->path.back().dst;
-        }
-    } else {
-        tmplink = subpath->path.front();
-        subpath->path.pop_front();
-        tmpdp = subpath->id.src;
-        subpath->id.src = tmplink.dst;
-    }
-
-    for (RouteList::const_iterator rte = extensions.begin();
-         rte != extensions.end(); ++rte)
-    {
-        clean_route(*rte, subpath, is_left_extension);
-        to_clean.insert(*rte);
-    }
-
-    if (is_left_extension) {
-        subpath->path.push_back(tmplink);
-        subpath->id.dst = tmplink.dst;
-    } else {
-        subpath->path.push_front(tmplink);
-        subpath->id.src = tmpdp;
-    }
-}
-
-
-void
-Routing_module::clean_route(const RoutePtr& route,
-                            RoutePtr& subpath,
-                            bool cleaned_left)
-{
-    datapathid tmpdp;
-
-    if (remove(local_routes, route)) {
-        bool is_short = remove(shortest, route);
-        if (cleaned_left) {
-            tmpdp = subpath->id.src;
-            subpath->id.src = route->id.src;
-            subpath->path.push_front(route->path.front());
-            remove(right_local, route, subpath);
-            if (is_short)
-                remove(right_shortest, route, subpath);
-            subpath->id.src = tmpdp;
-            subpath->path.pop_front();
-        } else {
-            const Link& newlink = route->path.back();
-            tmpdp = subpath->id.dst;
-            subpath->id.dst = newlink.dst;
-            subpath->path.push_back(newlink);
-            remove(left_local, route, subpath);
-            if (is_short)
-                remove(left_shortest, route, subpath);
-            subpath->id.dst = tmpdp;
-            subpath->path.pop_back();
-        }
-    }
-}
-
-
-void
-Routing_module::fixup(RouteQueue& new_candidates, bool add_least)
-{
-    if (add_least) {
-        for (RoutesMap::iterator rtes = local_routes.begin();
-             rtes != local_routes.end(); ++rtes)
-        {
-            new_candidates.push(*(rtes->second.begin()));
-        }
-    }
-
-    while (!new_candidates.empty()) {
-        RoutePtr route = new_candidates.top();
-        new_candidates.pop();
-        RouteMap::iterator old = shortest.find(route->id);
-        if (old != shortest.end()) {
-            if (old->second->path.size() <= route->path.size()) {
-                continue;
-            }
-            cleanup(old->second, false);
-        } else if (route->id.src == route->id.dst) {
-            continue;
-        }
-
-        RoutePtr left_subpath(new Route());
-        RoutePtr right_subpath(new Route());
-        *left_subpath = *right_subpath = *route;
-        set_subpath(left_subpath, true);
-        set_subpath(right_subpath, false);
-        get_cached_path(left_subpath);
-        get_cached_path(right_subpath);
-        add(shortest, route);
-        add(left_shortest, route, right_subpath);
-        add(right_shortest, route, left_subpath);
-        add_local_routes(route, left_subpath, right_subpath, new_candidates);
-    }
-}
-
-
-void
-Routing_module::add_local_routes(const RoutePtr& route,
-                                 const RoutePtr& left_subpath,
-                                 const RoutePtr& right_subpath,
-                                 RouteQueue& new_candidates)
-{
-    ExtensionMap::iterator rtes = left_shortest.find(left_subpath);
-    if (rtes != left_shortest.end()) {
-        for (RouteList::const_iterator rte = rtes->second.begin();
-             rte != rtes->second.end(); ++rte)
-        {
-            RoutePtr new_local(new Route());
-            *new_local = *route;
-            new_local->id.src = (*rte)->id.src;
-            new_local->path.push_front((*rte)->path.front());
-            add(local_routes, new_local);
-            add(left_local, new_local, route);
-            add(right_local, new_local, *rte);
-            new_candidates.push(new_local);
-        }
-    }
-    rtes = right_shortest.find(right_subpath);
-    if (rtes != right_shortest.end()) {
-        for (RouteList::const_iterator rte = rtes->second.begin();
-             rte != rtes->second.end(); ++rte)
-        {
-            RoutePtr new_local(new Route());
-            *new_local = *route;
-            new_local->id.dst = (*rte)->id.dst;
-            new_local->path.push_back((*rte)->path.back());
-            add(local_routes, new_local);
-            add(left_local, new_local, *rte);
-            add(right_local, new_local, route);
-            new_candidates.push(new_local);
-        }
-    }
-}
-
-
-void
-Routing_module::set_subpath(RoutePtr& subpath, bool left)
-{
-    if (left) {
-        subpath->path.pop_back();
-        if (subpath->path.empty()) {
-            subpath->id.dst = subpath->id.src;
-            return;
-        }
-        subpath->id.dst = subpath->path.back().dst;
-    } else {
-        subpath->id.src = subpath->path.front().dst;
-        subpath->path.pop_front();
-    }
-}
-
-
-void
-Routing_module::get_cached_path(RoutePtr& route)
-{
-    RoutesMap::iterator rtes = local_routes.find(route->id);
-    if (rtes == local_routes.end()) {
-        // for (dp, dp) paths
-        ExtensionMap::iterator check = left_local.find(route);
-        if (check != left_local.end()) {
-            route = check->first;
-        }
-        return;
-    }
-
-    for (RouteList::const_iterator rte = rtes->second.begin();
-         rte != rtes->second.end(); ++rte)
-    {
-        if (routeq()(route, *rte)) {
-            route = *rte;
-            return;
-        }
-    }
-}
-
-
-bool
-Routing_module::remove(RouteMap& routes, const RoutePtr& route)
-{
-    RouteMap::iterator rtes = routes.find(route->id);
-    if (rtes != routes.end()) {
-        if (routeq()(route, rtes->second)) {
-            routes.erase(rtes);
-            return true;
-        }
-    }
-    return false;
-}
-
-
-bool
-Routing_module::remove(RoutesMap& routes, const RoutePtr& route)
-{
-    RoutesMap::iterator rtes = routes.find(route->id);
-    if (rtes != routes.end()) {
-        for (RouteList::iterator rte = rtes->second.begin();
-             rte != rtes->second.end(); ++rte)
-        {
-            if (routeq()(route, *rte)) {
-                rtes->second.erase(rte);
-                if (rtes->second.empty())
-                    routes.erase(rtes);
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
-
-bool
-Routing_module::remove(ExtensionMap& routes, const RoutePtr& route,
-                       const RoutePtr& subpath)
-{
-    ExtensionMap::iterator rtes = routes.find(subpath);
-    if (rtes != routes.end()) {
-        for (RouteList::iterator rte = rtes->second.begin();
-             rte != rtes->second.end(); ++rte)
-        {
-            if (routeq()(route, *rte)) {
-                rtes->second.erase(rte);
-                if (rtes->second.empty()) {
-                    routes.erase(rtes);
-                }
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
-
-void
-Routing_module::add(RouteMap& routes, const RoutePtr& route)
-{
-    routes[route->id] = route;
-}
-
-void
-Routing_module::add(RoutesMap& routes, const RoutePtr& route)
-{
-    RoutesMap::iterator rtes = routes.find(route->id);
-    if (rtes == routes.end()) {
-        routes[route->id] = RouteList(1, route);
-    } else {
-        uint32_t len = route->path.size();
-        for (RouteList::iterator rte = rtes->second.begin();
-             rte != rtes->second.end(); ++rte)
-        {
-            if ((*rte)->path.size() > len) {
-                rtes->second.insert(rte, route);
-                return;
-            }
-        }
-        rtes->second.push_back(route);
-    }
-}
-
-void
-Routing_module::add(ExtensionMap& routes, const RoutePtr& route,
-                    const RoutePtr& subpath)
-{
-    ExtensionMap::iterator rtes = routes.find(subpath);
-    if (rtes == routes.end()) {
-        routes[subpath] = RouteList(1, route);
-    } else {
-        rtes->second.push_back(route);
-    }
-}
-
 
 // Methods handling a Flow_in_event, setting up the route to permit the flow
 // all the way to its destination without having to go up to the controller for
@@ -725,10 +369,11 @@ Routing_module::setup_flow(const Flow& flow, const datapathid& dp,
         bool allow_overwrite = !flow.dl_dst.is_multicast();
         if (outport == OFPP_FLOOD) {
             uint64_t orig_dl = flow.dl_dst.hb_long();
-            const Topology::DpInfo& dpinfo = topology->get_dpinfo(dp);
-            check_openflow((dpinfo.ports.size() * max_output_action_len) + actions_len);
-            for (Topology::PortVector::const_iterator p_iter = dpinfo.ports.begin();
-                 p_iter != dpinfo.ports.end(); ++p_iter)
+            Topology::SnapshotPtr snapshot = topology->get_snapshot();
+            Topology::Snapshot::PortRange ports = snapshot->get_ports(dp);
+            check_openflow(((ports.second - ports.first) * max_output_action_len) + actions_len);
+            for (Topology::Snapshot::PortIterator p_iter = ports.first;
+                 p_iter != ports.second; ++p_iter)
             {
                 if (p_iter->port_no != inport && p_iter->port_no < OFPP_MAX) {
                     set_action(((uint8_t*)ofm->actions) + actions_len, dp,
@@ -830,7 +475,7 @@ Routing_module::setup_route(const Flow& flow, const Route& route,
         }
         ofm->match.in_port = htons(inport);
 
-        int err = send_openflow_command(dp, &ofm->header, false);
+        int err = send_flow_mod(dp);
         CHECK_OF_ERR(err, dp);
 
         if (lg.is_dbg_enabled()) {
@@ -865,6 +510,65 @@ Routing_module::setup_route(const Flow& flow, const Route& route,
 }
 
 
+void
+Routing_module::begin_install()
+{
+    batches.begin();
+}
+
+bool
+Routing_module::commit_install(const Install_callback& done)
+{
+    return batches.commit(done);
+}
+
+int
+Routing_module::send_batched(const datapathid& dp, const ofp_header* oh)
+{
+    return send_openflow_command(dp, oh, false);
+}
+
+Disposition
+Routing_module::handle_barrier_reply(const Event& e)
+{
+    const Barrier_reply_event& br = assert_cast<const Barrier_reply_event&>(e);
+    batches.barrier_reply(br.datapath_id, br.xid());
+    return CONTINUE;
+}
+
+Disposition
+Routing_module::handle_error(const Event& e)
+{
+    const Error_event& ee = assert_cast<const Error_event&>(e);
+    if (batches.error(ee.datapath_id, ee.xid())) {
+        VLOG_WARN(lg, "Install batch entry rejected by dp:%"PRIx64
+                  " with type %"PRIu16" code %"PRIu16".",
+                  ee.datapath_id.as_host(), ee.type, ee.code);
+    }
+    return CONTINUE;
+}
+
+Disposition
+Routing_module::handle_datapath_leave(const Event& e)
+{
+    const Datapath_leave_event& dl = assert_cast<const Datapath_leave_event&>(e);
+    batches.datapath_leave(dl.datapath_id);
+    return CONTINUE;
+}
+
+// Sends the flow entry in 'ofm' to 'dp', or queues it if a batch is open.
+
+int
+Routing_module::send_flow_mod(const datapathid& dp)
+{
+    if (!batches.is_open()) {
+        return send_openflow_command(dp, &ofm->header, false);
+    }
+    batches.queue(dp, &ofm->header);
+    return 0;
+}
+
+
 // return true if nat-ed, else false
 bool
 Routing_module::set_action(uint8_t *action, const datapathid& dp, uint16_t port,
@@ -936,11 +640,12 @@ Routing_module::send_packet(const datapathid& dp, uint16_t inport, uint16_t outp
                                ddladdr_groups, dnwaddr_groups, nat_flow);
         bool allow_overwrite = !flow.dl_dst.is_multicast();
         if (outport == OFPP_FLOOD) {
-            const Topology::DpInfo& dpinfo = topology->get_dpinfo(dp);
-            check_openflow(actions_len + (dpinfo.ports.size() * max_output_action_len));
+            Topology::SnapshotPtr snapshot = topology->get_snapshot();
+            Topology::Snapshot::PortRange ports = snapshot->get_ports(dp);
+            check_openflow(actions_len + ((ports.second - ports.first) * max_output_action_len));
             uint64_t orig_dl = flow.dl_dst.hb_long();
-            for (Topology::PortVector::const_iterator p_iter = dpinfo.ports.begin();
-                 p_iter != dpinfo.ports.end(); ++p_iter)
+            for (Topology::Snapshot::PortIterator p_iter = ports.first;
+                 p_iter != ports.second; ++p_iter)
             {
                 if (p_iter->port_no != inport && p_iter->port_no < OFPP_MAX) {
                     set_action(((uint8_t*)ofm->actions) + actions_len, dp,
@@ -21,7 +21,6 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_array.hpp>
 #include <list>
-#include <queue>
 #include <sstream>
 #include <vector>
 
@@ -29,12 +28,13 @@
 #include "event.hh"
 #include "flow.hh"
 #include "hash_map.hh"
-#include "hash_set.hh"
 #include "discovery/link-event.hh"
+#include "install-batches.hh"
 #include "nat_enforcer.hh"
 #include "netinet++/datapathid.hh"
 #include "netinet++/ethernetaddr.hh"
 #include "openflow/openflow.h"
+#include "shortest-paths.hh"
 #include "topology/topology.hh"
 
 
@@ -52,9 +52,10 @@ namespace applications {
  * the network.  Such components should list 'routing_module' in their meta.xml
  * dependencies.  See 'sprouting.hh/.cc' for an example.
  *
- * Uses algorithm described in "A New Approach to Dynamic All Pairs Shortest
- * Paths" by C. Demetrescu to perform incremental updates when links are
- * added/removed from the network instead of recomputing all shortest paths.
+ * Shortest paths are kept by Shortest_paths, which updates them incrementally
+ * when links are added/removed from the network instead of recomputing all
+ * of them.  Routes are built from it on request and cached until a path from
+ * their source datapath changes.
  *
  * All integer values are stored in host byte order and should be passed in as
  * such as well.
@@ -83,6 +84,7 @@ public:
 
     typedef boost::shared_ptr<Route> RoutePtr;
     typedef std::list<Nonowning_buffer> ActionList;
+    typedef Install_batches::Callback Install_callback;
 
     Routing_module(const container::Context*,
                    const json_object*);
@@ -142,6 +144,18 @@ public:
                      const GroupList *ddladdr_groups,
                      const GroupList *dnwaddr_groups);
 
+    // Installs routes in bulk.  Between begin_install() and commit_install(),
+    // setup_route() queues its entries by datapath instead of sending them.
+    // commit_install() then sends each datapath its entries back to back,
+    // followed by a barrier request, and calls 'done' once every datapath has
+    // answered its barrier - with 'true' if all entries are in place, or
+    // 'false' if any could not be sent, was rejected by its switch, or its
+    // switch left before answering.  'done' is called before commit_install()
+    // returns if nothing was queued.  Returns 'false' if no batch was open.
+
+    void begin_install();
+    bool commit_install(const Install_callback& done);
+
     bool setup_flow(const Flow& flow, const datapathid& dp,
                     uint16_t outport, uint32_t bid, const Buffer& buf,
                     uint16_t flow_timeout, const Buffer& actions,
@@ -169,35 +183,21 @@ private:
         bool operator()(const RouteId& a, const RouteId& b) const;
     };
 
-    struct routehash {
-        std::size_t operator()(const RoutePtr& rte) const;
-    };
-
-    struct routeq {
-        bool operator()(const RoutePtr& a, const RoutePtr& b) const;
+    // A route as built from the source's shortest path tree at 'version'.
+    struct CachedRoute {
+        RoutePtr route;
+        uint32_t version;
     };
 
-    struct ruleptrcmp {
-        bool operator()(const RoutePtr& a, const RoutePtr& b) const;
-    };
-
-    typedef std::list<RoutePtr> RouteList;
-    typedef hash_set<RoutePtr, routehash, routeq> RouteSet;
-    typedef hash_map<RouteId, RoutePtr, ridhash, rideq> RouteMap;
-    typedef hash_map<RouteId, RouteList, ridhash, rideq> RoutesMap;
-    typedef hash_map<RoutePtr, RouteList, routehash, routeq> ExtensionMap;
-    typedef std::priority_queue<RoutePtr, std::vector<RoutePtr>, ruleptrcmp> RouteQueue;
-
-    // Data structures needed by All-Pairs Shortest Path Algorithm
+    typedef hash_map<RouteId, CachedRoute, ridhash, rideq> RouteCache;
 
     Topology *topology;
     NAT_enforcer *nat;
-    RouteMap shortest;
-    RoutesMap local_routes;
-    ExtensionMap left_local;
-    ExtensionMap left_shortest;
-    ExtensionMap right_local;
-    ExtensionMap right_shortest;
+    Shortest_paths paths;
+    mutable RouteCache routes;
+    mutable std::vector<Shortest_paths::Hop> hops;
+
+    Install_batches batches;
 
     std::vector<const std::vector<uint64_t>*> nat_flow;
 
@@ -210,32 +210,17 @@ private:
     std::ostringstream os;
 
     Disposition handle_link_change(const Event&);
-
-    // All-pairs shortest path fns
-
-    void cleanup(RoutePtr, bool);
-    void clean_subpath(RoutePtr&, const RouteList&, RouteSet&, bool);
-    void clean_route(const RoutePtr&, RoutePtr&, bool);
-
-    void fixup(RouteQueue&, bool);
-    void add_local_routes(const RoutePtr&, const RoutePtr&,
-                          const RoutePtr&, RouteQueue&);
-
-    void set_subpath(RoutePtr&, bool);
-    void get_cached_path(RoutePtr&);
-
-    bool remove(RouteMap&, const RoutePtr&);
-    bool remove(RoutesMap&, const RoutePtr&);
-    bool remove(ExtensionMap&, const RoutePtr&, const RoutePtr&);
-    void add(RouteMap&, const RoutePtr&);
-    void add(RoutesMap&, const RoutePtr&);
-    void add(ExtensionMap&, const RoutePtr&, const RoutePtr&);
+    Disposition handle_barrier_reply(const Event&);
+    Disposition handle_error(const Event&);
+    Disposition handle_datapath_leave(const Event&);
+    int send_batched(const datapathid&, const ofp_header*);
 
     // Flow-in handler that sets up path
 
     void init_openflow(uint16_t);
     void check_openflow(uint16_t);
     void set_openflow(const Flow&, uint32_t, uint16_t);
+    int send_flow_mod(const datapathid&);
     bool set_openflow_actions(const Buffer&, const datapathid&, uint16_t, bool, bool);
     void modify_match(const Buffer&);
     bool set_action(uint8_t*, const datapathid&, uint16_t, uint16_t&, bool check_nat,
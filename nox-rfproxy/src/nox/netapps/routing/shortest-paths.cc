@@ -0,0 +1,299 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "shortest-paths.hh"
+
+#include <algorithm>
+
+namespace vigil {
+namespace applications {
+
+Shortest_paths::Shortest_paths()
+    : stride(0)
+{ }
+
+bool
+Shortest_paths::find_index(const datapathid& dp, uint32_t& index) const
+{
+    Index_map::const_iterator i = indices.find(dp);
+    if (i == indices.end()) {
+        return false;
+    }
+    index = i->second;
+    return true;
+}
+
+// Returns the index of 'dp', adding it with an empty tree if it is new.  The
+// trees are laid out again, at twice the stride, when they run out of room.
+
+uint32_t
+Shortest_paths::get_index(const datapathid& dp)
+{
+    uint32_t index;
+    if (find_index(dp, index)) {
+        return index;
+    }
+
+    index = dps.size();
+    if (index == stride) {
+        size_t new_stride = stride ? stride * 2 : 16;
+        Entry unreachable = { NONE, NONE, 0, 0 };
+        std::vector<Entry> new_trees(new_stride * new_stride, unreachable);
+        for (uint32_t src = 0; src < index; ++src) {
+            std::copy(tree(src), tree(src) + index,
+                      &new_trees[src * new_stride]);
+        }
+        trees.swap(new_trees);
+        stride = new_stride;
+    }
+
+    dps.push_back(dp);
+    out_links.push_back(std::vector<Edge>());
+    in_links.push_back(std::vector<Edge>());
+    versions.push_back(0);
+    marks.push_back(0);
+    indices[dp] = index;
+    tree(index)[index].dist = 0;
+    return index;
+}
+
+bool
+Shortest_paths::relax(Entry* t, uint32_t from, const Edge& edge)
+{
+    Entry& entry = t[edge.dp];
+    if (t[from].dist + 1 >= entry.dist) {
+        return false;
+    }
+    entry.dist = t[from].dist + 1;
+    entry.prev = from;
+    entry.outport = edge.outport;
+    entry.inport = edge.inport;
+    return true;
+}
+
+bool
+Shortest_paths::add_link(const datapathid& src, uint16_t outport,
+                         const datapathid& dst, uint16_t inport)
+{
+    uint32_t from = get_index(src);
+    uint32_t to = get_index(dst);
+
+    std::vector<Edge>& out = out_links[from];
+    for (std::vector<Edge>::const_iterator e = out.begin();
+         e != out.end(); ++e)
+    {
+        if (e->dp == to && e->outport == outport && e->inport == inport) {
+            return false;
+        }
+    }
+
+    Edge edge = { to, outport, inport };
+    out.push_back(edge);
+    edge.dp = from;
+    in_links[to].push_back(edge);
+    edge.dp = to;
+
+    // Only datapaths whose distance improves are visited, and since every
+    // improved path runs through the new link, a breadth-first walk from its
+    // destination finds each of them at its final distance.
+
+    for (uint32_t s = 0; s < dps.size(); ++s) {
+        Entry* t = tree(s);
+        if (t[from].dist == NONE || !relax(t, from, edge)) {
+            continue;
+        }
+        fifo.clear();
+        fifo.push_back(to);
+        for (size_t i = 0; i < fifo.size(); ++i) {
+            uint32_t dp = fifo[i];
+            const std::vector<Edge>& links = out_links[dp];
+            for (std::vector<Edge>::const_iterator e = links.begin();
+                 e != links.end(); ++e)
+            {
+                if (relax(t, dp, *e)) {
+                    fifo.push_back(e->dp);
+                }
+            }
+        }
+        ++versions[s];
+    }
+    return true;
+}
+
+bool
+Shortest_paths::remove_link(const datapathid& src, uint16_t outport,
+                            const datapathid& dst, uint16_t inport)
+{
+    uint32_t from, to;
+    if (!find_index(src, from) || !find_index(dst, to)) {
+        return false;
+    }
+
+    std::vector<Edge>& out = out_links[from];
+    std::vector<Edge>::iterator e;
+    for (e = out.begin(); e != out.end(); ++e) {
+        if (e->dp == to && e->outport == outport && e->inport == inport) {
+            break;
+        }
+    }
+    if (e == out.end()) {
+        return false;
+    }
+    out.erase(e);
+
+    std::vector<Edge>& in = in_links[to];
+    for (e = in.begin(); e != in.end(); ++e) {
+        if (e->dp == from && e->outport == outport && e->inport == inport) {
+            in.erase(e);
+            break;
+        }
+    }
+
+    for (uint32_t s = 0; s < dps.size(); ++s) {
+        const Entry& entry = tree(s)[to];
+        if (entry.prev == from && entry.outport == outport
+            && entry.inport == inport)
+        {
+            repair(s, to);
+        }
+    }
+    return true;
+}
+
+// Reattaches the subtree below 'dst' in the tree of 'src', after the link into
+// 'dst' has been removed.  Every other datapath keeps its distance, so each
+// one in the subtree is first offered the best link into it from outside the
+// subtree, and those offers are then settled in order of distance, extended
+// through the subtree, breadth first.  Datapaths left unreached are cut off.
+
+void
+Shortest_paths::repair(uint32_t src, uint32_t dst)
+{
+    Entry* t = tree(src);
+
+    subtree.clear();
+    subtree.push_back(dst);
+    marks[dst] = 1;
+    for (size_t i = 0; i < subtree.size(); ++i) {
+        uint32_t dp = subtree[i];
+        const std::vector<Edge>& links = out_links[dp];
+        for (std::vector<Edge>::const_iterator e = links.begin();
+             e != links.end(); ++e)
+        {
+            if (t[e->dp].prev == dp && !marks[e->dp]) {
+                marks[e->dp] = 1;
+                subtree.push_back(e->dp);
+            }
+        }
+    }
+    for (size_t i = 0; i < subtree.size(); ++i) {
+        t[subtree[i]].dist = NONE;
+        t[subtree[i]].prev = NONE;
+    }
+
+    seeds.clear();
+    for (size_t i = 0; i < subtree.size(); ++i) {
+        uint32_t dp = subtree[i];
+        const std::vector<Edge>& links = in_links[dp];
+        for (std::vector<Edge>::const_iterator e = links.begin();
+             e != links.end(); ++e)
+        {
+            if (!marks[e->dp] && t[e->dp].dist != NONE) {
+                Edge edge = { dp, e->outport, e->inport };
+                relax(t, e->dp, edge);
+            }
+        }
+        if (t[dp].dist != NONE) {
+            seeds.push_back(std::make_pair(t[dp].dist, dp));
+        }
+    }
+    std::sort(seeds.begin(), seeds.end());
+
+    // The seeds and the breadth-first queue are each in order of distance;
+    // settle whichever comes first.  Entries that have since been improved
+    // are skipped.
+
+    fifo.clear();
+    size_t next_seed = 0, next = 0;
+    while (next_seed < seeds.size() || next < fifo.size()) {
+        uint32_t dp, dist;
+        if (next == fifo.size()
+            || (next_seed < seeds.size()
+                && seeds[next_seed].first <= t[fifo[next]].dist))
+        {
+            dist = seeds[next_seed].first;
+            dp = seeds[next_seed++].second;
+            if (t[dp].dist != dist) {
+                continue;
+            }
+        } else {
+            dp = fifo[next++];
+        }
+
+        const std::vector<Edge>& links = out_links[dp];
+        for (std::vector<Edge>::const_iterator e = links.begin();
+             e != links.end(); ++e)
+        {
+            if (marks[e->dp] && relax(t, dp, *e)) {
+                fifo.push_back(e->dp);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < subtree.size(); ++i) {
+        marks[subtree[i]] = 0;
+    }
+    ++versions[src];
+}
+
+bool
+Shortest_paths::get_path(const datapathid& src, const datapathid& dst,
+                         std::vector<Hop>& path) const
+{
+    uint32_t from, to;
+    if (!find_index(src, from) || !find_index(dst, to)) {
+        return false;
+    }
+
+    const Entry* t = tree(from);
+    if (t[to].dist == NONE) {
+        return false;
+    }
+
+    path.resize(t[to].dist);
+    for (uint32_t dp = to, i = t[to].dist; i > 0; dp = t[dp].prev) {
+        Hop& hop = path[--i];
+        hop.dst = dps[dp];
+        hop.outport = t[dp].outport;
+        hop.inport = t[dp].inport;
+    }
+    return true;
+}
+
+bool
+Shortest_paths::get_version(const datapathid& src, uint32_t& version) const
+{
+    uint32_t index;
+    if (!find_index(src, index)) {
+        return false;
+    }
+    version = versions[index];
+    return true;
+}
+
+}
+}
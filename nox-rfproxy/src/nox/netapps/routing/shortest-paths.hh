@@ -0,0 +1,123 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SHORTEST_PATHS_HH
+#define SHORTEST_PATHS_HH 1
+
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "hash_map.hh"
+#include "netinet++/datapathid.hh"
+
+namespace vigil {
+namespace applications {
+
+/*
+ * Dynamic all-pairs shortest paths, by hop count, between datapaths.
+ *
+ * The topology is kept as arrays of outgoing and incoming links per
+ * datapath, and the paths as one shortest path tree per source: for every
+ * (source, destination) pair, the distance and the link by which the tree
+ * reaches the destination, in one flat source-major array.  Paths are read
+ * off the trees on demand.
+ *
+ * Changes are applied incrementally.  Adding a link relaxes, for each source
+ * that it brings closer to the link's destination, only the datapaths whose
+ * distance improves.  Removing a link touches only the sources whose tree
+ * used it, and in each of those only the subtree below the link, which is
+ * reattached through the best remaining links into it.  Where several
+ * shortest paths exist, the one already in use is kept.
+ */
+
+class Shortest_paths {
+
+public:
+    /* A link on a path: to 'dst', leaving the previous datapath by
+     * 'outport' and entering 'dst' by 'inport'. */
+    struct Hop {
+        datapathid dst;
+        uint16_t outport;
+        uint16_t inport;
+    };
+
+    Shortest_paths();
+
+    bool add_link(const datapathid& src, uint16_t outport,
+                  const datapathid& dst, uint16_t inport);
+    bool remove_link(const datapathid& src, uint16_t outport,
+                     const datapathid& dst, uint16_t inport);
+
+    bool get_path(const datapathid& src, const datapathid& dst,
+                  std::vector<Hop>& path) const;
+    bool get_version(const datapathid& src, uint32_t& version) const;
+
+    size_t get_n_datapaths() const { return dps.size(); }
+
+private:
+    static const uint32_t NONE = ~(uint32_t)0;
+
+    /* A link between datapaths, by index; 'dp' is the datapath at the other
+     * end from the array that holds it. */
+    struct Edge {
+        uint32_t dp;
+        uint16_t outport;
+        uint16_t inport;
+    };
+
+    /* How a source's tree reaches a datapath: from 'prev' through the given
+     * ports, at 'dist' hops.  'prev' is NONE for the source itself and for
+     * unreachable datapaths. */
+    struct Entry {
+        uint32_t dist;
+        uint32_t prev;
+        uint16_t outport;
+        uint16_t inport;
+    };
+
+    typedef hash_map<datapathid, uint32_t> Index_map;
+
+    std::vector<datapathid> dps;
+    Index_map indices;
+    std::vector<std::vector<Edge> > out_links;
+    std::vector<std::vector<Edge> > in_links;
+
+    /* Entry of destination 'd' in the tree of source 's' is at
+     * 's * stride + d'. */
+    size_t stride;
+    std::vector<Entry> trees;
+    std::vector<uint32_t> versions;     // Bumped when a source's tree changes.
+
+    /* Scratch space for repair(). */
+    std::vector<uint8_t> marks;
+    std::vector<uint32_t> subtree;
+    std::vector<uint32_t> fifo;
+    std::vector<std::pair<uint32_t, uint32_t> > seeds;
+
+    uint32_t get_index(const datapathid&);
+    bool find_index(const datapathid&, uint32_t&) const;
+    Entry* tree(uint32_t src) { return &trees[src * stride]; }
+    const Entry* tree(uint32_t src) const { return &trees[src * stride]; }
+    bool relax(Entry*, uint32_t from, const Edge&);
+    void repair(uint32_t src, uint32_t dst);
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,152 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Immutable snapshots of the topology, kept apart from the component so
+ * they can be built and tested on their own. */
+#include "topology.hh"
+
+#include <algorithm>
+
+namespace vigil {
+namespace applications {
+
+static bool
+link_less(const Topology::Snapshot::Link& a, const Topology::Snapshot::Link& b)
+{
+    if (a.dst != b.dst) {
+        return a.dst < b.dst;
+    } else if (a.ports.src != b.ports.src) {
+        return a.ports.src < b.ports.src;
+    }
+    return a.ports.dst < b.ports.dst;
+}
+
+static bool
+link_dst_less(const Topology::Snapshot::Link& a,
+              const Topology::Snapshot::Link& b)
+{
+    return a.dst < b.dst;
+}
+
+Topology::Snapshot::Snapshot(const NetworkLinkMap& topology, uint64_t version_)
+    : version(version_)
+{
+    dps.reserve(topology.size());
+    for (NetworkLinkMap::const_iterator nlm_iter = topology.begin();
+         nlm_iter != topology.end(); ++nlm_iter)
+    {
+        dps.push_back(nlm_iter->first);
+    }
+    std::sort(dps.begin(), dps.end());
+
+    active.reserve(dps.size());
+    port_offsets.reserve(dps.size() + 1);
+    internal_offsets.reserve(dps.size() + 1);
+    link_offsets.reserve(dps.size() + 1);
+    for (uint32_t i = 0; i < dps.size(); ++i) {
+        const DpInfo& di = topology.find(dps[i])->second;
+        active.push_back(di.active);
+
+        port_offsets.push_back(ports.size());
+        ports.insert(ports.end(), di.ports.begin(), di.ports.end());
+
+        internal_offsets.push_back(internal.size());
+        for (PortMap::const_iterator pm_iter = di.internal.begin();
+             pm_iter != di.internal.end(); ++pm_iter)
+        {
+            internal.push_back(pm_iter->first);
+        }
+        std::sort(internal.begin() + internal_offsets.back(), internal.end());
+
+        link_offsets.push_back(links.size());
+        for (DatapathLinkMap::const_iterator dlm_iter = di.outlinks.begin();
+             dlm_iter != di.outlinks.end(); ++dlm_iter)
+        {
+            Link link;
+            if (!find(dlm_iter->first, link.dst)) {
+                continue;
+            }
+            for (LinkSet::const_iterator ls_iter = dlm_iter->second.begin();
+                 ls_iter != dlm_iter->second.end(); ++ls_iter)
+            {
+                link.ports = *ls_iter;
+                links.push_back(link);
+            }
+        }
+        std::sort(links.begin() + link_offsets.back(), links.end(), link_less);
+    }
+    port_offsets.push_back(ports.size());
+    internal_offsets.push_back(internal.size());
+    link_offsets.push_back(links.size());
+}
+
+bool
+Topology::Snapshot::find(const datapathid& dp, uint32_t& index) const
+{
+    std::vector<datapathid>::const_iterator i
+        = std::lower_bound(dps.begin(), dps.end(), dp);
+    if (i == dps.end() || *i != dp) {
+        return false;
+    }
+    index = i - dps.begin();
+    return true;
+}
+
+Topology::Snapshot::PortRange
+Topology::Snapshot::get_ports(uint32_t index) const
+{
+    return PortRange(ports.begin() + port_offsets[index],
+                     ports.begin() + port_offsets[index + 1]);
+}
+
+Topology::Snapshot::PortRange
+Topology::Snapshot::get_ports(const datapathid& dp) const
+{
+    uint32_t index;
+    if (!find(dp, index)) {
+        return PortRange(ports.end(), ports.end());
+    }
+    return get_ports(index);
+}
+
+Topology::Snapshot::LinkRange
+Topology::Snapshot::get_outlinks(uint32_t src) const
+{
+    return LinkRange(links.begin() + link_offsets[src],
+                     links.begin() + link_offsets[src + 1]);
+}
+
+Topology::Snapshot::LinkRange
+Topology::Snapshot::get_outlinks(uint32_t src, uint32_t dst) const
+{
+    Link key;
+    key.dst = dst;
+    return std::equal_range(links.begin() + link_offsets[src],
+                            links.begin() + link_offsets[src + 1],
+                            key, link_dst_less);
+}
+
+bool
+Topology::Snapshot::is_internal(uint32_t index, uint16_t port) const
+{
+    return std::binary_search(internal.begin() + internal_offsets[index],
+                              internal.begin() + internal_offsets[index + 1],
+                              port);
+}
+
+}
+}
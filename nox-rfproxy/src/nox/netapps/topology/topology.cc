@@ -38,7 +38,7 @@ static Vlog_module lg("topology");
 
 Topology::Topology(const Context* c,
                    const json_object*)
-    : Component(c)
+    : Component(c), version(0)
 {
     empty_dp.active = false;
 
@@ -120,6 +120,16 @@ Topology::get_outlinks(const datapathid& dpsrc, const datapathid& dpdst) const
 }
 
 
+Topology::SnapshotPtr
+Topology::get_snapshot() const
+{
+    if (!snapshot || snapshot->get_version() != version) {
+        snapshot.reset(new Snapshot(topology, version));
+    }
+    return snapshot;
+}
+
+
 bool
 Topology::is_internal(const datapathid& dp, uint16_t port) const
 {
@@ -147,6 +157,7 @@ Topology::handle_datapath_join(const Event& e)
 
     nlm_iter->second.active = true;
     nlm_iter->second.ports = dj.ports;
+    ++version;
     return CONTINUE;
 }
 
@@ -165,6 +176,7 @@ Topology::handle_datapath_leave(const Event& e)
         } else {
             topology.erase(nlm_iter);
         }
+        ++version;
     } else {
         VLOG_ERR(lg, "Received datapath_leave for non-existing dp %"PRIx64".",
                  dl.datapath_id.as_host());
@@ -183,6 +195,7 @@ Topology::handle_port_status(const Event& e)
         add_port(ps.datapath_id, ps.port, ps.reason != OFPPR_ADD);
     }
 
+    ++version;
     return CONTINUE;
 }
 
@@ -256,6 +269,7 @@ Topology::handle_link_event(const Event& e)
         lg.err("unknown link action %u", le.action);
     }
 
+    ++version;
     return CONTINUE;
 }
 
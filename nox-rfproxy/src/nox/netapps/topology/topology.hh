@@ -19,6 +19,8 @@
 #define TOPOLOGY_HH 1
 
 #include <list>
+#include <vector>
+#include <boost/shared_ptr.hpp>
 
 #include "component.hh"
 #include "hash_map.hh"
@@ -32,6 +34,12 @@ namespace applications {
 /** \ingroup noxcomponents
  *
  * \brief The current network topology  
+ *
+ * Besides the per-datapath queries, the topology can be read through
+ * immutable snapshots, which stay valid and unchanged while later events
+ * update the topology.  Each change bumps the topology's version; the
+ * snapshot for a version is built when first asked for and then shared by
+ * every reader of that version.
  */
 class Topology
     : public container::Component {
@@ -67,6 +75,83 @@ public:
         bool active;
     };
 
+    /** \brief Immutable view of the topology at one version
+     *
+     * Datapaths are numbered by increasing datapath id, from 0 to
+     * get_n_datapaths() - 1.  Their ports, internal ports and outgoing links
+     * are kept in compressed arrays: one array of each for all datapaths, with
+     * each datapath's entries contiguous, and outgoing links sorted by the
+     * number of the datapath at the other end.
+     */
+    class Snapshot {
+    public:
+        /** \brief Outgoing link, to datapath number 'dst'
+         */
+        struct Link {
+            uint32_t dst;
+            LinkPorts ports;
+        };
+
+        typedef std::vector<Port>::const_iterator PortIterator;
+        typedef std::vector<Link>::const_iterator LinkIterator;
+        typedef std::pair<PortIterator, PortIterator> PortRange;
+        typedef std::pair<LinkIterator, LinkIterator> LinkRange;
+
+        /** \brief Build snapshot of 'topology' at 'version'
+         */
+        Snapshot(const hash_map<datapathid, DpInfo>& topology,
+                 uint64_t version);
+
+        /** \brief Get version of topology
+         */
+        uint64_t get_version() const { return version; }
+        /** \brief Get number of datapaths
+         */
+        uint32_t get_n_datapaths() const { return dps.size(); }
+        /** \brief Get number of datapath, false if unknown
+         */
+        bool find(const datapathid& dp, uint32_t& index) const;
+        /** \brief Get datapath id of datapath number 'index'
+         */
+        const datapathid& get_datapath(uint32_t index) const
+            { return dps[index]; }
+        /** \brief Check if datapath is active
+         */
+        bool is_active(uint32_t index) const { return active[index]; }
+        /** \brief Get ports of datapath
+         */
+        PortRange get_ports(uint32_t index) const;
+        /** \brief Get ports of datapath, none if unknown
+         */
+        PortRange get_ports(const datapathid& dp) const;
+        /** \brief Get outgoing links of datapath
+         */
+        LinkRange get_outlinks(uint32_t src) const;
+        /** \brief Get links between two datapaths
+         */
+        LinkRange get_outlinks(uint32_t src, uint32_t dst) const;
+        /** \brief Check if link is internal (i.e., between switches)
+         */
+        bool is_internal(uint32_t index, uint16_t port) const;
+
+    private:
+        uint64_t version;
+        std::vector<datapathid> dps;
+        std::vector<bool> active;
+        /* Entries of datapath 'i' are at [offsets[i], offsets[i + 1]). */
+        std::vector<uint32_t> port_offsets;
+        std::vector<Port> ports;
+        std::vector<uint32_t> internal_offsets;
+        std::vector<uint16_t> internal;
+        std::vector<uint32_t> link_offsets;
+        std::vector<Link> links;
+
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+    };
+
+    typedef boost::shared_ptr<const Snapshot> SnapshotPtr;
+
     /** \brief Constructor
      */
     Topology(const container::Context*, const json_object*);
@@ -95,6 +180,12 @@ public:
     /** \brief Check if link is internal (i.e., between switches)
      */
     bool is_internal(const datapathid& dp, uint16_t port) const;
+    /** \brief Get version of topology, bumped on every change
+     */
+    uint64_t get_version() const { return version; }
+    /** \brief Get snapshot of current topology
+     */
+    SnapshotPtr get_snapshot() const;
 
 private:
     /** \brief Map of information index by datapath id
@@ -103,6 +194,8 @@ private:
     NetworkLinkMap topology;
     DpInfo empty_dp;
     LinkSet empty_link_set;
+    uint64_t version;
+    mutable SnapshotPtr snapshot;
 
     //Topology() { }
 
@@ -52,6 +52,7 @@ namespace vigil
 {
 
 class Buffer;
+class Event_dispatcher;
 class Openflow_connection;
 class Openflow_connection_factory;
 class Co_sema;
@@ -60,11 +61,18 @@ namespace nox {
 
 typedef boost::function<void()> Callback;
 
-void init();
+/* Initializes the core.  If 'n_io_threads' is nonzero, switch connections
+ * are read and parsed by that many I/O threads, each serving a fixed subset
+ * of the switches, instead of by the main thread. */
+void init(unsigned int n_io_threads = 0);
 
 /* Get a reference to the main poll loop. */
 Poll_loop* get_poll_loop();
 
+/* Get a reference to the event dispatcher, e.g. to configure its queues or
+ * read its statistics. */
+Event_dispatcher* get_event_dispatcher();
+
 void connect(Openflow_connection_factory*, bool reliable);
 void register_conn(Openflow_connection*, Co_sema*);
 void run();
@@ -31,17 +31,18 @@ class Packet_classifier
 {
 public:
     Packet_classifier(uint32_t split_field, int n_buckets)
-        : Classifier<Packet_expr, Pexpr_action>(split_field, n_buckets), result(NULL) { }
+        : Classifier<Packet_expr, Pexpr_action>(split_field, n_buckets) { }
     Packet_classifier()
-        : Classifier<Packet_expr, Pexpr_action>(), result(NULL) { }
+        : Classifier<Packet_expr, Pexpr_action>() { }
     ~Packet_classifier() { }
 
     void register_packet_in();
+
+    /* Runs the actions of the highest priority rules that match the packet.
+     * Safe to call from any thread. */
     Disposition handle_packet_in(const Event& e);
 
 private:
-    Cnode_result<Packet_expr, Pexpr_action, Flow> result;
-
     Packet_classifier(const Packet_classifier&);
     Packet_classifier& operator=(const Packet_classifier&);
 };
@@ -165,7 +165,8 @@ void usage(const char* program_name)
            "  -i pcapt:FILE[:OUTFILE] same as \"pcap\", but delay packets based on pcap timestamps\n"
            "  -i pgen:                continuously generate packet-in events\n"
            "\nNetwork control options (must also specify an interface):\n"
-           "  -u, --unreliable        do not reconnect to interfaces on error\n",
+           "  -u, --unreliable        do not reconnect to interfaces on error\n"
+           "  --io-threads=N          read from TCP switches in N I/O threads\n",
 	   program_name, program_name, OFP_TCP_PORT, OFP_SSL_PORT);
     leak_checker_usage();
     printf("\nOther options:\n"
@@ -177,6 +178,7 @@ void usage(const char* program_name)
 	   "  -v, --verbose           set maximum verbosity level (for console)\n"
 #ifndef LOG4CXX_ENABLED
 	   "  -v, --verbose=CONFIG    configure verbosity\n"
+	   "  --log-file=FILE         also write console log messages to FILE\n"
 #endif
 	   "  -h, --help              display this help message\n"
 	   "  -V, --version           display version information\n");
@@ -240,12 +242,21 @@ int start_gui() {
 bool verbose = false;
 #ifndef LOG4CXX_ENABLED
 vector<string> verbosity;
+const char* log_file = 0;
 #endif
 
 void init_log() {
 #ifndef LOG4CXX_ENABLED
     static Vlog_server_socket vlog_server(vlog());
     vlog_server.listen();
+
+    /* Hand log output to a writer thread, now that any fork is done. */
+    vlog().start_writer();
+    if (log_file && !vlog().set_log_file(log_file)) {
+        fprintf(stderr, "Unable to open log file '%s': %s\n",
+                log_file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 #endif
 
 #ifdef LOG4CXX_ENABLED
@@ -291,6 +302,7 @@ int main(int argc, char *argv[])
     bool reliable = true;
     bool daemon_flag = false;
     bool gui_flag = false;
+    unsigned int n_io_threads = 0;
     vector<string> interfaces;
 
     string conf = PKGSYSCONFDIR"/nox.json";
@@ -311,7 +323,9 @@ int main(int argc, char *argv[])
     for (;;) {
         enum {
             OPT_CHECK_LEAKS = UCHAR_MAX + 1,
-            OPT_LEAK_LIMIT
+            OPT_LEAK_LIMIT,
+            OPT_IO_THREADS,
+            OPT_LOG_FILE
         };
         static struct option long_options[] = {
             {"daemon",      no_argument, 0, 'd'},
@@ -328,10 +342,13 @@ int main(int argc, char *argv[])
             {"check-leaks", required_argument, 0, OPT_CHECK_LEAKS},
             {"leak-limit",  required_argument, 0, OPT_LEAK_LIMIT},
 
+            {"io-threads",  required_argument, 0, OPT_IO_THREADS},
+
 #ifdef LOG4CXX_ENABLED
             {"verbose",     no_argument, 0, 'v'},
 #else
             {"verbose",     optional_argument, 0, 'v'},
+            {"log-file",    required_argument, 0, OPT_LOG_FILE},
 #endif
             {"help",        no_argument, 0, 'h'},
             {"version",     no_argument, 0, 'V'},
@@ -405,6 +422,16 @@ int main(int argc, char *argv[])
             leak_checker_set_limit(strtoll(optarg,NULL,10));
             break;
 
+        case OPT_IO_THREADS:
+            n_io_threads = strtoul(optarg, NULL, 10);
+            break;
+
+#ifndef LOG4CXX_ENABLED
+        case OPT_LOG_FILE:
+            log_file = optarg;
+            break;
+#endif
+
         case 'V':
             hello(program_name);
             exit(EXIT_SUCCESS);
@@ -507,7 +534,7 @@ int main(int argc, char *argv[])
         }
 
         /* Boot the container */
-        nox::init();
+        nox::init(n_io_threads);
         Kernel::init(info_file, argc, argv);
         Kernel* kernel = Kernel::get_instance();
     
@@ -0,0 +1,260 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Measures packet-in classification with thousands of rules of the kind
+ * registered with register_handler_on_match(): through the Cnode tree, both
+ * unbuilt and built, and through the flattened lookup, single-threaded and
+ * from several threads at once.  Then measures rule churn (replacing one rule
+ * with an equal one) on the built tree: incrementally, incrementally with a
+ * flattened lookup (which publishes the change) after each change,
+ * incrementally within updates of UPDATE_SIZE changes, and followed by a
+ * build() as keeping the tree built used to require.
+ *
+ * Usage: bench-classifier [N_RULES [N_THREADS]] */
+
+#include "classifier.hh"
+#include "expr.hh"
+#include "flow.hh"
+#include <boost/function.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+
+using namespace vigil;
+
+typedef boost::function<void()> Bench_action;
+typedef Classifier<Packet_expr, Bench_action> Bench_classifier;
+
+static const int N_FLOWS = 4096;
+static const unsigned long int N_LOOKUPS = 1000000;
+static const unsigned long int N_CHANGES = 100000;
+static const int UPDATE_SIZE = 64;
+
+static Bench_classifier classifier;
+static std::vector<Flow> flows;
+static std::vector<uint32_t> ids;
+
+static double
+now()
+{
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+report(const char* what, double elapsed, unsigned long int n,
+       const char* unit = "lookup")
+{
+    printf("%-32s %8.1f ns/%s\n", what, elapsed * 1e9 / n, unit);
+}
+
+static void
+set_field(Packet_expr& expr, Packet_expr::Expr_field field, uint32_t v0,
+          uint32_t v1 = 0)
+{
+    uint32_t value[Packet_expr::MAX_FIELD_LEN] = { v0, v1 };
+    expr.set_field(field, value);
+}
+
+/* Adds a rule in one of a few typical shapes, and a flow that hits it. */
+static void
+add_rule(int i)
+{
+    Packet_expr expr;
+    Flow flow;
+    flow.in_port = rand() % 48;
+    flow.dl_type = 0x0800;
+    flow.nw_proto = 6;
+    flow.nw_src = rand();
+    flow.nw_dst = rand();
+    flow.tp_src = rand();
+    flow.tp_dst = rand();
+    uint8_t mac[6] = { 0, 0, rand(), rand(), rand(), rand() };
+    flow.dl_src = ethernetaddr(mac);
+
+    switch (i % 4) {
+    case 0:                     /* Per-destination forwarding. */
+        set_field(expr, Packet_expr::DL_TYPE, flow.dl_type);
+        set_field(expr, Packet_expr::NW_DST, flow.nw_dst);
+        break;
+    case 1:                     /* Per-service handling. */
+        set_field(expr, Packet_expr::DL_TYPE, flow.dl_type);
+        set_field(expr, Packet_expr::NW_PROTO, flow.nw_proto);
+        set_field(expr, Packet_expr::TP_DST, flow.tp_dst);
+        break;
+    case 2: {                   /* Per-host, per-port authentication. */
+        uint32_t words[2];
+        memcpy(words, mac, sizeof mac);
+        set_field(expr, Packet_expr::AP_SRC, flow.in_port);
+        set_field(expr, Packet_expr::DL_SRC, words[0], words[1]);
+        break;
+    }
+    case 3:                     /* Per-source policy. */
+        set_field(expr, Packet_expr::DL_TYPE, flow.dl_type);
+        set_field(expr, Packet_expr::NW_SRC, flow.nw_src);
+        break;
+    }
+    ids.push_back(classifier.add_rule(rand() % 100, expr, Bench_action()));
+    if (flows.size() < N_FLOWS) {
+        flows.push_back(flow);
+    }
+}
+
+static unsigned long int
+lookup_flows(unsigned long int n)
+{
+    unsigned long int hits = 0;
+    Bench_classifier::Lookup_result result;
+    for (unsigned long int i = 0; i < n; i++) {
+        classifier.lookup(flows[i % flows.size()], result);
+        hits += result.size();
+    }
+    return hits;
+}
+
+static unsigned long int
+tree_lookup_flows(unsigned long int n)
+{
+    unsigned long int hits = 0;
+    Cnode_result<Packet_expr, Bench_action, Flow> result(NULL);
+    for (unsigned long int i = 0; i < n; i++) {
+        result.set_data(&flows[i % flows.size()]);
+        classifier.get_rules(result);
+        const Rule<Packet_expr, Bench_action>* r = result.next();
+        if (r) {
+            uint32_t top = r->priority;
+            do {
+                hits++;
+                r = result.next();
+            } while (r && r->priority == top);
+        }
+        result.clear();
+    }
+    return hits;
+}
+
+/* Replaces rule 'i' with a copy, as a policy application changing its rules
+ * would. */
+static void
+replace_rule(unsigned long int i)
+{
+    uint32_t& id = ids[i % ids.size()];
+    const Rule<Packet_expr, Bench_action>* rule = classifier.get_rule(id);
+    uint32_t priority = rule->priority;
+    Packet_expr expr = rule->expr;
+    classifier.delete_rule(id);
+    id = classifier.add_rule(priority, expr, Bench_action());
+}
+
+static void*
+lookup_thread(void* n)
+{
+    lookup_flows(*(unsigned long int*) n);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int n_rules = argc > 1 ? atoi(argv[1]) : 5000;
+    int n_threads = argc > 2 ? atoi(argv[2]) : 4;
+    unsigned long int n = N_LOOKUPS;
+
+    srand(1);
+    for (int i = 0; i < n_rules; i++) {
+        add_rule(i);
+    }
+    printf("%d rules, %d flows\n", n_rules, (int) flows.size());
+
+    /* The tree is far slower, so give it fewer lookups. */
+    unsigned long int n_tree = n / 100;
+    double start = now();
+    unsigned long int tree_hits = tree_lookup_flows(n_tree);
+    report("Cnode tree, unbuilt", now() - start, n_tree);
+
+    unsigned long int hits = lookup_flows(n_tree);
+    if (hits != tree_hits) {
+        fprintf(stderr, "flat lookup found %lu rules, tree found %lu\n",
+                hits, tree_hits);
+        return 1;
+    }
+
+    classifier.build();
+    start = now();
+    tree_lookup_flows(n);
+    report("Cnode tree, built", now() - start, n);
+
+    start = now();
+    lookup_flows(n);
+    report("flat, 1 thread", now() - start, n);
+
+    std::vector<pthread_t> threads(n_threads);
+    start = now();
+    for (int i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, lookup_thread, &n);
+    }
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    char what[64];
+    snprintf(what, sizeof what, "flat, %d threads (aggregate)", n_threads);
+    report(what, now() - start, n * n_threads);
+
+    start = now();
+    for (unsigned long int i = 0; i < N_CHANGES; i++) {
+        replace_rule(i);
+    }
+    report("churn, incremental", now() - start, N_CHANGES, "change");
+
+    Bench_classifier::Lookup_result result;
+    start = now();
+    for (unsigned long int i = 0; i < N_CHANGES; i++) {
+        replace_rule(i);
+        classifier.lookup(flows[i % flows.size()], result);
+    }
+    report("churn, lookup after each", now() - start, N_CHANGES, "change");
+
+    start = now();
+    for (unsigned long int i = 0; i < N_CHANGES; i++) {
+        if (i % UPDATE_SIZE == 0) {
+            classifier.begin_update();
+        }
+        replace_rule(i);
+        if (i % UPDATE_SIZE == UPDATE_SIZE - 1) {
+            classifier.commit_update();
+        }
+    }
+    classifier.commit_update();
+    snprintf(what, sizeof what, "churn, updates of %d", UPDATE_SIZE);
+    report(what, now() - start, N_CHANGES, "change");
+
+    start = now();
+    for (unsigned long int i = 0; i < N_CHANGES / 100; i++) {
+        replace_rule(i);
+        classifier.build();
+    }
+    report("churn, build() after each", now() - start, N_CHANGES / 100,
+           "change");
+
+    start = now();
+    tree_lookup_flows(n);
+    report("Cnode tree, after churn", now() - start, n);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Measures the cost of arming, rearming, canceling and expiring a large
+ * number of timers, as kept by applications with per-flow or per-host idle
+ * timeouts.
+ *
+ * Usage: bench-timer-dispatcher [N_TIMERS] */
+
+#include "timer-dispatcher.hh"
+#include "threads/cooperative.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace vigil;
+
+static unsigned long int n_fired;
+
+static void
+fire()
+{
+    n_fired++;
+}
+
+static double
+now()
+{
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+report(const char* what, double elapsed, unsigned long int n)
+{
+    printf("%-28s %8.1f ns/timer\n", what, elapsed * 1e9 / n);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long int n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    Timer_dispatcher td;
+    Pollable& pollable = td;
+    std::vector<Timer> timers(n);
+    srand(1);
+
+    /* Idle timeouts between 1 second and 1 hour. */
+    double start = now();
+    for (unsigned long int i = 0; i < n; i++) {
+        timers[i] = td.post(fire, make_timeval(1 + rand() % 3600, 0));
+    }
+    report("arm", now() - start, n);
+
+    start = now();
+    for (unsigned long int i = 0; i < n; i++) {
+        timers[i].reset(1 + rand() % 3600, 0);
+    }
+    report("rearm", now() - start, n);
+
+    start = now();
+    for (unsigned long int i = 0; i < n; i++) {
+        timers[i].delay(false, 5, 0);
+    }
+    report("delay", now() - start, n);
+
+    start = now();
+    for (unsigned long int i = 0; i < n; i++) {
+        timers[i].cancel();
+    }
+    report("cancel", now() - start, n);
+
+    /* Timers due within the next 100 ms, all fired by a single poll. */
+    for (unsigned long int i = 0; i < n; i++) {
+        timers[i] = td.post(fire, make_timeval(0, rand() % 100000));
+    }
+    usleep(200000);
+    start = now();
+    pollable.poll();
+    report("expire", now() - start, n);
+
+    if (n_fired != n) {
+        fprintf(stderr, "fired %lu timers, expected %lu\n", n_fired, n);
+        return 1;
+    }
+    return 0;
+}
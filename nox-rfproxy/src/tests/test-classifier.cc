@@ -36,6 +36,7 @@ using namespace vigil;
 typedef std::list<pair<uint32_t,Rule<Packet_expr, void*> > > Rule_list;
 
 void add_rmv_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules);
+void update_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules);
 void check_lookup(Classifier_t<Packet_expr, void *>& test, Rule_list& rules);
 bool read_rules(const char *filename, Rule_list& exprs);
 bool set_field(Packet_expr& expr, std::string type, std::string strvalue);
@@ -110,6 +111,10 @@ main(int argc, char *argv[])
     add_rmv_test(test, rules);
 //    test.print();
 
+//    printf("Updating rules in a batch...\n");
+    update_test(test, rules);
+//    test.print();
+
     if (to_delete.size() > 0) {
 //        printf("Deleting exprs and cleaning...\n");
         for (Rule_list::iterator iter = to_delete.begin(); iter != to_delete.end(); ++iter)
@@ -197,6 +202,49 @@ add_rmv_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules)
     check_lookup(test, rules);
 }
 
+/*
+ * Deletes, re-adds and reprioritizes rules within an update, checking that
+ * lookups see none of the changes until the update is committed.
+ */
+
+void
+update_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules)
+{
+    test.begin_update();
+
+    int i = 0;
+    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter) {
+        if (i++ % 2 == 0)
+            EXIT_ASSERT(test.check_delete_rule(iter->first));
+    }
+    check_lookup(test, rules);
+
+    i = 0;
+    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter) {
+        if (i++ % 2 == 0)
+            EXIT_ASSERT((iter->first = test.check_add_rule(iter->second.priority,
+                                                           iter->second.expr,
+                                                           iter->second.action)) != 0);
+        else
+            EXIT_ASSERT(test.check_change_rule_priority(iter->first,
+                                                        iter->second.priority + 1));
+    }
+    check_lookup(test, rules);
+
+    test.commit_update();
+    check_lookup(test, rules);
+
+//    printf("   Deleting rules, then re-adding them...\n");
+    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter)
+        EXIT_ASSERT(test.check_delete_rule(iter->first));
+    check_lookup(test, rules);
+    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter)
+        EXIT_ASSERT((iter->first = test.check_add_rule(iter->second.priority,
+                                                       iter->second.expr,
+                                                       iter->second.action)) != 0);
+    check_lookup(test, rules);
+}
+
 void
 check_lookup(Classifier_t<Packet_expr, void *>& test, Rule_list& rules)
 {
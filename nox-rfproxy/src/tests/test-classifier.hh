@@ -18,13 +18,18 @@
 #ifndef CLASSIFIER_TEST_HH
 #define CLASSIFIER_TEST_HH
 
+#include <algorithm>
+#include <vector>
+
 #include "classifier.hh"
 
 /*
  * Classifier test class.
  *
- * Compares Classifier results to a linear
- * list classifier's results.
+ * Compares Classifier results, from both the Cnode tree and the flattened
+ * lookup, to a linear list classifier's results.  Between begin_update() and
+ * commit_update(), changes go to a copy of the linear list, and lookups are
+ * still compared to the list as it was when the update began.
  */
 
 template<class Expr, typename Action>
@@ -33,8 +38,11 @@ class Classifier_t {
 public:
     typedef std::list<vigil::Rule<Expr, Action> > Rule_list;
 
+    Classifier_t() : updating(false) { }
+
     uint32_t check_add_rule(uint32_t, const Expr&, Action);
     bool check_delete_rule(uint32_t);
+    bool check_change_rule_priority(uint32_t, uint32_t);
 
     template<class Data>
     bool check_delete_rules(const Data *data);
@@ -46,6 +54,8 @@ public:
     void unbuild() { classifier.unbuild(); }
     void clean() { classifier.clean(); }
     void print() const { classifier.print(); }
+    void begin_update();
+    void commit_update();
 
     vigil::Classifier<Expr, Action>& get_classifier()
         { return classifier; }
@@ -53,6 +63,14 @@ public:
 private:
     vigil::Classifier<Expr, Action> classifier;
     std::list<vigil::Rule<Expr, Action> > linear;
+    std::list<vigil::Rule<Expr, Action> > staged;
+    bool updating;
+
+    Rule_list& changes() { return updating ? staged : linear; }
+    static void insert_linear(Rule_list&, const vigil::Rule<Expr, Action>&);
+
+    template<class Data>
+    bool check_flat_lookup(const Data *);
 
     template<class Data>
     bool resolve_priority(typename Rule_list::const_iterator&,
@@ -77,25 +95,39 @@ Classifier_t<Expr, Action>::check_add_rule(uint32_t priority, const Expr& expr,
         return 0;
     }
 
-    for (typename Rule_list::const_iterator iter = linear.begin();
-         iter != linear.end(); ++iter)
+    Rule_list& list = changes();
+    for (typename Rule_list::const_iterator iter = list.begin();
+         iter != list.end(); ++iter)
     {
         if (iter->id == id) {
             return 0;
         }
     }
 
-    for (typename Rule_list::iterator iter = linear.begin();
-         iter != linear.end(); ++iter)
+    insert_linear(list, vigil::Rule<Expr, Action>(id, priority, expr, action));
+    return id;
+}
+
+
+/*
+ * Inserts 'rule' into 'list' in priority order.
+ */
+
+template<class Expr, typename Action>
+void
+Classifier_t<Expr, Action>::insert_linear(Rule_list& list,
+                                          const vigil::Rule<Expr, Action>& rule)
+{
+    for (typename Rule_list::iterator iter = list.begin();
+         iter != list.end(); ++iter)
     {
-        if (iter->priority >= priority) {
-            linear.insert(iter, vigil::Rule<Expr, Action>(id, priority, expr, action));
-            return id;
+        if (iter->priority >= rule.priority) {
+            list.insert(iter, rule);
+            return;
         }
     }
 
-    linear.push_back(vigil::Rule<Expr, Action>(id, priority, expr, action));
-    return id;
+    list.push_back(rule);
 }
 
 /*
@@ -110,11 +142,12 @@ Classifier_t<Expr, Action>::check_delete_rule(uint32_t id)
 {
     bool success = classifier.delete_rule(id);
 
-    for (typename Rule_list::iterator iter = linear.begin();
-         iter != linear.end(); ++iter)
+    Rule_list& list = changes();
+    for (typename Rule_list::iterator iter = list.begin();
+         iter != list.end(); ++iter)
     {
         if (iter->id == id) {
-            linear.erase(iter);
+            list.erase(iter);
             return success == true;
         }
     }
@@ -122,6 +155,56 @@ Classifier_t<Expr, Action>::check_delete_rule(uint32_t id)
 }
 
 
+/*
+ * Changes a rule's priority in both classifiers.  Returns true if the change
+ * either fails on both classifiers or succeeds on both, else false.
+ */
+
+template<class Expr, typename Action>
+bool
+Classifier_t<Expr, Action>::check_change_rule_priority(uint32_t id,
+                                                       uint32_t priority)
+{
+    bool success = classifier.change_rule_priority(id, priority);
+
+    Rule_list& list = changes();
+    for (typename Rule_list::iterator iter = list.begin();
+         iter != list.end(); ++iter)
+    {
+        if (iter->id == id) {
+            vigil::Rule<Expr, Action> rule(*iter);
+            rule.priority = priority;
+            list.erase(iter);
+            insert_linear(list, rule);
+            return success == true;
+        }
+    }
+    return success == false;
+}
+
+
+template<class Expr, typename Action>
+void
+Classifier_t<Expr, Action>::begin_update()
+{
+    classifier.begin_update();
+    Rule_list copy(linear);
+    staged.swap(copy);
+    updating = true;
+}
+
+
+template<class Expr, typename Action>
+void
+Classifier_t<Expr, Action>::commit_update()
+{
+    classifier.commit_update();
+    linear.swap(staged);
+    staged.clear();
+    updating = false;
+}
+
+
 /*
  * Deletes rules matching a criteria from both classifiers.  Checks that the
  * same number of rules are deleted from both classifiers.  Returns true if
@@ -161,6 +244,10 @@ template<class Data>
 bool
 Classifier_t<Expr, Action>::check_lookup(const Data *data)
 {
+    if (!check_flat_lookup(data)) {
+        return false;
+    }
+
     vigil::Cnode_result<Expr, Action, Data> result(data);
 
     classifier.get_rules(result);
@@ -192,6 +279,43 @@ Classifier_t<Expr, Action>::check_lookup(const Data *data)
 }
 
 
+/*
+ * Checks that the flattened lookup of 'data' returns exactly the highest
+ * priority rules that match 'data' in the linear classifier.
+ */
+
+template<class Expr, typename Action>
+template<class Data>
+bool
+Classifier_t<Expr, Action>::check_flat_lookup(const Data *data)
+{
+    std::vector<uint32_t> expected;
+    uint32_t priority = 0;
+    for (typename Rule_list::const_iterator iter = linear.begin();
+         iter != linear.end(); ++iter)
+    {
+        if (!expected.empty() && iter->priority != priority) {
+            break;
+        }
+        if (matches(iter->id, iter->expr, *data)) {
+            priority = iter->priority;
+            expected.push_back(iter->id);
+        }
+    }
+
+    typename vigil::Classifier<Expr, Action>::Lookup_result result;
+    classifier.lookup(*data, result);
+    std::vector<uint32_t> found;
+    for (size_t i = 0; i < result.size(); i++) {
+        found.push_back(result[i].id);
+    }
+
+    std::sort(expected.begin(), expected.end());
+    std::sort(found.begin(), found.end());
+    return expected == found;
+}
+
+
 /*
  * Matching rules of equivalent priority might be encountered in a different
  * order by the linear classifier.  This reconciles that by comparing rules of
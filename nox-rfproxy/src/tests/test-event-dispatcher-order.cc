@@ -0,0 +1,111 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests that flushing a switch's queued packet-ins ahead of its leave, as the
+ * core does, keeps them ahead of the leave while leaving other switches'
+ * packet-ins queued, and that other events go straight through. */
+
+#include "event.hh"
+#include "event-dispatcher.hh"
+#include <boost/bind.hpp>
+#include "assert.hh"
+#include "threads/cooperative.hh"
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace vigil;
+
+class Switch_event
+    : public Event
+{
+public:
+    Switch_event(const Event_name& name, int dp_, int n_)
+        : Event(name), dp(dp_), n(n_) { }
+    int dp;
+    int n;
+};
+
+static Disposition
+handle_switch_event(const Event& e_)
+{
+    const Switch_event& e = assert_cast<const Switch_event&>(e_);
+    printf("Handling %s %d.%d\n", e.get_name().c_str(), e.dp, e.n);
+    return CONTINUE;
+}
+
+static bool
+is_from(const Event& e, int dp)
+{
+    return assert_cast<const Switch_event&>(e).dp == dp;
+}
+
+static void
+flush_packets(Event_dispatcher& event_dispatcher, int dp)
+{
+    event_dispatcher.flush(Event_dispatcher::PRIO_PACKET_IN,
+                           boost::bind(is_from, _1, dp));
+}
+
+static void
+print_stats(const Event_dispatcher& event_dispatcher, const Event_name& name)
+{
+    std::vector<std::pair<Event_name, Event_dispatcher::Stats> > stats;
+    event_dispatcher.get_stats(stats);
+    for (size_t i = 0; i < stats.size(); i++) {
+        if (stats[i].first == name) {
+            printf("%s: %d dispatched, %d dropped\n", name.c_str(),
+                   (int) stats[i].second.dispatched,
+                   (int) stats[i].second.dropped);
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    Event_dispatcher event_dispatcher;
+    event_dispatcher.set_priority("Leave", Event_dispatcher::PRIO_CONTROL);
+    event_dispatcher.set_priority("Packet", Event_dispatcher::PRIO_PACKET_IN);
+    event_dispatcher.add_handler("Leave", handle_switch_event, 0);
+    event_dispatcher.add_handler("Packet", handle_switch_event, 0);
+    event_dispatcher.add_handler("Status", handle_switch_event, 0);
+
+    event_dispatcher.post(new Switch_event("Packet", 1, 1));
+    event_dispatcher.post(new Switch_event("Packet", 2, 1));
+    event_dispatcher.post(new Switch_event("Packet", 1, 2));
+
+    /* A status change is dispatched right away, not held up by the
+     * packet-ins queued before it. */
+    event_dispatcher.dispatch(Switch_event("Status", 2, 2));
+
+    /* A leave event follows the packet-ins its switch sent before it,
+     * although it is queued with higher priority. */
+    flush_packets(event_dispatcher, 1);
+    event_dispatcher.post(new Switch_event("Leave", 1, 3));
+
+    event_dispatcher.post(new Switch_event("Packet", 2, 3));
+    event_dispatcher.poll();
+    print_stats(event_dispatcher, "Leave");
+    print_stats(event_dispatcher, "Packet");
+    return 0;
+}
@@ -0,0 +1,13 @@
+#! /bin/sh -e
+trap 'rm -f tmp$$' 0
+$SUPERVISOR ./test-event-dispatcher-order > tmp$$
+diff -u - tmp$$ <<EOF
+Handling Status 2.2
+Handling Packet 1.1
+Handling Packet 1.2
+Handling Leave 1.3
+Handling Packet 2.1
+Handling Packet 2.3
+Leave: 1 dispatched, 0 dropped
+Packet: 4 dispatched, 0 dropped
+EOF
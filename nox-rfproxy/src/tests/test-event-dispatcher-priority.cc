@@ -0,0 +1,96 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests that the event dispatcher serves its priority queues in weighted
+ * round-robin order and that a bounded queue drops events according to its
+ * drop policy. */
+
+#include "event.hh"
+#include "event-dispatcher.hh"
+#include <boost/bind.hpp>
+#include "assert.hh"
+#include "threads/cooperative.hh"
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace vigil;
+
+class My_event
+    : public Event 
+{
+public:
+    My_event(const Event_name& name, int event_data_)
+        : Event(name), event_data(event_data_) { }
+    int get_event_data() const { return event_data; }
+private:
+    int event_data;
+};
+
+static Disposition
+handle_my_event(const Event& e_)
+{
+    const My_event& e = assert_cast<const My_event&>(e_);
+    printf("Handling %s %d\n", e.get_name().c_str(), e.get_event_data());
+    return CONTINUE;
+}
+
+static void
+print_stats(const Event_dispatcher& event_dispatcher, const Event_name& name)
+{
+    std::vector<std::pair<Event_name, Event_dispatcher::Stats> > stats;
+    event_dispatcher.get_stats(stats);
+    for (size_t i = 0; i < stats.size(); i++) {
+        if (stats[i].first == name) {
+            printf("%s: %d dispatched, %d dropped\n", name.c_str(),
+                   (int) stats[i].second.dispatched,
+                   (int) stats[i].second.dropped);
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    Event_dispatcher event_dispatcher;
+    event_dispatcher.set_priority("Control", Event_dispatcher::PRIO_CONTROL);
+    event_dispatcher.set_priority("Packet", Event_dispatcher::PRIO_PACKET_IN);
+    event_dispatcher.set_weight(Event_dispatcher::PRIO_CONTROL, 2);
+    event_dispatcher.set_weight(Event_dispatcher::PRIO_PACKET_IN, 1);
+    event_dispatcher.set_limit(Event_dispatcher::PRIO_PACKET_IN, 3,
+                               Event_dispatcher::DROP_OLDEST);
+
+    event_dispatcher.add_handler("Control", handle_my_event, 0);
+    event_dispatcher.add_handler("Packet", handle_my_event, 0);
+
+    for (int i = 1; i <= 5; i++) {
+        event_dispatcher.post(new My_event("Packet", i));
+    }
+    for (int i = 1; i <= 3; i++) {
+        event_dispatcher.post(new My_event("Control", i));
+    }
+
+    event_dispatcher.poll();
+    print_stats(event_dispatcher, "Control");
+    print_stats(event_dispatcher, "Packet");
+    return 0;
+}
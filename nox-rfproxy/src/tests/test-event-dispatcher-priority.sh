@@ -0,0 +1,13 @@
+#! /bin/sh -e
+trap 'rm -f tmp$$' 0
+$SUPERVISOR ./test-event-dispatcher-priority > tmp$$
+diff -u - tmp$$ <<EOF
+Handling Control 1
+Handling Control 2
+Handling Packet 3
+Handling Control 3
+Handling Packet 4
+Handling Packet 5
+Control: 3 dispatched, 0 dropped
+Packet: 3 dispatched, 2 dropped
+EOF
@@ -0,0 +1,193 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests the chunks in which the flow fetcher hands out the flows of each flow
+ * stats reply: that a chunk holds the flows of its reply, in order and as
+ * the switch sent them, without a truncated last flow, that it keeps the
+ * reply alive, and that a filter, in particular one on match and table,
+ * picks out the flows that the switch would have picked. */
+
+#include "flow_fetcher.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace vigil;
+using namespace vigil::applications;
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+static const uint32_t TCP_FROM_HOST = OFPFW_ALL & ~(OFPFW_DL_TYPE
+                                                    | OFPFW_NW_PROTO
+                                                    | OFPFW_NW_SRC_MASK);
+static const uint32_t UDP_FROM_SUBNET = ((TCP_FROM_HOST & ~OFPFW_NW_SRC_MASK)
+                                         | (8 << OFPFW_NW_SRC_SHIFT));
+
+/* Appends a flow of 'table_id', matching on 'wildcards', 'nw_proto' and
+ * 'nw_src', with 'n_actions' output actions. */
+static void
+put_flow(Array_buffer& b, uint8_t table_id, uint32_t wildcards,
+         uint8_t nw_proto, uint32_t nw_src, int n_actions)
+{
+    size_t length = (sizeof(ofp_flow_stats)
+                     + n_actions * sizeof(ofp_action_output));
+    ofp_flow_stats* ofs = (ofp_flow_stats*) b.put(length);
+    memset(ofs, 0, length);
+    ofs->length = htons(length);
+    ofs->table_id = table_id;
+    ofs->match.wildcards = htonl(wildcards);
+    ofs->match.dl_type = htons(0x0800);
+    ofs->match.nw_proto = nw_proto;
+    ofs->match.nw_src = htonl(nw_src);
+    ofs->priority = htons(1000 + table_id);
+}
+
+/* A reply of, in order: a TCP flow from 10.0.0.1 in table 0 with one action;
+ * a UDP flow from 10.0.1.0/24 in table 1 with none; a flow that matches
+ * everything in table 0 with two actions; and a flow whose length runs past
+ * the end of the reply. */
+static Flow_stats_in_event*
+reply(bool more)
+{
+    std::auto_ptr<Buffer> buf(new Array_buffer(0));
+    Array_buffer& b = (Array_buffer&) *buf;
+    size_t body_ofs = offsetof(ofp_stats_reply, body);
+    memset(b.put(body_ofs), 0, body_ofs);
+    put_flow(b, 0, TCP_FROM_HOST, 6, 0x0a000001, 1);
+    put_flow(b, 1, UDP_FROM_SUBNET, 17, 0x0a000100, 0);
+    put_flow(b, 0, OFPFW_ALL, 0, 0, 2);
+    ofp_flow_stats* cut = (ofp_flow_stats*) b.put(sizeof(ofp_flow_stats));
+    memset(cut, 0, sizeof *cut);
+    cut->length = htons(sizeof *cut + sizeof(ofp_action_output));
+
+    ofp_stats_reply* osr = &b.at<ofp_stats_reply>(0);
+    osr->header.version = OFP_VERSION;
+    osr->header.type = OFPT_STATS_REPLY;
+    osr->header.length = htons(b.size());
+    osr->type = htons(OFPST_FLOW);
+    osr->flags = htons(more ? OFPSF_REPLY_MORE : 0);
+    return new Flow_stats_in_event(datapathid::from_host(7), osr, buf);
+}
+
+static bool
+in_table_1(const ofp_flow_stats& ofs)
+{
+    return ofs.table_id == 1;
+}
+
+/* Returns the tables of the flows in 'chunk', in order, as a string. */
+static std::string
+tables(const Flow_stats_chunk& chunk)
+{
+    std::string s;
+    for (size_t i = 0; i < chunk.size(); ++i) {
+        s += (char) ('0' + chunk[i].table_id);
+    }
+    return s;
+}
+
+/* Returns the tables of the flows in a reply that a filter on 'wildcards',
+ * 'nw_proto', 'nw_src' and 'table_id' keeps. */
+static std::string
+matching(uint32_t wildcards, uint8_t nw_proto, uint32_t nw_src,
+         uint8_t table_id)
+{
+    ofp_match match;
+    memset(&match, 0, sizeof match);
+    match.wildcards = htonl(wildcards);
+    match.dl_type = htons(0x0800);
+    match.nw_proto = nw_proto;
+    match.nw_src = htonl(nw_src);
+
+    std::auto_ptr<Flow_stats_in_event> fsie(reply(false));
+    return tables(Flow_stats_chunk(*fsie,
+                                   Flow_match_filter(match, table_id)));
+}
+
+static void
+test_chunk()
+{
+    std::auto_ptr<Flow_stats_in_event> fsie(reply(true));
+    Flow_stats_chunk chunk(*fsie, Flow_fetcher::Filter());
+    MUST_SUCCEED(chunk.datapath_id == datapathid::from_host(7));
+    MUST_SUCCEED(chunk.more);
+    MUST_SUCCEED(chunk.size() == 3);
+    MUST_SUCCEED(tables(chunk) == "010");
+    MUST_SUCCEED(chunk.n_actions(0) == 1);
+    MUST_SUCCEED(chunk.n_actions(1) == 0);
+    MUST_SUCCEED(chunk.n_actions(2) == 2);
+
+    /* The flows are those of the reply, in network byte order. */
+    MUST_SUCCEED(&chunk[0] == (const ofp_flow_stats*)
+                 ((const ofp_stats_reply*) fsie->get_ofp_msg())->body);
+    MUST_SUCCEED(ntohs(chunk[1].priority) == 1001);
+    MUST_SUCCEED(ntohl(chunk[1].match.nw_src) == 0x0a000100);
+
+    /* The chunk keeps the reply alive. */
+    Flow_stats_chunk copy(chunk);
+    fsie.reset();
+    MUST_SUCCEED(copy.size() == 3 && ntohs(copy[2].priority) == 1000);
+
+    fsie.reset(reply(false));
+    MUST_SUCCEED(!Flow_stats_chunk(*fsie, Flow_fetcher::Filter()).more);
+    Flow_stats_chunk filtered(*fsie, in_table_1);
+    MUST_SUCCEED(tables(filtered) == "1");
+    MUST_SUCCEED(ntohs(filtered[0].priority) == 1001);
+}
+
+static void
+test_match_filter()
+{
+    /* By table, and everything. */
+    MUST_SUCCEED(matching(OFPFW_ALL, 0, 0, 0) == "00");
+    MUST_SUCCEED(matching(OFPFW_ALL, 0, 0, 1) == "1");
+    MUST_SUCCEED(matching(OFPFW_ALL, 0, 0, 0xff) == "010");
+
+    /* Fields matched on must be matched on by the flow, alike. */
+    uint32_t ip = OFPFW_ALL & ~OFPFW_DL_TYPE;
+    MUST_SUCCEED(matching(ip, 0, 0, 0xff) == "01");
+    MUST_SUCCEED(matching(ip & ~OFPFW_NW_PROTO, 6, 0, 0xff) == "0");
+    MUST_SUCCEED(matching(ip & ~OFPFW_NW_PROTO, 17, 0, 1) == "1");
+    MUST_SUCCEED(matching(ip & ~OFPFW_NW_PROTO, 17, 0, 0) == "");
+
+    /* Addresses must be within the filter's prefix, and no wider. */
+    uint32_t nw = ip & ~OFPFW_NW_SRC_MASK;
+    MUST_SUCCEED(matching(nw | (16 << OFPFW_NW_SRC_SHIFT), 0, 0x0a000000,
+                          0xff) == "01");
+    MUST_SUCCEED(matching(nw | (8 << OFPFW_NW_SRC_SHIFT), 0, 0x0a000000,
+                          0xff) == "0");
+    MUST_SUCCEED(matching(nw | (8 << OFPFW_NW_SRC_SHIFT), 0, 0x0a0001ff,
+                          0xff) == "1");
+    MUST_SUCCEED(matching(nw, 0, 0x0a000001, 0xff) == "0");
+    MUST_SUCCEED(matching(nw, 0, 0x0a000002, 0xff) == "");
+    MUST_SUCCEED(matching(nw, 0, 0x0a000100, 0xff) == "");
+    MUST_SUCCEED(matching(nw | (63 << OFPFW_NW_SRC_SHIFT), 0, 0, 0xff)
+                 == "01");
+}
+
+int
+main(void)
+{
+    test_chunk();
+    test_match_filter();
+    return 0;
+}
@@ -0,0 +1,216 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests the routing module's install batches: that every message of a batch
+ * goes out under the same xid, ending with a barrier request per datapath,
+ * and that barrier replies and errors are matched to their batch on the xid
+ * field exactly as a switch echoes it back, so that a byte-swapped xid or a
+ * reply from another datapath does not complete it. */
+
+#include "install-batches.hh"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+using namespace vigil;
+using namespace vigil::applications;
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+/* Headers of the messages sent to each datapath, as they went out. */
+static std::map<uint64_t, std::vector<ofp_header> > sent;
+static uint64_t failing_dp;
+
+static int
+send_msg(const datapathid& dp, const ofp_header* oh)
+{
+    if (dp.as_host() == failing_dp) {
+        return EAGAIN;
+    }
+    sent[dp.as_host()].push_back(*oh);
+    return 0;
+}
+
+static int n_done;
+static bool last_ok;
+
+static void
+done(bool ok)
+{
+    n_done++;
+    last_ok = ok;
+}
+
+static void
+queue_flow_mod(Install_batches& batches, uint64_t dp)
+{
+    ofp_flow_mod ofm;
+    memset(&ofm, 0, sizeof ofm);
+    ofm.header.version = OFP_VERSION;
+    ofm.header.type = OFPT_FLOW_MOD;
+    ofm.header.length = htons(sizeof ofm);
+    ofm.header.xid = htonl(12345);
+    batches.queue(datapathid::from_host(dp), &ofm.header);
+}
+
+/* Checks that 'dp' was sent 'n' flow entries and a barrier request, all with
+ * the same xid, and returns the barrier request's xid field as sent. */
+static uint32_t
+check_sent(uint64_t dp, size_t n)
+{
+    const std::vector<ofp_header>& msgs = sent[dp];
+    MUST_SUCCEED(msgs.size() == n + 1);
+    for (size_t i = 0; i < n; i++) {
+        MUST_SUCCEED(msgs[i].type == OFPT_FLOW_MOD);
+        MUST_SUCCEED(ntohs(msgs[i].length) == sizeof(ofp_flow_mod));
+        MUST_SUCCEED(msgs[i].xid == msgs[n].xid);
+    }
+    MUST_SUCCEED(msgs[n].type == OFPT_BARRIER_REQUEST);
+    MUST_SUCCEED(ntohs(msgs[n].length) == sizeof(ofp_header));
+    return msgs[n].xid;
+}
+
+/* The xid field of a reply to 'request', as the switch would send it back:
+ * the same four bytes. */
+static uint32_t
+echo_xid(const ofp_header& request)
+{
+    ofp_header reply;
+    memcpy(&reply.xid, &request.xid, sizeof reply.xid);
+    return reply.xid;
+}
+
+static uint32_t
+swap_bytes(uint32_t x)
+{
+    return ((x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000)
+            | (x << 24));
+}
+
+int
+main(void)
+{
+    Install_batches batches(send_msg);
+    datapathid dp1 = datapathid::from_host(1);
+    datapathid dp2 = datapathid::from_host(2);
+    datapathid dp3 = datapathid::from_host(3);
+
+    /* Nothing to commit without a batch; an empty batch completes at once. */
+    MUST_SUCCEED(!batches.commit(done));
+    batches.begin();
+    MUST_SUCCEED(batches.is_open());
+    MUST_SUCCEED(batches.commit(done));
+    MUST_SUCCEED(n_done == 1 && last_ok);
+    MUST_SUCCEED(!batches.is_open());
+
+    /* A batch to two datapaths completes once both answer with its xid. */
+    n_done = 0;
+    batches.begin();
+    queue_flow_mod(batches, 1);
+    queue_flow_mod(batches, 1);
+    queue_flow_mod(batches, 2);
+    MUST_SUCCEED(batches.commit(done));
+    MUST_SUCCEED(n_done == 0);
+    uint32_t xid = check_sent(1, 2);
+    MUST_SUCCEED(check_sent(2, 1) == xid);
+    MUST_SUCCEED(xid != htonl(12345));
+
+    batches.barrier_reply(dp1, echo_xid(sent[1].back()));
+    MUST_SUCCEED(n_done == 0);
+    batches.barrier_reply(dp1, echo_xid(sent[1].back()));
+    MUST_SUCCEED(n_done == 0);
+    batches.barrier_reply(dp3, echo_xid(sent[2].back()));
+    MUST_SUCCEED(n_done == 0);
+    if (swap_bytes(xid) != xid) {
+        batches.barrier_reply(dp2, swap_bytes(xid));
+        MUST_SUCCEED(n_done == 0);
+    }
+    batches.barrier_reply(dp2, echo_xid(sent[2].back()));
+    MUST_SUCCEED(n_done == 1 && last_ok);
+    MUST_SUCCEED(batches.get_n_pending() == 0);
+
+    /* An error for an entry of the batch fails it, but only once its
+     * barrier reply comes; errors from elsewhere are not the batch's. */
+    sent.clear();
+    n_done = 0;
+    batches.begin();
+    queue_flow_mod(batches, 1);
+    batches.commit(done);
+    xid = check_sent(1, 1);
+    MUST_SUCCEED(!batches.error(dp2, echo_xid(sent[1][0])));
+    if (swap_bytes(xid) != xid) {
+        MUST_SUCCEED(!batches.error(dp1, swap_bytes(xid)));
+    }
+    MUST_SUCCEED(batches.error(dp1, echo_xid(sent[1][0])));
+    MUST_SUCCEED(n_done == 0);
+    batches.barrier_reply(dp1, echo_xid(sent[1].back()));
+    MUST_SUCCEED(n_done == 1 && !last_ok);
+
+    /* Batches in flight together are matched separately, and a datapath
+     * leaving fails only the batches still waiting on it. */
+    sent.clear();
+    n_done = 0;
+    batches.begin();
+    queue_flow_mod(batches, 1);
+    queue_flow_mod(batches, 2);
+    batches.commit(done);
+    uint32_t xid1 = check_sent(1, 1);
+    batches.begin();
+    queue_flow_mod(batches, 1);
+    batches.commit(done);
+    MUST_SUCCEED(sent[1].size() == 4);
+    uint32_t xid2 = echo_xid(sent[1].back());
+    MUST_SUCCEED(xid1 != xid2);
+    MUST_SUCCEED(batches.get_n_pending() == 2);
+
+    batches.barrier_reply(dp1, xid2);
+    MUST_SUCCEED(n_done == 1 && last_ok);
+    batches.barrier_reply(dp1, xid1);
+    MUST_SUCCEED(n_done == 1);
+    batches.datapath_leave(dp2);
+    MUST_SUCCEED(n_done == 2 && !last_ok);
+    MUST_SUCCEED(batches.get_n_pending() == 0);
+
+    /* A datapath that cannot be sent to fails the batch without being
+     * waited on. */
+    sent.clear();
+    n_done = 0;
+    failing_dp = 3;
+    batches.begin();
+    queue_flow_mod(batches, 1);
+    queue_flow_mod(batches, 3);
+    batches.commit(done);
+    MUST_SUCCEED(sent.count(3) == 0);
+    batches.barrier_reply(dp1, echo_xid(sent[1].back()));
+    MUST_SUCCEED(n_done == 1 && !last_ok);
+
+    batches.begin();
+    queue_flow_mod(batches, 3);
+    batches.commit(done);
+    MUST_SUCCEED(n_done == 2 && !last_ok);
+    MUST_SUCCEED(batches.get_n_pending() == 0);
+    return 0;
+}
@@ -0,0 +1,2 @@
+#! /bin/sh
+$SUPERVISOR ./test-install-batches
@@ -0,0 +1,136 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests linkload's history of a port: that each reply adds the increase of
+ * the counters since the last one as a sample, that a reply with counters
+ * going back or no time passed adds none, that only the latest
+ * LINKLOAD_HISTORY samples are kept, and the average and percentile rates
+ * over a window of them. */
+
+#include "linkload.hh"
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace vigil;
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+static Port_stats
+stats(uint64_t tx_bytes, uint64_t rx_bytes)
+{
+    Port_stats ps(1);
+    ps.tx_bytes = tx_bytes;
+    ps.rx_bytes = rx_bytes;
+    ps.tx_packets = tx_bytes / 100;
+    ps.rx_packets = rx_bytes / 100;
+    return ps;
+}
+
+static timeval
+at(long int secs)
+{
+    return make_timeval(1000 + secs, 0);
+}
+
+static void
+test_samples()
+{
+    linkload::history hist(stats(1000, 500), at(0));
+    MUST_SUCCEED(hist.count == 0);
+
+    /* Each reply adds the increase since the last. */
+    MUST_SUCCEED(hist.add_sample(stats(3000, 1500), at(10)));
+    MUST_SUCCEED(hist.count == 1);
+    MUST_SUCCEED(hist.latest(0).txBytes == 2000);
+    MUST_SUCCEED(hist.latest(0).rxBytes == 1000);
+    MUST_SUCCEED(hist.latest(0).txPackets == 20);
+    MUST_SUCCEED(hist.latest(0).msecs == 10000);
+
+    /* No time passed: no sample, and the counters are not taken. */
+    MUST_SUCCEED(!hist.add_sample(stats(9000, 9000), at(10)));
+    MUST_SUCCEED(hist.count == 1 && hist.txBytes == 3000);
+
+    /* Counters going back: no sample, but the next starts from them. */
+    MUST_SUCCEED(!hist.add_sample(stats(100, 2000), at(20)));
+    MUST_SUCCEED(hist.count == 1 && hist.txBytes == 100);
+    MUST_SUCCEED(hist.add_sample(stats(600, 2500), at(25)));
+    MUST_SUCCEED(hist.count == 2);
+    MUST_SUCCEED(hist.latest(0).txBytes == 500);
+    MUST_SUCCEED(hist.latest(0).msecs == 5000);
+    MUST_SUCCEED(hist.latest(1).txBytes == 2000);
+}
+
+static void
+test_ring()
+{
+    linkload::history hist(stats(0, 0), at(0));
+    for (int i = 1; i <= LINKLOAD_HISTORY + 5; i++) {
+        MUST_SUCCEED(hist.add_sample(stats(i * (i + 1) / 2, 0), at(i)));
+    }
+
+    /* Only the latest are kept, the i-th reply adding i bytes. */
+    MUST_SUCCEED(hist.count == LINKLOAD_HISTORY);
+    for (uint32_t j = 0; j < LINKLOAD_HISTORY; j++) {
+        MUST_SUCCEED(hist.latest(j).txBytes == LINKLOAD_HISTORY + 5 - j);
+    }
+}
+
+static void
+test_rates()
+{
+    /* Samples, oldest first, of 10 s at 100, 400, 200 and 300 bytes/s tx
+     * and a tenth of that rx. */
+    linkload::history hist(stats(0, 0), at(0));
+    MUST_SUCCEED(hist.add_sample(stats(1000, 100), at(10)));
+    MUST_SUCCEED(hist.add_sample(stats(5000, 500), at(20)));
+    MUST_SUCCEED(hist.add_sample(stats(7000, 700), at(30)));
+    MUST_SUCCEED(hist.add_sample(stats(10000, 1000), at(40)));
+
+    /* The window holds the samples that end in it, and at least one. */
+    double tx, rx;
+    hist.get_rate(0, tx, rx);
+    MUST_SUCCEED(tx == 300 && rx == 30);
+    hist.get_rate(10, tx, rx);
+    MUST_SUCCEED(tx == 300);
+    hist.get_rate(20, tx, rx);
+    MUST_SUCCEED(tx == 250 && rx == 25);
+    hist.get_rate(3600, tx, rx);
+    MUST_SUCCEED(tx == 250);
+
+    /* Nearest rank, of the sorted rates 100, 200, 300 and 400. */
+    MUST_SUCCEED(hist.get_rate_percentile(3600, 0, true) == 100);
+    MUST_SUCCEED(hist.get_rate_percentile(3600, 25, true) == 100);
+    MUST_SUCCEED(hist.get_rate_percentile(3600, 50, true) == 200);
+    MUST_SUCCEED(hist.get_rate_percentile(3600, 95, true) == 400);
+    MUST_SUCCEED(hist.get_rate_percentile(3600, 100, false) == 40);
+    MUST_SUCCEED(hist.get_rate_percentile(30, 50, true) == 300);
+    MUST_SUCCEED(hist.get_rate_percentile(0, 50, true) == 300);
+}
+
+int
+main(void)
+{
+    test_samples();
+    test_ring();
+    test_rates();
+    return 0;
+}
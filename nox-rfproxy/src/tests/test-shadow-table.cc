@@ -0,0 +1,234 @@
+/* Copyright 2012 (C) Victoria University of Waikato.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests rfproxy's shadow of the flows it installed: that adds and strict
+ * deletes keep it up to date, that reconciling yields only the FlowMods that
+ * bring a switch back in line, that a complete reconcile adds back exactly
+ * the flows the switch did not report, that a datapath's shadow is kept when
+ * it leaves, for a bounded number of datapaths, and goes away only when it
+ * is forgotten. */
+
+#include "ShadowTable.hh"
+#include "rfofmsg.hh"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+static const uint64_t DP = 1;
+
+/* A flow matching 'nw_dst'/24 and forwarding to 'port', as a FlowMod and as
+ * a switch reports it in flow stats. */
+struct Flow {
+    uint8_t ofm[sizeof(ofp_flow_mod) + sizeof(ofp_action_output)];
+    uint8_t ofs[sizeof(ofp_flow_stats) + sizeof(ofp_action_output)];
+
+    Flow(uint32_t nw_dst, uint16_t port, uint16_t command = OFPFC_ADD) {
+        ofp_flow_mod* fm = mod();
+        ofm_init(fm, sizeof ofm);
+        fm->match.wildcards = htonl((OFPFW_ALL & ~OFPFW_DL_TYPE
+                                     & ~OFPFW_NW_DST_MASK)
+                                    | (8 << OFPFW_NW_DST_SHIFT));
+        fm->match.dl_type = htons(0x0800);
+        fm->match.nw_dst = htonl(nw_dst);
+        ofm_set_command(fm, (enum ofp_flow_mod_command) command);
+        ofp_action_output* oa = (ofp_action_output*) fm->actions;
+        oa->type = htons(OFPAT_OUTPUT);
+        oa->len = htons(sizeof *oa);
+        oa->port = htons(port);
+
+        ofp_flow_stats* fs = stats();
+        memset(ofs, 0, sizeof ofs);
+        fs->length = htons(sizeof ofs);
+        fs->match = fm->match;
+        fs->priority = fm->priority;
+        memcpy(fs->actions, fm->actions, sizeof *oa);
+    }
+
+    ofp_flow_mod* mod() { return (ofp_flow_mod*) ofm; }
+    ofp_flow_stats* stats() { return (ofp_flow_stats*) ofs; }
+};
+
+/* Returns the port that 'flow_mod' forwards to. */
+static uint16_t
+out_port(const ShadowTable::FlowMod& flow_mod)
+{
+    const ofp_flow_mod* fm = (const ofp_flow_mod*) flow_mod.get();
+    MUST_SUCCEED(ntohs(fm->command) == OFPFC_ADD);
+    return ntohs(((const ofp_action_output*) fm->actions)->port);
+}
+
+int
+main(void)
+{
+    ShadowTable shadow(2);
+    ShadowTable::Delta delta;
+
+    /* Only datapaths that have joined are shadowed. */
+    Flow a(0x0a000100, 1), b(0x0a000200, 2), c(0x0a000300, 3);
+    shadow.record(DP, a.mod());
+    MUST_SUCCEED(shadow.size(DP) == 0);
+    MUST_SUCCEED(!shadow.begin_reconcile(DP));
+    shadow.join(DP);
+
+    /* Adds are shadowed once per match, strict deletes remove them, and
+     * flows that time out are left to the switch. */
+    shadow.record(DP, a.mod());
+    shadow.record(DP, a.mod());
+    shadow.record(DP, b.mod());
+    shadow.record(DP, c.mod());
+    MUST_SUCCEED(shadow.size(DP) == 3);
+
+    Flow d(0x0a000400, 4), delete_d(0x0a000400, 4, OFPFC_DELETE_STRICT);
+    shadow.record(DP, d.mod());
+    MUST_SUCCEED(shadow.size(DP) == 4);
+    shadow.record(DP, delete_d.mod());
+    MUST_SUCCEED(shadow.size(DP) == 3);
+
+    Flow timed(0x0a000500, 5);
+    timed.mod()->idle_timeout = htons(60);
+    shadow.record(DP, timed.mod());
+    MUST_SUCCEED(shadow.size(DP) == 3);
+
+    /* The switch reports 'a' as installed, 'b' with other actions and a flow
+     * that rfproxy never added, and does not have 'c'.  Bits that the
+     * wildcards mask off do not matter. */
+    MUST_SUCCEED(shadow.begin_reconcile(DP));
+    MUST_SUCCEED(!shadow.begin_reconcile(DP));
+    a.stats()->match.nw_dst |= htonl(0xff);
+    a.stats()->match.tp_dst = htons(80);
+    shadow.check_flow(DP, a.stats(), delta);
+    MUST_SUCCEED(delta.install.empty() && delta.remove.empty());
+
+    Flow b_moved(0x0a000200, 9), extra(0x0a000600, 6);
+    shadow.check_flow(DP, b_moved.stats(), delta);
+    shadow.check_flow(DP, extra.stats(), delta);
+    MUST_SUCCEED(delta.install.size() == 1 && out_port(delta.install[0]) == 2);
+    MUST_SUCCEED(delta.remove.size() == 1);
+    const ofp_flow_mod* removal = (const ofp_flow_mod*) delta.remove[0].get();
+    MUST_SUCCEED(ntohs(removal->command) == OFPFC_DELETE_STRICT);
+    MUST_SUCCEED(removal->match.nw_dst == htonl(0x0a000600));
+    MUST_SUCCEED(removal->priority == extra.mod()->priority);
+
+    /* Once the stats are complete, the flow that was not among them is
+     * added back. */
+    delta = ShadowTable::Delta();
+    shadow.end_reconcile(DP, true, delta);
+    MUST_SUCCEED(delta.install.size() == 1 && out_port(delta.install[0]) == 3);
+    MUST_SUCCEED(delta.remove.empty());
+
+    /* The next reconcile does not count what the last one found: a flow
+     * reported then but not now is added back, and incomplete stats add
+     * nothing back. */
+    delta = ShadowTable::Delta();
+    MUST_SUCCEED(shadow.begin_reconcile(DP));
+    shadow.check_flow(DP, a.stats(), delta);
+    shadow.check_flow(DP, c.stats(), delta);
+    shadow.end_reconcile(DP, true, delta);
+    MUST_SUCCEED(delta.install.size() == 1 && out_port(delta.install[0]) == 2);
+
+    delta = ShadowTable::Delta();
+    MUST_SUCCEED(shadow.begin_reconcile(DP));
+    shadow.check_flow(DP, a.stats(), delta);
+    shadow.end_reconcile(DP, false, delta);
+    MUST_SUCCEED(delta.install.empty() && delta.remove.empty());
+
+    /* A datapath that leaves keeps its shadow, even while it is being
+     * reconciled, but is not reconciled until it joins again. */
+    MUST_SUCCEED(shadow.begin_reconcile(DP));
+    shadow.leave(DP);
+    MUST_SUCCEED(shadow.size(DP) == 3);
+    shadow.check_flow(DP, extra.stats(), delta);
+    shadow.end_reconcile(DP, true, delta);
+    MUST_SUCCEED(delta.install.empty() && delta.remove.empty());
+    MUST_SUCCEED(!shadow.begin_reconcile(DP));
+
+    /* Once it is back, flows that RFServer has yet to send again are not
+     * taken for extra ones, those it sent already are not sent again, and
+     * only what changed while it was away is. */
+    shadow.join(DP);
+    shadow.record(DP, a.mod());
+    MUST_SUCCEED(shadow.size(DP) == 3);
+    MUST_SUCCEED(shadow.begin_reconcile(DP));
+    shadow.check_flow(DP, a.stats(), delta);
+    shadow.check_flow(DP, b.stats(), delta);
+    shadow.check_flow(DP, extra.stats(), delta);
+    shadow.end_reconcile(DP, true, delta);
+    MUST_SUCCEED(delta.install.size() == 1 && out_port(delta.install[0]) == 3);
+    MUST_SUCCEED(delta.remove.size() == 1);
+
+    /* Forgetting a datapath that has left drops its shadow, and a FlowMod
+     * sent to it just before does not bring the shadow back. */
+    shadow.leave(DP);
+    shadow.forget(DP);
+    shadow.record(DP, a.mod());
+    MUST_SUCCEED(shadow.size(DP) == 0);
+    MUST_SUCCEED(!shadow.begin_reconcile(DP));
+
+    /* It joins afresh, and extra flows are not deleted from it until flows
+     * are added again. */
+    delta = ShadowTable::Delta();
+    shadow.join(DP);
+    MUST_SUCCEED(shadow.begin_reconcile(DP));
+    shadow.check_flow(DP, a.stats(), delta);
+    shadow.end_reconcile(DP, true, delta);
+    MUST_SUCCEED(delta.install.empty() && delta.remove.empty());
+
+    /* Forgetting a datapath that is there shadows it afresh, and a
+     * reconcile in progress yields nothing. */
+    shadow.record(DP, a.mod());
+    MUST_SUCCEED(shadow.begin_reconcile(DP));
+    shadow.forget(DP);
+    MUST_SUCCEED(shadow.size(DP) == 0);
+    shadow.check_flow(DP, extra.stats(), delta);
+    shadow.end_reconcile(DP, true, delta);
+    MUST_SUCCEED(delta.install.empty() && delta.remove.empty());
+    shadow.record(DP, a.mod());
+    MUST_SUCCEED(shadow.size(DP) == 1);
+
+    /* Other datapaths are not affected, and only the shadows of the last
+     * two that left are kept. */
+    shadow.join(DP + 1);
+    shadow.join(DP + 2);
+    shadow.join(DP + 3);
+    shadow.record(DP + 1, b.mod());
+    shadow.record(DP + 2, b.mod());
+    shadow.record(DP + 3, b.mod());
+    shadow.forget(DP);
+    MUST_SUCCEED(shadow.size(DP) == 0);
+    MUST_SUCCEED(shadow.size(DP + 1) == 1);
+
+    shadow.leave(DP + 1);
+    shadow.leave(DP + 2);
+    shadow.leave(DP + 1);
+    shadow.join(DP + 2);
+    shadow.leave(DP + 2);
+    MUST_SUCCEED(shadow.size(DP + 1) == 1 && shadow.size(DP + 2) == 1);
+    shadow.leave(DP + 3);
+    MUST_SUCCEED(shadow.size(DP + 1) == 0);
+    MUST_SUCCEED(shadow.size(DP + 2) == 1 && shadow.size(DP + 3) == 1);
+    shadow.leave(DP);
+    MUST_SUCCEED(shadow.size(DP + 2) == 0 && shadow.size(DP + 3) == 1);
+    return 0;
+}
@@ -0,0 +1,229 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests the routing module's incremental shortest paths against breadth-first
+ * search from scratch.  Random links are added and removed among a growing
+ * set of switches, with parallel links between some of them, and after every
+ * change each path must be as short as the breadth-first one, run over links
+ * that exist, and be reported unreachable exactly when no path exists.  A
+ * source whose paths changed must have a new version. */
+
+#include "shortest-paths.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+#include <vector>
+
+using namespace vigil;
+using namespace vigil::applications;
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+/* Enough switches that the trees are laid out again as they grow. */
+static const uint32_t N_SWITCHES = 40;
+static const int N_CHANGES = 3000;
+
+static const uint32_t UNREACHABLE = ~(uint32_t) 0;
+
+struct Test_link {
+    uint32_t src;
+    uint16_t outport;
+    uint32_t dst;
+    uint16_t inport;
+
+    bool operator<(const Test_link& rhs) const {
+        if (src != rhs.src) {
+            return src < rhs.src;
+        } else if (dst != rhs.dst) {
+            return dst < rhs.dst;
+        } else if (outport != rhs.outport) {
+            return outport < rhs.outport;
+        } else {
+            return inport < rhs.inport;
+        }
+    }
+};
+
+/* The links, in a vector to pick random ones and in a set to look them up. */
+static std::vector<Test_link> links;
+static std::set<Test_link> link_set;
+
+static std::vector<Shortest_paths::Hop> unreachable;
+
+static bool
+has_link(const Test_link& link)
+{
+    return link_set.count(link) > 0;
+}
+
+/* Distances from 'src' to each of the first 'n' switches over 'links',
+ * given the switches each one has links to in 'adjacent'. */
+static void
+bfs(uint32_t src, uint32_t n,
+    const std::vector<std::vector<uint32_t> >& adjacent,
+    std::vector<uint32_t>& dist)
+{
+    dist.assign(n, UNREACHABLE);
+    dist[src] = 0;
+    std::vector<uint32_t> queue(1, src);
+    for (size_t i = 0; i < queue.size(); i++) {
+        uint32_t dp = queue[i];
+        for (size_t j = 0; j < adjacent[dp].size(); j++) {
+            uint32_t next = adjacent[dp][j];
+            if (dist[next] == UNREACHABLE) {
+                dist[next] = dist[dp] + 1;
+                queue.push_back(next);
+            }
+        }
+    }
+}
+
+/* Compares every path among the first 'n' switches against breadth-first
+ * search.  'paths_before' and 'versions_before' hold what the previous check
+ * found, and are updated. */
+static void
+check(const Shortest_paths& paths, uint32_t n,
+      std::vector<std::vector<std::vector<Shortest_paths::Hop> > >&
+      paths_before,
+      std::vector<uint32_t>& versions_before)
+{
+    std::vector<std::vector<uint32_t> > adjacent(n);
+    for (size_t i = 0; i < links.size(); i++) {
+        adjacent[links[i].src].push_back(links[i].dst);
+    }
+
+    std::vector<uint32_t> dist;
+    for (uint32_t src = 0; src < n; src++) {
+        bfs(src, n, adjacent, dist);
+        bool changed = false;
+        for (uint32_t dst = 0; dst < n; dst++) {
+            std::vector<Shortest_paths::Hop> path;
+            bool found = paths.get_path(datapathid::from_host(src),
+                                        datapathid::from_host(dst), path);
+            MUST_SUCCEED(found == (dist[dst] != UNREACHABLE));
+            if (!found) {
+                path = unreachable;
+            } else {
+                MUST_SUCCEED(path.size() == dist[dst]);
+                uint32_t dp = src;
+                for (size_t i = 0; i < path.size(); i++) {
+                    Test_link link = { dp, path[i].outport,
+                                       (uint32_t) path[i].dst.as_host(),
+                                       path[i].inport };
+                    MUST_SUCCEED(has_link(link));
+                    dp = link.dst;
+                }
+                MUST_SUCCEED(dp == dst);
+            }
+
+            std::vector<Shortest_paths::Hop>& before = paths_before[src][dst];
+            if (path.size() != before.size()) {
+                changed = true;
+            } else {
+                for (size_t i = 0; i < path.size(); i++) {
+                    if (path[i].dst != before[i].dst
+                        || path[i].outport != before[i].outport
+                        || path[i].inport != before[i].inport) {
+                        changed = true;
+                    }
+                }
+            }
+            before.swap(path);
+        }
+
+        uint32_t version;
+        MUST_SUCCEED(paths.get_version(datapathid::from_host(src), version));
+        if (changed) {
+            MUST_SUCCEED(version != versions_before[src]);
+        }
+        versions_before[src] = version;
+    }
+}
+
+/* Adds 'link' to both 'paths' and 'links', checking that it is only added
+ * once. */
+static void
+add_link(Shortest_paths& paths, const Test_link& link)
+{
+    bool added = paths.add_link(datapathid::from_host(link.src), link.outport,
+                                datapathid::from_host(link.dst), link.inport);
+    MUST_SUCCEED(added == !has_link(link));
+    if (added) {
+        links.push_back(link);
+        link_set.insert(link);
+    }
+}
+
+int
+main(void)
+{
+    Shortest_paths paths;
+    uint32_t n = 1;
+    unreachable.resize(1);
+    unreachable[0].dst = datapathid::from_host(UNREACHABLE);
+    std::vector<std::vector<std::vector<Shortest_paths::Hop> > >
+        paths_before(N_SWITCHES,
+                     std::vector<std::vector<Shortest_paths::Hop> >(
+                         N_SWITCHES, unreachable));
+    std::vector<uint32_t> versions_before(N_SWITCHES, 0);
+    for (uint32_t i = 0; i < N_SWITCHES; i++) {
+        paths_before[i][i].clear();
+    }
+
+    /* Few ports per switch, so that some links are parallel and some are
+     * added twice. */
+    srand(1);
+    for (int change = 0; change < N_CHANGES; change++) {
+        Test_link link;
+        link.outport = 1 + rand() % 3;
+        link.inport = 1 + rand() % 3;
+
+        if (n < N_SWITCHES && (n < 4 || rand() % 20 == 0)) {
+            /* A new switch, connected to a known one. */
+            link.src = rand() % n;
+            link.dst = n++;
+            add_link(paths, link);
+        } else if (links.empty() || rand() % 3) {
+            link.src = rand() % n;
+            link.dst = (link.src + 1 + rand() % (n - 1)) % n;
+            add_link(paths, link);
+        } else {
+            size_t i = rand() % links.size();
+            link = links[i];
+            links.erase(links.begin() + i);
+            link_set.erase(link);
+            MUST_SUCCEED(paths.remove_link(datapathid::from_host(link.src),
+                                           link.outport,
+                                           datapathid::from_host(link.dst),
+                                           link.inport));
+            MUST_SUCCEED(!paths.remove_link(datapathid::from_host(link.src),
+                                            link.outport,
+                                            datapathid::from_host(link.dst),
+                                            link.inport));
+        }
+
+        MUST_SUCCEED(paths.get_n_datapaths() == n);
+        check(paths, n, paths_before, versions_before);
+    }
+    MUST_SUCCEED(n == N_SWITCHES);
+    return 0;
+}
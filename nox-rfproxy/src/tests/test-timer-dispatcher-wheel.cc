@@ -0,0 +1,108 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests that timers fire in order across the wraparound of the timer
+ * wheel's first level, which covers 256 ms, and that canceling or
+ * rescheduling them works wherever they are in the wheel:
+ *
+ *      - Timers 2 and 3 are due on either side of the first wraparound, so
+ *        timer 3 starts out in the second level and is cascaded down.
+ *
+ *      - Timer 4 is rescheduled from the second level to an earlier slot.
+ *
+ *      - Timers 5 and 6 are due in the same tick and fire in the order they
+ *        were posted.
+ *
+ *      - Timer 1 cancels timers in the third level and beyond the range of
+ *        the wheel, timer 2 one still in the second level, and timer 3 one
+ *        cascaded into the first level since it was posted.
+ *
+ *      - A stale facade of a canceled timer does not cancel the timer that
+ *        reused its node.
+ */
+
+#include "timer-dispatcher.hh"
+#include <boost/bind.hpp>
+#include "threads/cooperative.hh"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace vigil;
+
+static Timer timers[13];
+
+static void
+fire(int id)
+{
+    printf("Timer %d fired\n", id);
+    switch (id) {
+    case 1:
+        timers[9].cancel();
+        timers[10].cancel();
+        break;
+    case 2:
+        timers[11].cancel();
+        break;
+    case 3:
+        timers[12].cancel();
+        break;
+    case 8:
+        exit(0);
+    }
+}
+
+static void
+post(Timer_dispatcher& timer_dispatcher, int id, long sec, long msec)
+{
+    timers[id] = timer_dispatcher.post(boost::bind(fire, id),
+                                       make_timeval(sec, msec * 1000));
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    Poll_loop loop(1);
+
+    Timer_dispatcher timer_dispatcher;
+    loop.add_pollable(&timer_dispatcher);
+
+    post(timer_dispatcher, 1, 0, 10);
+    post(timer_dispatcher, 2, 0, 240);
+    post(timer_dispatcher, 3, 0, 270);
+    post(timer_dispatcher, 4, 0, 700);
+    timers[4].reset(0, 300 * 1000);
+    post(timer_dispatcher, 5, 0, 400);
+    post(timer_dispatcher, 6, 0, 400);
+    post(timer_dispatcher, 8, 0, 600);
+
+    post(timer_dispatcher, 9, 40, 0);
+    post(timer_dispatcher, 10, 60 * 86400, 0);
+    post(timer_dispatcher, 11, 0, 290);
+    post(timer_dispatcher, 12, 0, 320);
+
+    Timer stale = timers[0] = timer_dispatcher.post(boost::bind(fire, 0),
+                                                    make_timeval(0, 500000));
+    timers[0].cancel();
+    post(timer_dispatcher, 7, 0, 500);
+    stale.cancel();
+
+    loop.run();
+}
@@ -0,0 +1,13 @@
+#! /bin/sh -e
+trap 'rm -f tmp$$' 0
+$SUPERVISOR ./test-timer-dispatcher-wheel > tmp$$
+diff -u - tmp$$ <<EOF
+Timer 1 fired
+Timer 2 fired
+Timer 3 fired
+Timer 4 fired
+Timer 5 fired
+Timer 6 fired
+Timer 7 fired
+Timer 8 fired
+EOF
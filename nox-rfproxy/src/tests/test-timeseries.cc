@@ -0,0 +1,161 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests the fixed-memory time series kept by switchrtt and linkload: that
+ * values recorded go into a bucket of each tier, that a bucket is reused
+ * once its ring comes round again, that a summary uses the finest tier that
+ * spans its window, and the JSON written for a window. */
+
+#include "timeseries.hh"
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace vigil;
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+typedef timeseries<int> series;
+
+/* A time on the hour, so that buckets of each tier start with it. */
+static const time_t T = 3600000;
+
+static std::string
+json(const series& ts, int key, time_t now, time_t window,
+     size_t maxBuckets = 100)
+{
+    std::ostringstream os;
+    ts.write_json(key, os, now, window, maxBuckets);
+    return os.str();
+}
+
+static void
+test_record()
+{
+    /* 5 buckets of 1 s, 3 of 1 min and 2 of 1 h. */
+    series ts(5, 3, 2);
+    ts.record(1, T, 2);
+    ts.record(1, T, 4);
+    ts.record(1, T + 1, 10);
+    ts.record(2, T + 1, 1);
+
+    series::summary s;
+    MUST_SUCCEED(ts.summarize(1, T + 1, 5, 100, s));
+    MUST_SUCCEED(s.resolution == 1);
+    MUST_SUCCEED(s.count == 3 && s.min == 2 && s.max == 10);
+    MUST_SUCCEED(s.avg == 16.0 / 3);
+    MUST_SUCCEED(s.percentile == 10);
+    MUST_SUCCEED(ts.summarize(1, T + 1, 5, 50, s) && s.percentile == 4);
+
+    /* The window is (now - window, now]. */
+    MUST_SUCCEED(ts.summarize(1, T + 1, 1, 100, s));
+    MUST_SUCCEED(s.count == 1 && s.min == 10);
+    MUST_SUCCEED(!ts.summarize(1, T - 1, 1, 100, s));
+    MUST_SUCCEED(!ts.summarize(3, T + 1, 5, 100, s));
+
+    /* Windows beyond 5 s are summarized from the 1 min tier, and beyond
+     * 3 min from the 1 h tier, and beyond that the coarsest still. */
+    MUST_SUCCEED(ts.summarize(1, T + 1, 6, 100, s));
+    MUST_SUCCEED(s.resolution == 60 && s.count == 3 && s.percentile == 10);
+    MUST_SUCCEED(ts.summarize(1, T + 1, 181, 100, s) && s.resolution == 3600);
+    MUST_SUCCEED(ts.summarize(1, T + 1, 86400, 100, s) && s.resolution == 3600);
+
+    MUST_SUCCEED(ts.summarize(2, T + 1, 5, 100, s) && s.count == 1);
+    ts.erase(2);
+    MUST_SUCCEED(!ts.summarize(2, T + 1, 5, 100, s));
+}
+
+static void
+test_eviction()
+{
+    series ts(5, 3, 2);
+    ts.record(1, T, 2);
+    ts.record(1, T + 1, 3);
+
+    /* 5 s on, the ring of 1 s buckets comes round to that of T again. */
+    ts.record(1, T + 5, 7);
+    series::summary s;
+    MUST_SUCCEED(ts.summarize(1, T + 5, 5, 100, s));
+    MUST_SUCCEED(s.count == 2 && s.min == 3 && s.max == 7);
+
+    /* An old bucket left in the ring is not counted for a later window. */
+    MUST_SUCCEED(ts.summarize(1, T + 6, 5, 100, s));
+    MUST_SUCCEED(s.count == 1 && s.min == 7);
+
+    /* The minute holds all, until its ring comes round too. */
+    MUST_SUCCEED(ts.summarize(1, T + 5, 60, 100, s) && s.count == 3);
+    ts.record(1, T + 3 * 60, 1);
+    MUST_SUCCEED(!ts.summarize(1, T + 5 + 3 * 60, 5, 100, s));
+    MUST_SUCCEED(ts.summarize(1, T + 3 * 60, 60, 100, s));
+    MUST_SUCCEED(s.count == 1 && s.max == 1);
+    MUST_SUCCEED(ts.summarize(1, T + 3 * 60, 3600, 100, s));
+    MUST_SUCCEED(s.count == 4 && s.max == 7);
+}
+
+static void
+test_json()
+{
+    series ts(5, 3, 2);
+    ts.record(1, T, 2);
+    ts.record(1, T, 4);
+    ts.record(1, T + 2, 10);
+
+    /* Buckets in the window, oldest first, as [start,count,min,avg,max]. */
+    MUST_SUCCEED(json(ts, 1, T + 2, 5) ==
+                 "[{\"resolution\":1,\"buckets\":"
+                 "[[3600000,2,2,3,4],[3600002,1,10,10,10]]},"
+                 "{\"resolution\":60,\"buckets\":[[3600000,3,2,5.33333,10]]},"
+                 "{\"resolution\":3600,\"buckets\":[[3600000,3,2,5.33333,10]]}]");
+    MUST_SUCCEED(json(ts, 1, T + 2, 2) ==
+                 "[{\"resolution\":1,\"buckets\":[[3600002,1,10,10,10]]},"
+                 "{\"resolution\":60,\"buckets\":[[3600000,3,2,5.33333,10]]},"
+                 "{\"resolution\":3600,\"buckets\":[[3600000,3,2,5.33333,10]]}]");
+
+    /* At most the latest maxBuckets of each tier. */
+    MUST_SUCCEED(json(ts, 1, T + 2, 5, 1) ==
+                 "[{\"resolution\":1,\"buckets\":[[3600002,1,10,10,10]]},"
+                 "{\"resolution\":60,\"buckets\":[[3600000,3,2,5.33333,10]]},"
+                 "{\"resolution\":3600,\"buckets\":[[3600000,3,2,5.33333,10]]}]");
+    MUST_SUCCEED(json(ts, 1, T + 3, 5, 1) ==
+                 "[{\"resolution\":1,\"buckets\":[]},"
+                 "{\"resolution\":60,\"buckets\":[[3600000,3,2,5.33333,10]]},"
+                 "{\"resolution\":3600,\"buckets\":[[3600000,3,2,5.33333,10]]}]");
+
+    /* An unknown series has no buckets, and a tier of none is left out. */
+    MUST_SUCCEED(json(ts, 2, T + 2, 5) ==
+                 "[{\"resolution\":1,\"buckets\":[]},"
+                 "{\"resolution\":60,\"buckets\":[]},"
+                 "{\"resolution\":3600,\"buckets\":[]}]");
+    series minutes(0, 3, 0);
+    minutes.record(1, T, 2);
+    MUST_SUCCEED(json(minutes, 1, T + 2, 60) ==
+                 "[{\"resolution\":60,\"buckets\":[[3600000,1,2,2,2]]}]");
+}
+
+int
+main(void)
+{
+    test_record();
+    test_eviction();
+    test_json();
+    return 0;
+}
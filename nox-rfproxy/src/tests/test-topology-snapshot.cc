@@ -0,0 +1,155 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests the topology's compressed snapshots: that datapaths are numbered in
+ * datapath id order, that each one's ports, internal ports and links come
+ * back as they were in the topology, with links sorted by the datapath at
+ * the other end and those to unknown datapaths left out, and that a snapshot
+ * does not change when the topology it was built from does. */
+
+#include "topology/topology.hh"
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace vigil;
+using namespace vigil::applications;
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+typedef hash_map<datapathid, Topology::DpInfo> Network;
+
+static datapathid
+dp(uint64_t id)
+{
+    return datapathid::from_host(id);
+}
+
+static Topology::DpInfo&
+add_datapath(Network& network, uint64_t id, bool active, int n_ports)
+{
+    Topology::DpInfo& di = network[dp(id)];
+    di.active = active;
+    for (int i = 1; i <= n_ports; i++) {
+        Port port;
+        port.port_no = i;
+        di.ports.push_back(port);
+    }
+    return di;
+}
+
+static void
+add_link(Topology::DpInfo& di, uint64_t dst, uint16_t src_port,
+         uint16_t dst_port)
+{
+    Topology::LinkPorts ports = { src_port, dst_port };
+    di.outlinks[dp(dst)].push_back(ports);
+    di.internal[src_port].second++;
+}
+
+static bool
+is_link(const Topology::Snapshot::Link& link, uint32_t dst,
+        uint16_t src_port, uint16_t dst_port)
+{
+    return (link.dst == dst && link.ports.src == src_port
+            && link.ports.dst == dst_port);
+}
+
+int
+main(void)
+{
+    /* Four datapaths, not added in id order.  10 has parallel links to 20,
+     * added out of order, one to 30 and one to a datapath that is not in
+     * the topology. */
+    Network network;
+    add_datapath(network, 30, true, 2);
+    Topology::DpInfo& di10 = add_datapath(network, 10, true, 6);
+    add_datapath(network, 40, false, 0);
+    add_datapath(network, 20, true, 4);
+    add_link(di10, 30, 5, 1);
+    add_link(di10, 20, 3, 4);
+    add_link(di10, 20, 1, 2);
+    add_link(di10, 99, 6, 1);
+
+    Topology::Snapshot snapshot(network, 7);
+    MUST_SUCCEED(snapshot.get_version() == 7);
+    MUST_SUCCEED(snapshot.get_n_datapaths() == 4);
+    for (uint32_t i = 0; i < 4; i++) {
+        MUST_SUCCEED(snapshot.get_datapath(i) == dp(10 * (i + 1)));
+        uint32_t index;
+        MUST_SUCCEED(snapshot.find(dp(10 * (i + 1)), index) && index == i);
+    }
+    uint32_t index;
+    MUST_SUCCEED(!snapshot.find(dp(25), index));
+    MUST_SUCCEED(!snapshot.find(dp(99), index));
+    MUST_SUCCEED(snapshot.is_active(0) && !snapshot.is_active(3));
+
+    /* Ports, by number or by datapath id. */
+    Topology::Snapshot::PortRange ports = snapshot.get_ports(0);
+    MUST_SUCCEED(ports.second - ports.first == 6);
+    MUST_SUCCEED(ports.first->port_no == 1);
+    ports = snapshot.get_ports(dp(20));
+    MUST_SUCCEED(ports.second - ports.first == 4);
+    ports = snapshot.get_ports(3);
+    MUST_SUCCEED(ports.first == ports.second);
+    ports = snapshot.get_ports(dp(25));
+    MUST_SUCCEED(ports.first == ports.second);
+
+    /* Links, sorted by the datapath at the other end, then by port. */
+    Topology::Snapshot::LinkRange links = snapshot.get_outlinks(0);
+    MUST_SUCCEED(links.second - links.first == 3);
+    MUST_SUCCEED(is_link(links.first[0], 1, 1, 2));
+    MUST_SUCCEED(is_link(links.first[1], 1, 3, 4));
+    MUST_SUCCEED(is_link(links.first[2], 2, 5, 1));
+    links = snapshot.get_outlinks(1);
+    MUST_SUCCEED(links.first == links.second);
+
+    links = snapshot.get_outlinks(0, 1);
+    MUST_SUCCEED(links.second - links.first == 2);
+    MUST_SUCCEED(is_link(links.first[0], 1, 1, 2));
+    links = snapshot.get_outlinks(0, 2);
+    MUST_SUCCEED(links.second - links.first == 1);
+    links = snapshot.get_outlinks(0, 3);
+    MUST_SUCCEED(links.first == links.second);
+
+    MUST_SUCCEED(snapshot.is_internal(0, 1));
+    MUST_SUCCEED(snapshot.is_internal(0, 5));
+    MUST_SUCCEED(!snapshot.is_internal(0, 2));
+    MUST_SUCCEED(!snapshot.is_internal(1, 1));
+
+    /* Later changes make a new version, and leave the old one alone. */
+    network.erase(dp(20));
+    network[dp(10)].outlinks.erase(dp(20));
+    add_datapath(network, 5, true, 1);
+    Topology::Snapshot next(network, 8);
+    MUST_SUCCEED(next.get_n_datapaths() == 4);
+    MUST_SUCCEED(next.get_datapath(0) == dp(5));
+    MUST_SUCCEED(next.find(dp(10), index) && index == 1);
+    links = next.get_outlinks(1);
+    MUST_SUCCEED(links.second - links.first == 1);
+    MUST_SUCCEED(is_link(links.first[0], 2, 5, 1));
+
+    MUST_SUCCEED(snapshot.get_n_datapaths() == 4);
+    MUST_SUCCEED(snapshot.get_datapath(1) == dp(20));
+    links = snapshot.get_outlinks(0, 1);
+    MUST_SUCCEED(links.second - links.first == 2);
+    return 0;
+}
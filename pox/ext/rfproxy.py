@@ -8,7 +8,7 @@ from pox.openflow.libopenflow_01 import *
 import pymongo as mongo
 
 import rflib.ipc.IPC as IPC
-import rflib.ipc.MongoIPC as MongoIPC
+import rflib.ipc.IPCService as IPCService
 from rflib.ipc.RFProtocol import *
 from rflib.ipc.RFProtocolFactory import RFProtocolFactory
 from rflib.defs import *
@@ -64,8 +64,9 @@ netmask_prefix = lambda a: sum([bin(int(x)).count("1") for x in a.split(".", 4)]
 
 # TODO: add proper support for ID
 ID = 0
-ipc = MongoIPC.MongoIPCMessageService(MONGO_ADDRESS, MONGO_DB_NAME, str(ID),
-                                      threading.Thread, time.sleep)
+ipc = IPCService.create_ipc_message_service(IPCService.default_ipc_address(),
+                                            MONGO_DB_NAME, str(ID),
+                                            threading.Thread, time.sleep)
 table = Table()
 
 # Logging
@@ -122,6 +123,8 @@ def on_datapath_down(event):
 
     msg = DatapathDown(ct_id=ID, dp_id=dp_id)
     ipc.send(RFSERVER_RFPROXY_CHANNEL, RFSERVER_ID, msg)
+    # Drop the RouteMods still queued for it, they would only fail
+    ipc.discard(RFSERVER_RFPROXY_CHANNEL, str(ID), ROUTE_MOD, "id", str(dp_id))
 
 def on_packet_in(event):
     packet = event.parsed
@@ -34,6 +34,7 @@
 
 #include "fpm_lsp.h"
 
+#include "log/Log.h"
 #include "FPMServer.hh"
 #include "FlowTable.h"
 
@@ -45,19 +46,10 @@ typedef struct glob_t_ {
 glob_t glob_space;
 glob_t *glob = &glob_space;
 
-/* TODO: Integrate logging with RFClient */
-int log_level = 1;
-
-#define log(level, format...)     \
-if (level <= log_level) {     \
-    fprintf(stderr, format);      \
-    fprintf(stderr, "\n");      \
-}
-
-#define info_msg(format...) log(1, format)
-#define warn_msg(format...) log(0, format)
-#define err_msg(format...) log(-1, format)
-#define trace log
+#define info_msg(format...) RFLOG_INFO(format)
+#define warn_msg(format...) RFLOG_WARN(format)
+#define err_msg(format...) RFLOG_ERR(format)
+#define trace(format...) RFLOG_DEBUG(format)
 
 /*
  * create_listen_sock
@@ -109,13 +101,13 @@ int FPMServer::accept_conn(int listen_sock) {
     unsigned int client_len;
 
     while (1) {
-        trace(1, "Waiting for client connection...");
+        info_msg("Waiting for client connection...");
         client_len = sizeof(client_addr);
         sock = accept(listen_sock, (struct sockaddr *) &client_addr,
                         &client_len);
 
         if (sock >= 0) {
-            trace(1, "Accepted client %s", inet_ntoa(client_addr.sin_addr));
+            info_msg("Accepted client %s", inet_ntoa(client_addr.sin_addr));
             return sock;
         }
 
@@ -155,7 +147,7 @@ FPMServer::read_fpm_msg(char *buf, size_t buf_len) {
             reading_full_msg = 1;
         }
 
-        trace(3, "Looking to read %d bytes", need_len);
+        trace("Looking to read %d bytes", need_len);
         bytes_read = read(glob->sock, cur, need_len);
 
         if (bytes_read <= 0) {
@@ -163,7 +155,7 @@ FPMServer::read_fpm_msg(char *buf, size_t buf_len) {
             return NULL;
         }
 
-        trace(3, "Read %d bytes", bytes_read);
+        trace("Read %d bytes", bytes_read);
         cur += bytes_read;
 
         if (bytes_read < need_len) {
@@ -202,7 +194,7 @@ void FPMServer::print_nhlfe(const nhlfe_msg_t *msg) {
  * process_fpm_msg
  */
 void FPMServer::process_fpm_msg(fpm_msg_hdr_t *hdr) {
-    trace(1, "FPM message - Type: %d, Length %d", hdr->msg_type,
+    trace("FPM message - Type: %d, Length %d", hdr->msg_type,
             ntohs(hdr->msg_len));
 
     /**
@@ -255,7 +247,7 @@ void FPMServer::start() {
     while (1) {
         glob->sock = FPMServer::accept_conn(glob->server_sock);
         FPMServer::fpm_serve();
-        trace(1, "Done serving client");
+        info_msg("Done serving client");
     }
 }
 
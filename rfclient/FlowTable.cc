@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -12,6 +13,8 @@
 #include <iostream>
 
 #include "converter.h"
+#include "log/Log.h"
+#include "metrics/Metrics.h"
 #include "FlowTable.h"
 #ifdef FPM_ENABLED
   #include "FPMServer.hh"
@@ -50,6 +53,7 @@ uint64_t FlowTable::vm_id;
 
 typedef std::pair<RouteModType,RouteEntry> PendingRoute;
 SyncQueue<PendingRoute> FlowTable::pendingRoutes;
+boost::mutex routeTableMutex;
 list<RouteEntry> FlowTable::routeTable;
 boost::mutex hostTableMutex;
 map<string, HostEntry> FlowTable::hostTable;
@@ -57,6 +61,17 @@ map<string, HostEntry> FlowTable::hostTable;
 boost::mutex ndMutex;
 map<string, int> FlowTable::pendingNeighbours;
 
+static Gauge& pendingRoutesDepth = Metrics::gauge("rfclient_pending_routes",
+    "Routes waiting for the gateway resolver");
+static Counter& routeRetries = Metrics::counter("rfclient_route_retries_total",
+    "Routes put back in the queue because they could not be sent");
+static Counter& routeModsSent = Metrics::counter(
+    "rfclient_route_mods_sent_total", "RouteMods sent to RFServer");
+static Counter& netlinkRoutes = Metrics::counter(
+    "rfclient_netlink_routes_total", "Route additions and removals received");
+static Counter& netlinkNeighbours = Metrics::counter(
+    "rfclient_netlink_neighbours_total", "Neighbour additions received");
+
 // TODO: implement a way to pause the flow table updates when the VM is not
 //       associated with a valid datapath
 
@@ -81,10 +96,10 @@ void FlowTable::start(uint64_t vm_id, map<string, Interface> interfaces,
     HTPolling = boost::thread(&FlowTable::HTPollingCb);
 
 #ifdef FPM_ENABLED
-    std::cout << "FPM interface enabled\n";
+    RFLOG_INFO("FPM interface enabled");
     FPMClient = boost::thread(&FPMServer::start);
 #else
-    std::cout << "Netlink interface enabled\n";
+    RFLOG_INFO("Netlink interface enabled");
     rtnl_open(&rth, RTMGRP_IPV4_MROUTE | RTMGRP_IPV4_ROUTE
                   | RTMGRP_IPV6_MROUTE | RTMGRP_IPV6_ROUTE);
     RTPolling = boost::thread(&FlowTable::RTPollingCb);
@@ -95,11 +110,40 @@ void FlowTable::start(uint64_t vm_id, map<string, Interface> interfaces,
 }
 
 void FlowTable::clear() {
-    FlowTable::routeTable.clear();
+    {
+        boost::lock_guard<boost::mutex> lock(routeTableMutex);
+        FlowTable::routeTable.clear();
+    }
     boost::lock_guard<boost::mutex> lock(hostTableMutex);
     FlowTable::hostTable.clear();
 }
 
+/*
+ * Send every route and host in the tables again, for RFServer to catch up
+ * after RouteMods sent to it or on from it were lost. Routes removed since
+ * are not sent, so removals that were lost are not made good.
+ */
+void FlowTable::resync() {
+    list<RouteEntry> routes;
+    {
+        boost::lock_guard<boost::mutex> lock(routeTableMutex);
+        routes = FlowTable::routeTable;
+    }
+    map<string, HostEntry> hosts;
+    {
+        boost::lock_guard<boost::mutex> lock(hostTableMutex);
+        hosts = FlowTable::hostTable;
+    }
+    RFLOG_INFO("flow_table_resync routes=%zu hosts=%zu", routes.size(),
+               hosts.size());
+
+    for (list<RouteEntry>::iterator it = routes.begin(); it != routes.end(); it++)
+        FlowTable::sendToHw(RMT_ADD, *it);
+    map<string, HostEntry>::iterator it;
+    for (it = hosts.begin(); it != hosts.end(); it++)
+        FlowTable::sendToHw(RMT_ADD, it->second);
+}
+
 void FlowTable::interrupt() {
     HTPolling.interrupt();
     GWResolver.interrupt();
@@ -116,25 +160,29 @@ void FlowTable::GWResolverCb() {
 
         PendingRoute pr;
         FlowTable::pendingRoutes.wait_and_pop(pr);
+        pendingRoutesDepth.add(-1);
 
         bool existingEntry = false;
-        std::list<RouteEntry>::iterator iter = FlowTable::routeTable.begin();
-        for (; iter != FlowTable::routeTable.end(); iter++) {
-            if (pr.second == *iter) {
-                existingEntry = true;
-                break;
+        {
+            boost::lock_guard<boost::mutex> lock(routeTableMutex);
+            std::list<RouteEntry>::iterator iter = FlowTable::routeTable.begin();
+            for (; iter != FlowTable::routeTable.end(); iter++) {
+                if (pr.second == *iter) {
+                    existingEntry = true;
+                    break;
+                }
             }
         }
 
         if (existingEntry && pr.first == RMT_ADD) {
-            fprintf(stdout, "Received duplicate route addition for route %s\n",
-                    pr.second.address.toString().c_str());
+            RFLOG_INFO("route_add_duplicate net=%s",
+                       pr.second.address.toString().c_str());
             continue;
         }
 
         if (!existingEntry && pr.first == RMT_DELETE) {
-            fprintf(stdout, "Received route removal for %s but route %s.\n",
-                    pr.second.address.toString().c_str(), "cannot be found");
+            RFLOG_INFO("route_delete_unknown net=%s",
+                       pr.second.address.toString().c_str());
             continue;
         }
 
@@ -146,28 +194,34 @@ void FlowTable::GWResolverCb() {
                 /* If we can't resolve the gateway, put it to the end of the
                  * queue. Routes with unresolvable gateways will constantly
                  * loop through this code, popping and re-pushing. */
-                fprintf(stderr, "An error occurred while %s %s/%s.\n",
-                        "attempting to resolve", re.address.toString().c_str(),
-                        re.netmask.toString().c_str());
+                RFLOG_WARN("route_resolve_failed net=%s mask=%s gw=%s",
+                           re.address.toString().c_str(),
+                           re.netmask.toString().c_str(),
+                           re.gateway.toString().c_str());
                 FlowTable::pendingRoutes.push(pr);
+                pendingRoutesDepth.add(1);
+                routeRetries.inc();
                 continue;
             }
         }
 
         if (FlowTable::sendToHw(pr.first, pr.second) < 0) {
-            fprintf(stderr, "An error occurred while pushing route %s/%s.\n",
-                    re.address.toString().c_str(),
-                    re.netmask.toString().c_str());
+            RFLOG_WARN("route_push_failed net=%s mask=%s",
+                       re.address.toString().c_str(),
+                       re.netmask.toString().c_str());
             FlowTable::pendingRoutes.push(pr);
+            pendingRoutesDepth.add(1);
+            routeRetries.inc();
             continue;
         }
 
+        boost::lock_guard<boost::mutex> lock(routeTableMutex);
         if (pr.first == RMT_ADD) {
             FlowTable::routeTable.push_back(pr.second);
         } else if (pr.first == RMT_DELETE) {
             FlowTable::routeTable.remove(pr.second);
         } else {
-            fprintf(stderr, "Received unexpected RouteModType (%d)\n", pr.first);
+            RFLOG_ERR("route_mod_unexpected type=%d", pr.first);
         }
     }
 }
@@ -177,21 +231,19 @@ void FlowTable::GWResolverCb() {
  *
  * On success, overwrites given interface pointer with the active interface
  * and returns 0;
- * On error, prints to stderr with appropriate message and returns -1.
+ * On error, logs an appropriate message and returns -1.
  */
 int FlowTable::getInterface(const char *intf, const char *type,
                             Interface& iface) {
     map<string, Interface>::iterator it = interfaces.find(intf);
 
     if (it == interfaces.end()) {
-        fprintf(stderr, "Interface %s not found, dropping %s entry\n",
-                intf, type);
+        RFLOG_WARN("interface_unknown intf=%s dropped=%s", intf, type);
         return -1;
     }
 
     if (not it->second.active) {
-        fprintf(stderr, "Interface %s inactive, dropping %s entry\n",
-                intf, type);
+        RFLOG_WARN("interface_inactive intf=%s dropped=%s", intf, type);
         return -1;
     }
 
@@ -205,12 +257,12 @@ int rta_to_ip(unsigned char family, const void *ip, IPAddress& result) {
     } else if (family == AF_INET6) {
         result = IPAddress(reinterpret_cast<const struct in6_addr *>(ip));
     } else {
-        fprintf(stderr, "Unrecognised nlmsg family");
+        RFLOG_WARN("nlmsg_family_unknown family=%u", family);
         return -1;
     }
 
     if (result.toString() == "") {
-        fprintf(stderr, "Blank IP address. Dropping Route\n");
+        RFLOG_WARN("route_address_blank dropped=route");
         return -1;
     }
 
@@ -227,7 +279,8 @@ int FlowTable::updateHostTable(const struct sockaddr_nl *, struct nlmsghdr *n, v
     boost::this_thread::interruption_point();
 
     if (if_indextoname((unsigned int) ndmsg_ptr->ndm_ifindex, (char *) intf) == NULL) {
-        perror("HostTable");
+        RFLOG_WARN("host_interface_unknown ifindex=%d error=\"%s\"",
+                   ndmsg_ptr->ndm_ifindex, strerror(errno));
         return 0;
     }
 
@@ -257,7 +310,7 @@ int FlowTable::updateHostTable(const struct sockaddr_nl *, struct nlmsghdr *n, v
         }
         case NDA_LLADDR:
             if (strncpy(mac, ether_ntoa(((ether_addr *) RTA_DATA(rtattr_ptr))), sizeof(mac)) == NULL) {
-                perror("HostTable");
+                RFLOG_WARN("host_mac_invalid error=\"%s\"", strerror(errno));
                 return 0;
             }
             break;
@@ -272,12 +325,13 @@ int FlowTable::updateHostTable(const struct sockaddr_nl *, struct nlmsghdr *n, v
     }
 
     if (strlen(mac) == 0) {
-        fprintf(stderr, "Received host entry with blank mac. Ignoring\n");
+        RFLOG_WARN("host_mac_blank intf=%s", intf);
         return 0;
     }
 
     switch (n->nlmsg_type) {
         case RTM_NEWNEIGH: {
+            netlinkNeighbours.inc();
             FlowTable::sendToHw(RMT_ADD, *hentry);
 
             string host = hentry->address.toString();
@@ -293,14 +347,14 @@ int FlowTable::updateHostTable(const struct sockaddr_nl *, struct nlmsghdr *n, v
                 map<string, int>::iterator iter = pendingNeighbours.find(host);
                 if (iter != pendingNeighbours.end()) {
                     if (close(iter->second) == -1) {
-                        perror("pendingNeighbours");
+                        RFLOG_WARN("nd_close_failed host=%s error=\"%s\"",
+                                   host.c_str(), strerror(errno));
                     }
                     pendingNeighbours.erase(host);
                 }
             }
 
-            std::cout << "netlink->RTM_NEWNEIGH: ip=" << host << ", mac=" << mac
-                      << std::endl;
+            RFLOG_INFO("neigh_add ip=%s mac=%s", host.c_str(), mac);
             break;
         }
         /* TODO: enable this? It is causing serious problems. Why?
@@ -335,6 +389,7 @@ int FlowTable::updateRouteTable(struct nlmsghdr *n) {
     }
 
     boost::scoped_ptr<RouteEntry> rentry(new RouteEntry());
+    rentry->trace.start(TRACE_NETLINK_RECEIVE);
 
     char intf[IF_NAMESIZE + 1];
     memset(intf, 0, IF_NAMESIZE + 1);
@@ -408,14 +463,18 @@ int FlowTable::updateRouteTable(struct nlmsghdr *n) {
 
     switch (n->nlmsg_type) {
         case RTM_NEWROUTE:
-            std::cout << "netlink->RTM_NEWROUTE: net=" << net << ", mask="
-                      << mask << ", gw=" << gw << std::endl;
+            RFLOG_INFO("route_add net=%s mask=%s gw=%s", net.c_str(),
+                       mask.c_str(), gw.c_str());
             FlowTable::pendingRoutes.push(PendingRoute(RMT_ADD, *rentry));
+            pendingRoutesDepth.add(1);
+            netlinkRoutes.inc();
             break;
         case RTM_DELROUTE:
-            std::cout << "netlink->RTM_DELROUTE: net=" << net << ", mask="
-                      << mask << ", gw=" << gw << std::endl;
+            RFLOG_INFO("route_delete net=%s mask=%s gw=%s", net.c_str(),
+                       mask.c_str(), gw.c_str());
             FlowTable::pendingRoutes.push(PendingRoute(RMT_DELETE, *rentry));
+            pendingRoutesDepth.add(1);
+            netlinkRoutes.inc();
             break;
     }
 
@@ -440,20 +499,21 @@ int FlowTable::initiateND(const char *hostAddr) {
     } else if (inet_pton(AF_INET6, hostAddr, &sin6->sin6_addr) == 1) {
         store.ss_family = AF_INET6;
     } else {
-        fprintf(stderr, "Invalid IP address \"%s\" for resolution. Dropping\n",
-                hostAddr);
+        RFLOG_WARN("nd_address_invalid host=\"%s\"", hostAddr);
         return -1;
     }
 
     if ((s = socket(store.ss_family, SOCK_STREAM, 0)) < 0) {
-        perror("socket() failed");
+        RFLOG_ERR("nd_socket_failed host=%s error=\"%s\"", hostAddr,
+                  strerror(errno));
         return -1;
     }
 
     // Prevent the connect() call from blocking
     flags = fcntl(s, F_GETFL, 0);
     if (fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1) {
-        perror("fcntl() failed");
+        RFLOG_ERR("nd_fcntl_failed host=%s error=\"%s\"", hostAddr,
+                  strerror(errno));
         close(s);
         return -1;
     }
@@ -540,7 +600,8 @@ int FlowTable::setIP(RouteMod& rm, const IPAddress& addr,
     } else if (addr.getVersion() == IPV6) {
         rm.add_match(Match(RFMT_IPV6, addr, mask));
     } else {
-        fprintf(stderr, "Cannot send route with unsupported IP version\n");
+        RFLOG_WARN("route_version_unsupported version=%d",
+                   addr.getVersion());
         return -1;
     }
 
@@ -555,18 +616,21 @@ int FlowTable::sendToHw(RouteModType mod, const RouteEntry& re) {
     const string gateway_str = re.gateway.toString();
     if (mod == RMT_DELETE) {
         return sendToHw(mod, re.address, re.netmask, re.interface,
-                        FlowTable::MAC_ADDR_NONE);
+                        FlowTable::MAC_ADDR_NONE, re.trace);
     } else if (mod == RMT_ADD) {
         const MACAddress& remoteMac = findHost(re.gateway);
         if (remoteMac == FlowTable::MAC_ADDR_NONE) {
-            fprintf(stderr, "Cannot Resolve %s\n", gateway_str.c_str());
+            RFLOG_DEBUG("gateway_unresolved gw=%s", gateway_str.c_str());
             return -1;
         }
 
-        return sendToHw(mod, re.address, re.netmask, re.interface, remoteMac);
+        Trace trace = re.trace;
+        trace.stamp(TRACE_GATEWAY_RESOLVED);
+        return sendToHw(mod, re.address, re.netmask, re.interface, remoteMac,
+                        trace);
     }
 
-    fprintf(stderr, "Unhandled RouteModType (%d)\n", mod);
+    RFLOG_ERR("route_mod_unhandled type=%d", mod);
     return -1;
 }
 
@@ -578,7 +642,8 @@ int FlowTable::sendToHw(RouteModType mod, const HostEntry& he) {
     } else if (he.address.getVersion() == IPV4) {
         mask.reset(new IPAddress(IPV4, FULL_IPV4_PREFIX));
     } else {
-        fprintf(stderr, "Received HostEntry with unsupported IP version\n");
+        RFLOG_WARN("host_version_unsupported version=%d",
+                   he.address.getVersion());
         return -1;
     }
 
@@ -587,9 +652,9 @@ int FlowTable::sendToHw(RouteModType mod, const HostEntry& he) {
 
 int FlowTable::sendToHw(RouteModType mod, const IPAddress& addr,
                          const IPAddress& mask, const Interface& local_iface,
-                         const MACAddress& gateway) {
+                         const MACAddress& gateway, const Trace& trace) {
     if (is_port_down(local_iface.port)) {
-        fprintf(stderr, "Cannot send RouteMod for down port\n");
+        RFLOG_DEBUG("route_mod_port_down port=%u", local_iface.port);
         return -1;
     }
 
@@ -609,7 +674,10 @@ int FlowTable::sendToHw(RouteModType mod, const IPAddress& addr,
      * the port to determine which datapath to send to. */
     rm.add_action(Action(RFAT_OUTPUT, local_iface.port));
 
+    rm.trace = trace;
+    rm.trace.stamp(TRACE_IPC_SEND);
     FlowTable::ipc->send(RFCLIENT_RFSERVER_CHANNEL, RFSERVER_ID, rm);
+    routeModsSent.inc();
     return 0;
 }
 
@@ -628,7 +696,8 @@ void FlowTable::updateNHLFE(nhlfe_msg_t *nhlfe_msg) {
     } else if (nhlfe_msg->table_operation == REMOVE_LSP) {
         msg.set_mod(RMT_DELETE);
     } else {
-        std::cerr << "Unrecognised NHLFE table operation" << std::endl;
+        RFLOG_WARN("nhlfe_operation_unknown operation=%d",
+                   nhlfe_msg->table_operation);
         return;
     }
     msg.set_id(FlowTable::vm_id);
@@ -643,21 +712,21 @@ void FlowTable::updateNHLFE(nhlfe_msg_t *nhlfe_msg) {
     map<string, HostEntry>::iterator iter;
     iter = FlowTable::hostTable.find(gwIP.toString());
     if (iter == FlowTable::hostTable.end()) {
-        std::cerr << "Failed to locate interface for LSP" << std::endl;
+        RFLOG_WARN("nhlfe_interface_unknown gw=%s", gwIP.toString().c_str());
         return;
     } else {
         iface = iter->second.interface;
     }
 
     if (is_port_down(iface.port)) {
-        std::cerr << "Cannot send route via inactive interface" << std::endl;
+        RFLOG_WARN("nhlfe_port_down port=%u", iface.port);
         return;
     }
 
     // Get the MAC address corresponding to our gateway.
     const MACAddress& gwMAC = findHost(gwIP);
     if (gwMAC == FlowTable::MAC_ADDR_NONE) {
-        std::cerr << "Failed to resolve gwMAC IP for NHLFE" << std::endl;
+        RFLOG_WARN("nhlfe_gateway_unresolved gw=%s", gwIP.toString().c_str());
         return;
     }
 
@@ -675,13 +744,15 @@ void FlowTable::updateNHLFE(nhlfe_msg_t *nhlfe_msg) {
     } else if (nhlfe_msg->nhlfe_operation == SWAP) {
         msg.add_action(Action(RFAT_SWAP_MPLS, ntohl(nhlfe_msg->out_label)));
     } else {
-        std::cerr << "Unknown lsp_operation" << std::endl;
+        RFLOG_WARN("nhlfe_lsp_operation_unknown operation=%d",
+                   nhlfe_msg->nhlfe_operation);
         return;
     }
 
     msg.add_action(Action(RFAT_OUTPUT, iface.port));
 
     FlowTable::ipc->send(RFCLIENT_RFSERVER_CHANNEL, RFSERVER_ID, msg);
+    routeModsSent.inc();
 
     return;
 }
@@ -32,6 +32,7 @@ class FlowTable {
 
         static void clear();
         static void interrupt();
+        static void resync();
         static void start(uint64_t vm_id, map<string, Interface> interfaces, IPCMessageService* ipc, vector<uint32_t>* down_ports);
         static void print_test();
 
@@ -92,7 +93,8 @@ class FlowTable {
         static int sendToHw(RouteModType, const HostEntry&);
         static int sendToHw(RouteModType, const IPAddress& addr,
                             const IPAddress& mask, const Interface&,
-                            const MACAddress& gateway);
+                            const MACAddress& gateway,
+                            const Trace& trace = Trace());
 };
 
 #endif /* FLOWTABLE_HH_ */
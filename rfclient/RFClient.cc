@@ -11,6 +11,9 @@
 #include "RFClient.hh"
 #include "converter.h"
 #include "defs.h"
+#include "log/Log.h"
+#include "metrics/Metrics.h"
+#include "metrics/Trace.h"
 #include "FlowTable.h"
 
 #define BUFFER_SIZE 23 /* Mapping packet size. */
@@ -35,7 +38,8 @@ int get_hwaddr_byname(const char * ifname, uint8_t hwaddr[]) {
     ifr.ifr_name[sizeof(ifr.ifr_name) - 1] = '\0';
 
     if (-1 == ioctl(sock, SIOCGIFHWADDR, &ifr)) {
-        perror("ioctl(SIOCGIFHWADDR) ");
+        RFLOG_ERR("ioctl_failed request=SIOCGIFHWADDR intf=%s error=\"%s\"",
+                  ifname, strerror(errno));
         return -1;
     }
 
@@ -66,8 +70,9 @@ uint64_t get_interface_id(const char *ifname) {
 
 RFClient::RFClient(uint64_t id, const string &address) {
     this->id = id;
-    syslog(LOG_INFO, "Starting RFClient (vm_id=%s)", to_string<uint64_t>(this->id).c_str());
-    ipc = (IPCMessageService*) new MongoIPCMessageService(address, MONGO_DB_NAME, to_string<uint64_t>(this->id));
+    RFLOG_INFO("Starting RFClient (vm_id=%s)", to_string<uint64_t>(this->id).c_str());
+    ipc = createIPCMessageService(address, MONGO_DB_NAME, to_string<uint64_t>(this->id));
+    ipc->set_resync_handler(this);
 
     this->init_ports = 0;
     this->load_interfaces();
@@ -78,7 +83,7 @@ RFClient::RFClient(uint64_t id, const string &address) {
 
         PortRegister msg(this->id, i.port, i.hwaddress);
         this->ipc->send(RFCLIENT_RFSERVER_CHANNEL, RFSERVER_ID, msg);
-        syslog(LOG_INFO, "Registering client port (vm_port=%d)", i.port);
+        RFLOG_INFO("Registering client port (vm_port=%d)", i.port);
     }
 
     this->startFlowTable();
@@ -99,9 +104,7 @@ bool RFClient::process(const string &, const string &, const string &, IPCMessag
         uint32_t operation_id = config->get_operation_id();
 
         if (operation_id == 0) {
-            syslog(LOG_INFO,
-                   "Received port configuration (vm_port=%d)",
-                   vm_port);
+            RFLOG_INFO("Received port configuration (vm_port=%d)", vm_port);
             vector<uint32_t>::iterator it;
             for (it=down_ports.begin(); it < down_ports.end(); it++)
                 if (*it == vm_port)
@@ -109,9 +112,7 @@ bool RFClient::process(const string &, const string &, const string &, IPCMessag
             send_port_map(vm_port);
         }
         else if (operation_id == 1) {
-            syslog(LOG_INFO,
-                   "Received port reset (vm_port=%d)",
-                   vm_port);
+            RFLOG_INFO("Received port reset (vm_port=%d)", vm_port);
             down_ports.push_back(vm_port);
         }
     }
@@ -121,6 +122,11 @@ bool RFClient::process(const string &, const string &, const string &, IPCMessag
     return true;
 }
 
+// RouteMods for RFServer were lost: send the routes and hosts again
+void RFClient::resync(const string &, const string &) {
+    FlowTable::resync();
+}
+
 int RFClient::send_packet(const char ethName[], uint64_t vm_id, uint8_t port) {
     char buffer[BUFFER_SIZE];
     uint16_t ethType;
@@ -134,18 +140,21 @@ int RFClient::send_packet(const char ethName[], uint64_t vm_id, uint8_t port) {
     strcpy(req.ifr_name, ethName);
 
     if (ioctl(SockFd, SIOCGIFFLAGS, &req) < 0) {
-        fprintf(stderr, "ERROR! ioctl() call has failed: %s\n", strerror(errno));
+        RFLOG_ERR("ioctl_failed intf=%s error=\"%s\"", ethName,
+                  strerror(errno));
         exit(1);
     }
 
     /* If the interface is down we can't send the packet. */
-    printf("FLAG %d\n", req.ifr_flags & IFF_UP);
+    RFLOG_DEBUG("interface_flags intf=%s up=%d", ethName,
+                req.ifr_flags & IFF_UP);
     if (!(req.ifr_flags & IFF_UP))
         return -1;
 
     /* Get the interface index. */
     if (ioctl(SockFd, SIOCGIFINDEX, &req) < 0) {
-        fprintf(stderr, "ERROR! ioctl() call has failed: %s\n", strerror(errno));
+        RFLOG_ERR("ioctl_failed intf=%s error=\"%s\"", ethName,
+                  strerror(errno));
         exit(1);
     }
 
@@ -154,7 +163,8 @@ int RFClient::send_packet(const char ethName[], uint64_t vm_id, uint8_t port) {
     int addrLen = sizeof(struct sockaddr_ll);
 
     if (ioctl(SockFd, SIOCGIFHWADDR, &req) < 0) {
-        fprintf(stderr, "ERROR! ioctl() call has failed: %s\n", strerror(errno));
+        RFLOG_ERR("ioctl_failed intf=%s error=\"%s\"", ethName,
+                  strerror(errno));
         exit(1);
     }
     int i;
@@ -166,7 +176,8 @@ int RFClient::send_packet(const char ethName[], uint64_t vm_id, uint8_t port) {
     sll.sll_ifindex = ifindex;
 
     if (bind(SockFd, (struct sockaddr *) &sll, addrLen) < 0) {
-        fprintf(stderr, "ERROR! bind() call has failed: %s\n", strerror(errno));
+        RFLOG_ERR("bind_failed intf=%s error=\"%s\"", ethName,
+                  strerror(errno));
         exit(1);
     }
 
@@ -201,7 +212,8 @@ int RFClient::set_hwaddr_byname(const char * ifname, uint8_t hwaddr[], int16_t f
     ifr.ifr_ifru.ifru_flags = flags & (~IFF_UP);
 
     if (-1 == ioctl(sock, SIOCSIFFLAGS, &ifr)) {
-        perror("ioctl(SIOCSIFFLAGS) ");
+        RFLOG_ERR("ioctl_failed request=SIOCSIFFLAGS intf=%s error=\"%s\"",
+                  ifname, strerror(errno));
         return -1;
     }
 
@@ -209,14 +221,16 @@ int RFClient::set_hwaddr_byname(const char * ifname, uint8_t hwaddr[], int16_t f
     std::memcpy(ifr.ifr_ifru.ifru_hwaddr.sa_data, hwaddr, IFHWADDRLEN);
 
     if (-1 == ioctl(sock, SIOCSIFHWADDR, &ifr)) {
-        perror("ioctl(SIOCSIFHWADDR) ");
+        RFLOG_ERR("ioctl_failed request=SIOCSIFHWADDR intf=%s error=\"%s\"",
+                  ifname, strerror(errno));
         return -1;
     }
 
     ifr.ifr_ifru.ifru_flags = flags | IFF_UP;
 
     if (-1 == ioctl(sock, SIOCSIFFLAGS, &ifr)) {
-        perror("ioctl(SIOCSIFFLAGS) ");
+        RFLOG_ERR("ioctl_failed request=SIOCSIFFLAGS intf=%s error=\"%s\"",
+                  ifname, strerror(errno));
         return -1;
     }
 
@@ -232,7 +246,7 @@ void RFClient::load_interfaces() {
     int intfNum;
 
     if (getifaddrs(&ifaddr) == -1) {
-        perror("getifaddrs");
+        RFLOG_ERR("getifaddrs_failed error=\"%s\"", strerror(errno));
         exit( EXIT_FAILURE);
     }
 
@@ -255,7 +269,7 @@ void RFClient::load_interfaces() {
 	        interface.hwaddress = MACAddress(hwaddress);
 	        interface.active = true;
 
-	        printf("Loaded interface %s\n", interface.name.c_str());
+	        RFLOG_INFO("Loaded interface %s", interface.name.c_str());
 
 	        this->interfaces[interface.port] = interface;
 	        intfNum++;
@@ -269,20 +283,20 @@ void RFClient::load_interfaces() {
 void RFClient::send_port_map(uint32_t port) {
     Interface i = this->interfaces[port];
     if (send_packet(i.name.c_str(), this->id, i.port) == -1)
-        syslog(LOG_INFO, "Error sending mapping packet (vm_port=%d)",
-               i.port);
+        RFLOG_WARN("Error sending mapping packet (vm_port=%d)", i.port);
     else
-        syslog(LOG_INFO, "Mapping packet was sent to RFVS (vm_port=%d)",
-               i.port);
+        RFLOG_INFO("Mapping packet was sent to RFVS (vm_port=%d)", i.port);
 }
 
 int main(int argc, char* argv[]) {
     char c;
     stringstream ss;
     string id;
-    string address = MONGO_ADDRESS;
+    string address = defaultIPCAddress();
+    LogLevel level = RFLL_INFO;
+    string metrics;
 
-    while ((c = getopt (argc, argv, "n:i:a:")) != -1)
+    while ((c = getopt (argc, argv, "n:i:a:m:t:v")) != -1)
         switch (c) {
             case 'n':
                 fprintf (stderr, "Custom naming not supported yet.");
@@ -305,8 +319,19 @@ int main(int argc, char* argv[]) {
             case 'a':
                 address = optarg;
                 break;
+            case 'm':
+                metrics = optarg;
+                break;
+            case 't':
+                // Trace one in every N route updates, or none for 0
+                Trace::setSample(atoi(optarg));
+                break;
+            case 'v':
+                level = RFLL_DEBUG;
+                break;
             case '?':
-                if (optopt == 'n' || optopt == 'i' || optopt == 'a')
+                if (optopt == 'n' || optopt == 'i' || optopt == 'a'
+                    || optopt == 'm' || optopt == 't')
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 else if (isprint(optopt))
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -319,6 +344,10 @@ int main(int argc, char* argv[]) {
 
 
     openlog("rfclient", LOG_NDELAY | LOG_NOWAIT | LOG_PID, SYSLOGFACILITY);
+    Log::init("rfclient", level, true);
+    if (!metrics.empty() && !Metrics::serve(metrics))
+        RFLOG_ERR("metrics_serve_failed address=%s error=\"%s\"",
+                  metrics.c_str(), strerror(errno));
     RFClient s(get_interface_id(DEFAULT_RFCLIENT_INTERFACE), address);
 
     return 0;
@@ -3,12 +3,13 @@
 #include <vector>
 
 #include "ipc/IPC.h"
-#include "ipc/MongoIPC.h"
+#include "ipc/IPCService.h"
 #include "ipc/RFProtocol.h"
 #include "ipc/RFProtocolFactory.h"
 #include "FlowTable.h"
 
-class RFClient : private RFProtocolFactory, private IPCMessageProcessor {
+class RFClient : private RFProtocolFactory, private IPCMessageProcessor,
+                 private IPCResyncHandler {
     public:
         RFClient(uint64_t id, const string &address);
 
@@ -26,6 +27,7 @@ class RFClient : private RFProtocolFactory, private IPCMessageProcessor {
 
         void startFlowTable();
         bool process(const string &from, const string &to, const string &channel, IPCMessage& msg);
+        void resync(const string &channelId, const string &to);
 
         int send_packet(const char ethName[], uint64_t vm_id, uint8_t port);
         int set_hwaddr_byname(const char * ifname, uint8_t hwaddr[], int16_t flags);
@@ -2,6 +2,7 @@
 #define ROUTEENTRY_HH
 
 #include "types/IPAddress.h"
+#include "metrics/Trace.h"
 #include "Interface.hh"
 
 class RouteEntry {
@@ -10,6 +11,8 @@ class RouteEntry {
         IPAddress gateway;
         IPAddress netmask;
         Interface interface;
+        /** The trace of the update that added or removed the route */
+        Trace trace;
 
         bool operator==(const RouteEntry& other) const {
             return (this->address == other.address) and
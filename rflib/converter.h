@@ -1,6 +1,7 @@
 #ifndef __CONVERTER_H__
 #define __CONVERTER_H__
 
+#include <stdint.h>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -32,6 +33,24 @@ public:
      throw conversionError("Error converting string to type");
  }
  
+// Streams read and write a uint8_t as a character, so convert it as a
+// number instead
+template<>
+inline std::string to_string(uint8_t const& val)
+{
+   return to_string<unsigned int>(val);
+}
+
+template<>
+inline void convert(std::string const& str, uint8_t& val)
+{
+   unsigned int v;
+   convert(str, v);
+   if (v > 0xff)
+     throw conversionError("Error converting string to type");
+   val = (uint8_t) v;
+}
+
 template<typename T>
 inline T string_to(std::string const& str)
 {
@@ -3,11 +3,17 @@
 
 #define MONGO_ADDRESS "192.169.1.1:27017"
 #define MONGO_DB_NAME "db"
+/* Environment variable overriding the IPC address, see ipc/IPCService.h */
+#define IPC_ADDRESS_ENV "RF_IPC_ADDRESS"
 
 #define RFCLIENT_RFSERVER_CHANNEL "rfclient<->rfserver"
 #define RFSERVER_RFPROXY_CHANNEL "rfserver<->rfproxy"
 
+#define RFTABLE_NAME "rftable"
+#define RFISL_NAME "rfisl"
+
 #define RFSERVER_ID "rfserver"
+#define RFSERVER_CONTROL_ID "rfserver-control"
 #define RFPROXY_ID "rfproxy"
 
 #define DEFAULT_RFCLIENT_INTERFACE "eth0"
@@ -61,4 +67,18 @@ typedef enum route_mod_type {
 #define PRIORITY_HIGH 0x8020
 #define PRIORITY_HIGHEST 0xC030
 
+/* Flow table routes go in when rfserver runs in pipeline mode. The first
+ * table holds the controller rules and a rule per active port sending
+ * traffic on to it. */
+#define RF_ROUTE_TABLE 1
+
+/* Stages of a traced route update, in the order they are reached */
+#define TRACE_NETLINK_RECEIVE "netlink_receive"
+#define TRACE_GATEWAY_RESOLVED "gateway_resolved"
+#define TRACE_IPC_SEND "ipc_send"
+#define TRACE_RFSERVER_ROUTE_MOD "rfserver_route_mod"
+#define TRACE_RFPROXY_PROCESS "rfproxy_process"
+#define TRACE_CREATE_FLOW_MOD "create_flow_mod"
+#define TRACE_SEND_OPENFLOW "send_openflow_command"
+
 #endif /* __DEFS_H__ */
@@ -1,5 +1,7 @@
 MONGO_ADDRESS = "192.169.1.1:27017"
 MONGO_DB_NAME = "db"
+# Environment variable overriding the IPC address, see ipc/IPCService.py
+IPC_ADDRESS_ENV = "RF_IPC_ADDRESS"
 
 RFCLIENT_RFSERVER_CHANNEL = "rfclient<->rfserver"
 RFSERVER_RFPROXY_CHANNEL = "rfserver<->rfproxy"
@@ -10,6 +12,7 @@ RFISL_NAME = "rfisl"
 RFISLCONF_NAME = "rfislconf"
 
 RFSERVER_ID = "rfserver"
+RFSERVER_CONTROL_ID = "rfserver-control"
 RFPROXY_ID = "rfproxy"
 
 DEFAULT_RFCLIENT_INTERFACE = "eth0"
@@ -76,3 +79,17 @@ PRIORITY_LOWEST = 0x0000
 PRIORITY_LOW = 0x4010
 PRIORITY_HIGH = 0x8020
 PRIORITY_HIGHEST = 0xC030
+
+# Flow table routes go in when rfserver runs in pipeline mode. The first
+# table holds the controller rules and a rule per active port sending
+# traffic on to it.
+RF_ROUTE_TABLE = 1
+
+# Stages of a traced route update, in the order they are reached
+TRACE_NETLINK_RECEIVE = "netlink_receive"
+TRACE_GATEWAY_RESOLVED = "gateway_resolved"
+TRACE_IPC_SEND = "ipc_send"
+TRACE_RFSERVER_ROUTE_MOD = "rfserver_route_mod"
+TRACE_RFPROXY_PROCESS = "rfproxy_process"
+TRACE_CREATE_FLOW_MOD = "create_flow_mod"
+TRACE_SEND_OPENFLOW = "send_openflow_command"
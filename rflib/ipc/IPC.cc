@@ -1,4 +1,5 @@
 #include "IPC.h"
+#include "log/Log.h"
 
 string IPCMessageService::get_id() {
     return this->id;
@@ -7,3 +8,17 @@ string IPCMessageService::get_id() {
 void IPCMessageService::set_id(string id) {
     this->id = id;
 }
+
+void IPCMessageService::set_resync_handler(IPCResyncHandler *handler) {
+    this->resyncHandler = handler;
+}
+
+void IPCMessageService::resync(const string &channelId, const string &to) {
+    if (this->resyncHandler == NULL) {
+        RFLOG_WARN("ipc_resync_unhandled channel=%s to=%s", channelId.c_str(),
+                   to.c_str());
+        return;
+    }
+    RFLOG_INFO("ipc_resync channel=%s to=%s", channelId.c_str(), to.c_str());
+    this->resyncHandler->resync(channelId, to);
+}
@@ -2,9 +2,26 @@
 #define __IPC_H__
 
 #include <string>
+#include "metrics/Trace.h"
 
 using namespace std;
 
+/* Priority classes of messages. Listeners process every pending control
+ * message before going on to bulk ones. */
+#define IPC_PRIORITY_BULK 0
+#define IPC_PRIORITY_CONTROL 1
+
+/* Types of the messages services send each other to recover lost messages,
+ * below those of application messages. See Sequence.h. */
+#define IPC_REPLAY_REQUEST -1
+#define IPC_RESYNC_REQUEST -2
+
+// Messages a sender keeps for each receiver and priority class to replay
+#define IPC_REPLAY_WINDOW 1024
+
+// How long a receiver holds messages after a gap, waiting for a replay
+#define IPC_REPLAY_TIMEOUT_MS 1000
+
 /** Abstract class for a message transmited through the IPC */
 class IPCMessage {
     public:
@@ -23,6 +40,13 @@ class IPCMessage {
         /**  Get a string representation of the message.
         * @return the string representation of the message */              
         virtual string str() = 0;
+
+        /** Get the priority class of the message.
+        * @return IPC_PRIORITY_CONTROL, unless overridden */
+        virtual int get_priority() { return IPC_PRIORITY_CONTROL; }
+
+        /** The trace of the message, carried along with it if started. */
+        Trace trace;
 };
 
 /** Abstract class for an IPC message factory. 
@@ -52,6 +76,18 @@ class IPCMessageProcessor {
         virtual bool process(const string &from, const string &to, const string &channel, IPCMessage& msg) = 0;
 };
 
+/** Abstract class for a handler of resync requests.
+A receiver asks for a resync when messages to it were lost and the sender no
+longer has them to send again, so their effect has to be restored some other
+way, usually by sending the whole state they were updating. */
+class IPCResyncHandler {
+    public:
+        /** Bring a receiver up to date.
+        @param channelId the channel the lost messages were sent on
+        @param to the user the lost messages were sent to */
+        virtual void resync(const string &channelId, const string &to) = 0;
+};
+
 /** Abstract class for an IPC messaging service using the Publish/Subscribe 
 model. 
 Every time a service is created, an ID is supplied by its user, which tells the
@@ -59,6 +95,8 @@ publish/subscribe model where to deliver the messages sent to that ID.
 */
 class IPCMessageService {
     public:
+        virtual ~IPCMessageService() {}
+
         /** Returns the id of the service user.
         @return a string with the user ID */
         string get_id();
@@ -82,9 +120,39 @@ class IPCMessageService {
         @param msg the message
         @return true if the message was sent, false otherwise */        
         virtual bool send(const string &channelId, const string &to, IPCMessage& msg) = 0;
-        
+
+        /** Drop messages of a type sent to a user on a channel that have not
+        been processed yet, if one of their fields has the given value. Used
+        to skip work that has become useless, such as RouteMods for a
+        datapath that went down.
+        @param channelId the channel of the messages
+        @param to the user the messages were sent to
+        @param type the type of the messages
+        @param field the name of the message field to check
+        @param value the value of the field, as stored in the message */
+        virtual void discard(const string &channelId, const string &to, int type, const string &field, const string &value) = 0;
+
+        /** Ask a user to resync what it sends this one on a channel. The
+        request is handled by the resync handler of the user's service, if it
+        listens on the channel.
+        @param channelId the channel
+        @param to the user to ask */
+        virtual void request_resync(const string &channelId, const string &to) = 0;
+
+        /** Sets the handler of resync requests from receivers of the
+        messages this user sends. Without one, requests are only logged.
+        @param handler the handler */
+        void set_resync_handler(IPCResyncHandler *handler);
+
+    protected:
+        IPCMessageService() : resyncHandler(NULL) {}
+
+        /** Hands a resync request to the handler. */
+        void resync(const string &channelId, const string &to);
+
     private:
         string id;
+        IPCResyncHandler *resyncHandler;
 };
 
 #endif /* __IPC_H__ */
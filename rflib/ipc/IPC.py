@@ -1,6 +1,29 @@
+import logging
+
+# Priority classes of messages. Listeners process every pending control
+# message before going on to bulk ones.
+PRIORITY_BULK = 0
+PRIORITY_CONTROL = 1
+
+# Types of the messages services send each other to recover lost messages,
+# below those of application messages. See MongoIPC.py.
+REPLAY_REQUEST = -1
+RESYNC_REQUEST = -2
+
+# Messages a sender keeps for each receiver and priority class to replay
+REPLAY_WINDOW = 1024
+
+# How long a receiver holds messages after a gap, waiting for a replay
+REPLAY_TIMEOUT = 1.0
+
+log = logging.getLogger("rflib.ipc")
+
 class IPCMessage:
     def get_type(self):
         raise NotImplementedError
+
+    def get_priority(self):
+        return PRIORITY_CONTROL
     
     def from_bson(self, data):
         raise NotImplementedError
@@ -22,6 +45,13 @@ class IPCMessageProcessor:
     def process(self, from_, to, channel, msg):
         raise NotImplementedError
         
+class IPCResyncHandler:
+    def resync(self, channel_id, to):
+        """Bring a receiver up to date, as messages sent to it on a channel
+        were lost and can no longer be sent again. Usually done by sending
+        the whole state the messages were updating."""
+        raise NotImplementedError
+
 class IPCMessageService:
     def get_id(self):
         return self._id
@@ -34,3 +64,34 @@ class IPCMessageService:
         
     def send(channel_id, to, msg):
         raise NotImplementedError
+
+    def discard(self, channel_id, to, type_, field, value):
+        """Drop messages of a type sent to a user on a channel that have
+        not been processed yet, if one of their fields has the given value.
+        """
+        raise NotImplementedError
+
+    def request_resync(self, channel_id, to):
+        """Ask a user to resync what it sends this one on a channel. The
+        request is handled by the resync handler of the user's service, if it
+        listens on the channel."""
+        raise NotImplementedError
+
+    def stop(self):
+        """Stop the threads the service started on its own, which answer
+        the requests of receivers. Listeners are left running."""
+        raise NotImplementedError
+
+    def set_resync_handler(self, handler):
+        """Set the handler of resync requests from receivers of the messages
+        this user sends. Without one, requests are only logged."""
+        self._resync_handler = handler
+
+    def _resync(self, channel_id, to):
+        handler = getattr(self, "_resync_handler", None)
+        if handler is None:
+            log.warning("ipc_resync_unhandled channel=%s to=%s", channel_id,
+                        to)
+            return
+        log.info("ipc_resync channel=%s to=%s", channel_id, to)
+        handler.resync(channel_id, to)
@@ -0,0 +1,20 @@
+#include "IPCService.h"
+
+#include <stdlib.h>
+
+#include "MongoIPC.h"
+#include "ShmIPC.h"
+
+string defaultIPCAddress(const string &fallback) {
+    const char *address = getenv(IPC_ADDRESS_ENV);
+    return address != NULL && *address != '\0' ? address : fallback;
+}
+
+IPCMessageService* createIPCMessageService(const string &address, const string &db, const string &id) {
+    string prefix = SHM_ADDRESS_PREFIX;
+    if (address.compare(0, prefix.size(), prefix) == 0) {
+        string dir = address.substr(prefix.size());
+        return new ShmIPCMessageService(dir.empty() ? SHM_IPC_DIR : dir, id);
+    }
+    return new MongoIPCMessageService(address, db, id);
+}
@@ -0,0 +1,24 @@
+#ifndef __IPCSERVICE_H__
+#define __IPCSERVICE_H__
+
+#include "IPC.h"
+#include "defs.h"
+
+/* Addresses starting with this select the shared memory backend, followed by
+ * the directory of its segments (SHM_IPC_DIR if empty). Other addresses are
+ * the address:port of a MongoDB server. */
+#define SHM_ADDRESS_PREFIX "shm:"
+
+/** Get the IPC address to use unless told otherwise.
+@param fallback the address to use if IPC_ADDRESS_ENV is not set
+@return the value of the environment variable IPC_ADDRESS_ENV if set, the
+        fallback otherwise */
+string defaultIPCAddress(const string &fallback = MONGO_ADDRESS);
+
+/** Create an IPC message service for the backend an address selects.
+@param address the shared memory or MongoDB address
+@param db the name of the MongoDB database to use
+@param id the ID of this IPC service user */
+IPCMessageService* createIPCMessageService(const string &address, const string &db, const string &id);
+
+#endif /* __IPCSERVICE_H__ */
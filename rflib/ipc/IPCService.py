@@ -0,0 +1,28 @@
+import os
+
+from rflib.defs import *
+
+# Addresses starting with this select the shared memory backend, followed by
+# the directory of its segments (ShmIPC.SHM_IPC_DIR if empty). Other addresses
+# are the address:port of a MongoDB server.
+SHM_ADDRESS_PREFIX = "shm:"
+
+def default_ipc_address(fallback=MONGO_ADDRESS):
+    """Get the IPC address to use unless told otherwise: the value of the
+    environment variable IPC_ADDRESS_ENV if set, the fallback otherwise."""
+    return os.environ.get(IPC_ADDRESS_ENV) or fallback
+
+def create_ipc_message_service(address, db, id_, thread_constructor,
+                               sleep_function):
+    """Create an IPC message service for the backend an address selects.
+
+    The arguments are those of MongoIPCMessageService.
+    """
+    if address.startswith(SHM_ADDRESS_PREFIX):
+        import rflib.ipc.ShmIPC as ShmIPC
+        directory = address[len(SHM_ADDRESS_PREFIX):] or ShmIPC.SHM_IPC_DIR
+        return ShmIPC.ShmIPCMessageService(directory, id_, thread_constructor,
+                                           sleep_function)
+    import rflib.ipc.MongoIPC as MongoIPC
+    return MongoIPC.MongoIPCMessageService(address, db, id_,
+                                           thread_constructor, sleep_function)
@@ -1,5 +1,19 @@
 #include "MongoIPC.h"
 #include <boost/thread.hpp>
+#include "log/Log.h"
+#include "metrics/Metrics.h"
+
+static Counter& messagesSent = Metrics::counter("rflib_ipc_messages_sent_total",
+    "IPC messages sent");
+static Histogram& sendTime = Metrics::histogram("rflib_ipc_send_seconds",
+    "Time to send an IPC message, waiting for other senders included");
+static Counter& messagesReceived = Metrics::counter(
+    "rflib_ipc_messages_received_total", "IPC messages received");
+static Counter& messagesDiscarded = Metrics::counter(
+    "rflib_ipc_messages_discarded_total",
+    "IPC messages dropped on request before being processed");
+static Histogram& processTime = Metrics::histogram(
+    "rflib_ipc_process_seconds", "Time to process a received IPC message");
 
 MongoIPCMessageService::MongoIPCMessageService(const string &address, const string db, const string id) {
     this->set_id(id);
@@ -8,6 +22,13 @@ MongoIPCMessageService::MongoIPCMessageService(const string &address, const stri
     this->connect(producerConnection, this->address);
 }
 
+MongoIPCMessageService::~MongoIPCMessageService() {
+    if (this->responder.joinable()) {
+        this->responder.interrupt();
+        this->responder.join();
+    }
+}
+
 void MongoIPCMessageService::createChannel(mongo::DBClientConnection &con, const string &ns) {
     con.createCollection(ns, CC_SIZE, true);
     con.ensureIndex(ns, BSON("_id" << 1));
@@ -30,22 +51,148 @@ void MongoIPCMessageService::listenWorker(const string &channelId, IPCMessageFac
     this->connect(connection, this->address);
 
     this->createChannel(connection, ns);
-    mongo::Query query = QUERY(TO_FIELD << this->get_id() << READ_FIELD << false).sort("$natural");
+    mongo::Query control = QUERY(TO_FIELD << this->get_id()
+                                 << READ_FIELD << false
+                                 << PRIORITY_FIELD << IPC_PRIORITY_CONTROL)
+                           .sort("$natural");
+    // Messages from older senders have no priority, and count as bulk
+    mongo::Query bulk = QUERY(TO_FIELD << this->get_id()
+                              << READ_FIELD << false
+                              << PRIORITY_FIELD
+                              << BSON("$ne" << IPC_PRIORITY_CONTROL))
+                        .sort("$natural");
+    ReceiveLog log;
     while (true) {
-        auto_ptr<mongo::DBClientCursor> cur = connection.query(ns, query,
-                                                               PENDINGLIMIT);
-        while (cur->more()) {
-            mongo::BSONObj envelope = cur->nextSafe();
-            IPCMessage *msg = takeFromEnvelope(envelope, factory);
-            processor->process(envelope["from"].String(), this->get_id(), channelId, *msg);
-            delete msg;
+        // Drain control messages before each batch of bulk ones
+        while (this->receive(connection, ns, control, log, channelId, factory, processor) == PENDINGLIMIT);
+        int n = this->receive(connection, ns, bulk, log, channelId, factory, processor);
+
+        vector<mongo::BSONObj> ready;
+        vector<SequenceRequest> requests;
+        log.expire(ready, requests);
+        this->deliver(connection, ns, ready, requests, channelId, factory, processor);
+
+        if (n < PENDINGLIMIT)
+            usleep(50000); // 50ms
+    }
+}
+
+/* Take up to PENDINGLIMIT messages matching the query, returning how many
+ * there were, and process those that are in order. */
+int MongoIPCMessageService::receive(mongo::DBClientConnection &connection, const string &ns, const mongo::Query &query, ReceiveLog &log, const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor) {
+    int n = 0;
+    auto_ptr<mongo::DBClientCursor> cur = connection.query(ns, query,
+                                                           PENDINGLIMIT);
+    while (cur->more()) {
+        mongo::BSONObj envelope = cur->nextSafe();
+        connection.update(ns,
+            QUERY("_id" << envelope["_id"]), 
+            BSON("$set" << BSON(READ_FIELD << true)),
+            false, true);
+
+        vector<mongo::BSONObj> ready;
+        vector<SequenceRequest> requests;
+        log.receive(envelope, ready, requests);
+        this->deliver(connection, ns, ready, requests, channelId, factory, processor);
+        n++;
+    }
+    return n;
+}
+
+/* Process envelopes that are ready and send requests for missing ones. */
+void MongoIPCMessageService::deliver(mongo::DBClientConnection &connection, const string &ns, vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests, const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor) {
+    for (size_t i = 0; i < ready.size(); i++) {
+        mongo::BSONObj &envelope = ready[i];
+        if (envelope[TYPE_FIELD].Int() == IPC_RESYNC_REQUEST) {
+            this->resync(channelId, envelope[FROM_FIELD].String());
+            continue;
+        }
+        // Discarded messages are still taken in, to keep their streams whole
+        if (envelope.hasField(DISCARDED_FIELD)) {
+            messagesDiscarded.inc();
+            continue;
+        }
+
+        IPCMessage *msg = takeFromEnvelope(envelope, factory);
+        messagesReceived.inc();
+        {
+            ScopedTimer timer(processTime);
+            processor->process(envelope[FROM_FIELD].String(), this->get_id(), channelId, *msg);
+        }
+        delete msg;
+    }
+
+    for (size_t i = 0; i < requests.size(); i++)
+        connection.insert(ns, requestEnvelope(this->get_id(), requests[i]));
+}
+
+/* Answer the requests of receivers of the messages sent on any channel, until
+the service is destroyed. Requests are read with the connection messages are
+sent on, so there is one thread and one connection per service. */
+void MongoIPCMessageService::respondWorker() {
+    while (true) {
+        vector<string> channels;
+        {
+            boost::lock_guard<boost::mutex> lock(ipcMutex);
+            channels.assign(this->respondChannels.begin(),
+                            this->respondChannels.end());
+        }
+        for (size_t i = 0; i < channels.size(); i++)
+            this->respond(channels[i]);
+
+        // An interruption point, where the destructor stops the thread
+        boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    }
+}
 
-            connection.update(ns,
-                QUERY("_id" << envelope["_id"]), 
+/* Answer the requests waiting on a channel. */
+void MongoIPCMessageService::respond(const string &channelId) {
+    string ns = this->db + "." + channelId;
+    mongo::Query query = QUERY(TO_FIELD << this->sendLog.get_session()
+                               << READ_FIELD << false).sort("$natural");
+
+    vector<mongo::BSONObj> requests;
+    {
+        boost::lock_guard<boost::mutex> lock(ipcMutex);
+        auto_ptr<mongo::DBClientCursor> cur = producerConnection.query(ns, query);
+        while (cur->more()) {
+            mongo::BSONObj request = cur->nextSafe().getOwned();
+            producerConnection.update(ns,
+                QUERY("_id" << request["_id"]),
                 BSON("$set" << BSON(READ_FIELD << true)),
                 false, true);
+            requests.push_back(request);
+        }
+    }
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        const mongo::BSONObj &request = requests[i];
+        string from = request[FROM_FIELD].String();
+        if (request[TYPE_FIELD].Int() == IPC_RESYNC_REQUEST) {
+            // Not under the mutex, as the handler sends
+            this->resync(channelId, from);
+            continue;
+        }
+
+        mongo::BSONObj content = request[CONTENT_FIELD].Obj();
+        boost::lock_guard<boost::mutex> lock(ipcMutex);
+        vector<mongo::BSONObj> envelopes;
+        if (!this->sendLog.replay(channelId, from,
+                                  content["priority"].Int(),
+                                  content["first"].numberLong(),
+                                  content["last"].numberLong(),
+                                  envelopes)) {
+            // The receiver asks for a resync once it stops waiting
+            RFLOG_INFO("ipc_replay_unavailable channel=%s to=%s",
+                       channelId.c_str(), from.c_str());
+            continue;
+        }
+        for (size_t j = 0; j < envelopes.size(); j++) {
+            mongo::BSONObjBuilder envelope;
+            envelope.genOID();
+            envelope.appendElements(envelopes[j].removeField("_id"));
+            this->producerConnection.insert(ns, envelope.obj());
         }
-        usleep(50000); // 50ms
     }
 }
 
@@ -58,16 +205,43 @@ void MongoIPCMessageService::listen(const string &channelId, IPCMessageFactory *
 }
 
 bool MongoIPCMessageService::send(const string &channelId, const string &to, IPCMessage& msg) {
+    ScopedTimer timer(sendTime);
     boost::lock_guard<boost::mutex> lock(ipcMutex);
     string ns = this->db + "." + channelId;
 
     this->createChannel(producerConnection, ns);
-    this->producerConnection.insert(ns, putInEnvelope(this->get_id(), to, msg));
+    this->producerConnection.insert(ns, this->sendLog.envelope(channelId, this->get_id(), to, msg));
+    messagesSent.inc();
+
+    // Receivers can ask for what they missed once there is something to miss
+    this->respondChannels.insert(channelId);
+    if (!this->responder.joinable())
+        this->responder = boost::thread(&MongoIPCMessageService::respondWorker, this);
 
     return true;
 }
 
-mongo::BSONObj putInEnvelope(const string &from, const string &to, IPCMessage &msg) {
+void MongoIPCMessageService::discard(const string &channelId, const string &to, int type, const string &field, const string &value) {
+    boost::lock_guard<boost::mutex> lock(ipcMutex);
+    string ns = this->db + "." + channelId;
+
+    this->producerConnection.update(ns,
+        QUERY(TO_FIELD << to << READ_FIELD << false << TYPE_FIELD << type
+              << string(CONTENT_FIELD) + "." + field << value),
+        BSON("$set" << BSON(DISCARDED_FIELD << true)),
+        false, true);
+}
+
+void MongoIPCMessageService::request_resync(const string &channelId, const string &to) {
+    boost::lock_guard<boost::mutex> lock(ipcMutex);
+    string ns = this->db + "." + channelId;
+
+    SequenceRequest request = {to, IPC_RESYNC_REQUEST, IPC_PRIORITY_CONTROL, 0, 0};
+    this->createChannel(producerConnection, ns);
+    this->producerConnection.insert(ns, requestEnvelope(this->get_id(), request));
+}
+
+mongo::BSONObj putInEnvelope(const string &from, const string &to, IPCMessage &msg, const string &session, long long seq) {
     mongo::BSONObjBuilder envelope;
 
     envelope.genOID();
@@ -75,16 +249,54 @@ mongo::BSONObj putInEnvelope(const string &from, const string &to, IPCMessage &m
     envelope.append(TO_FIELD, to);
     envelope.append(TYPE_FIELD, msg.get_type());
     envelope.append(READ_FIELD, false);
+    envelope.append(PRIORITY_FIELD, msg.get_priority());
+    if (!session.empty()) {
+        envelope.append(SESSION_FIELD, session);
+        envelope.append(SEQUENCE_FIELD, seq);
+    }
 
     const char* data = msg.to_BSON();
     envelope.append(CONTENT_FIELD, mongo::BSONObj(data));
     delete data;
 
+    if (msg.trace.active()) {
+        mongo::BSONObjBuilder trace;
+        mongo::BSONArrayBuilder stages;
+        vector<TraceStage>::const_iterator it;
+        for (it = msg.trace.stages.begin(); it != msg.trace.stages.end(); it++)
+            stages.append(BSON("name" << it->name
+                               << "time" << (long long) it->time));
+        trace.append("id", (long long) msg.trace.id);
+        if (msg.trace.parent != 0) {
+            trace.append("parent", (long long) msg.trace.parent);
+            trace.append("forked", (int) msg.trace.forked);
+        }
+        trace.append("stages", stages.arr());
+        envelope.append(TRACE_FIELD, trace.obj());
+    }
+
     return envelope.obj();
 }
 
 IPCMessage* takeFromEnvelope(mongo::BSONObj envelope, IPCMessageFactory *factory) {
    IPCMessage* msg = factory->buildForType(envelope[TYPE_FIELD].Int());
    msg->from_BSON(envelope[CONTENT_FIELD].Obj().objdata());
+
+   if (envelope.hasField(TRACE_FIELD)) {
+       mongo::BSONObj trace = envelope[TRACE_FIELD].Obj();
+       msg->trace.id = (uint64_t) trace["id"].numberLong();
+       if (trace.hasField("parent")) {
+           msg->trace.parent = (uint64_t) trace["parent"].numberLong();
+           msg->trace.forked = trace["forked"].numberInt();
+       }
+       vector<mongo::BSONElement> stages = trace["stages"].Array();
+       for (size_t i = 0; i < stages.size(); i++) {
+           mongo::BSONObj stage = stages[i].Obj();
+           TraceStage s;
+           s.name = stage["name"].String();
+           s.time = stage["time"].numberLong();
+           msg->trace.stages.push_back(s);
+       }
+   }
    return msg;
 }
@@ -1,14 +1,20 @@
 #ifndef __MONGOIPC_H__
 #define __MONGOIPC_H__
 
+#include <set>
+#include <boost/thread.hpp>
 #include <mongo/client/dbclient.h>
 #include "IPC.h"
+#include "Sequence.h"
 
 #define FROM_FIELD "from"
 #define TO_FIELD "to"
 #define TYPE_FIELD "type"
 #define READ_FIELD "read"
 #define CONTENT_FIELD "content"
+#define TRACE_FIELD "trace"
+#define PRIORITY_FIELD "priority"
+#define DISCARDED_FIELD "discarded"
 
 // 1 MB for the capped collection
 #define CC_SIZE 1048576
@@ -16,7 +22,7 @@
 // Handle a maximum of 10 messages at a time
 #define PENDINGLIMIT 10
 
-mongo::BSONObj putInEnvelope(const string &from, const string &to, IPCMessage &msg);
+mongo::BSONObj putInEnvelope(const string &from, const string &to, IPCMessage &msg, const string &session="", long long seq=0);
 IPCMessage* takeFromEnvelope(mongo::BSONObj envelope, IPCMessageFactory *factory);
 
 /** An IPC message service that uses MongoDB as its backend. */
@@ -28,15 +34,28 @@ class MongoIPCMessageService : public IPCMessageService {
         @param db the name of the database to use
         @param id the ID of this IPC service user */
         MongoIPCMessageService(const string &address, const string db, const string id);
+
+        /** Stops answering the replay and resync requests of receivers. */
+        virtual ~MongoIPCMessageService();
+
         virtual void listen(const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor, bool block=true);
         virtual bool send(const string &channelId, const string &to, IPCMessage& msg);
+        virtual void discard(const string &channelId, const string &to, int type, const string &field, const string &value);
+        virtual void request_resync(const string &channelId, const string &to);
         
     private:
         string db;
         string address;
         mongo::DBClientConnection producerConnection;
         boost::mutex ipcMutex;
+        SendLog sendLog;
+        set<string> respondChannels;
+        boost::thread responder;
         void listenWorker(const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor);
+        int receive(mongo::DBClientConnection &connection, const string &ns, const mongo::Query &query, ReceiveLog &log, const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor);
+        void deliver(mongo::DBClientConnection &connection, const string &ns, vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests, const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor);
+        void respondWorker();
+        void respond(const string &channelId);
         void createChannel(mongo::DBClientConnection &con, const string &ns);
         void connect(mongo::DBClientConnection &connection, const string &address);
 };
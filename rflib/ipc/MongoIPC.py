@@ -1,3 +1,6 @@
+import time
+import collections
+
 import pymongo as mongo
 import bson
 
@@ -8,29 +11,213 @@ TO_FIELD = "to"
 TYPE_FIELD = "type"
 READ_FIELD = "read"
 CONTENT_FIELD = "content"
+TRACE_FIELD = "trace"
+PRIORITY_FIELD = "priority"
+DISCARDED_FIELD = "discarded"
+SESSION_FIELD = "session"
+SEQUENCE_FIELD = "seq"
 
 # 1 MB for the capped collection
 CC_SIZE = 1048576
 
-def put_in_envelope(from_, to, msg):
+# Handle a maximum of 10 bulk messages at a time
+PENDING_LIMIT = 10
+
+def put_in_envelope(from_, to, msg, session=None, seq=0):
     envelope = {}
 
     envelope[FROM_FIELD] = from_
     envelope[TO_FIELD] = to
     envelope[READ_FIELD] = False
     envelope[TYPE_FIELD] = msg.get_type()
+    envelope[PRIORITY_FIELD] = msg.get_priority()
+    if session is not None:
+        envelope[SESSION_FIELD] = session
+        envelope[SEQUENCE_FIELD] = seq
 
     envelope[CONTENT_FIELD] = {}
     for (k, v) in msg.to_dict().items():
         envelope[CONTENT_FIELD][k] = v
 
+    trace = getattr(msg, "trace", None)
+    if trace is not None:
+        envelope[TRACE_FIELD] = trace
+
     return envelope
 
 def take_from_envelope(envelope, factory):
     msg = factory.build_for_type(envelope[TYPE_FIELD]);
     msg.from_dict(envelope[CONTENT_FIELD]);
+    msg.trace = envelope.get(TRACE_FIELD)
     return msg;
 
+def request_envelope(from_, to, type_, priority=IPC.PRIORITY_CONTROL,
+                     first=0, last=0):
+    """Get the envelope of a replay or resync request, sent to the session of
+    a stream or, for a resync, to a user."""
+    return {FROM_FIELD: from_, TO_FIELD: to, READ_FIELD: False,
+            TYPE_FIELD: type_, PRIORITY_FIELD: IPC.PRIORITY_CONTROL,
+            CONTENT_FIELD: {"priority": priority, "first": first,
+                            "last": last}}
+
+# Detection and recovery of lost messages, as in Sequence.h.
+#
+# The messages a service sends are numbered from 1 on each stream: those of a
+# priority class to a user on a channel, which backends deliver in order.
+# Envelopes carry the number along with a session id unique to the service,
+# so that a restarted sender starts new streams.
+#
+# A receiver that finds a gap in a stream holds the messages after it and
+# asks the session for a replay of the missing ones. The sender keeps the
+# last REPLAY_WINDOW messages of each stream to send again. If the gap is
+# wider than that, or the replay does not come within REPLAY_TIMEOUT, the
+# receiver processes what it holds and asks the session for a resync
+# instead, which goes to its IPCResyncHandler.
+
+class SendLog:
+    """Numbers the messages sent by a service and keeps the last
+    REPLAY_WINDOW of each stream. Callers serialise access to each stream,
+    in the order its messages are sent."""
+    def __init__(self):
+        self.session = str(bson.ObjectId())
+        self._streams = {}
+
+    def envelope(self, channel_id, from_, to, msg):
+        """Put a message in an envelope with the next sequence number of its
+        stream, and keep the envelope for replay."""
+        key = (channel_id, to, msg.get_priority())
+        stream = self._streams.get(key)
+        if stream is None:
+            stream = self._streams[key] = [0, collections.deque(
+                maxlen=IPC.REPLAY_WINDOW)]
+        stream[0] += 1
+        envelope = put_in_envelope(from_, to, msg, self.session, stream[0])
+        stream[1].append(dict(envelope))
+        return envelope
+
+    def replay(self, channel_id, to, priority, first, last):
+        """Get the envelopes of the messages numbered first to last of a
+        stream, or None if some of them are no longer kept."""
+        stream = self._streams.get((channel_id, to, priority))
+        if stream is None:
+            return None
+        seq, sent = stream
+        oldest = seq - len(sent) + 1
+        if first < oldest or last > seq or first > last:
+            return None
+        return [dict(sent[i - oldest]) for i in range(first, last + 1)]
+
+class ReceiveLog:
+    """Puts the messages a listener receives back in order, and finds those
+    missing."""
+    def __init__(self):
+        # (session, priority) to [next, {seq: envelope}, since]
+        self._streams = {}
+
+    def receive(self, envelope, ready, requests):
+        """Take in a received envelope, adding those now ready to be
+        processed to ready, in order, and the requests to send to senders to
+        requests, as (to, type, priority, first, last)."""
+        if SEQUENCE_FIELD not in envelope:
+            ready.append(envelope)
+            return
+
+        # Messages from older senders have no priority, and count as bulk
+        key = (envelope[SESSION_FIELD],
+               envelope.get(PRIORITY_FIELD, IPC.PRIORITY_BULK))
+        seq = envelope[SEQUENCE_FIELD]
+        # Whatever came before the first message seen is not ours to miss
+        stream = self._streams.setdefault(key, [seq, {}, None])
+        held = stream[1]
+
+        if seq < stream[0] or seq in held:
+            return
+
+        if seq == stream[0]:
+            ready.append(envelope)
+            stream[0] += 1
+            # Messages held after the gap follow until the next gap, if any
+            while stream[0] in held:
+                ready.append(held.pop(stream[0]))
+                stream[0] += 1
+            stream[2] = time.time() if held else None
+            return
+
+        # Ask for what is missing between the last message held and this one
+        first = max(held) + 1 if held else stream[0]
+        held[seq] = envelope
+        if stream[2] is None:
+            stream[2] = time.time()
+
+        if seq - stream[0] > IPC.REPLAY_WINDOW or len(held) > IPC.REPLAY_WINDOW:
+            self._release(key, stream, ready, requests)
+        elif first < seq:
+            IPC.log.info("ipc_gap session=%s priority=%d first=%d last=%d",
+                         key[0], key[1], first, seq - 1)
+            requests.append((key[0], IPC.REPLAY_REQUEST, key[1], first,
+                             seq - 1))
+
+    def expire(self, ready, requests):
+        """Give up on replays that timed out, asking for a resync instead."""
+        now = time.time()
+        for key, stream in self._streams.items():
+            if stream[1] and now - stream[2] >= IPC.REPLAY_TIMEOUT:
+                self._release(key, stream, ready, requests)
+
+    def _release(self, key, stream, ready, requests):
+        lost = 0
+        held = stream[1]
+        for seq in sorted(held):
+            lost += seq - stream[0]
+            ready.append(held[seq])
+            stream[0] = seq + 1
+        held.clear()
+        stream[2] = None
+
+        IPC.log.warning("ipc_messages_lost session=%s priority=%d lost=%d",
+                        key[0], key[1], lost)
+        requests.append((key[0], IPC.RESYNC_REQUEST, key[1], 0, 0))
+
+def stamp_trace(msg, stage):
+    """Record that a message reached a stage now, if it carries a trace.
+
+    Times are in microseconds since the epoch, as stamped by rflib's Trace.
+    """
+    trace = getattr(msg, "trace", None)
+    if trace is not None:
+        trace["stages"].append({"name": stage,
+                                "time": int(time.time() * 1000000)})
+
+def _mix(x):
+    """splitmix64 finalizer, as in rflib's Trace, never 0."""
+    x = ((x ^ (x >> 30)) * 0xbf58476d1ce4e5b9) & 0xffffffffffffffff
+    x = ((x ^ (x >> 27)) * 0x94d049bb133111eb) & 0xffffffffffffffff
+    x = x ^ (x >> 31)
+    return x or 1
+
+def _signed(x):
+    """Trace IDs are stored as signed 64-bit integers."""
+    return x - (1 << 64) if x >= (1 << 63) else x
+
+def fork_trace(trace, copy):
+    """Get the trace for a copy of a message that is sent more than once.
+
+    Copy 0 carries on 'trace'. Each other copy gets a child trace, whose ID is
+    derived from the parent's as rflib's Trace::fork() does, and which only
+    records the stages stamped after the fork when it is finished, so that
+    the update is counted once. Returns None if 'trace' is None.
+    """
+    if trace is None or copy == 0:
+        return trace
+    id_ = trace["id"] & 0xffffffffffffffff
+    child = dict(trace)
+    child["id"] = _signed(_mix((id_ + copy * 0x9e3779b97f4a7c15)
+                               & 0xffffffffffffffff))
+    child["parent"] = trace.get("parent", trace["id"])
+    child["forked"] = len(trace["stages"])
+    child["stages"] = list(trace["stages"])
+    return child
+
 def format_address(address):
     try:
         tmp = address.split(":")
@@ -62,6 +249,10 @@ class MongoIPCMessageService(IPC.IPCMessageService):
         self._producer_connection = mongo.Connection(*self.address)
         self._threading = thread_constructor
         self._sleep = sleep_function
+        self._send_log = SendLog()
+        self._respond_channels = set()
+        self._responder = None
+        self._stopped = False
         
     def listen(self, channel_id, factory, processor, block=True):
         worker = self._threading(target=self._listen_worker,
@@ -73,24 +264,136 @@ class MongoIPCMessageService(IPC.IPCMessageService):
     def send(self, channel_id, to, msg):
         self._create_channel(self._producer_connection, channel_id)
         collection = self._producer_connection[self._db][channel_id]
-        collection.insert(put_in_envelope(self.get_id(), to, msg))
+        collection.insert(self._send_log.envelope(channel_id, self.get_id(),
+                                                  to, msg))
+        # Receivers can ask for what they missed once there is something to
+        # miss
+        self._respond_channels.add(channel_id)
+        if self._responder is None:
+            self._responder = self._threading(target=self._respond_worker,
+                                              args=())
+            self._responder.start()
         return True
 
+    def stop(self):
+        self._stopped = True
+        if self._responder is not None:
+            self._responder.join()
+            self._responder = None
+
+    def discard(self, channel_id, to, type_, field, value):
+        collection = self._producer_connection[self._db][channel_id]
+        collection.update({TO_FIELD: to, READ_FIELD: False, TYPE_FIELD: type_,
+                           CONTENT_FIELD + "." + field: value},
+                          {"$set": {DISCARDED_FIELD: True}}, multi=True)
+
+    def request_resync(self, channel_id, to):
+        self._create_channel(self._producer_connection, channel_id)
+        collection = self._producer_connection[self._db][channel_id]
+        collection.insert(request_envelope(self.get_id(), to,
+                                           IPC.RESYNC_REQUEST))
+
     def _listen_worker(self, channel_id, factory, processor):
         connection = mongo.Connection(*self.address)
         self._create_channel(connection, channel_id)
         
         collection = connection[self._db][channel_id]
-        cursor = collection.find({TO_FIELD: self.get_id(), READ_FIELD: False}, sort=[("_id", mongo.ASCENDING)])
+        control = {TO_FIELD: self.get_id(), READ_FIELD: False,
+                   PRIORITY_FIELD: IPC.PRIORITY_CONTROL}
+        # Messages from older senders have no priority, and count as bulk
+        bulk = {TO_FIELD: self.get_id(), READ_FIELD: False,
+                PRIORITY_FIELD: {"$ne": IPC.PRIORITY_CONTROL}}
+        log = ReceiveLog()
 
         while True:
-            for envelope in cursor:
-                msg = take_from_envelope(envelope, factory)
-                processor.process(envelope[FROM_FIELD], envelope[TO_FIELD], channel_id, msg);
-                collection.update({"_id": envelope["_id"]}, {"$set": {READ_FIELD: True}})
-            self._sleep(0.05)
-            cursor = collection.find({TO_FIELD: self.get_id(), READ_FIELD: False}, sort=[("_id", mongo.ASCENDING)])
-                
+            # Drain control messages before each batch of bulk ones
+            self._receive(collection, control, 0, log, channel_id, factory,
+                          processor)
+            n = self._receive(collection, bulk, PENDING_LIMIT, log,
+                              channel_id, factory, processor)
+
+            ready, requests = [], []
+            log.expire(ready, requests)
+            self._deliver(collection, ready, requests, channel_id, factory,
+                          processor)
+
+            if n < PENDING_LIMIT:
+                self._sleep(0.05)
+
+    def _receive(self, collection, query, limit, log, channel_id, factory,
+                 processor):
+        n = 0
+        cursor = collection.find(query, sort=[("_id", mongo.ASCENDING)],
+                                 limit=limit)
+        for envelope in cursor:
+            collection.update({"_id": envelope["_id"]}, {"$set": {READ_FIELD: True}})
+            ready, requests = [], []
+            log.receive(envelope, ready, requests)
+            self._deliver(collection, ready, requests, channel_id, factory,
+                          processor)
+            n += 1
+        return n
+
+    def _deliver(self, collection, ready, requests, channel_id, factory,
+                 processor):
+        """Process envelopes that are ready and send requests for missing
+        ones."""
+        for envelope in ready:
+            if envelope[TYPE_FIELD] == IPC.RESYNC_REQUEST:
+                self._resync(channel_id, envelope[FROM_FIELD])
+                continue
+            # Discarded messages are still taken in, to keep their streams
+            # whole
+            if envelope.get(DISCARDED_FIELD):
+                continue
+            msg = take_from_envelope(envelope, factory)
+            processor.process(envelope[FROM_FIELD], envelope[TO_FIELD], channel_id, msg);
+
+        for request in requests:
+            collection.insert(request_envelope(self.get_id(), *request))
+
+    def _respond_worker(self):
+        """Answer the requests of receivers of the messages sent on any
+        channel, until the service is stopped. Requests are read with the
+        connection messages are sent on."""
+        while not self._stopped:
+            n = 0
+            for channel_id in list(self._respond_channels):
+                n += self._respond(channel_id)
+            if n == 0:
+                self._sleep(0.05)
+
+    def _respond(self, channel_id):
+        """Answer the requests waiting on a channel, returning how many
+        there were."""
+        collection = self._producer_connection[self._db][channel_id]
+        query = {TO_FIELD: self._send_log.session, READ_FIELD: False}
+        n = 0
+        for request in list(collection.find(query,
+                                            sort=[("_id", mongo.ASCENDING)])):
+            collection.update({"_id": request["_id"]},
+                              {"$set": {READ_FIELD: True}})
+            n += 1
+
+            from_ = request[FROM_FIELD]
+            if request[TYPE_FIELD] == IPC.RESYNC_REQUEST:
+                self._resync(channel_id, from_)
+                continue
+
+            content = request[CONTENT_FIELD]
+            envelopes = self._send_log.replay(channel_id, from_,
+                                              content["priority"],
+                                              content["first"],
+                                              content["last"])
+            if envelopes is None:
+                # The receiver asks for a resync once it stops waiting
+                IPC.log.info("ipc_replay_unavailable channel=%s to=%s",
+                             channel_id, from_)
+                continue
+            for envelope in envelopes:
+                collection.insert(envelope)
+        return n
+
     def _create_channel(self, connection, name):
         db = connection[self._db]
         try:
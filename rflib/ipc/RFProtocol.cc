@@ -450,6 +450,10 @@ int RouteMod::get_type() {
     return ROUTE_MOD;
 }
 
+int RouteMod::get_priority() {
+    return IPC_PRIORITY_BULK;
+}
+
 uint8_t RouteMod::get_mod() {
     return this->mod;
 }
@@ -534,3 +538,319 @@ string RouteMod::str() {
     ss << "  options: " << OptionList::to_BSON(get_options()) << endl;
     return ss.str();
 }
+
+PortEntryUpdate::PortEntryUpdate() {
+    set_entry_id("");
+    set_removed(false);
+    set_vm_id(0);
+    set_vm_port(0);
+    set_ct_id(0);
+    set_dp_id(0);
+    set_dp_port(0);
+    set_eth_addr("");
+    set_status(0);
+}
+
+PortEntryUpdate::PortEntryUpdate(string entry_id, bool removed, uint64_t vm_id, uint32_t vm_port, uint64_t ct_id, uint64_t dp_id, uint32_t dp_port, string eth_addr, uint32_t status) {
+    set_entry_id(entry_id);
+    set_removed(removed);
+    set_vm_id(vm_id);
+    set_vm_port(vm_port);
+    set_ct_id(ct_id);
+    set_dp_id(dp_id);
+    set_dp_port(dp_port);
+    set_eth_addr(eth_addr);
+    set_status(status);
+}
+
+int PortEntryUpdate::get_type() {
+    return PORT_ENTRY_UPDATE;
+}
+
+string PortEntryUpdate::get_entry_id() {
+    return this->entry_id;
+}
+
+void PortEntryUpdate::set_entry_id(string entry_id) {
+    this->entry_id = entry_id;
+}
+
+bool PortEntryUpdate::get_removed() {
+    return this->removed;
+}
+
+void PortEntryUpdate::set_removed(bool removed) {
+    this->removed = removed;
+}
+
+uint64_t PortEntryUpdate::get_vm_id() {
+    return this->vm_id;
+}
+
+void PortEntryUpdate::set_vm_id(uint64_t vm_id) {
+    this->vm_id = vm_id;
+}
+
+uint32_t PortEntryUpdate::get_vm_port() {
+    return this->vm_port;
+}
+
+void PortEntryUpdate::set_vm_port(uint32_t vm_port) {
+    this->vm_port = vm_port;
+}
+
+uint64_t PortEntryUpdate::get_ct_id() {
+    return this->ct_id;
+}
+
+void PortEntryUpdate::set_ct_id(uint64_t ct_id) {
+    this->ct_id = ct_id;
+}
+
+uint64_t PortEntryUpdate::get_dp_id() {
+    return this->dp_id;
+}
+
+void PortEntryUpdate::set_dp_id(uint64_t dp_id) {
+    this->dp_id = dp_id;
+}
+
+uint32_t PortEntryUpdate::get_dp_port() {
+    return this->dp_port;
+}
+
+void PortEntryUpdate::set_dp_port(uint32_t dp_port) {
+    this->dp_port = dp_port;
+}
+
+string PortEntryUpdate::get_eth_addr() {
+    return this->eth_addr;
+}
+
+void PortEntryUpdate::set_eth_addr(string eth_addr) {
+    this->eth_addr = eth_addr;
+}
+
+uint32_t PortEntryUpdate::get_status() {
+    return this->status;
+}
+
+void PortEntryUpdate::set_status(uint32_t status) {
+    this->status = status;
+}
+
+void PortEntryUpdate::from_BSON(const char* data) {
+    mongo::BSONObj obj(data);
+    set_entry_id(obj["entry_id"].String());
+    set_removed(obj["removed"].Bool());
+    set_vm_id(string_to<uint64_t>(obj["vm_id"].String()));
+    set_vm_port(string_to<uint32_t>(obj["vm_port"].String()));
+    set_ct_id(string_to<uint64_t>(obj["ct_id"].String()));
+    set_dp_id(string_to<uint64_t>(obj["dp_id"].String()));
+    set_dp_port(string_to<uint32_t>(obj["dp_port"].String()));
+    set_eth_addr(obj["eth_addr"].String());
+    set_status(string_to<uint32_t>(obj["status"].String()));
+}
+
+const char* PortEntryUpdate::to_BSON() {
+    mongo::BSONObjBuilder _b;
+    _b.append("entry_id", get_entry_id());
+    _b.append("removed", get_removed());
+    _b.append("vm_id", to_string<uint64_t>(get_vm_id()));
+    _b.append("vm_port", to_string<uint32_t>(get_vm_port()));
+    _b.append("ct_id", to_string<uint64_t>(get_ct_id()));
+    _b.append("dp_id", to_string<uint64_t>(get_dp_id()));
+    _b.append("dp_port", to_string<uint32_t>(get_dp_port()));
+    _b.append("eth_addr", get_eth_addr());
+    _b.append("status", to_string<uint32_t>(get_status()));
+    mongo::BSONObj o = _b.obj();
+    char* data = new char[o.objsize()];
+    memcpy(data, o.objdata(), o.objsize());
+    return data;
+}
+
+string PortEntryUpdate::str() {
+    stringstream ss;
+    ss << "PortEntryUpdate" << endl;
+    ss << "  entry_id: " << get_entry_id() << endl;
+    ss << "  removed: " << get_removed() << endl;
+    ss << "  vm_id: " << to_string<uint64_t>(get_vm_id()) << endl;
+    ss << "  vm_port: " << to_string<uint32_t>(get_vm_port()) << endl;
+    ss << "  ct_id: " << to_string<uint64_t>(get_ct_id()) << endl;
+    ss << "  dp_id: " << to_string<uint64_t>(get_dp_id()) << endl;
+    ss << "  dp_port: " << to_string<uint32_t>(get_dp_port()) << endl;
+    ss << "  eth_addr: " << get_eth_addr() << endl;
+    ss << "  status: " << to_string<uint32_t>(get_status()) << endl;
+    return ss.str();
+}
+
+LinkEntryUpdate::LinkEntryUpdate() {
+    set_entry_id("");
+    set_removed(false);
+    set_ct_id(0);
+    set_dp_id(0);
+    set_dp_port(0);
+    set_eth_addr("");
+    set_rem_ct(0);
+    set_rem_id(0);
+    set_rem_port(0);
+    set_rem_eth_addr("");
+    set_status(0);
+}
+
+LinkEntryUpdate::LinkEntryUpdate(string entry_id, bool removed, uint64_t ct_id, uint64_t dp_id, uint32_t dp_port, string eth_addr, uint64_t rem_ct, uint64_t rem_id, uint32_t rem_port, string rem_eth_addr, uint32_t status) {
+    set_entry_id(entry_id);
+    set_removed(removed);
+    set_ct_id(ct_id);
+    set_dp_id(dp_id);
+    set_dp_port(dp_port);
+    set_eth_addr(eth_addr);
+    set_rem_ct(rem_ct);
+    set_rem_id(rem_id);
+    set_rem_port(rem_port);
+    set_rem_eth_addr(rem_eth_addr);
+    set_status(status);
+}
+
+int LinkEntryUpdate::get_type() {
+    return LINK_ENTRY_UPDATE;
+}
+
+string LinkEntryUpdate::get_entry_id() {
+    return this->entry_id;
+}
+
+void LinkEntryUpdate::set_entry_id(string entry_id) {
+    this->entry_id = entry_id;
+}
+
+bool LinkEntryUpdate::get_removed() {
+    return this->removed;
+}
+
+void LinkEntryUpdate::set_removed(bool removed) {
+    this->removed = removed;
+}
+
+uint64_t LinkEntryUpdate::get_ct_id() {
+    return this->ct_id;
+}
+
+void LinkEntryUpdate::set_ct_id(uint64_t ct_id) {
+    this->ct_id = ct_id;
+}
+
+uint64_t LinkEntryUpdate::get_dp_id() {
+    return this->dp_id;
+}
+
+void LinkEntryUpdate::set_dp_id(uint64_t dp_id) {
+    this->dp_id = dp_id;
+}
+
+uint32_t LinkEntryUpdate::get_dp_port() {
+    return this->dp_port;
+}
+
+void LinkEntryUpdate::set_dp_port(uint32_t dp_port) {
+    this->dp_port = dp_port;
+}
+
+string LinkEntryUpdate::get_eth_addr() {
+    return this->eth_addr;
+}
+
+void LinkEntryUpdate::set_eth_addr(string eth_addr) {
+    this->eth_addr = eth_addr;
+}
+
+uint64_t LinkEntryUpdate::get_rem_ct() {
+    return this->rem_ct;
+}
+
+void LinkEntryUpdate::set_rem_ct(uint64_t rem_ct) {
+    this->rem_ct = rem_ct;
+}
+
+uint64_t LinkEntryUpdate::get_rem_id() {
+    return this->rem_id;
+}
+
+void LinkEntryUpdate::set_rem_id(uint64_t rem_id) {
+    this->rem_id = rem_id;
+}
+
+uint32_t LinkEntryUpdate::get_rem_port() {
+    return this->rem_port;
+}
+
+void LinkEntryUpdate::set_rem_port(uint32_t rem_port) {
+    this->rem_port = rem_port;
+}
+
+string LinkEntryUpdate::get_rem_eth_addr() {
+    return this->rem_eth_addr;
+}
+
+void LinkEntryUpdate::set_rem_eth_addr(string rem_eth_addr) {
+    this->rem_eth_addr = rem_eth_addr;
+}
+
+uint32_t LinkEntryUpdate::get_status() {
+    return this->status;
+}
+
+void LinkEntryUpdate::set_status(uint32_t status) {
+    this->status = status;
+}
+
+void LinkEntryUpdate::from_BSON(const char* data) {
+    mongo::BSONObj obj(data);
+    set_entry_id(obj["entry_id"].String());
+    set_removed(obj["removed"].Bool());
+    set_ct_id(string_to<uint64_t>(obj["ct_id"].String()));
+    set_dp_id(string_to<uint64_t>(obj["dp_id"].String()));
+    set_dp_port(string_to<uint32_t>(obj["dp_port"].String()));
+    set_eth_addr(obj["eth_addr"].String());
+    set_rem_ct(string_to<uint64_t>(obj["rem_ct"].String()));
+    set_rem_id(string_to<uint64_t>(obj["rem_id"].String()));
+    set_rem_port(string_to<uint32_t>(obj["rem_port"].String()));
+    set_rem_eth_addr(obj["rem_eth_addr"].String());
+    set_status(string_to<uint32_t>(obj["status"].String()));
+}
+
+const char* LinkEntryUpdate::to_BSON() {
+    mongo::BSONObjBuilder _b;
+    _b.append("entry_id", get_entry_id());
+    _b.append("removed", get_removed());
+    _b.append("ct_id", to_string<uint64_t>(get_ct_id()));
+    _b.append("dp_id", to_string<uint64_t>(get_dp_id()));
+    _b.append("dp_port", to_string<uint32_t>(get_dp_port()));
+    _b.append("eth_addr", get_eth_addr());
+    _b.append("rem_ct", to_string<uint64_t>(get_rem_ct()));
+    _b.append("rem_id", to_string<uint64_t>(get_rem_id()));
+    _b.append("rem_port", to_string<uint32_t>(get_rem_port()));
+    _b.append("rem_eth_addr", get_rem_eth_addr());
+    _b.append("status", to_string<uint32_t>(get_status()));
+    mongo::BSONObj o = _b.obj();
+    char* data = new char[o.objsize()];
+    memcpy(data, o.objdata(), o.objsize());
+    return data;
+}
+
+string LinkEntryUpdate::str() {
+    stringstream ss;
+    ss << "LinkEntryUpdate" << endl;
+    ss << "  entry_id: " << get_entry_id() << endl;
+    ss << "  removed: " << get_removed() << endl;
+    ss << "  ct_id: " << to_string<uint64_t>(get_ct_id()) << endl;
+    ss << "  dp_id: " << to_string<uint64_t>(get_dp_id()) << endl;
+    ss << "  dp_port: " << to_string<uint32_t>(get_dp_port()) << endl;
+    ss << "  eth_addr: " << get_eth_addr() << endl;
+    ss << "  rem_ct: " << to_string<uint64_t>(get_rem_ct()) << endl;
+    ss << "  rem_id: " << to_string<uint64_t>(get_rem_id()) << endl;
+    ss << "  rem_port: " << to_string<uint32_t>(get_rem_port()) << endl;
+    ss << "  rem_eth_addr: " << get_rem_eth_addr() << endl;
+    ss << "  status: " << to_string<uint32_t>(get_status()) << endl;
+    return ss.str();
+}
@@ -18,7 +18,9 @@ enum {
 	DATAPATH_DOWN,
 	VIRTUAL_PLANE_MAP,
 	DATA_PLANE_MAP,
-	ROUTE_MOD
+	ROUTE_MOD,
+	PORT_ENTRY_UPDATE,
+	LINK_ENTRY_UPDATE
 };
 
 class PortRegister : public IPCMessage {
@@ -203,6 +205,7 @@ class RouteMod : public IPCMessage {
         void add_option(const Option& option);
 
         virtual int get_type();
+        virtual int get_priority();
         virtual void from_BSON(const char* data);
         virtual const char* to_BSON();
         virtual string str();
@@ -215,4 +218,110 @@ class RouteMod : public IPCMessage {
         std::vector<Option> options;
 };
 
+class PortEntryUpdate : public IPCMessage {
+    public:
+        PortEntryUpdate();
+        PortEntryUpdate(string entry_id, bool removed, uint64_t vm_id, uint32_t vm_port, uint64_t ct_id, uint64_t dp_id, uint32_t dp_port, string eth_addr, uint32_t status);
+
+        string get_entry_id();
+        void set_entry_id(string entry_id);
+
+        bool get_removed();
+        void set_removed(bool removed);
+
+        uint64_t get_vm_id();
+        void set_vm_id(uint64_t vm_id);
+
+        uint32_t get_vm_port();
+        void set_vm_port(uint32_t vm_port);
+
+        uint64_t get_ct_id();
+        void set_ct_id(uint64_t ct_id);
+
+        uint64_t get_dp_id();
+        void set_dp_id(uint64_t dp_id);
+
+        uint32_t get_dp_port();
+        void set_dp_port(uint32_t dp_port);
+
+        string get_eth_addr();
+        void set_eth_addr(string eth_addr);
+
+        uint32_t get_status();
+        void set_status(uint32_t status);
+
+        virtual int get_type();
+        virtual void from_BSON(const char* data);
+        virtual const char* to_BSON();
+        virtual string str();
+
+    private:
+        string entry_id;
+        bool removed;
+        uint64_t vm_id;
+        uint32_t vm_port;
+        uint64_t ct_id;
+        uint64_t dp_id;
+        uint32_t dp_port;
+        string eth_addr;
+        uint32_t status;
+};
+
+class LinkEntryUpdate : public IPCMessage {
+    public:
+        LinkEntryUpdate();
+        LinkEntryUpdate(string entry_id, bool removed, uint64_t ct_id, uint64_t dp_id, uint32_t dp_port, string eth_addr, uint64_t rem_ct, uint64_t rem_id, uint32_t rem_port, string rem_eth_addr, uint32_t status);
+
+        string get_entry_id();
+        void set_entry_id(string entry_id);
+
+        bool get_removed();
+        void set_removed(bool removed);
+
+        uint64_t get_ct_id();
+        void set_ct_id(uint64_t ct_id);
+
+        uint64_t get_dp_id();
+        void set_dp_id(uint64_t dp_id);
+
+        uint32_t get_dp_port();
+        void set_dp_port(uint32_t dp_port);
+
+        string get_eth_addr();
+        void set_eth_addr(string eth_addr);
+
+        uint64_t get_rem_ct();
+        void set_rem_ct(uint64_t rem_ct);
+
+        uint64_t get_rem_id();
+        void set_rem_id(uint64_t rem_id);
+
+        uint32_t get_rem_port();
+        void set_rem_port(uint32_t rem_port);
+
+        string get_rem_eth_addr();
+        void set_rem_eth_addr(string rem_eth_addr);
+
+        uint32_t get_status();
+        void set_status(uint32_t status);
+
+        virtual int get_type();
+        virtual void from_BSON(const char* data);
+        virtual const char* to_BSON();
+        virtual string str();
+
+    private:
+        string entry_id;
+        bool removed;
+        uint64_t ct_id;
+        uint64_t dp_id;
+        uint32_t dp_port;
+        string eth_addr;
+        uint64_t rem_ct;
+        uint64_t rem_id;
+        uint32_t rem_port;
+        string rem_eth_addr;
+        uint32_t status;
+};
+
 #endif /* __RFPROTOCOL_H__ */
\ No newline at end of file
@@ -4,6 +4,7 @@ import pymongo as mongo
 from rflib.types.Match import Match
 from rflib.types.Action import Action
 from rflib.types.Option import Option
+from IPC import PRIORITY_BULK
 from MongoIPC import MongoIPCMessage
 
 format_id = lambda dp_id: hex(dp_id).rstrip('L')
@@ -15,6 +16,8 @@ DATAPATH_DOWN = 3
 VIRTUAL_PLANE_MAP = 4
 DATA_PLANE_MAP = 5
 ROUTE_MOD = 6
+PORT_ENTRY_UPDATE = 7
+LINK_ENTRY_UPDATE = 8
 
 class PortRegister(MongoIPCMessage):
     def __init__(self, vm_id=None, vm_port=None, hwaddress=None):
@@ -445,6 +448,9 @@ class RouteMod(MongoIPCMessage):
     def get_type(self):
         return ROUTE_MOD
 
+    def get_priority(self):
+        return PRIORITY_BULK
+
     def get_mod(self):
         return self.mod
 
@@ -541,3 +547,329 @@ class RouteMod(MongoIPCMessage):
         for option in self.get_options():
             s += "    " + str(Option.from_dict(option)) + "\n"
         return s
+
+class PortEntryUpdate(MongoIPCMessage):
+    def __init__(self, entry_id=None, removed=None, vm_id=None, vm_port=None, ct_id=None, dp_id=None, dp_port=None, eth_addr=None, status=None):
+        self.set_entry_id(entry_id)
+        self.set_removed(removed)
+        self.set_vm_id(vm_id)
+        self.set_vm_port(vm_port)
+        self.set_ct_id(ct_id)
+        self.set_dp_id(dp_id)
+        self.set_dp_port(dp_port)
+        self.set_eth_addr(eth_addr)
+        self.set_status(status)
+
+    def get_type(self):
+        return PORT_ENTRY_UPDATE
+
+    def get_entry_id(self):
+        return self.entry_id
+
+    def set_entry_id(self, entry_id):
+        entry_id = "" if entry_id is None else entry_id
+        try:
+            self.entry_id = str(entry_id)
+        except:
+            self.entry_id = ""
+
+    def get_removed(self):
+        return self.removed
+
+    def set_removed(self, removed):
+        removed = False if removed is None else removed
+        try:
+            self.removed = bool(removed)
+        except:
+            self.removed = False
+
+    def get_vm_id(self):
+        return self.vm_id
+
+    def set_vm_id(self, vm_id):
+        vm_id = 0 if vm_id is None else vm_id
+        try:
+            self.vm_id = int(vm_id)
+        except:
+            self.vm_id = 0
+
+    def get_vm_port(self):
+        return self.vm_port
+
+    def set_vm_port(self, vm_port):
+        vm_port = 0 if vm_port is None else vm_port
+        try:
+            self.vm_port = int(vm_port)
+        except:
+            self.vm_port = 0
+
+    def get_ct_id(self):
+        return self.ct_id
+
+    def set_ct_id(self, ct_id):
+        ct_id = 0 if ct_id is None else ct_id
+        try:
+            self.ct_id = int(ct_id)
+        except:
+            self.ct_id = 0
+
+    def get_dp_id(self):
+        return self.dp_id
+
+    def set_dp_id(self, dp_id):
+        dp_id = 0 if dp_id is None else dp_id
+        try:
+            self.dp_id = int(dp_id)
+        except:
+            self.dp_id = 0
+
+    def get_dp_port(self):
+        return self.dp_port
+
+    def set_dp_port(self, dp_port):
+        dp_port = 0 if dp_port is None else dp_port
+        try:
+            self.dp_port = int(dp_port)
+        except:
+            self.dp_port = 0
+
+    def get_eth_addr(self):
+        return self.eth_addr
+
+    def set_eth_addr(self, eth_addr):
+        eth_addr = "" if eth_addr is None else eth_addr
+        try:
+            self.eth_addr = str(eth_addr)
+        except:
+            self.eth_addr = ""
+
+    def get_status(self):
+        return self.status
+
+    def set_status(self, status):
+        status = 0 if status is None else status
+        try:
+            self.status = int(status)
+        except:
+            self.status = 0
+
+    def from_dict(self, data):
+        self.set_entry_id(data["entry_id"])
+        self.set_removed(data["removed"])
+        self.set_vm_id(data["vm_id"])
+        self.set_vm_port(data["vm_port"])
+        self.set_ct_id(data["ct_id"])
+        self.set_dp_id(data["dp_id"])
+        self.set_dp_port(data["dp_port"])
+        self.set_eth_addr(data["eth_addr"])
+        self.set_status(data["status"])
+
+    def to_dict(self):
+        data = {}
+        data["entry_id"] = self.get_entry_id()
+        data["removed"] = bool(self.get_removed())
+        data["vm_id"] = str(self.get_vm_id())
+        data["vm_port"] = str(self.get_vm_port())
+        data["ct_id"] = str(self.get_ct_id())
+        data["dp_id"] = str(self.get_dp_id())
+        data["dp_port"] = str(self.get_dp_port())
+        data["eth_addr"] = self.get_eth_addr()
+        data["status"] = str(self.get_status())
+        return data
+
+    def from_bson(self, data):
+        data = bson.BSON.decode(data)
+        self.from_dict(data)
+
+    def to_bson(self):
+        return bson.BSON.encode(self.get_dict())
+
+    def __str__(self):
+        s = "PortEntryUpdate\n"
+        s += "  entry_id: " + str(self.get_entry_id()) + "\n"
+        s += "  removed: " + str(self.get_removed()) + "\n"
+        s += "  vm_id: " + format_id(self.get_vm_id()) + "\n"
+        s += "  vm_port: " + str(self.get_vm_port()) + "\n"
+        s += "  ct_id: " + format_id(self.get_ct_id()) + "\n"
+        s += "  dp_id: " + format_id(self.get_dp_id()) + "\n"
+        s += "  dp_port: " + str(self.get_dp_port()) + "\n"
+        s += "  eth_addr: " + str(self.get_eth_addr()) + "\n"
+        s += "  status: " + str(self.get_status()) + "\n"
+        return s
+
+class LinkEntryUpdate(MongoIPCMessage):
+    def __init__(self, entry_id=None, removed=None, ct_id=None, dp_id=None, dp_port=None, eth_addr=None, rem_ct=None, rem_id=None, rem_port=None, rem_eth_addr=None, status=None):
+        self.set_entry_id(entry_id)
+        self.set_removed(removed)
+        self.set_ct_id(ct_id)
+        self.set_dp_id(dp_id)
+        self.set_dp_port(dp_port)
+        self.set_eth_addr(eth_addr)
+        self.set_rem_ct(rem_ct)
+        self.set_rem_id(rem_id)
+        self.set_rem_port(rem_port)
+        self.set_rem_eth_addr(rem_eth_addr)
+        self.set_status(status)
+
+    def get_type(self):
+        return LINK_ENTRY_UPDATE
+
+    def get_entry_id(self):
+        return self.entry_id
+
+    def set_entry_id(self, entry_id):
+        entry_id = "" if entry_id is None else entry_id
+        try:
+            self.entry_id = str(entry_id)
+        except:
+            self.entry_id = ""
+
+    def get_removed(self):
+        return self.removed
+
+    def set_removed(self, removed):
+        removed = False if removed is None else removed
+        try:
+            self.removed = bool(removed)
+        except:
+            self.removed = False
+
+    def get_ct_id(self):
+        return self.ct_id
+
+    def set_ct_id(self, ct_id):
+        ct_id = 0 if ct_id is None else ct_id
+        try:
+            self.ct_id = int(ct_id)
+        except:
+            self.ct_id = 0
+
+    def get_dp_id(self):
+        return self.dp_id
+
+    def set_dp_id(self, dp_id):
+        dp_id = 0 if dp_id is None else dp_id
+        try:
+            self.dp_id = int(dp_id)
+        except:
+            self.dp_id = 0
+
+    def get_dp_port(self):
+        return self.dp_port
+
+    def set_dp_port(self, dp_port):
+        dp_port = 0 if dp_port is None else dp_port
+        try:
+            self.dp_port = int(dp_port)
+        except:
+            self.dp_port = 0
+
+    def get_eth_addr(self):
+        return self.eth_addr
+
+    def set_eth_addr(self, eth_addr):
+        eth_addr = "" if eth_addr is None else eth_addr
+        try:
+            self.eth_addr = str(eth_addr)
+        except:
+            self.eth_addr = ""
+
+    def get_rem_ct(self):
+        return self.rem_ct
+
+    def set_rem_ct(self, rem_ct):
+        rem_ct = 0 if rem_ct is None else rem_ct
+        try:
+            self.rem_ct = int(rem_ct)
+        except:
+            self.rem_ct = 0
+
+    def get_rem_id(self):
+        return self.rem_id
+
+    def set_rem_id(self, rem_id):
+        rem_id = 0 if rem_id is None else rem_id
+        try:
+            self.rem_id = int(rem_id)
+        except:
+            self.rem_id = 0
+
+    def get_rem_port(self):
+        return self.rem_port
+
+    def set_rem_port(self, rem_port):
+        rem_port = 0 if rem_port is None else rem_port
+        try:
+            self.rem_port = int(rem_port)
+        except:
+            self.rem_port = 0
+
+    def get_rem_eth_addr(self):
+        return self.rem_eth_addr
+
+    def set_rem_eth_addr(self, rem_eth_addr):
+        rem_eth_addr = "" if rem_eth_addr is None else rem_eth_addr
+        try:
+            self.rem_eth_addr = str(rem_eth_addr)
+        except:
+            self.rem_eth_addr = ""
+
+    def get_status(self):
+        return self.status
+
+    def set_status(self, status):
+        status = 0 if status is None else status
+        try:
+            self.status = int(status)
+        except:
+            self.status = 0
+
+    def from_dict(self, data):
+        self.set_entry_id(data["entry_id"])
+        self.set_removed(data["removed"])
+        self.set_ct_id(data["ct_id"])
+        self.set_dp_id(data["dp_id"])
+        self.set_dp_port(data["dp_port"])
+        self.set_eth_addr(data["eth_addr"])
+        self.set_rem_ct(data["rem_ct"])
+        self.set_rem_id(data["rem_id"])
+        self.set_rem_port(data["rem_port"])
+        self.set_rem_eth_addr(data["rem_eth_addr"])
+        self.set_status(data["status"])
+
+    def to_dict(self):
+        data = {}
+        data["entry_id"] = self.get_entry_id()
+        data["removed"] = bool(self.get_removed())
+        data["ct_id"] = str(self.get_ct_id())
+        data["dp_id"] = str(self.get_dp_id())
+        data["dp_port"] = str(self.get_dp_port())
+        data["eth_addr"] = self.get_eth_addr()
+        data["rem_ct"] = str(self.get_rem_ct())
+        data["rem_id"] = str(self.get_rem_id())
+        data["rem_port"] = str(self.get_rem_port())
+        data["rem_eth_addr"] = self.get_rem_eth_addr()
+        data["status"] = str(self.get_status())
+        return data
+
+    def from_bson(self, data):
+        data = bson.BSON.decode(data)
+        self.from_dict(data)
+
+    def to_bson(self):
+        return bson.BSON.encode(self.get_dict())
+
+    def __str__(self):
+        s = "LinkEntryUpdate\n"
+        s += "  entry_id: " + str(self.get_entry_id()) + "\n"
+        s += "  removed: " + str(self.get_removed()) + "\n"
+        s += "  ct_id: " + format_id(self.get_ct_id()) + "\n"
+        s += "  dp_id: " + format_id(self.get_dp_id()) + "\n"
+        s += "  dp_port: " + str(self.get_dp_port()) + "\n"
+        s += "  eth_addr: " + str(self.get_eth_addr()) + "\n"
+        s += "  rem_ct: " + format_id(self.get_rem_ct()) + "\n"
+        s += "  rem_id: " + format_id(self.get_rem_id()) + "\n"
+        s += "  rem_port: " + str(self.get_rem_port()) + "\n"
+        s += "  rem_eth_addr: " + str(self.get_rem_eth_addr()) + "\n"
+        s += "  status: " + str(self.get_status()) + "\n"
+        return s
@@ -16,6 +16,10 @@ IPCMessage* RFProtocolFactory::buildForType(int type) {
             return new DataPlaneMap();
         case ROUTE_MOD:
             return new RouteMod();
+        case PORT_ENTRY_UPDATE:
+            return new PortEntryUpdate();
+        case LINK_ENTRY_UPDATE:
+            return new LinkEntryUpdate();
         default:
             return NULL;
     }
@@ -17,3 +17,7 @@ class RFProtocolFactory(IPC.IPCMessageFactory):
             return DataPlaneMap()
         if type_ == ROUTE_MOD:
             return RouteMod()
+        if type_ == PORT_ENTRY_UPDATE:
+            return PortEntryUpdate()
+        if type_ == LINK_ENTRY_UPDATE:
+            return LinkEntryUpdate()
@@ -0,0 +1,173 @@
+#include "Sequence.h"
+#include <time.h>
+#include "MongoIPC.h"
+#include "log/Log.h"
+#include "metrics/Metrics.h"
+
+static Counter& messagesLost = Metrics::counter("rflib_ipc_messages_lost_total",
+    "IPC messages found missing and not replayed");
+static Counter& messagesReplayed = Metrics::counter(
+    "rflib_ipc_messages_replayed_total",
+    "IPC messages missing at first and then received from a replay");
+static Counter& messagesDuplicated = Metrics::counter(
+    "rflib_ipc_messages_duplicated_total",
+    "IPC messages received more than once and dropped");
+static Counter& resyncsRequested = Metrics::counter(
+    "rflib_ipc_resyncs_requested_total",
+    "Resyncs requested for messages that could not be replayed");
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int priorityOf(const mongo::BSONObj &envelope) {
+    // Messages from older senders have no priority, and count as bulk
+    return envelope.hasField(PRIORITY_FIELD) ?
+        envelope[PRIORITY_FIELD].Int() : IPC_PRIORITY_BULK;
+}
+
+mongo::BSONObj requestEnvelope(const string &from, const SequenceRequest &request) {
+    mongo::BSONObjBuilder envelope;
+
+    envelope.genOID();
+    envelope.append(FROM_FIELD, from);
+    envelope.append(TO_FIELD, request.to);
+    envelope.append(TYPE_FIELD, request.type);
+    envelope.append(READ_FIELD, false);
+    envelope.append(PRIORITY_FIELD, IPC_PRIORITY_CONTROL);
+    envelope.append(CONTENT_FIELD, BSON("priority" << request.priority
+                                        << "first" << request.first
+                                        << "last" << request.last));
+    return envelope.obj();
+}
+
+SendLog::SendLog() {
+    this->session = mongo::OID::gen().str();
+}
+
+const string& SendLog::get_session() const {
+    return this->session;
+}
+
+SendLog::Stream& SendLog::stream(const string &channelId, const string &to, int priority) {
+    boost::lock_guard<boost::mutex> lock(this->streamsMutex);
+    return this->streams[StreamKey(make_pair(channelId, to), priority)];
+}
+
+boost::mutex& SendLog::lock(const string &channelId, const string &to, int priority) {
+    return *this->stream(channelId, to, priority).mutex;
+}
+
+mongo::BSONObj SendLog::envelope(const string &channelId, const string &from, const string &to, IPCMessage &msg) {
+    Stream &s = this->stream(channelId, to, msg.get_priority());
+
+    mongo::BSONObj envelope = putInEnvelope(from, to, msg, this->session, ++s.seq);
+    s.sent.push_back(envelope);
+    if (s.sent.size() > IPC_REPLAY_WINDOW)
+        s.sent.pop_front();
+    return envelope;
+}
+
+bool SendLog::replay(const string &channelId, const string &to, int priority, long long first, long long last, vector<mongo::BSONObj> &envelopes) {
+    // A stream never sent on is made here, with nothing kept to replay
+    const Stream &s = this->stream(channelId, to, priority);
+
+    // The envelopes kept are numbered up to seq, without gaps
+    long long oldest = s.seq - (long long) s.sent.size() + 1;
+    if (first < oldest || last > s.seq || first > last)
+        return false;
+
+    for (long long seq = first; seq <= last; seq++)
+        envelopes.push_back(s.sent[seq - oldest]);
+    return true;
+}
+
+void ReceiveLog::receive(const mongo::BSONObj &envelope, vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests) {
+    if (!envelope.hasField(SEQUENCE_FIELD)) {
+        ready.push_back(envelope);
+        return;
+    }
+
+    StreamKey key(envelope[SESSION_FIELD].String(), priorityOf(envelope));
+    long long seq = envelope[SEQUENCE_FIELD].numberLong();
+    map<StreamKey, Stream>::iterator it = this->streams.find(key);
+    if (it == this->streams.end()) {
+        // Whatever came before the first message seen is not ours to miss
+        Stream s;
+        s.next = seq;
+        s.since = 0;
+        it = this->streams.insert(make_pair(key, s)).first;
+    }
+    Stream &s = it->second;
+
+    if (seq < s.next || s.held.count(seq) > 0) {
+        messagesDuplicated.inc();
+        return;
+    }
+
+    if (seq == s.next) {
+        if (!s.held.empty())
+            messagesReplayed.inc();
+        ready.push_back(envelope);
+        s.next++;
+        // Messages held after the gap follow until the next gap, if any
+        while (!s.held.empty() && s.held.begin()->first == s.next) {
+            ready.push_back(s.held.begin()->second);
+            s.held.erase(s.held.begin());
+            s.next++;
+        }
+        s.since = s.held.empty() ? 0 : now_ms();
+        return;
+    }
+
+    // Ask for what is missing between the last message held and this one
+    long long first = s.held.empty() ? s.next : s.held.rbegin()->first + 1;
+    s.held[seq] = envelope.getOwned();
+    if (s.since == 0)
+        s.since = now_ms();
+
+    if (seq - s.next > IPC_REPLAY_WINDOW || s.held.size() > IPC_REPLAY_WINDOW) {
+        this->release(key, s, ready, requests);
+        return;
+    }
+    if (first < seq) {
+        RFLOG_INFO("ipc_gap session=%s priority=%d first=%lld last=%lld",
+                   key.first.c_str(), key.second, first, seq - 1);
+        SequenceRequest r = {key.first, IPC_REPLAY_REQUEST, key.second,
+                             first, seq - 1};
+        requests.push_back(r);
+    }
+}
+
+void ReceiveLog::expire(vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests) {
+    uint64_t now = now_ms();
+    map<StreamKey, Stream>::iterator it;
+    for (it = this->streams.begin(); it != this->streams.end(); it++) {
+        Stream &s = it->second;
+        if (!s.held.empty() && now - s.since >= IPC_REPLAY_TIMEOUT_MS)
+            this->release(it->first, s, ready, requests);
+    }
+}
+
+/* Give up on the messages missing from a stream: process those held and ask
+ * for a resync. */
+void ReceiveLog::release(const StreamKey &key, Stream &s, vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests) {
+    long long lost = 0;
+    map<long long, mongo::BSONObj>::iterator it;
+    for (it = s.held.begin(); it != s.held.end(); it++) {
+        lost += it->first - s.next;
+        ready.push_back(it->second);
+        s.next = it->first + 1;
+    }
+    s.held.clear();
+    s.since = 0;
+
+    messagesLost.inc(lost);
+    resyncsRequested.inc();
+    RFLOG_WARN("ipc_messages_lost session=%s priority=%d lost=%lld",
+               key.first.c_str(), key.second, lost);
+    SequenceRequest r = {key.first, IPC_RESYNC_REQUEST, key.second, 0, 0};
+    requests.push_back(r);
+}
@@ -0,0 +1,117 @@
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <mongo/client/dbclient.h>
+#include "IPC.h"
+
+#define SESSION_FIELD "session"
+#define SEQUENCE_FIELD "seq"
+
+/* Detection and recovery of lost messages.
+ *
+ * The messages a service sends are numbered from 1 on each stream: those of
+ * a priority class to a user on a channel, which backends deliver in order.
+ * Envelopes carry the number along with a session id unique to the service,
+ * so that a restarted sender starts new streams.
+ *
+ * A receiver that finds a gap in a stream holds the messages after it and
+ * asks the session for a replay of the missing ones. The sender keeps the
+ * last IPC_REPLAY_WINDOW messages of each stream to send again. If the gap
+ * is wider than that, or the replay does not come within
+ * IPC_REPLAY_TIMEOUT_MS, the receiver processes what it holds and asks the
+ * session for a resync instead, which goes to its IPCResyncHandler.
+ *
+ * Requests are sent on the channel of the stream, to the session id, where
+ * the sender's service answers them. Loss of the last messages of a stream
+ * is only found once another one follows. */
+
+/** A request for the sender of a stream. */
+struct SequenceRequest {
+    /** The session of the stream, or the ID of a user for a resync */
+    string to;
+    int type;
+    int priority;
+    long long first;
+    long long last;
+};
+
+/** Get the envelope of a request.
+@param from the ID of the requesting user */
+mongo::BSONObj requestEnvelope(const string &from, const SequenceRequest &request);
+
+/** Numbers the messages sent by a service and keeps the last
+IPC_REPLAY_WINDOW of each stream. Callers serialise access to each stream,
+in the order its messages are sent, by holding the stream's lock; different
+streams can be used at once. */
+class SendLog {
+    public:
+        SendLog();
+
+        /** Get the session id of the service. */
+        const string& get_session() const;
+
+        /** Get the lock of a stream, to hold from numbering a message to
+        sending it, or while replaying some, so that the stream goes out in
+        the order it is numbered. */
+        boost::mutex& lock(const string &channelId, const string &to, int priority);
+
+        /** Put a message in an envelope with the next sequence number of its
+        stream, and keep the envelope for replay. */
+        mongo::BSONObj envelope(const string &channelId, const string &from, const string &to, IPCMessage &msg);
+
+        /** Get the envelopes of the messages numbered first to last of a
+        stream, for a replay request.
+        @return false if some of them are no longer kept */
+        bool replay(const string &channelId, const string &to, int priority, long long first, long long last, vector<mongo::BSONObj> &envelopes);
+
+    private:
+        struct Stream {
+            Stream() : seq(0), mutex(new boost::mutex) {}
+            long long seq;
+            deque<mongo::BSONObj> sent;
+            boost::shared_ptr<boost::mutex> mutex;
+        };
+        typedef pair<pair<string, string>, int> StreamKey;
+
+        string session;
+        // Guards the map only; a stream, once in it, stays where it is
+        boost::mutex streamsMutex;
+        map<StreamKey, Stream> streams;
+
+        Stream& stream(const string &channelId, const string &to, int priority);
+};
+
+/** Puts the messages a listener receives back in order, and finds those
+missing. Used by a single listener thread. */
+class ReceiveLog {
+    public:
+        /** Take in a received envelope.
+        @param ready the envelopes to add those now ready to be processed to,
+        in order. Envelopes without a sequence number are ready at once.
+        @param requests the requests to add those to send to senders to */
+        void receive(const mongo::BSONObj &envelope, vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests);
+
+        /** Give up on replays that timed out, asking for a resync instead.
+        Called regularly while listening. */
+        void expire(vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests);
+
+    private:
+        struct Stream {
+            long long next;
+            map<long long, mongo::BSONObj> held;
+            uint64_t since;
+        };
+        typedef pair<string, int> StreamKey;
+
+        map<StreamKey, Stream> streams;
+
+        void release(const StreamKey &key, Stream &s, vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests);
+};
+
+#endif /* __SEQUENCE_H__ */
@@ -0,0 +1,259 @@
+#include "ShmIPC.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <boost/thread.hpp>
+#include <boost/scoped_array.hpp>
+#include "MongoIPC.h"
+#include "log/Log.h"
+#include "metrics/Metrics.h"
+
+static Counter& messagesSent = Metrics::counter("rflib_ipc_messages_sent_total",
+    "IPC messages sent");
+static Counter& sendFailures = Metrics::counter(
+    "rflib_ipc_send_failures_total", "IPC messages that could not be sent");
+static Histogram& sendTime = Metrics::histogram("rflib_ipc_send_seconds",
+    "Time to send an IPC message, waiting for other senders included");
+static Counter& messagesReceived = Metrics::counter(
+    "rflib_ipc_messages_received_total", "IPC messages received");
+static Counter& messagesDiscarded = Metrics::counter(
+    "rflib_ipc_messages_discarded_total",
+    "IPC messages dropped on request before being processed");
+static Histogram& processTime = Metrics::histogram(
+    "rflib_ipc_process_seconds", "Time to process a received IPC message");
+
+ShmIPCMessageService::ShmIPCMessageService(const string &dir, const string id) {
+    this->set_id(id);
+    this->dir = dir;
+}
+
+ShmIPCMessageService::~ShmIPCMessageService() {
+    if (this->responder.joinable()) {
+        this->responder.interrupt();
+        this->responder.join();
+    }
+    map<string, void*>::iterator it;
+    for (it = this->mailboxes.begin(); it != this->mailboxes.end(); it++)
+        if (it->second != NULL)
+            rfshm_close(it->second);
+}
+
+/* Whether a discard request made after the message was sent matches it. */
+static bool discarded(void *mailbox, const mongo::BSONObj &envelope, uint64_t time) {
+    char buf[SHM_DISCARDS * 96];
+    int n = rfshm_discards(mailbox, envelope[TYPE_FIELD].Int(), time, buf, sizeof buf);
+    if (n == 0)
+        return false;
+
+    mongo::BSONObj content = envelope[CONTENT_FIELD].Obj();
+    const char *p = buf;
+    for (int i = 0; i < n; i++) {
+        const char *field = p;
+        const char *value = field + strlen(field) + 1;
+        p = value + strlen(value) + 1;
+        mongo::BSONElement e = content[field];
+        if (e.type() == mongo::String && e.String() == value)
+            return true;
+    }
+    return false;
+}
+
+void ShmIPCMessageService::listenWorker(const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor) {
+    void *mailbox = rfshm_listen(this->dir.c_str(), channelId.c_str(), this->get_id().c_str());
+    if (mailbox == NULL) {
+        RFLOG_ERR("shm_listen_failed dir=%s channel=%s error=\"%s\"",
+                  this->dir.c_str(), channelId.c_str(), strerror(errno));
+        exit(1);
+    }
+
+    uint32_t len = 64 * 1024;
+    boost::scoped_array<char> buf(new char[len]);
+    ReceiveLog log;
+    while (true) {
+        uint64_t time;
+        int64_t n = rfshm_receive(mailbox, buf.get(), len, 50, &time);
+        if (n < 0) {
+            len = -n;
+            buf.reset(new char[len]);
+            continue;
+        }
+
+        vector<mongo::BSONObj> ready;
+        vector<SequenceRequest> requests;
+        if (n == 0) {
+            log.expire(ready, requests);
+            this->deliver(ready, requests, channelId, factory, processor);
+            continue;
+        }
+
+        mongo::BSONObj envelope(buf.get());
+        // Discarded messages are still taken in, to keep their streams whole
+        if (discarded(mailbox, envelope, time)) {
+            mongo::BSONObjBuilder b;
+            b.appendElements(envelope);
+            b.append(DISCARDED_FIELD, true);
+            envelope = b.obj();
+        }
+        log.receive(envelope, ready, requests);
+        this->deliver(ready, requests, channelId, factory, processor);
+    }
+}
+
+/* Process envelopes that are ready and send requests for missing ones. */
+void ShmIPCMessageService::deliver(vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests, const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor) {
+    for (size_t i = 0; i < ready.size(); i++) {
+        mongo::BSONObj &envelope = ready[i];
+        if (envelope[TYPE_FIELD].Int() == IPC_RESYNC_REQUEST) {
+            this->resync(channelId, envelope[FROM_FIELD].String());
+            continue;
+        }
+        if (envelope.hasField(DISCARDED_FIELD)) {
+            messagesDiscarded.inc();
+            continue;
+        }
+
+        IPCMessage *msg = takeFromEnvelope(envelope, factory);
+        messagesReceived.inc();
+        {
+            ScopedTimer timer(processTime);
+            processor->process(envelope[FROM_FIELD].String(), this->get_id(), channelId, *msg);
+        }
+        delete msg;
+    }
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        mongo::BSONObj request = requestEnvelope(this->get_id(), requests[i]);
+        rfshm_send(this->dir.c_str(), channelId.c_str(),
+                   requests[i].to.c_str(), IPC_PRIORITY_CONTROL,
+                   request.objdata(), request.objsize());
+    }
+}
+
+/* Answer the requests of receivers of the messages sent on any channel, until
+the service is destroyed. The mailboxes of the session are only used by this
+thread, one per channel, and are polled in turn. */
+void ShmIPCMessageService::respondWorker() {
+    const string &session = this->sendLog.get_session();
+    uint32_t len = 1024;
+    boost::scoped_array<char> buf(new char[len]);
+    while (true) {
+        vector<string> channels;
+        {
+            boost::lock_guard<boost::mutex> lock(sendMutex);
+            channels.assign(this->respondChannels.begin(),
+                            this->respondChannels.end());
+        }
+
+        bool idle = true;
+        for (size_t i = 0; i < channels.size(); i++) {
+            const string &channelId = channels[i];
+            map<string, void*>::iterator it = this->mailboxes.find(channelId);
+            if (it == this->mailboxes.end()) {
+                void *mailbox = rfshm_listen(this->dir.c_str(), channelId.c_str(), session.c_str());
+                if (mailbox == NULL)
+                    RFLOG_ERR("shm_listen_failed dir=%s channel=%s error=\"%s\"",
+                              this->dir.c_str(), channelId.c_str(), strerror(errno));
+                it = this->mailboxes.insert(make_pair(channelId, mailbox)).first;
+            }
+            if (it->second == NULL)
+                continue;
+
+            uint64_t time;
+            int64_t n;
+            while ((n = rfshm_receive(it->second, buf.get(), len, 0, &time)) != 0) {
+                if (n < 0) {
+                    len = -n;
+                    buf.reset(new char[len]);
+                    continue;
+                }
+                idle = false;
+                this->respond(channelId, mongo::BSONObj(buf.get()));
+            }
+        }
+
+        // Both are interruption points, where the destructor stops the thread
+        if (idle)
+            boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+        else
+            boost::this_thread::interruption_point();
+    }
+}
+
+/* Answer a request of a receiver of the messages sent on a channel. */
+void ShmIPCMessageService::respond(const string &channelId, const mongo::BSONObj &request) {
+    string from = request[FROM_FIELD].String();
+    if (request[TYPE_FIELD].Int() == IPC_RESYNC_REQUEST) {
+        this->resync(channelId, from);
+        return;
+    }
+
+    mongo::BSONObj content = request[CONTENT_FIELD].Obj();
+    int priority = content["priority"].Int();
+    // Replayed messages go out between those of the stream sent after them,
+    // in the order they are numbered, while other streams are sent on
+    boost::lock_guard<boost::mutex> lock(
+        this->sendLog.lock(channelId, from, priority));
+    vector<mongo::BSONObj> envelopes;
+    if (!this->sendLog.replay(channelId, from, priority,
+                              content["first"].numberLong(),
+                              content["last"].numberLong(), envelopes)) {
+        // The receiver asks for a resync once it stops waiting
+        RFLOG_INFO("ipc_replay_unavailable channel=%s to=%s",
+                   channelId.c_str(), from.c_str());
+        return;
+    }
+    for (size_t i = 0; i < envelopes.size(); i++)
+        rfshm_send(this->dir.c_str(), channelId.c_str(), from.c_str(),
+                   envelopes[i][PRIORITY_FIELD].Int(),
+                   envelopes[i].objdata(), envelopes[i].objsize());
+}
+
+void ShmIPCMessageService::listen(const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor, bool block) {
+    boost::thread t(&ShmIPCMessageService::listenWorker, this, channelId, factory, processor);
+    if (block)
+        t.join();
+    else
+        t.detach();
+}
+
+bool ShmIPCMessageService::send(const string &channelId, const string &to, IPCMessage& msg) {
+    ScopedTimer timer(sendTime);
+    {
+        boost::lock_guard<boost::mutex> lock(sendMutex);
+        // Receivers can ask for what they missed once there is something to
+        // miss
+        this->respondChannels.insert(channelId);
+        if (!this->responder.joinable())
+            this->responder = boost::thread(&ShmIPCMessageService::respondWorker, this);
+    }
+
+    // Only senders on the same stream wait for each other, so that it is
+    // written to its ring in the order it is numbered. A message that cannot
+    // be sent is still numbered and kept, so that the receiver asks for it
+    // once the ring has room again.
+    boost::lock_guard<boost::mutex> lock(
+        this->sendLog.lock(channelId, to, msg.get_priority()));
+    mongo::BSONObj envelope = this->sendLog.envelope(channelId, this->get_id(), to, msg);
+    if (rfshm_send(this->dir.c_str(), channelId.c_str(), to.c_str(),
+                   msg.get_priority(), envelope.objdata(),
+                   envelope.objsize()) != 0) {
+        sendFailures.inc();
+        RFLOG_WARN("shm_send_failed channel=%s to=%s", channelId.c_str(),
+                   to.c_str());
+        return false;
+    }
+    messagesSent.inc();
+    return true;
+}
+
+void ShmIPCMessageService::discard(const string &channelId, const string &to, int type, const string &field, const string &value) {
+    rfshm_discard(this->dir.c_str(), channelId.c_str(), to.c_str(), type,
+                  field.c_str(), value.c_str());
+}
+
+void ShmIPCMessageService::request_resync(const string &channelId, const string &to) {
+    SequenceRequest request = {to, IPC_RESYNC_REQUEST, IPC_PRIORITY_CONTROL, 0, 0};
+    mongo::BSONObj envelope = requestEnvelope(this->get_id(), request);
+    rfshm_send(this->dir.c_str(), channelId.c_str(), to.c_str(),
+               IPC_PRIORITY_CONTROL, envelope.objdata(), envelope.objsize());
+}
@@ -0,0 +1,44 @@
+#ifndef __SHMIPC_H__
+#define __SHMIPC_H__
+
+#include <map>
+#include <set>
+#include <boost/thread.hpp>
+#include "IPC.h"
+#include "Sequence.h"
+#include "ShmRing.h"
+
+/** An IPC message service over rings in shared memory, for processes on the
+same host. Messages are carried in the same BSON envelopes as with MongoDB,
+so C++ and Python users can talk to each other. */
+class ShmIPCMessageService : public IPCMessageService {
+    public:
+        /** Creates an IPC message service using shared memory.
+        @param dir the directory of the shared memory segments
+        @param id the ID of this IPC service user */
+        ShmIPCMessageService(const string &dir, const string id);
+
+        /** Stops answering the replay and resync requests of receivers. */
+        virtual ~ShmIPCMessageService();
+
+        virtual void listen(const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor, bool block=true);
+        virtual bool send(const string &channelId, const string &to, IPCMessage& msg);
+        virtual void discard(const string &channelId, const string &to, int type, const string &field, const string &value);
+        virtual void request_resync(const string &channelId, const string &to);
+
+    private:
+        string dir;
+        // Guards respondChannels and the start of the responder; each
+        // stream sent on has a lock of its own in sendLog
+        boost::mutex sendMutex;
+        SendLog sendLog;
+        set<string> respondChannels;
+        boost::thread responder;
+        map<string, void*> mailboxes;
+        void listenWorker(const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor);
+        void deliver(vector<mongo::BSONObj> &ready, vector<SequenceRequest> &requests, const string &channelId, IPCMessageFactory *factory, IPCMessageProcessor *processor);
+        void respondWorker();
+        void respond(const string &channelId, const mongo::BSONObj &request);
+};
+
+#endif /* __SHMIPC_H__ */
@@ -0,0 +1,268 @@
+import os
+import time
+import ctypes
+import threading
+import ctypes.util
+
+import bson
+
+import rflib.ipc.IPC as IPC
+from rflib.ipc.MongoIPC import take_from_envelope, request_envelope
+from rflib.ipc.MongoIPC import SendLog, ReceiveLog
+from rflib.ipc.MongoIPC import FROM_FIELD, TO_FIELD, TYPE_FIELD, CONTENT_FIELD
+from rflib.ipc.MongoIPC import PRIORITY_FIELD, DISCARDED_FIELD
+
+# Default directory of the shared memory segments, as in ShmRing.h
+SHM_IPC_DIR = "/dev/shm/rfipc"
+SHM_DISCARDS = 16
+
+# librfshm.so is built from ShmRing.cc along with rflib
+LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            "..", "..", "build", "lib", "librfshm.so")
+
+def _load_library():
+    path = LIBRARY_PATH
+    if not os.path.exists(path):
+        path = ctypes.util.find_library("rfshm")
+    if path is None:
+        raise ImportError("librfshm.so not found, build rflib first")
+
+    lib = ctypes.CDLL(path, use_errno=True)
+    lib.rfshm_send.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                               ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p,
+                               ctypes.c_uint32]
+    lib.rfshm_send.restype = ctypes.c_int
+    lib.rfshm_discard.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                                  ctypes.c_char_p, ctypes.c_int,
+                                  ctypes.c_char_p, ctypes.c_char_p]
+    lib.rfshm_discard.restype = ctypes.c_int
+    lib.rfshm_listen.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                                 ctypes.c_char_p]
+    lib.rfshm_listen.restype = ctypes.c_void_p
+    lib.rfshm_close.argtypes = [ctypes.c_void_p]
+    lib.rfshm_close.restype = None
+    lib.rfshm_receive.argtypes = [ctypes.c_void_p, ctypes.c_void_p,
+                                  ctypes.c_uint32, ctypes.c_int,
+                                  ctypes.POINTER(ctypes.c_uint64)]
+    lib.rfshm_receive.restype = ctypes.c_int64
+    lib.rfshm_discards.argtypes = [ctypes.c_void_p, ctypes.c_int,
+                                   ctypes.c_uint64, ctypes.c_char_p,
+                                   ctypes.c_uint32]
+    lib.rfshm_discards.restype = ctypes.c_int
+    return lib
+
+_lib = _load_library()
+
+def _encode(s):
+    return s.encode("utf-8") if not isinstance(s, bytes) else s
+
+class ShmIPCMessageService(IPC.IPCMessageService):
+    def __init__(self, directory, id_, thread_constructor, sleep_function):
+        """Construct an IPCMessageService over rings in shared memory, for
+        processes on the same host.
+
+        Args:
+            directory: the directory of the shared memory segments.
+            id_: is an identifier to allow messages to be directed to the
+                appropriate recipient.
+            thread_constructor: as for MongoIPCMessageService.
+            sleep_function: as for MongoIPCMessageService. Listeners wait for
+                messages inside librfshm when it is time.sleep; with any other
+                function, such as that of a cooperative scheduler which a
+                blocking call would stall, they poll and sleep with it.
+        """
+        self._dir = _encode(directory)
+        self._id = id_
+        self._threading = thread_constructor
+        self._sleep = sleep_function
+        self._send_log = SendLog()
+        # Guards _stream_locks and the start of the responder; each stream
+        # sent on, (channel_id, to, priority), has a lock of its own
+        self._lock = threading.Lock()
+        self._stream_locks = {}
+        self._respond_channels = set()
+        self._responder = None
+        self._stopped = False
+
+    def listen(self, channel_id, factory, processor, block=True):
+        worker = self._threading(target=self._listen_worker,
+                                 args=(channel_id, factory, processor))
+        worker.start()
+        if block:
+            worker.join()
+
+    def send(self, channel_id, to, msg):
+        with self._lock:
+            # Receivers can ask for what they missed once there is something
+            # to miss
+            self._respond_channels.add(channel_id)
+            if self._responder is None:
+                self._responder = self._threading(
+                    target=self._respond_worker, args=())
+                self._responder.start()
+        # Only senders on the same stream wait for each other, so that it is
+        # written to its ring in the order it is numbered. A message that
+        # cannot be sent is still numbered and kept, so that the receiver
+        # asks for it once the ring has room again.
+        with self._stream_lock(channel_id, to, msg.get_priority()):
+            envelope = self._send_log.envelope(channel_id, self.get_id(), to,
+                                               msg)
+            return self._transmit(channel_id, to, envelope)
+
+    def stop(self):
+        self._stopped = True
+        if self._responder is not None:
+            self._responder.join()
+            self._responder = None
+
+    def discard(self, channel_id, to, type_, field, value):
+        _lib.rfshm_discard(self._dir, _encode(channel_id), _encode(to), type_,
+                           _encode(field), _encode(value))
+
+    def request_resync(self, channel_id, to):
+        self._transmit(channel_id, to,
+                       request_envelope(self.get_id(), to,
+                                        IPC.RESYNC_REQUEST))
+
+    def _stream_lock(self, channel_id, to, priority):
+        key = (channel_id, to, priority)
+        with self._lock:
+            lock = self._stream_locks.get(key)
+            if lock is None:
+                lock = self._stream_locks[key] = threading.Lock()
+            return lock
+
+    def _transmit(self, channel_id, to, envelope):
+        data = bson.BSON.encode(envelope)
+        return _lib.rfshm_send(self._dir, _encode(channel_id), _encode(to),
+                               envelope[PRIORITY_FIELD], data, len(data)) == 0
+
+    def _open(self, channel_id, to):
+        mailbox = _lib.rfshm_listen(self._dir, _encode(channel_id),
+                                    _encode(to))
+        if not mailbox:
+            raise OSError(ctypes.get_errno(), "Failed to open mailbox for " +
+                          channel_id)
+        return mailbox
+
+    def _wait(self, mailbox, buf, sent):
+        """Take the next message from a mailbox into buf, returning it and
+        the buffer, or None if there was none for a while."""
+        timeout = 50 if self._sleep is time.sleep else 0
+        while True:
+            n = _lib.rfshm_receive(mailbox, buf, len(buf), timeout,
+                                   ctypes.byref(sent))
+            if n < 0:
+                buf = ctypes.create_string_buffer(-n)
+                continue
+            if n == 0:
+                if timeout == 0:
+                    self._sleep(0.001)
+                return None, buf
+            return bson.BSON(buf.raw[:n]).decode(), buf
+
+    def _listen_worker(self, channel_id, factory, processor):
+        mailbox = self._open(channel_id, self.get_id())
+        buf = ctypes.create_string_buffer(64 * 1024)
+        sent = ctypes.c_uint64()
+        log = ReceiveLog()
+
+        while True:
+            envelope, buf = self._wait(mailbox, buf, sent)
+            ready, requests = [], []
+            if envelope is None:
+                log.expire(ready, requests)
+            else:
+                # Discarded messages are still taken in, to keep their
+                # streams whole
+                if self._discarded(mailbox, envelope, sent.value):
+                    envelope[DISCARDED_FIELD] = True
+                log.receive(envelope, ready, requests)
+
+            for envelope in ready:
+                if envelope[TYPE_FIELD] == IPC.RESYNC_REQUEST:
+                    self._resync(channel_id, envelope[FROM_FIELD])
+                    continue
+                if envelope.get(DISCARDED_FIELD):
+                    continue
+                msg = take_from_envelope(envelope, factory)
+                processor.process(envelope[FROM_FIELD], envelope[TO_FIELD],
+                                  channel_id, msg)
+            for request in requests:
+                self._transmit(channel_id, request[0],
+                               request_envelope(self.get_id(), *request))
+
+    def _respond_worker(self):
+        """Answer the requests of receivers of the messages sent on any
+        channel, until the service is stopped. The mailboxes of the session,
+        one per channel, are polled in turn."""
+        mailboxes = {}
+        buf = ctypes.create_string_buffer(1024)
+        sent = ctypes.c_uint64()
+
+        try:
+            while not self._stopped:
+                idle = True
+                for channel_id in list(self._respond_channels):
+                    if channel_id not in mailboxes:
+                        mailboxes[channel_id] = self._open(
+                            channel_id, self._send_log.session)
+                    while True:
+                        n = _lib.rfshm_receive(mailboxes[channel_id], buf,
+                                               len(buf), 0,
+                                               ctypes.byref(sent))
+                        if n < 0:
+                            buf = ctypes.create_string_buffer(-n)
+                            continue
+                        if n == 0:
+                            break
+                        idle = False
+                        self._respond(channel_id,
+                                      bson.BSON(buf.raw[:n]).decode())
+                if idle:
+                    self._sleep(0.05)
+        finally:
+            for mailbox in mailboxes.values():
+                _lib.rfshm_close(mailbox)
+
+    def _respond(self, channel_id, request):
+        """Answer a request of a receiver of the messages sent on a
+        channel."""
+        from_ = request[FROM_FIELD]
+        if request[TYPE_FIELD] == IPC.RESYNC_REQUEST:
+            self._resync(channel_id, from_)
+            return
+
+        content = request[CONTENT_FIELD]
+        # Replayed messages go out between those of the stream sent after
+        # them, in the order they are numbered, while other streams are sent
+        # on
+        with self._stream_lock(channel_id, from_, content["priority"]):
+            envelopes = self._send_log.replay(channel_id, from_,
+                                              content["priority"],
+                                              content["first"],
+                                              content["last"])
+            if envelopes is None:
+                # The receiver asks for a resync once it stops waiting
+                IPC.log.info("ipc_replay_unavailable channel=%s to=%s",
+                             channel_id, from_)
+                return
+            for envelope in envelopes:
+                self._transmit(channel_id, from_, envelope)
+
+    def _discarded(self, mailbox, envelope, sent):
+        """Whether a discard request made after the message was sent matches
+        it."""
+        buf = ctypes.create_string_buffer(SHM_DISCARDS * 96)
+        n = _lib.rfshm_discards(mailbox, envelope[TYPE_FIELD], sent, buf,
+                                len(buf))
+        if n == 0:
+            return False
+
+        parts = buf.raw.split(b"\0")
+        content = envelope[CONTENT_FIELD]
+        for i in range(n):
+            field, value = parts[2 * i].decode(), parts[2 * i + 1].decode()
+            if content.get(field) == value:
+                return True
+        return False
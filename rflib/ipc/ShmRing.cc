@@ -0,0 +1,451 @@
+#include "ShmRing.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <map>
+#include <string>
+
+using namespace std;
+
+#define RING_MAGIC 0x52464952 /* "RFIR" */
+#define RECORD_WRAP 0xFFFFFFFF
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t) 7)
+
+// How often a busy receiver looks for rings of new senders anyway
+#define RESCAN_NS 1000000000LL
+
+// Segments are for the processes of the user that made them only
+#define SEGMENT_MODE 0600
+#define DIR_MODE 0700
+
+/* Head and tail are written by different processes, so they are kept in
+ * cache lines of their own. */
+struct RingHeader {
+    uint32_t magic;
+    uint32_t size;
+    char pad0[56];
+    volatile uint64_t head;     // bytes written, moved by the sender
+    char pad1[56];
+    volatile uint64_t tail;     // bytes read, moved by the receiver
+    char pad2[56];
+};
+
+struct RecordHeader {
+    uint32_t len;
+    uint32_t reserved;
+    uint64_t time;
+};
+
+struct DiscardEntry {
+    uint64_t time;
+    int32_t type;
+    char field[32];
+    char value[64];
+};
+
+/* A new doorbell is all zeros, which is a valid state. */
+struct Doorbell {
+    volatile uint32_t seq;          // bumped for every message
+    volatile uint32_t waiters;      // receivers waiting on seq
+    volatile uint32_t generation;   // bumped for every new ring
+    volatile int lock;              // guards the discard requests
+    uint32_t nextDiscard;
+    DiscardEntry discards[SHM_DISCARDS];
+};
+
+struct Ring {
+    RingHeader *header;
+    uint8_t *data;
+    int priority;
+    pid_t pid;
+};
+
+/* A ring of this process. 'lock' serialises sends to it, so that a sender
+ * waiting for room in a full ring holds up no other ring. */
+struct SendRing {
+    Ring ring;
+    pthread_mutex_t lock;
+};
+
+struct Mailbox {
+    string dir;
+    string prefix;
+    Doorbell *bell;
+    uint32_t generation;
+    int64_t lastScan;
+    map<string, Ring> rings;
+    string last;                    // the ring read last
+};
+
+/* Guards the maps below, which only grow, so their entries can be used once
+ * the mutex is released. */
+static pthread_mutex_t sendMutex = PTHREAD_MUTEX_INITIALIZER;
+static map<string, SendRing> sendRings;
+static map<string, Doorbell*> doorbells;
+
+static int64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static string prefixOf(const char *channel, const char *to) {
+    string prefix = string(channel) + "@" + to;
+    for (size_t i = 0; i < prefix.size(); i++)
+        if (prefix[i] == '/')
+            prefix[i] = '_';
+    return prefix;
+}
+
+static void* mapFile(const string &path, size_t size, bool create) {
+    int fd = open(path.c_str(), create ? O_RDWR | O_CREAT : O_RDWR,
+                  SEGMENT_MODE);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1
+        || ((size_t) st.st_size < size && ftruncate(fd, size) == -1)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Called with sendMutex held. */
+static Doorbell* openDoorbell(const string &dir, const string &prefix) {
+    string path = dir + "/" + prefix;
+    map<string, Doorbell*>::iterator it = doorbells.find(path);
+    if (it != doorbells.end())
+        return it->second;
+
+    mkdir(dir.c_str(), DIR_MODE);
+    Doorbell *bell = (Doorbell*) mapFile(path, sizeof(Doorbell), true);
+    if (bell != NULL)
+        doorbells[path] = bell;
+    return bell;
+}
+
+static void ring(Doorbell *bell, bool newRing) {
+    if (newRing)
+        __sync_fetch_and_add(&bell->generation, 1);
+    __sync_fetch_and_add(&bell->seq, 1);
+    if (bell->waiters)
+        syscall(SYS_futex, &bell->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Rings of this process are told apart from those of an earlier process with
+ * the same pid by a token taken at first use. */
+static string ringName(const string &prefix, int priority) {
+    static int64_t token = now();
+    char buf[64];
+    snprintf(buf, sizeof buf, "@%d-%llx.%d", (int) getpid(),
+             (unsigned long long) token, priority);
+    return prefix + buf;
+}
+
+/* Called with sendMutex held. The ring is set up under a temporary name, so
+ * that receivers never see it half-made. */
+static SendRing* openSendRing(const string &dir, const string &prefix,
+                              int priority, bool &created) {
+    string path = dir + "/" + ringName(prefix, priority);
+    map<string, SendRing>::iterator it = sendRings.find(path);
+    created = false;
+    if (it != sendRings.end())
+        return &it->second;
+
+    size_t size = sizeof(RingHeader) + SHM_RING_SIZE;
+    string tmp = path + ".tmp";
+    mkdir(dir.c_str(), DIR_MODE);
+    RingHeader *header = (RingHeader*) mapFile(tmp, size, true);
+    if (header == NULL)
+        return NULL;
+    header->magic = RING_MAGIC;
+    header->size = SHM_RING_SIZE;
+    if (rename(tmp.c_str(), path.c_str()) == -1) {
+        munmap(header, size);
+        unlink(tmp.c_str());
+        return NULL;
+    }
+
+    SendRing &sr = sendRings[path];
+    Ring r = {header, (uint8_t*) (header + 1), priority, getpid()};
+    sr.ring = r;
+    pthread_mutex_init(&sr.lock, NULL);
+    created = true;
+    return &sr;
+}
+
+int rfshm_send(const char *dir, const char *channel, const char *to,
+               int priority, const void *data, uint32_t len) {
+    uint64_t need = ALIGN8(sizeof(RecordHeader) + len);
+    if (need > SHM_RING_SIZE / 2)
+        return -1;
+
+    pthread_mutex_lock(&sendMutex);
+    string prefix = prefixOf(channel, to);
+    bool created;
+    Doorbell *bell = openDoorbell(dir, prefix);
+    SendRing *sr = bell == NULL ? NULL : openSendRing(dir, prefix, priority,
+                                                      created);
+    pthread_mutex_unlock(&sendMutex);
+    if (sr == NULL)
+        return -1;
+
+    pthread_mutex_lock(&sr->lock);
+    Ring *r = &sr->ring;
+    RingHeader *h = r->header;
+    uint64_t head = h->head;
+    uint64_t pos, pad;
+    int64_t deadline = now() + SHM_SEND_TIMEOUT_MS * 1000000LL;
+    while (true) {
+        pos = head % h->size;
+        pad = h->size - pos < need ? h->size - pos : 0;
+        if (h->size - (head - h->tail) >= pad + need)
+            break;
+        if (now() > deadline) {
+            pthread_mutex_unlock(&sr->lock);
+            return -1;
+        }
+        usleep(100);
+    }
+
+    // Records don't wrap around; a marker sends the reader back to the start
+    if (pad != 0) {
+        *(uint32_t*) (r->data + pos) = RECORD_WRAP;
+        head += pad;
+        pos = 0;
+    }
+    RecordHeader *rec = (RecordHeader*) (r->data + pos);
+    rec->len = len;
+    rec->reserved = 0;
+    rec->time = now();
+    memcpy(rec + 1, data, len);
+    __sync_synchronize();
+    h->head = head + need;
+
+    pthread_mutex_unlock(&sr->lock);
+    ring(bell, created);
+    return 0;
+}
+
+int rfshm_discard(const char *dir, const char *channel, const char *to,
+                  int type, const char *field, const char *value) {
+    pthread_mutex_lock(&sendMutex);
+    Doorbell *bell = openDoorbell(dir, prefixOf(channel, to));
+    pthread_mutex_unlock(&sendMutex);
+    if (bell == NULL)
+        return -1;
+
+    while (__sync_lock_test_and_set(&bell->lock, 1))
+        sched_yield();
+    DiscardEntry *e = &bell->discards[bell->nextDiscard++ % SHM_DISCARDS];
+    e->time = now();
+    e->type = type;
+    snprintf(e->field, sizeof e->field, "%s", field);
+    snprintf(e->value, sizeof e->value, "%s", value);
+    __sync_lock_release(&bell->lock);
+    return 0;
+}
+
+void* rfshm_listen(const char *dir, const char *channel, const char *to) {
+    Mailbox *mb = new Mailbox;
+    mb->dir = dir;
+    mb->prefix = prefixOf(channel, to) + "@";
+
+    pthread_mutex_lock(&sendMutex);
+    mb->bell = openDoorbell(dir, prefixOf(channel, to));
+    pthread_mutex_unlock(&sendMutex);
+    if (mb->bell == NULL) {
+        delete mb;
+        return NULL;
+    }
+    mb->generation = mb->bell->generation - 1;
+    mb->lastScan = 0;
+    return mb;
+}
+
+/* The doorbell is shared with the sends of the process, and stays mapped. */
+void rfshm_close(void *mailbox) {
+    Mailbox *mb = (Mailbox*) mailbox;
+    map<string, Ring>::iterator it;
+    for (it = mb->rings.begin(); it != mb->rings.end(); it++)
+        munmap(it->second.header, sizeof(RingHeader) + it->second.header->size);
+    delete mb;
+}
+
+static bool empty(const Ring &r) {
+    return r.header->head == r.header->tail;
+}
+
+/* Pick up the rings of new senders, and drop those of senders that are gone
+ * once they have been read. */
+static void scan(Mailbox *mb) {
+    mb->generation = mb->bell->generation;
+    mb->lastScan = now();
+
+    DIR *d = opendir(mb->dir.c_str());
+    if (d == NULL)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        string name = ent->d_name;
+        if (name.compare(0, mb->prefix.size(), mb->prefix) != 0
+            || name.find(".tmp") != string::npos
+            || mb->rings.count(name))
+            continue;
+
+        int pid, priority;
+        if (sscanf(name.c_str() + mb->prefix.size(), "%d-%*x.%d",
+                   &pid, &priority) != 2)
+            continue;
+        string path = mb->dir + "/" + name;
+        RingHeader *header = (RingHeader*) mapFile(path, sizeof(RingHeader),
+                                                   false);
+        if (header == NULL)
+            continue;
+        if (header->magic != RING_MAGIC) {
+            munmap(header, sizeof(RingHeader));
+            continue;
+        }
+        size_t size = sizeof(RingHeader) + header->size;
+        munmap(header, sizeof(RingHeader));
+        header = (RingHeader*) mapFile(path, size, false);
+        if (header == NULL)
+            continue;
+
+        Ring r = {header, (uint8_t*) (header + 1), priority, pid};
+        mb->rings[name] = r;
+    }
+    closedir(d);
+
+    map<string, Ring>::iterator it = mb->rings.begin();
+    while (it != mb->rings.end()) {
+        Ring &r = it->second;
+        if (empty(r) && kill(r.pid, 0) == -1 && errno == ESRCH) {
+            unlink((mb->dir + "/" + it->first).c_str());
+            munmap(r.header, sizeof(RingHeader) + r.header->size);
+            mb->rings.erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
+
+/* Rings of the same priority are read in turn, starting after the one read
+ * last, so no sender can keep the others out. */
+static Ring* next(Mailbox *mb) {
+    map<string, Ring>::iterator it = mb->rings.upper_bound(mb->last);
+    map<string, Ring>::iterator best = mb->rings.end();
+    for (size_t i = 0; i < mb->rings.size(); i++, it++) {
+        if (it == mb->rings.end())
+            it = mb->rings.begin();
+        if (!empty(it->second) && (best == mb->rings.end()
+                || it->second.priority > best->second.priority))
+            best = it;
+    }
+    if (best == mb->rings.end())
+        return NULL;
+    mb->last = best->first;
+    return &best->second;
+}
+
+static int64_t pop(Ring *r, void *buf, uint32_t len, uint64_t *time) {
+    RingHeader *h = r->header;
+    while (true) {
+        uint64_t tail = h->tail;
+        if (h->head == tail)
+            return 0;
+        __sync_synchronize();
+
+        uint64_t pos = tail % h->size;
+        RecordHeader *rec = (RecordHeader*) (r->data + pos);
+        if (rec->len == RECORD_WRAP) {
+            h->tail = tail + h->size - pos;
+            continue;
+        }
+        if (rec->len > len)
+            return -(int64_t) rec->len;
+
+        memcpy(buf, rec + 1, rec->len);
+        *time = rec->time;
+        int64_t n = rec->len;
+        __sync_synchronize();
+        h->tail = tail + ALIGN8(sizeof(RecordHeader) + rec->len);
+        return n;
+    }
+}
+
+int64_t rfshm_receive(void *mailbox, void *buf, uint32_t len, int timeout_ms,
+                      uint64_t *time) {
+    Mailbox *mb = (Mailbox*) mailbox;
+    bool waited = false;
+    while (true) {
+        uint32_t seq = mb->bell->seq;
+        if (mb->generation != mb->bell->generation
+            || now() - mb->lastScan > RESCAN_NS)
+            scan(mb);
+
+        Ring *r = next(mb);
+        if (r != NULL) {
+            int64_t n = pop(r, buf, len, time);
+            if (n != 0)
+                return n;
+            continue;
+        }
+        if (waited || timeout_ms <= 0)
+            return 0;
+
+        // A message sent since seq was read makes the wait return at once
+        struct timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        __sync_fetch_and_add(&mb->bell->waiters, 1);
+        syscall(SYS_futex, &mb->bell->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+        __sync_fetch_and_sub(&mb->bell->waiters, 1);
+        waited = true;
+    }
+}
+
+int rfshm_discards(void *mailbox, int type, uint64_t time, char *buf,
+                   uint32_t len) {
+    Mailbox *mb = (Mailbox*) mailbox;
+    Doorbell *bell = mb->bell;
+    int n = 0;
+    uint32_t used = 0;
+
+    while (__sync_lock_test_and_set(&bell->lock, 1))
+        sched_yield();
+    for (int i = 0; i < SHM_DISCARDS; i++) {
+        DiscardEntry *e = &bell->discards[i];
+        if (e->time == 0 || e->type != type || e->time < time)
+            continue;
+        size_t f = strlen(e->field) + 1, v = strlen(e->value) + 1;
+        if (used + f + v > len)
+            break;
+        memcpy(buf + used, e->field, f);
+        memcpy(buf + used + f, e->value, v);
+        used += f + v;
+        n++;
+    }
+    __sync_lock_release(&bell->lock);
+    return n;
+}
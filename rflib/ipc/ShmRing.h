@@ -0,0 +1,87 @@
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <stdint.h>
+
+/* Default directory of the shared memory segments */
+#define SHM_IPC_DIR "/dev/shm/rfipc"
+
+// Bytes of data in each ring. Segments are sparse until written to.
+#define SHM_RING_SIZE (4 << 20)
+
+// How long a sender waits for room in a full ring before giving up
+#define SHM_SEND_TIMEOUT_MS 1000
+
+// Discard requests remembered for each receiver
+#define SHM_DISCARDS 16
+
+/* Single-producer single-consumer rings in shared memory, for messages
+ * between processes on the same host.
+ *
+ * Messages for a receiver on a channel go through one ring per sending
+ * process and priority class, in a file of the segment directory named
+ * "<channel>@<to>@<pid>-<token>.<priority>". The receiver finds new rings by
+ * scanning the directory, and removes those of senders that are gone once
+ * they are empty. Rings are kept in the files, so messages wait for a
+ * receiver that is not running yet, or is restarting.
+ *
+ * Segments are made readable and writable by their owner only, and the
+ * directory searchable by its owner only, as messages carry routes and
+ * tables. All processes on a host using the same directory must therefore run
+ * as the same user.
+ *
+ * A doorbell segment per receiver, "<channel>@<to>", holds a futex word that
+ * senders bump after each message, and the discard requests. Futexes work
+ * across processes sharing a mapping without passing file descriptors
+ * around, which eventfds would need.
+ *
+ * This is a C interface so that Python can load it with ctypes. The functions
+ * are thread-safe; sends from a process to the same ring are serialised, and
+ * a sender waiting for room in a full ring holds up no other ring. */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Send a message.
+ * @param dir the segment directory
+ * @param priority the priority class, IPC_PRIORITY_CONTROL or
+ *        IPC_PRIORITY_BULK
+ * @return 0 on success, -1 if the ring could not be opened, the message is
+ *         too long or the ring stayed full for SHM_SEND_TIMEOUT_MS */
+int rfshm_send(const char *dir, const char *channel, const char *to,
+               int priority, const void *data, uint32_t len);
+
+/** Ask the receiver to drop queued messages of a type whose field has the
+ * given value. Only messages sent before the call are affected.
+ * @return 0 on success, -1 if the doorbell could not be opened */
+int rfshm_discard(const char *dir, const char *channel, const char *to,
+                  int type, const char *field, const char *value);
+
+/** Open the mailbox of a receiver on a channel.
+ * @return the mailbox, or NULL on failure */
+void* rfshm_listen(const char *dir, const char *channel, const char *to);
+
+/** Close a mailbox, unmapping the rings it has open. */
+void rfshm_close(void *mailbox);
+
+/** Take the next message from a mailbox. Messages of a higher priority class
+ * from any sender go first, so control messages go before bulk ones; within a
+ * class, messages from a sender keep their order.
+ * @param timeout_ms how long to wait for a message, 0 not to wait
+ * @param time set to the time the message was sent
+ * @return the length of the message, 0 if there was none, or minus the
+ *         length of the message if buf is too small for it */
+int64_t rfshm_receive(void *mailbox, void *buf, uint32_t len, int timeout_ms,
+                      uint64_t *time);
+
+/** Get the discard requests of a type made after a message was sent, as
+ * NUL-terminated field and value pairs.
+ * @return the number of pairs written to buf */
+int rfshm_discards(void *mailbox, int type, uint64_t time, char *buf,
+                   uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SHMRING_H__ */
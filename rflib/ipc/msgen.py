@@ -1,6 +1,8 @@
 import sys
 
 messages = []
+# Messages in the bulk priority class; all others are control messages
+bulkMessages = set()
 
 # C++
 typesMap = {
@@ -188,6 +190,8 @@ def genH(messages, fname):
             g.blankLine()
 
         g.addLine("virtual int get_type();")
+        if name in bulkMessages:
+            g.addLine("virtual int get_priority();")
         g.addLine("virtual void from_BSON(const char* data);")
         g.addLine("virtual const char* to_BSON();")
         g.addLine("virtual string str();")
@@ -236,6 +240,14 @@ def genCPP(messages, fname):
         g.addLine("}")
         g.blankLine();
 
+        if name in bulkMessages:
+            g.addLine("int {0}::get_priority() {{".format(name))
+            g.increaseIndent();
+            g.addLine("return IPC_PRIORITY_BULK;")
+            g.decreaseIndent()
+            g.addLine("}")
+            g.blankLine();
+
         for t, f in msg:
             g.addLine("{0} {1}::get_{2}() {{".format(typesMap[t], name, f))
             g.increaseIndent();
@@ -363,6 +375,7 @@ def genPy(messages, fname):
     g.blankLine()
     for tlv in ["Match","Action","Option"]:
         g.addLine("from rflib.types.{0} import {0}".format(tlv))
+    g.addLine("from IPC import PRIORITY_BULK")
     g.addLine("from MongoIPC import MongoIPCMessage")
     g.blankLine()
     g.addLine("format_id = lambda dp_id: hex(dp_id).rstrip('L')")
@@ -389,6 +402,13 @@ def genPy(messages, fname):
         g.decreaseIndent()
         g.blankLine();
 
+        if name in bulkMessages:
+            g.addLine("def get_priority(self):")
+            g.increaseIndent();
+            g.addLine("return PRIORITY_BULK")
+            g.decreaseIndent()
+            g.blankLine();
+
         for t, f in msg:
             g.addLine("def get_{0}(self):".format(f))
             g.increaseIndent();
@@ -504,9 +524,14 @@ for line in lines:
     parts = line.split()
     if len(parts) == 0:
         continue
-    elif len(parts) == 1:
+    elif not line[0].isspace():
+        # A message, optionally followed by its priority class
         currentMessage = parts[0]
         messages.append((currentMessage, []))
+        if parts[1:] == ["bulk"]:
+            bulkMessages.add(currentMessage)
+        elif len(parts) > 1:
+            print "Error: invalid priority class"
     elif len(parts) == 2:
         if currentMessage is None:
             print "Error: message not declared"
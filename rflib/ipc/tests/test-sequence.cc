@@ -0,0 +1,243 @@
+/* Tests the numbering of IPC messages and the recovery of lost ones, without a
+ * MongoDB server: that a receiver puts messages back in order, drops
+ * duplicates and asks for a replay of those missing, that the sender can
+ * replay only what is still in its window, and that a gap too wide to replay
+ * or a replay that does not come in time leads to a resync instead. */
+
+#include "Sequence.h"
+#include "MongoIPC.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+static const string CHANNEL = "channel";
+static const string FROM = "sender";
+static const string TO = "receiver";
+
+class TestMessage : public IPCMessage {
+    public:
+        TestMessage(int priority) : priority(priority) {}
+        virtual int get_type() { return 1; }
+        virtual int get_priority() { return this->priority; }
+        virtual void from_BSON(const char*) {}
+        virtual const char* to_BSON() {
+            mongo::BSONObj o = BSON("priority" << this->priority);
+            char* data = new char[o.objsize()];
+            memcpy(data, o.objdata(), o.objsize());
+            return data;
+        }
+        virtual string str() { return "test"; }
+
+    private:
+        int priority;
+};
+
+/* Sends 'n' messages of a priority class to TO, keeping their envelopes. */
+static void send(SendLog &out, int priority, int n, vector<mongo::BSONObj> &sent) {
+    TestMessage msg(priority);
+    for (int i = 0; i < n; i++)
+        sent.push_back(out.envelope(CHANNEL, FROM, TO, msg));
+}
+
+static long long seqOf(const mongo::BSONObj &envelope) {
+    return envelope[SEQUENCE_FIELD].numberLong();
+}
+
+/* Whether 'ready' holds the messages numbered first to last, in order. */
+static bool readyInOrder(const vector<mongo::BSONObj> &ready, long long first, long long last) {
+    if ((long long) ready.size() != last - first + 1)
+        return false;
+    for (size_t i = 0; i < ready.size(); i++)
+        if (seqOf(ready[i]) != first + (long long) i)
+            return false;
+    return true;
+}
+
+static void testGap() {
+    SendLog out;
+    ReceiveLog in;
+    vector<mongo::BSONObj> sent, ready;
+    vector<SequenceRequest> requests;
+    send(out, IPC_PRIORITY_BULK, 6, sent);
+    MUST_SUCCEED(seqOf(sent[0]) == 1 && seqOf(sent[5]) == 6);
+    MUST_SUCCEED(sent[0][SESSION_FIELD].String() == out.get_session());
+
+    /* The first message seen starts the stream, wherever it is numbered. */
+    in.receive(sent[1], ready, requests);
+    in.receive(sent[2], ready, requests);
+    MUST_SUCCEED(readyInOrder(ready, 2, 3) && requests.empty());
+
+    /* Messages after a gap are held, and the gap is asked for once. */
+    ready.clear();
+    in.receive(sent[4], ready, requests);
+    in.receive(sent[5], ready, requests);
+    MUST_SUCCEED(ready.empty());
+    MUST_SUCCEED(requests.size() == 1);
+    MUST_SUCCEED(requests[0].to == out.get_session());
+    MUST_SUCCEED(requests[0].type == IPC_REPLAY_REQUEST);
+    MUST_SUCCEED(requests[0].priority == IPC_PRIORITY_BULK);
+    MUST_SUCCEED(requests[0].first == 4 && requests[0].last == 4);
+
+    mongo::BSONObj request = requestEnvelope(TO, requests[0]);
+    MUST_SUCCEED(request[TO_FIELD].String() == out.get_session());
+    MUST_SUCCEED(request[PRIORITY_FIELD].Int() == IPC_PRIORITY_CONTROL);
+
+    /* Messages of another class are not held up by the gap. */
+    vector<mongo::BSONObj> control;
+    send(out, IPC_PRIORITY_CONTROL, 1, control);
+    MUST_SUCCEED(seqOf(control[0]) == 1);
+    requests.clear();
+    in.receive(control[0], ready, requests);
+    MUST_SUCCEED(ready.size() == 1 && requests.empty());
+    MUST_SUCCEED(ready[0][PRIORITY_FIELD].Int() == IPC_PRIORITY_CONTROL);
+
+    /* The replay fills the gap, releasing what was held in order. */
+    vector<mongo::BSONObj> replayed;
+    MUST_SUCCEED(out.replay(CHANNEL, TO, IPC_PRIORITY_BULK, 4, 4, replayed));
+    MUST_SUCCEED(replayed.size() == 1 && seqOf(replayed[0]) == 4);
+    ready.clear();
+    in.receive(replayed[0], ready, requests);
+    MUST_SUCCEED(readyInOrder(ready, 4, 6) && requests.empty());
+
+    /* Duplicates, replayed or held before, are dropped. */
+    ready.clear();
+    in.receive(replayed[0], ready, requests);
+    in.receive(sent[5], ready, requests);
+    in.receive(sent[0], ready, requests);
+    MUST_SUCCEED(ready.empty() && requests.empty());
+
+    /* Messages without a number are ready at once. */
+    TestMessage msg(IPC_PRIORITY_BULK);
+    in.receive(putInEnvelope(FROM, TO, msg), ready, requests);
+    MUST_SUCCEED(ready.size() == 1 && requests.empty());
+}
+
+static void testReplayWindow() {
+    SendLog out;
+    vector<mongo::BSONObj> sent, replayed;
+    send(out, IPC_PRIORITY_BULK, IPC_REPLAY_WINDOW + 3, sent);
+
+    /* Only the last IPC_REPLAY_WINDOW messages of a stream are kept. */
+    MUST_SUCCEED(out.replay(CHANNEL, TO, IPC_PRIORITY_BULK, 4, IPC_REPLAY_WINDOW + 3, replayed));
+    MUST_SUCCEED(readyInOrder(replayed, 4, IPC_REPLAY_WINDOW + 3));
+    replayed.clear();
+    MUST_SUCCEED(!out.replay(CHANNEL, TO, IPC_PRIORITY_BULK, 3, 5, replayed));
+    MUST_SUCCEED(!out.replay(CHANNEL, TO, IPC_PRIORITY_BULK, 5, IPC_REPLAY_WINDOW + 4, replayed));
+    MUST_SUCCEED(!out.replay(CHANNEL, TO, IPC_PRIORITY_BULK, 6, 5, replayed));
+    MUST_SUCCEED(!out.replay(CHANNEL, TO, IPC_PRIORITY_CONTROL, 5, 5, replayed));
+    MUST_SUCCEED(!out.replay(CHANNEL, FROM, IPC_PRIORITY_BULK, 5, 5, replayed));
+    MUST_SUCCEED(replayed.empty());
+
+    /* A receiver that misses more than the window asks for a resync at
+     * once, and processes what it got. */
+    ReceiveLog in;
+    vector<mongo::BSONObj> ready;
+    vector<SequenceRequest> requests;
+    in.receive(sent[0], ready, requests);
+    ready.clear();
+    in.receive(sent[IPC_REPLAY_WINDOW + 2], ready, requests);
+    MUST_SUCCEED(readyInOrder(ready, IPC_REPLAY_WINDOW + 3, IPC_REPLAY_WINDOW + 3));
+    MUST_SUCCEED(requests.size() == 1);
+    MUST_SUCCEED(requests[0].type == IPC_RESYNC_REQUEST);
+    MUST_SUCCEED(requests[0].to == out.get_session());
+
+    /* The stream goes on from there. */
+    vector<mongo::BSONObj> more;
+    send(out, IPC_PRIORITY_BULK, 1, more);
+    ready.clear();
+    requests.clear();
+    in.receive(more[0], ready, requests);
+    MUST_SUCCEED(readyInOrder(ready, IPC_REPLAY_WINDOW + 4, IPC_REPLAY_WINDOW + 4));
+    MUST_SUCCEED(requests.empty());
+}
+
+static void testExpiry() {
+    SendLog out;
+    ReceiveLog in;
+    vector<mongo::BSONObj> sent, ready;
+    vector<SequenceRequest> requests;
+    send(out, IPC_PRIORITY_BULK, 4, sent);
+
+    in.receive(sent[0], ready, requests);
+    in.receive(sent[2], ready, requests);
+    in.receive(sent[3], ready, requests);
+    MUST_SUCCEED(readyInOrder(ready, 1, 1) && requests.size() == 1);
+
+    /* Held messages wait for the replay until IPC_REPLAY_TIMEOUT_MS. */
+    ready.clear();
+    requests.clear();
+    in.expire(ready, requests);
+    MUST_SUCCEED(ready.empty() && requests.empty());
+
+    usleep((IPC_REPLAY_TIMEOUT_MS + 100) * 1000);
+    in.expire(ready, requests);
+    MUST_SUCCEED(readyInOrder(ready, 3, 4));
+    MUST_SUCCEED(requests.size() == 1);
+    MUST_SUCCEED(requests[0].type == IPC_RESYNC_REQUEST);
+
+    /* A replay that comes too late is dropped, and nothing expires again. */
+    ready.clear();
+    requests.clear();
+    in.receive(sent[1], ready, requests);
+    in.expire(ready, requests);
+    MUST_SUCCEED(ready.empty() && requests.empty());
+}
+
+/* Sends 'n' messages of a priority class on a channel, each under the lock of
+ * its stream, as ShmIPC does. */
+static void sendLocked(SendLog *out, string channel, int priority, int n, vector<mongo::BSONObj> *sent) {
+    TestMessage msg(priority);
+    for (int i = 0; i < n; i++) {
+        boost::lock_guard<boost::mutex> lock(out->lock(channel, TO, priority));
+        sent->push_back(out->envelope(channel, FROM, TO, msg));
+    }
+}
+
+static void testStreamLocks() {
+    SendLog out;
+    boost::mutex &bulk = out.lock(CHANNEL, TO, IPC_PRIORITY_BULK);
+    MUST_SUCCEED(&out.lock(CHANNEL, TO, IPC_PRIORITY_BULK) == &bulk);
+    MUST_SUCCEED(&out.lock(CHANNEL, TO, IPC_PRIORITY_CONTROL) != &bulk);
+    MUST_SUCCEED(&out.lock(CHANNEL, FROM, IPC_PRIORITY_BULK) != &bulk);
+    MUST_SUCCEED(&out.lock("other", TO, IPC_PRIORITY_BULK) != &bulk);
+
+    /* A sender holding up one stream holds up no other. */
+    vector<mongo::BSONObj> sent[4];
+    {
+        boost::lock_guard<boost::mutex> lock(bulk);
+        boost::thread t(sendLocked, &out, CHANNEL, IPC_PRIORITY_CONTROL, 10, &sent[0]);
+        MUST_SUCCEED(t.timed_join(boost::posix_time::seconds(5)));
+    }
+    MUST_SUCCEED(readyInOrder(sent[0], 1, 10));
+    sent[0].clear();
+
+    /* Streams sent on at once are each numbered in order. */
+    boost::thread_group senders;
+    senders.create_thread(boost::bind(sendLocked, &out, CHANNEL, IPC_PRIORITY_BULK, 1000, &sent[0]));
+    senders.create_thread(boost::bind(sendLocked, &out, CHANNEL, IPC_PRIORITY_CONTROL, 1000, &sent[1]));
+    senders.create_thread(boost::bind(sendLocked, &out, "a", IPC_PRIORITY_BULK, 1000, &sent[2]));
+    senders.create_thread(boost::bind(sendLocked, &out, "b", IPC_PRIORITY_BULK, 1000, &sent[3]));
+    senders.join_all();
+    MUST_SUCCEED(readyInOrder(sent[0], 1, 1000));
+    MUST_SUCCEED(readyInOrder(sent[1], 11, 1010));
+    MUST_SUCCEED(readyInOrder(sent[2], 1, 1000));
+    MUST_SUCCEED(readyInOrder(sent[3], 1, 1000));
+}
+
+int main(void) {
+    testGap();
+    testReplayWindow();
+    testExpiry();
+    testStreamLocks();
+    return 0;
+}
@@ -0,0 +1,289 @@
+#include "Log.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <vector>
+#include <boost/thread.hpp>
+
+/** A line waiting to be written. The message starts at 'body', after the
+time and ident that syslog adds by itself. */
+struct LogLine {
+    LogLevel level;
+    string text;
+    size_t body;
+    LogLine* next;
+};
+
+/** State shared by the logging threads and the writer thread. Never freed,
+so that it outlives any thread still logging at exit.
+
+Logging threads take no lock: they push lines onto 'queue' and sites onto
+'suppressedSites' with compare-and-swap, and whoever writes out takes the
+whole list at once. */
+struct LogState {
+    string ident;
+    bool useSyslog;
+    volatile int started;
+
+    /** Lines waiting to be written, newest first, and how many. */
+    LogLine* volatile queue;
+    volatile uint32_t queued;
+    volatile uint64_t dropped;
+    sem_t wakeup;
+
+    /** Sites with suppressed messages, listed by their 'listed' flag. */
+    LogSite* volatile suppressedSites;
+
+    /** Serializes writing out, by the writer thread or flush(). */
+    boost::mutex writeMutex;
+    uint64_t reportedDropped;
+    boost::thread writer;
+
+    LogState() : useSyslog(false), started(0), queue(NULL), queued(0),
+                 dropped(0), suppressedSites(NULL), reportedDropped(0) {
+        sem_init(&wakeup, 0, 0);
+    }
+};
+
+static LogState* const state = new LogState;
+
+static const char* levelNames[] = { "ERR", "WARN", "INFO", "DEBUG" };
+
+volatile LogLevel Log::level = RFLL_INFO;
+
+/* Build a line with the current time. */
+static LogLine* makeLine(LogLevel level, const string &msg) {
+    char stamp[32];
+    struct tm tm;
+    time_t now = time(NULL);
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S", &tm);
+
+    LogLine* line = new LogLine;
+    line->level = level;
+    line->text.reserve(msg.size() + 64);
+    line->text += stamp;
+    line->text += ' ';
+    if (!state->ident.empty()) {
+        line->text += state->ident;
+        line->text += ' ';
+    }
+    line->text += levelNames[level];
+    line->text += ' ';
+    line->body = line->text.size();
+    line->text += msg;
+    line->text += '\n';
+    return line;
+}
+
+/* Queue a line, or drop it if the queue is full. Returns whether the writer
+ * thread needs waking up. */
+static bool push(LogLine* line) {
+    if (__sync_add_and_fetch(&state->queued, 1) > RFLOG_QUEUE_LIMIT) {
+        __sync_fetch_and_sub(&state->queued, 1);
+        __sync_fetch_and_add(&state->dropped, 1);
+        delete line;
+        return false;
+    }
+
+    LogLine* head;
+    do {
+        head = state->queue;
+        line->next = head;
+    } while (!__sync_bool_compare_and_swap(&state->queue, head, line));
+    return head == NULL;
+}
+
+static void flushAtExit() {
+    Log::flush();
+}
+
+void Log::init(const string &ident, LogLevel level, bool useSyslog) {
+    // Called once at startup, before other threads log
+    if (state->started) {
+        return;
+    }
+    state->ident = ident;
+    state->useSyslog = useSyslog;
+    if (!__sync_bool_compare_and_swap(&state->started, 0, 1)) {
+        return;
+    }
+    Log::level = level;
+    state->writer = boost::thread(&Log::writerWorker);
+    atexit(flushAtExit);
+}
+
+void Log::setLevel(LogLevel level) {
+    Log::level = level;
+}
+
+/* Sampling and rate limiting use only atomic operations on the site. Threads
+ * that race at the start of a window may let a few more than RFLOG_BURST
+ * messages through, but every suppressed message is counted once. */
+bool Log::admit(LogSite &site) {
+    if (site.sample > 1
+        && __sync_fetch_and_add(&site.seen, 1) % site.sample != 0) {
+        return false;
+    }
+
+    time_t now = time(NULL);
+    time_t start = site.windowStart;
+    if (now - start >= RFLOG_INTERVAL
+        && __sync_bool_compare_and_swap(&site.windowStart, start, now)) {
+        __sync_lock_test_and_set(&site.windowCount, 0);
+        summarize(site);
+    }
+    if (__sync_add_and_fetch(&site.windowCount, 1) <= RFLOG_BURST) {
+        return true;
+    }
+
+    __sync_fetch_and_add(&site.suppressed, 1);
+    if (__sync_bool_compare_and_swap(&site.listed, 0, 1)) {
+        LogSite* head;
+        do {
+            head = state->suppressedSites;
+            site.nextListed = head;
+        } while (!__sync_bool_compare_and_swap(&state->suppressedSites, head,
+                                               &site));
+    }
+    return false;
+}
+
+/* Queue a summary of the messages suppressed at a site, if any. */
+void Log::summarize(LogSite &site) {
+    uint32_t suppressed = __sync_lock_test_and_set(&site.suppressed, 0);
+    if (suppressed == 0) {
+        return;
+    }
+
+    const char *file = strrchr(site.file, '/');
+    file = file ? file + 1 : site.file;
+
+    char msg[128];
+    snprintf(msg, sizeof msg, "%u similar messages suppressed (%s:%d)",
+             suppressed, file, site.line);
+    push(makeLine(site.level, msg));
+}
+
+/* Summarize the sites whose window has passed, so that messages suppressed
+ * at a site that went quiet are still reported. Called by the writer
+ * thread only. */
+void Log::sweepSites(time_t now) {
+    LogSite* site = __sync_lock_test_and_set(&state->suppressedSites,
+                                             (LogSite*) NULL);
+    while (site != NULL) {
+        LogSite* next = site->nextListed;
+        if (now - site->windowStart < RFLOG_INTERVAL) {
+            LogSite* head;
+            do {
+                head = state->suppressedSites;
+                site->nextListed = head;
+            } while (!__sync_bool_compare_and_swap(&state->suppressedSites,
+                                                   head, site));
+        } else {
+            // Unlist before taking the count: a message suppressed after
+            // that lists the site again
+            __sync_lock_test_and_set(&site->listed, 0);
+            summarize(*site);
+        }
+        site = next;
+    }
+}
+
+void Log::write(LogLevel level, const char *format, ...) {
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof buf, format, args);
+    va_end(args);
+
+    string msg;
+    if (n < (int) sizeof buf) {
+        msg = buf;
+    } else {
+        msg.resize(n + 1);
+        va_start(args, format);
+        vsnprintf(&msg[0], n + 1, format, args);
+        va_end(args);
+        msg.resize(n);
+    }
+
+    bool wake = push(makeLine(level, msg));
+    if (!state->started) {
+        writeLines();
+    } else if (wake) {
+        sem_post(&state->wakeup);
+    }
+}
+
+void Log::flush() {
+    writeLines();
+}
+
+uint64_t Log::getDropped() {
+    return state->dropped;
+}
+
+/* Write out the queued lines: to stderr in a single write, and to syslog one
+ * by one. */
+void Log::writeLines() {
+    boost::lock_guard<boost::mutex> writeLock(state->writeMutex);
+
+    // Take the whole queue and put it back in the order it was logged
+    LogLine* newest = __sync_lock_test_and_set(&state->queue, (LogLine*) NULL);
+    std::vector<LogLine*> lines;
+    for (LogLine* line = newest; line != NULL; line = line->next) {
+        lines.push_back(line);
+    }
+    __sync_fetch_and_sub(&state->queued, lines.size());
+
+    uint64_t dropped = state->dropped;
+    if (dropped != state->reportedDropped) {
+        char msg[64];
+        snprintf(msg, sizeof msg, "%llu log messages dropped",
+                 (unsigned long long) (dropped - state->reportedDropped));
+        // Oldest last, so that it is written ahead of what it explains
+        lines.push_back(makeLine(RFLL_WARN, msg));
+        state->reportedDropped = dropped;
+    }
+    if (lines.empty()) {
+        return;
+    }
+
+    string batch;
+    std::vector<LogLine*>::reverse_iterator it;
+    for (it = lines.rbegin(); it != lines.rend(); it++) {
+        LogLine* line = *it;
+        batch += line->text;
+        if (state->useSyslog) {
+            int priority = (line->level == RFLL_ERR ? LOG_ERR
+                            : line->level == RFLL_WARN ? LOG_WARNING
+                            : line->level == RFLL_INFO ? LOG_INFO
+                            : LOG_DEBUG);
+            syslog(priority, "%.*s",
+                   (int) (line->text.size() - line->body - 1),
+                   line->text.c_str() + line->body);
+        }
+        delete line;
+    }
+    fwrite(batch.data(), 1, batch.size(), stderr);
+}
+
+void Log::writerWorker() {
+    while (true) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += RFLOG_INTERVAL;
+        while (sem_timedwait(&state->wakeup, &deadline) != 0
+               && errno == EINTR) {
+            continue;
+        }
+        sweepSites(time(NULL));
+        writeLines();
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+using namespace std;
+
+/** Severity of a log message, most severe first. */
+enum LogLevel {
+    RFLL_ERR,
+    RFLL_WARN,
+    RFLL_INFO,
+    RFLL_DEBUG
+};
+
+// Each call site logs at most RFLOG_BURST messages every RFLOG_INTERVAL
+// seconds; the rest are counted and summarized
+#define RFLOG_BURST 20
+#define RFLOG_INTERVAL 1
+
+// Lines waiting for the writer thread beyond this many are dropped
+#define RFLOG_QUEUE_LIMIT 10000
+
+/** A place in the code that logs, and its rate limiting state.
+Declared by the RFLOG macros; the fields after the first four are updated
+with atomic operations, so that admitting a message takes no lock. */
+struct LogSite {
+    const char* file;
+    int line;
+    LogLevel level;
+    /** Log one in this many messages that pass the level check */
+    uint32_t sample;
+    volatile uint32_t seen;
+    volatile time_t windowStart;
+    volatile uint32_t windowCount;
+    volatile uint32_t suppressed;
+    /** Whether the site is in the list of sites with suppressed messages */
+    volatile int listed;
+    LogSite* nextListed;
+};
+
+/** A process-wide log with levels, per-call site rate limiting and sampling,
+and a writer thread, so that logging threads never wait on terminal or
+syslog I/O.
+
+Messages are written to stderr, and optionally to syslog, as
+"<time> <ident> <LEVEL> <message>". Until init() is called, they are written
+at once by the logging thread. */
+class Log {
+    public:
+        /** Start the writer thread.
+        @param ident the name to prefix messages with
+        @param level the least severe level to log
+        @param useSyslog whether to also write messages to syslog, which
+                         must have been opened */
+        static void init(const string &ident, LogLevel level, bool useSyslog);
+
+        /** Set the least severe level to log. */
+        static void setLevel(LogLevel level);
+
+        /** Check whether messages of a level are logged. */
+        static bool enabled(LogLevel level) { return level <= Log::level; }
+
+        /** Apply sampling and rate limiting of a call site to a message.
+        @return whether the message should be logged */
+        static bool admit(LogSite &site);
+
+        /** Format and queue a message. Use the RFLOG macros instead. */
+        static void write(LogLevel level, const char *format, ...)
+            __attribute__((format(printf, 2, 3)));
+
+        /** Write out all queued messages. */
+        static void flush();
+
+        /** Get the number of messages dropped because the queue was full. */
+        static uint64_t getDropped();
+
+    private:
+        static volatile LogLevel level;
+
+        static void writerWorker();
+        static void sweepSites(time_t now);
+        static void summarize(LogSite &site);
+        static void writeLines();
+};
+
+/* Log a message in printf style, as "event key=value ...". Arguments are
+ * only evaluated if the message is to be logged. */
+#define RFLOG_SAMPLED(LEVEL, N, ...)                                        \
+    do {                                                                    \
+        static LogSite rflog_site_ =                                        \
+            { __FILE__, __LINE__, (LEVEL), (N), 0, 0, 0, 0, 0, NULL };      \
+        if (Log::enabled(LEVEL) && Log::admit(rflog_site_)) {               \
+            Log::write((LEVEL), __VA_ARGS__);                               \
+        }                                                                   \
+    } while (0)
+
+#define RFLOG(LEVEL, ...) RFLOG_SAMPLED(LEVEL, 1, __VA_ARGS__)
+#define RFLOG_ERR(...) RFLOG(RFLL_ERR, __VA_ARGS__)
+#define RFLOG_WARN(...) RFLOG(RFLL_WARN, __VA_ARGS__)
+#define RFLOG_INFO(...) RFLOG(RFLL_INFO, __VA_ARGS__)
+#define RFLOG_DEBUG(...) RFLOG(RFLL_DEBUG, __VA_ARGS__)
+
+#endif /* __LOG_H__ */
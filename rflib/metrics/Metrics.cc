@@ -0,0 +1,300 @@
+#include "Metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <map>
+#include <vector>
+#include <boost/thread.hpp>
+
+/** The registry, never freed so that it outlives any thread updating a
+metric at exit. */
+struct MetricsRegistry {
+    boost::mutex mutex;
+    vector<Metric*> metrics;
+    map<string, Metric*> byName;
+};
+
+/* Metrics are usually created during static initialization, so the
+ * registry is created on first use. */
+static MetricsRegistry& getRegistry() {
+    static MetricsRegistry* registry = new MetricsRegistry;
+    return *registry;
+}
+
+__thread int Metrics::threadShard = -1;
+volatile int Metrics::nextShard = 0;
+
+Metric::Metric(const string &name, const string &help) {
+    this->name = name;
+    this->help = help;
+}
+
+void Metric::writeHeader(string &out, const char *type) const {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+Counter::Counter(const string &name, const string &help)
+    : Metric(name, help) {
+    memset(shards, 0, sizeof shards);
+}
+
+uint64_t Counter::value() const {
+    uint64_t v = 0;
+    for (int i = 0; i < METRICS_SHARDS; i++)
+        v += shards[i].value;
+    return v;
+}
+
+void Counter::write(string &out) const {
+    char buf[32];
+    snprintf(buf, sizeof buf, " %llu\n", (unsigned long long) value());
+    writeHeader(out, "counter");
+    out += name + buf;
+}
+
+Gauge::Gauge(const string &name, const string &help)
+    : Metric(name, help), current(0) {}
+
+void Gauge::write(string &out) const {
+    char buf[32];
+    snprintf(buf, sizeof buf, " %lld\n", (long long) value());
+    writeHeader(out, "gauge");
+    out += name + buf;
+}
+
+Histogram::Histogram(const string &name, const string &help)
+    : Metric(name, help), total(0), sum(0) {
+    for (int i = 0; i < N_BUCKETS; i++)
+        buckets[i] = 0;
+}
+
+/* Return the bucket of a value. Buckets take the values above the limit of
+the bucket before and up to their own limit, so that a power of 2 falls in the
+bucket that it ends. */
+int Histogram::bucketOf(uint64_t micros) {
+    if (micros > 0)
+        micros--;
+    if (micros < HISTOGRAM_SUB_BUCKETS)
+        return micros;
+
+    // The first 3 bits after the leading one pick the sub-bucket
+    int power = 63 - __builtin_clzll(micros);
+    if (power >= HISTOGRAM_POWERS)
+        return N_BUCKETS - 1;
+    int sub = (micros >> (power - 3)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return HISTOGRAM_SUB_BUCKETS * (power - 2) + sub;
+}
+
+/* Return the (inclusive) upper bound of the values in a bucket. */
+uint64_t Histogram::bucketLimit(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket + 1;
+
+    int power = bucket / HISTOGRAM_SUB_BUCKETS + 2;
+    int sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return (uint64_t) (HISTOGRAM_SUB_BUCKETS + sub + 1) << (power - 3);
+}
+
+void Histogram::record(uint64_t micros) {
+    __sync_fetch_and_add(&buckets[bucketOf(micros)], 1);
+    __sync_fetch_and_add(&total, 1);
+    __sync_fetch_and_add(&sum, micros);
+}
+
+uint64_t Histogram::percentile(double p) const {
+    uint64_t n = 0;
+    uint64_t counts[N_BUCKETS];
+    for (int i = 0; i < N_BUCKETS; i++)
+        n += counts[i] = buckets[i];
+    if (n == 0)
+        return 0;
+
+    // Nearest rank
+    uint64_t rank = (uint64_t) (p / 100 * n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank)
+            return bucketLimit(i);
+    }
+    return bucketLimit(N_BUCKETS - 1);
+}
+
+void Histogram::write(string &out) const {
+    char buf[128];
+    writeHeader(out, "histogram");
+
+    // Bucket limits fall on powers of 2, so each Prometheus bucket takes
+    // whole buckets, and counts the values up to and including its limit
+    uint64_t cumulative = 0;
+    int i = 0;
+    for (int power = 0; power < HISTOGRAM_POWERS; power++) {
+        uint64_t limit = (uint64_t) 1 << power;
+        for (; i < N_BUCKETS && bucketLimit(i) <= limit; i++)
+            cumulative += buckets[i];
+        snprintf(buf, sizeof buf, "_bucket{le=\"%.9g\"} %llu\n", limit / 1e6,
+                 (unsigned long long) cumulative);
+        out += name + buf;
+    }
+    for (; i < N_BUCKETS; i++)
+        cumulative += buckets[i];
+    snprintf(buf, sizeof buf, "_bucket{le=\"+Inf\"} %llu\n",
+             (unsigned long long) cumulative);
+    out += name + buf;
+    snprintf(buf, sizeof buf, "_sum %.6f\n", sum / 1e6);
+    out += name + buf;
+    snprintf(buf, sizeof buf, "_count %llu\n",
+             (unsigned long long) cumulative);
+    out += name + buf;
+}
+
+Metric* Metrics::find(const string &name) {
+    map<string, Metric*>::iterator it = getRegistry().byName.find(name);
+    return it == getRegistry().byName.end() ? NULL : it->second;
+}
+
+void Metrics::add(Metric *metric) {
+    getRegistry().metrics.push_back(metric);
+}
+
+Counter& Metrics::counter(const string &name, const string &help) {
+    boost::lock_guard<boost::mutex> lock(getRegistry().mutex);
+    Counter *c = dynamic_cast<Counter*>(find(name));
+    if (c == NULL) {
+        c = new Counter(name, help);
+        getRegistry().byName[name] = c;
+        add(c);
+    }
+    return *c;
+}
+
+Gauge& Metrics::gauge(const string &name, const string &help) {
+    boost::lock_guard<boost::mutex> lock(getRegistry().mutex);
+    Gauge *g = dynamic_cast<Gauge*>(find(name));
+    if (g == NULL) {
+        g = new Gauge(name, help);
+        getRegistry().byName[name] = g;
+        add(g);
+    }
+    return *g;
+}
+
+Histogram& Metrics::histogram(const string &name, const string &help) {
+    boost::lock_guard<boost::mutex> lock(getRegistry().mutex);
+    Histogram *h = dynamic_cast<Histogram*>(find(name));
+    if (h == NULL) {
+        h = new Histogram(name, help);
+        getRegistry().byName[name] = h;
+        add(h);
+    }
+    return *h;
+}
+
+string Metrics::exposition() {
+    boost::lock_guard<boost::mutex> lock(getRegistry().mutex);
+    string out;
+    vector<Metric*>::iterator it;
+    for (it = getRegistry().metrics.begin(); it != getRegistry().metrics.end(); it++)
+        (*it)->write(out);
+    return out;
+}
+
+bool Metrics::serve(const string &address) {
+    int sock;
+    if (address.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str() + 5, sizeof addr.sun_path - 1);
+        unlink(addr.sun_path);
+
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof addr) < 0)
+            goto error;
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(atoi(address.c_str()));
+
+        int reuse = 1;
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0)
+            goto error;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+        if (bind(sock, (struct sockaddr *) &addr, sizeof addr) < 0)
+            goto error;
+    }
+    if (listen(sock, 5) < 0)
+        goto error;
+
+    boost::thread(&Metrics::serveWorker, sock).detach();
+    return true;
+
+error:
+    int saved = errno;
+    if (sock >= 0)
+        close(sock);
+    errno = saved;
+    return false;
+}
+
+/* Answer every request on the socket, whatever its path, with the metrics.
+ * Requests are handled one at a time, with a timeout, so that a stuck
+ * client cannot hold up the process. */
+void Metrics::serveWorker(int sock) {
+    while (true) {
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            usleep(100000);
+            continue;
+        }
+
+        struct timeval timeout = { 1, 0 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+        // Read the request head, whose content does not matter
+        string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == string::npos
+               && request.size() < 8192) {
+            ssize_t n = read(conn, buf, sizeof buf);
+            if (n <= 0)
+                break;
+            request.append(buf, n);
+        }
+
+        string body = exposition();
+        char head[160];
+        snprintf(head, sizeof head,
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\n\r\n", body.size());
+        string response = head + body;
+        const char *p = response.data();
+        size_t left = response.size();
+        while (left > 0) {
+            ssize_t n = send(conn, p, left, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            p += n;
+            left -= n;
+        }
+        close(conn);
+    }
+}
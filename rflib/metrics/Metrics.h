@@ -0,0 +1,157 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+using namespace std;
+
+// Counters are split into this many shards, each padded to a cache line, so
+// that threads counting at once do not contend
+#define METRICS_SHARDS 16
+
+// Sub-buckets per power of 2 in a histogram, and the number of powers of 2
+// covered; larger values land in the last bucket
+#define HISTOGRAM_SUB_BUCKETS 8
+#define HISTOGRAM_POWERS 40
+
+/** A metric in the registry. Metrics are created through Metrics and never
+freed, so references to them can be kept in static variables. */
+class Metric {
+    public:
+        Metric(const string &name, const string &help);
+        virtual ~Metric() {}
+
+        /** Append the metric in Prometheus text format to a string. */
+        virtual void write(string &out) const = 0;
+
+    protected:
+        string name;
+        string help;
+        void writeHeader(string &out, const char *type) const;
+};
+
+/** A count that only goes up, such as of messages sent. */
+class Counter : public Metric {
+    public:
+        Counter(const string &name, const string &help);
+
+        void inc(uint64_t n = 1);
+        uint64_t value() const;
+        virtual void write(string &out) const;
+
+    private:
+        struct Shard {
+            volatile uint64_t value;
+            char pad[64 - sizeof(uint64_t)];
+        };
+        Shard shards[METRICS_SHARDS];
+};
+
+/** A value that goes up and down, such as a queue depth. */
+class Gauge : public Metric {
+    public:
+        Gauge(const string &name, const string &help);
+
+        void set(int64_t v) { __sync_lock_test_and_set(&current, v); }
+        void add(int64_t n) { __sync_fetch_and_add(&current, n); }
+        int64_t value() const { return current; }
+        virtual void write(string &out) const;
+
+    private:
+        volatile int64_t current;
+};
+
+/** A distribution of durations in microseconds, in log-linear buckets in
+the manner of HDR histograms: each power of 2 is split into
+HISTOGRAM_SUB_BUCKETS buckets, so that values are kept within 12.5%.
+
+It is exported as a Prometheus histogram in seconds, with a bucket at each
+power of 2 microseconds counting the values up to and including it. */
+class Histogram : public Metric {
+    public:
+        Histogram(const string &name, const string &help);
+
+        void record(uint64_t micros);
+
+        /** Get an estimate of a percentile (0 to 100), in microseconds,
+        from the upper bound of the bucket it falls in. */
+        uint64_t percentile(double p) const;
+        uint64_t count() const { return total; }
+        virtual void write(string &out) const;
+
+    private:
+        static const int N_BUCKETS =
+            HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_POWERS - 2);
+        volatile uint64_t buckets[N_BUCKETS];
+        volatile uint64_t total;
+        volatile uint64_t sum;
+
+        static int bucketOf(uint64_t micros);
+        static uint64_t bucketLimit(int bucket);
+};
+
+/** The process-wide registry of metrics, and its Prometheus endpoint.
+
+Updating a metric costs an atomic add to memory that is usually private to
+the thread; nothing else happens until the endpoint is scraped. */
+class Metrics {
+    public:
+        /** Get the metric with the given name, creating it on first use.
+        Names follow Prometheus conventions: counters end in _total and
+        histograms are named after what they measure in seconds. */
+        static Counter& counter(const string &name, const string &help);
+        static Gauge& gauge(const string &name, const string &help);
+        static Histogram& histogram(const string &name, const string &help);
+
+        /** Write all metrics in Prometheus text format. */
+        static string exposition();
+
+        /** Serve metrics over HTTP in a thread of their own.
+        @param address a TCP port to listen on at 127.0.0.1, or
+                       "unix:<path>" for a Unix socket
+        @return false if the socket could not be set up */
+        static bool serve(const string &address);
+
+        /** Get a monotonic time in microseconds, for timing. */
+        static uint64_t now() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+
+        /** Get the counter shard of the calling thread. */
+        static int shard() {
+            if (threadShard < 0)
+                threadShard = __sync_fetch_and_add(&nextShard, 1)
+                              % METRICS_SHARDS;
+            return threadShard;
+        }
+
+    private:
+        static __thread int threadShard;
+        static volatile int nextShard;
+
+        static Metric* find(const string &name);
+        static void add(Metric *metric);
+        static void serveWorker(int sock);
+};
+
+inline void Counter::inc(uint64_t n) {
+    __sync_fetch_and_add(&shards[Metrics::shard()].value, n);
+}
+
+/** Records the time from its construction to its destruction in a
+histogram. */
+class ScopedTimer {
+    public:
+        ScopedTimer(Histogram &h) : histogram(h), start(Metrics::now()) {}
+        ~ScopedTimer() { histogram.record(Metrics::now() - start); }
+
+    private:
+        Histogram &histogram;
+        uint64_t start;
+};
+
+#endif /* __METRICS_H__ */
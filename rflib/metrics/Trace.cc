@@ -0,0 +1,166 @@
+#include "Trace.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "Metrics.h"
+#include "defs.h"
+#include "log/Log.h"
+
+volatile unsigned Trace::sample = TRACE_SAMPLE;
+volatile unsigned Trace::logSample = 0;
+
+static volatile uint64_t nextTrace = 0;
+
+/* Updates seen by Trace::start() in this thread, for sampling. */
+static __thread unsigned starts = 0;
+
+/* The stages of defs.h, each with a histogram of the time to reach it. */
+static const char* const stageNames[] = {
+    TRACE_NETLINK_RECEIVE,
+    TRACE_GATEWAY_RESOLVED,
+    TRACE_IPC_SEND,
+    TRACE_RFSERVER_ROUTE_MOD,
+    TRACE_RFPROXY_PROCESS,
+    TRACE_CREATE_FLOW_MOD,
+    TRACE_SEND_OPENFLOW
+};
+static const size_t N_STAGES = sizeof stageNames / sizeof *stageNames;
+
+static Histogram& stageHistogram(const string &stage) {
+    return Metrics::histogram("rftrace_" + stage + "_seconds",
+        "Time for a route update to reach " + stage
+        + " from the previous stage");
+}
+
+/* The histograms that finishing a trace records to, registered once so that
+ * it needs no lookup by name. */
+struct TraceHistograms {
+    Histogram* stages[N_STAGES];
+    Histogram* total;
+
+    TraceHistograms() {
+        for (size_t i = 0; i < N_STAGES; i++)
+            stages[i] = &stageHistogram(stageNames[i]);
+        total = &Metrics::histogram("rftrace_total_seconds",
+            "Time for a route update to go through all stages");
+    }
+
+    /* Stages that are not in defs.h are looked up by name. */
+    Histogram& stage(const string &name) {
+        for (size_t i = 0; i < N_STAGES; i++)
+            if (name == stageNames[i])
+                return *stages[i];
+        return stageHistogram(name);
+    }
+};
+
+static TraceHistograms& histograms() {
+    static TraceHistograms h;
+    return h;
+}
+
+/* splitmix64 finalizer, never 0 so that the result can be a trace ID. */
+static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x = x ^ (x >> 31);
+    return x != 0 ? x : 1;
+}
+
+/* Trace IDs need to be unique across all clients, so they are made from a
+ * per-process sequence number mixed with a seed taken at first use. */
+static uint64_t newTraceId() {
+    static uint64_t seed = ((uint64_t) Trace::clock() << 16) ^ getpid();
+    return mix(seed + __sync_fetch_and_add(&nextTrace, 1));
+}
+
+void Trace::start(const char *stage) {
+    unsigned n = sample;
+    parent = 0;
+    forked = 0;
+    stages.clear();
+    if (n == 0 || starts++ % n != 0) {
+        id = 0;
+        return;
+    }
+
+    id = newTraceId();
+    stamp(stage);
+}
+
+void Trace::stamp(const char *stage) {
+    if (!active())
+        return;
+
+    TraceStage s;
+    s.name = stage;
+    s.time = clock();
+    stages.push_back(s);
+}
+
+/* The IDs of child traces are derived from their parent's as MongoIPC.py
+ * does, so that a copy forked in either language can be told apart. */
+Trace Trace::fork(unsigned copy) const {
+    if (!active() || copy == 0)
+        return *this;
+
+    Trace child = *this;
+    child.parent = parent != 0 ? parent : id;
+    child.id = mix(id + copy * 0x9e3779b97f4a7c15ULL);
+    child.forked = stages.size();
+    return child;
+}
+
+void Trace::finish() const {
+    if (!active() || stages.empty())
+        return;
+
+    TraceHistograms& h = histograms();
+    for (size_t i = forked > 1 ? forked : 1; i < stages.size(); i++) {
+        int64_t delta = stages[i].time - stages[i - 1].time;
+        h.stage(stages[i].name).record(delta > 0 ? delta : 0);
+    }
+
+    int64_t total = stages.back().time - stages.front().time;
+    if (parent == 0)
+        h.total->record(total > 0 ? total : 0);
+
+    unsigned n = logSample;
+    if (n != 0 && id % n == 0)
+        RFLOG_INFO("route_trace %s total_us=%lld", str().c_str(),
+                   (long long) total);
+}
+
+string Trace::str() const {
+    char buf[64];
+    snprintf(buf, sizeof buf, "id=%016llx", (unsigned long long) id);
+    string out = buf;
+    if (parent != 0) {
+        snprintf(buf, sizeof buf, " parent=%016llx",
+                 (unsigned long long) parent);
+        out += buf;
+    }
+
+    for (size_t i = 0; i < stages.size(); i++) {
+        int64_t delta = i > 0 ? stages[i].time - stages[i - 1].time : 0;
+        snprintf(buf, sizeof buf, "=%lld", (long long) delta);
+        out += " " + stages[i].name + buf;
+    }
+    return out;
+}
+
+void Trace::setSample(unsigned n) {
+    sample = n;
+}
+
+void Trace::setLogSample(unsigned n) {
+    logSample = n;
+}
+
+int64_t Trace::clock() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
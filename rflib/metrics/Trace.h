@@ -0,0 +1,94 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Route updates traced by default: one in every this many
+#define TRACE_SAMPLE 64
+
+/** A stage a traced message went through, and when. */
+struct TraceStage {
+    string name;
+    /** Wall clock time in microseconds since the epoch */
+    int64_t time;
+};
+
+/** The stages a route update went through on its way from the routing
+engine to the switch, with a timestamp for each.
+
+A trace is started where the update enters RouteFlow, stamped at every stage
+after that and carried along with the message in the IPC envelope. The
+process sending the last FlowMod finishes it, recording the time between each
+pair of stages in a histogram named rftrace_<stage>_seconds.
+
+A message sent more than once, such as a route sent for each port traffic
+may come in by, forks its trace: the first copy carries on the trace, and
+each other copy gets a child trace of its own, which is finished with it but
+records only the stages after the fork, so that an update is counted once in
+every histogram.
+
+Only a sample of updates is traced. The others get an inactive trace, which
+is not stamped, carried or recorded.
+
+Stages are stamped by different processes, possibly on different hosts, so
+wall clock time is used and the time between stages stamped on different
+hosts includes their clock skew. */
+class Trace {
+    public:
+        /** Create an empty trace, which is not stamped or carried. */
+        Trace() : id(0), parent(0), forked(0) {}
+
+        /** If this update is among those sampled, give the trace a new ID
+        and stamp its first stage; otherwise leave it inactive.
+        @param stage the name of the first stage */
+        void start(const char *stage);
+
+        /** Record that the traced message reached a stage now. Does nothing
+        if the trace was not started. */
+        void stamp(const char *stage);
+
+        /** Get the trace for a copy of the traced message.
+        @param copy the number of the copy, from 0. Copy 0 gets this trace,
+        and the others child traces whose IDs are derived from it. */
+        Trace fork(unsigned copy) const;
+
+        /** Record the time spent in each stage, and in the whole trace, in
+        histograms, and log the trace if it is sampled. A child trace records
+        only the stages after it was forked. */
+        void finish() const;
+
+        /** Check whether this is a started trace. */
+        bool active() const { return id != 0; }
+
+        /** Get a string representation of the trace, as the ID followed by
+        the time of each stage relative to the previous one. */
+        string str() const;
+
+        /** Trace one in every N route updates started in this process.
+        0 turns tracing off. The default is TRACE_SAMPLE. */
+        static void setSample(unsigned n);
+
+        /** Log one in every N traces finished in this process. 0 turns
+        logging off, which is the default. */
+        static void setLogSample(unsigned n);
+
+        /** Get the wall clock time in microseconds. */
+        static int64_t clock();
+
+        uint64_t id;
+        /** The ID of the trace this one was forked from, or 0. */
+        uint64_t parent;
+        /** How many of the stages were stamped before the fork. */
+        uint32_t forked;
+        vector<TraceStage> stages;
+
+    private:
+        static volatile unsigned sample;
+        static volatile unsigned logSample;
+};
+
+#endif /* __TRACE_H__ */
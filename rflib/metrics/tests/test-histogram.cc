@@ -0,0 +1,61 @@
+/* Tests the buckets of metric histograms: that a value equal to a bucket's
+ * limit counts in that bucket, in particular in the Prometheus bucket of each
+ * power of 2, and that percentiles come from the limit of their bucket. */
+
+#include "Metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+/* Return whether 'out' has the Prometheus bucket 'le' of histogram "h" with
+ * a count of 'count'. */
+static bool hasBucket(const string &out, const char* le, int count) {
+    char line[64];
+    snprintf(line, sizeof line, "h_bucket{le=\"%s\"} %d\n", le, count);
+    return out.find(line) != string::npos;
+}
+
+int main() {
+    Histogram h("h", "Test histogram");
+    h.record(0);
+    h.record(1);
+    h.record(2);
+    h.record(3);
+    h.record(8);
+    h.record(9);
+    h.record(1024);
+    h.record(1025);
+
+    // Each bucket counts the values up to and including its limit
+    string out;
+    h.write(out);
+    MUST_SUCCEED(hasBucket(out, "1e-06", 2));
+    MUST_SUCCEED(hasBucket(out, "2e-06", 3));
+    MUST_SUCCEED(hasBucket(out, "4e-06", 4));
+    MUST_SUCCEED(hasBucket(out, "8e-06", 5));
+    MUST_SUCCEED(hasBucket(out, "1.6e-05", 6));
+    MUST_SUCCEED(hasBucket(out, "0.000512", 6));
+    MUST_SUCCEED(hasBucket(out, "0.001024", 7));
+    MUST_SUCCEED(hasBucket(out, "0.002048", 8));
+    MUST_SUCCEED(hasBucket(out, "+Inf", 8));
+    MUST_SUCCEED(out.find("h_count 8\n") != string::npos);
+
+    // A value at a limit is estimated as that limit, and others as the
+    // limit of their bucket, within 12.5%
+    MUST_SUCCEED(h.count() == 8);
+    MUST_SUCCEED(h.percentile(50) == 3);
+    MUST_SUCCEED(h.percentile(62.5) == 8);
+    MUST_SUCCEED(h.percentile(75) == 9);
+    MUST_SUCCEED(h.percentile(87.5) == 1024);
+    MUST_SUCCEED(h.percentile(100) == 1152);
+
+    Histogram empty("empty", "Empty histogram");
+    MUST_SUCCEED(empty.percentile(50) == 0);
+    return 0;
+}
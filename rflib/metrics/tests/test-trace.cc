@@ -0,0 +1,72 @@
+/* Tests the forking of route update traces: that the first copy of a message
+ * carries on its trace and the others get child traces with IDs of their
+ * own, and that finishing every copy counts the update once in each
+ * histogram, the children only for the stages after the fork. */
+
+#include "Metrics.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+static void stampAt(Trace &trace, const char *stage, int64_t time) {
+    TraceStage s;
+    s.name = stage;
+    s.time = time;
+    trace.stages.push_back(s);
+}
+
+static uint64_t countOf(const char *stage) {
+    return Metrics::histogram(string("rftrace_") + stage + "_seconds",
+                              "").count();
+}
+
+int main() {
+    Trace trace;
+    MUST_SUCCEED(!trace.fork(1).active());
+
+    trace.id = 0x8123456789abcdefULL;
+    stampAt(trace, "test_client", 1000);
+    stampAt(trace, "test_server", 1100);
+
+    // The first copy carries on the trace, and the others get child traces
+    // with IDs of their own
+    Trace first = trace.fork(0);
+    Trace second = trace.fork(1);
+    Trace third = trace.fork(2);
+    MUST_SUCCEED(first.id == trace.id && first.parent == 0);
+    MUST_SUCCEED(second.parent == trace.id && third.parent == trace.id);
+    MUST_SUCCEED(second.id != trace.id && third.id != trace.id);
+    MUST_SUCCEED(second.id != third.id);
+    MUST_SUCCEED(second.forked == 2 && second.stages.size() == 2);
+    MUST_SUCCEED(second.id == trace.fork(1).id);
+
+    // A child of a child keeps the trace of the update as its parent
+    Trace grandchild = second.fork(1);
+    MUST_SUCCEED(grandchild.parent == trace.id);
+    MUST_SUCCEED(grandchild.id != second.id && grandchild.id != third.id);
+
+    // Each copy goes on to the proxy, which finishes its trace
+    stampAt(first, "test_proxy", 1300);
+    stampAt(second, "test_proxy", 1400);
+    stampAt(third, "test_proxy", 1500);
+    uint64_t total = Metrics::histogram("rftrace_total_seconds", "").count();
+    first.finish();
+    second.finish();
+    third.finish();
+    MUST_SUCCEED(countOf("test_server") == 1);
+    MUST_SUCCEED(countOf("test_proxy") == 3);
+    MUST_SUCCEED(Metrics::histogram("rftrace_total_seconds", "").count()
+                 == total + 1);
+
+    MUST_SUCCEED(second.str().find(" parent=8123456789abcdef ")
+                 != string::npos);
+    MUST_SUCCEED(first.str().find("parent") == string::npos);
+    return 0;
+}
@@ -39,6 +39,7 @@ std::string Action::type_to_string() const {
         case RFAT_SET_ETH_SRC:      return "RFAT_SET_ETH_SRC";
         case RFAT_SET_ETH_DST:      return "RFAT_SET_ETH_DST";
         case RFAT_POP_MPLS:         return "RFAT_POP_MPLS";
+        case RFAT_GOTO_TABLE:       return "RFAT_GOTO_TABLE";
         case RFAT_DROP:             return "RFAT_DROP";
         case RFAT_SFLOW:            return "RFAT_SFLOW";
         default:                    return "UNKNOWN_ACTION";
@@ -50,6 +51,7 @@ size_t Action::type_to_length(uint8_t type) {
         case RFAT_OUTPUT:
         case RFAT_PUSH_MPLS:
         case RFAT_SWAP_MPLS:
+        case RFAT_GOTO_TABLE:
             return sizeof(uint32_t);
         case RFAT_SET_ETH_SRC:
         case RFAT_SET_ETH_DST:
@@ -9,6 +9,7 @@ RFAT_SET_ETH_DST = 3    # Ethernet destination address
 RFAT_PUSH_MPLS = 4      # Push MPLS label
 RFAT_POP_MPLS = 5       # Pop MPLS label
 RFAT_SWAP_MPLS = 6      # Swap MPLS label
+RFAT_GOTO_TABLE = 7     # Continue processing in a flow table
 # MSB = 1; Indicates optional feature.
 RFAT_DROP = 254         # Drop packet (Unimplemented)
 RFAT_SFLOW = 255        # Generate SFlow messages (Unimplemented)
@@ -19,7 +20,8 @@ typeStrings = {
             RFAT_SET_ETH_DST : "RFAT_SET_ETH_DST",
             RFAT_PUSH_MPLS : "RFAT_PUSH_MPLS",
             RFAT_POP_MPLS : "RFAT_POP_MPLS",
-            RFAT_SWAP_MPLS : "RFAT_SWAP_MPLS"
+            RFAT_SWAP_MPLS : "RFAT_SWAP_MPLS",
+            RFAT_GOTO_TABLE : "RFAT_GOTO_TABLE"
         }
 
 class Action(TLV):
@@ -53,6 +55,10 @@ class Action(TLV):
     def SWAP_MPLS(cls, label):
         return cls(RFAT_SWAP_MPLS, label)
 
+    @classmethod
+    def GOTO_TABLE(cls, table):
+        return cls(RFAT_GOTO_TABLE, table)
+
     @classmethod
     def DROP(cls):
         return cls(RFAT_DROP, None)
@@ -74,7 +80,8 @@ class Action(TLV):
 
     @staticmethod
     def type_to_bin(actionType, value):
-        if actionType in (RFAT_OUTPUT, RFAT_PUSH_MPLS, RFAT_SWAP_MPLS):
+        if actionType in (RFAT_OUTPUT, RFAT_PUSH_MPLS, RFAT_SWAP_MPLS,
+                          RFAT_GOTO_TABLE):
             return int_to_bin(value, 32)
         elif actionType in (RFAT_SET_ETH_SRC, RFAT_SET_ETH_DST):
             return ether_to_bin(value)
@@ -91,7 +98,8 @@ class Action(TLV):
             return str(actionType)
 
     def get_value(self):
-        if self._type in (RFAT_OUTPUT, RFAT_PUSH_MPLS, RFAT_SWAP_MPLS):
+        if self._type in (RFAT_OUTPUT, RFAT_PUSH_MPLS, RFAT_SWAP_MPLS,
+                          RFAT_GOTO_TABLE):
             return bin_to_int(self._value)
         elif self._type in (RFAT_SET_ETH_SRC, RFAT_SET_ETH_DST):
             return bin_to_ether(self._value)
@@ -38,6 +38,7 @@ std::string Option::type_to_string() const {
         case RFOT_PRIORITY:         return "RFOT_PRIORITY";
         case RFOT_IDLE_TIMEOUT:     return "RFOT_IDLE_TIMEOUT";
         case RFOT_HARD_TIMEOUT:     return "RFOT_HARD_TIMEOUT";
+        case RFOT_TABLE:            return "RFOT_TABLE";
         case RFOT_CT_ID:            return "RFOT_CT_ID";
         default:                    return "UNKNOWN_OPTION";
     }
@@ -48,6 +49,7 @@ size_t Option::type_to_length(uint8_t type) {
         case RFOT_PRIORITY:
         case RFOT_IDLE_TIMEOUT:
         case RFOT_HARD_TIMEOUT:
+        case RFOT_TABLE:
             return sizeof(uint16_t);
         case RFOT_CT_ID:
             return sizeof(uint64_t);
@@ -9,6 +9,7 @@ enum OptionType {
     RFOT_PRIORITY = 1,      /* Route priority */
     RFOT_IDLE_TIMEOUT = 2,  /* Drop route after specified idle time */
     RFOT_HARD_TIMEOUT = 3,  /* Drop route after specified time has passed */
+    RFOT_TABLE = 4,         /* Flow table to install the route in */
     /* MSB = 1; Indicates optional feature. */
     RFOT_CT_ID = 255,       /* Specify destination controller */
 };
@@ -4,6 +4,7 @@ from bson.binary import Binary
 RFOT_PRIORITY = 1     # Route priority
 RFOT_IDLE_TIMEOUT = 2 # Drop route after specified idle time
 RFOT_HARD_TIMEOUT = 3 # Drop route after specified time has passed
+RFOT_TABLE = 4        # Flow table to install the route in
 # MSB = 1; Indicates optional feature.
 RFOT_CT_ID = 255      # Specify destination controller
 
@@ -11,6 +12,7 @@ typeStrings = {
             RFOT_PRIORITY : "RFOT_PRIORITY",
             RFOT_IDLE_TIMEOUT : "RFOT_IDLE_TIMEOUT",
             RFOT_HARD_TIMEOUT : "RFOT_HARD_TIMEOUT",
+            RFOT_TABLE : "RFOT_TABLE",
             RFOT_CT_ID : "RFOT_CT_ID"
         }
 
@@ -33,6 +35,10 @@ class Option(TLV):
     def HARD_TIMEOUT(cls, timeout):
         return cls(RFOT_HARD_TIMEOUT, timeout)
 
+    @classmethod
+    def TABLE(cls, table):
+        return cls(RFOT_TABLE, table)
+
     @classmethod
     def CT_ID(cls, controller):
         return cls(RFOT_CT_ID, controller)
@@ -46,7 +52,8 @@ class Option(TLV):
 
     @staticmethod
     def type_to_bin(optionType, value):
-        if optionType in (RFOT_PRIORITY, RFOT_IDLE_TIMEOUT, RFOT_HARD_TIMEOUT):
+        if optionType in (RFOT_PRIORITY, RFOT_IDLE_TIMEOUT, RFOT_HARD_TIMEOUT,
+                          RFOT_TABLE):
             return int_to_bin(value, 16)
         elif optionType == RFOT_CT_ID:
             return int_to_bin(value, 64)
@@ -62,7 +69,7 @@ class Option(TLV):
 
     def get_value(self):
         if self._type in (RFOT_PRIORITY, RFOT_IDLE_TIMEOUT, RFOT_HARD_TIMEOUT,
-                          RFOT_CT_ID):
+                          RFOT_TABLE, RFOT_CT_ID):
             return bin_to_int(self._value)
         else:
             return None
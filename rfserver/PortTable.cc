@@ -0,0 +1,225 @@
+#include "PortTable.hh"
+
+#include "converter.h"
+#include "defs.h"
+
+/* rfserver stores every field as a string, empty when unset. */
+static bool getField(const mongo::BSONObj &obj, const char *name,
+                     uint64_t &value) {
+    string s = obj.getStringField(name);
+    if (s.empty())
+        return false;
+    value = string_to<uint64_t>(s);
+    return true;
+}
+
+static bool getField(const mongo::BSONObj &obj, const char *name,
+                     uint32_t &value) {
+    uint64_t v;
+    if (!getField(obj, name, v))
+        return false;
+    value = (uint32_t) v;
+    return true;
+}
+
+size_t PortTable::load(mongo::DBClientConnection &connection,
+                       const string &db) {
+    ports.clear();
+    portsByVmPort.clear();
+    portsByDatapath.clear();
+    links.clear();
+    linksByDatapath.clear();
+    linksByRemote.clear();
+
+    size_t n = 0;
+    auto_ptr<mongo::DBClientCursor> cur = connection.query(
+        db + "." + RFTABLE_NAME, mongo::BSONObj());
+    while (cur->more()) {
+        mongo::BSONObj obj = cur->nextSafe();
+        PortEntry e;
+        bool vm = getField(obj, "vm_id", e.vm_id)
+                  & getField(obj, "vm_port", e.vm_port);
+        bool dp = getField(obj, "ct_id", e.ct_id)
+                  & getField(obj, "dp_id", e.dp_id)
+                  & getField(obj, "dp_port", e.dp_port);
+        uint64_t vs_id;
+        bool vs = getField(obj, "vs_id", vs_id);
+        e.eth_addr = obj.getStringField("eth_addr");
+
+        // Follows RFEntry.get_status()
+        if (vm && !dp && !vs)
+            e.status = RFENTRY_IDLE_VM_PORT;
+        else if (!vm && dp && !vs)
+            e.status = RFENTRY_IDLE_DP_PORT;
+        else if (!vs)
+            e.status = RFENTRY_ASSOCIATED;
+        else
+            e.status = RFENTRY_ACTIVE;
+
+        setPort(obj["_id"].OID().str(), e);
+        n++;
+    }
+
+    cur = connection.query(db + "." + RFISL_NAME, mongo::BSONObj());
+    while (cur->more()) {
+        mongo::BSONObj obj = cur->nextSafe();
+        LinkEntry e;
+        bool local = getField(obj, "ct_id", e.ct_id)
+                     & getField(obj, "dp_id", e.dp_id)
+                     & getField(obj, "dp_port", e.dp_port);
+        bool remote = getField(obj, "rem_ct", e.rem_ct)
+                      & getField(obj, "rem_id", e.rem_id)
+                      & getField(obj, "rem_port", e.rem_port);
+        e.eth_addr = obj.getStringField("eth_addr");
+        e.rem_eth_addr = obj.getStringField("rem_eth_addr");
+
+        // Follows RFISLEntry.get_status()
+        if (local && !remote)
+            e.status = RFISL_IDLE_DP_PORT;
+        else if (!local && remote)
+            e.status = RFISL_IDLE_REMOTE;
+        else
+            e.status = RFISL_ACTIVE;
+
+        setLink(obj["_id"].OID().str(), e);
+        n++;
+    }
+    return n;
+}
+
+void PortTable::setPort(const string &id, const PortEntry &entry) {
+    removePort(id);
+    ports[id] = entry;
+    if (entry.status != RFENTRY_IDLE_DP_PORT)
+        portsByVmPort[PortKey(entry.vm_id, entry.vm_port)].insert(id);
+    if (entry.status != RFENTRY_IDLE_VM_PORT)
+        portsByDatapath[DatapathKey(entry.ct_id, entry.dp_id)].insert(id);
+}
+
+void PortTable::removePort(const string &id) {
+    map<string, PortEntry>::iterator it = ports.find(id);
+    if (it == ports.end())
+        return;
+
+    const PortEntry &e = it->second;
+    PortKey key(e.vm_id, e.vm_port);
+    map<PortKey, set<string> >::iterator vp = portsByVmPort.find(key);
+    if (vp != portsByVmPort.end()) {
+        vp->second.erase(id);
+        if (vp->second.empty())
+            portsByVmPort.erase(vp);
+    }
+    unindex(portsByDatapath, DatapathKey(e.ct_id, e.dp_id), id);
+    ports.erase(it);
+}
+
+void PortTable::setLink(const string &id, const LinkEntry &entry) {
+    removeLink(id);
+    links[id] = entry;
+    if (entry.status != RFISL_IDLE_REMOTE)
+        linksByDatapath[DatapathKey(entry.ct_id, entry.dp_id)].insert(id);
+    if (entry.status != RFISL_IDLE_DP_PORT)
+        linksByRemote[DatapathKey(entry.rem_ct, entry.rem_id)].insert(id);
+}
+
+void PortTable::removeLink(const string &id) {
+    map<string, LinkEntry>::iterator it = links.find(id);
+    if (it == links.end())
+        return;
+
+    const LinkEntry &e = it->second;
+    unindex(linksByDatapath, DatapathKey(e.ct_id, e.dp_id), id);
+    unindex(linksByRemote, DatapathKey(e.rem_ct, e.rem_id), id);
+    links.erase(it);
+}
+
+const PortEntry* PortTable::findVmPort(uint64_t vm_id,
+                                       uint32_t vm_port) const {
+    map<PortKey, set<string> >::const_iterator it =
+        portsByVmPort.find(PortKey(vm_id, vm_port));
+    if (it == portsByVmPort.end())
+        return NULL;
+    return &ports.find(*it->second.begin())->second;
+}
+
+void PortTable::getIngress(uint64_t ct_id, uint64_t dp_id, bool withLinks,
+                           vector<Ingress> &ingress) const {
+    DatapathKey key(ct_id, dp_id);
+    DatapathIndex::const_iterator it = portsByDatapath.find(key);
+    if (it != portsByDatapath.end()) {
+        set<string>::const_iterator id;
+        for (id = it->second.begin(); id != it->second.end(); id++) {
+            const PortEntry &e = ports.find(*id)->second;
+            if (e.status != RFENTRY_ACTIVE)
+                continue;
+            Ingress in = {e.ct_id, e.dp_port, e.eth_addr};
+            ingress.push_back(in);
+        }
+    }
+
+    if (!withLinks)
+        return;
+
+    it = linksByDatapath.find(key);
+    if (it != linksByDatapath.end()) {
+        set<string>::const_iterator id;
+        for (id = it->second.begin(); id != it->second.end(); id++) {
+            const LinkEntry &e = links.find(*id)->second;
+            if (e.status != RFISL_ACTIVE)
+                continue;
+            Ingress in = {e.ct_id, e.dp_port, e.eth_addr};
+            ingress.push_back(in);
+        }
+    }
+}
+
+void PortTable::getRemoteLinks(uint64_t ct_id, uint64_t dp_id,
+                               vector<const LinkEntry*> &result) const {
+    DatapathIndex::const_iterator it =
+        linksByRemote.find(DatapathKey(ct_id, dp_id));
+    if (it == linksByRemote.end())
+        return;
+
+    set<string>::const_iterator id;
+    for (id = it->second.begin(); id != it->second.end(); id++) {
+        const LinkEntry &e = links.find(*id)->second;
+        if (e.status == RFISL_ACTIVE)
+            result.push_back(&e);
+    }
+}
+
+void PortTable::getVms(uint64_t ct_id, set<uint64_t> &vm_ids) const {
+    set<DatapathKey> datapaths;
+    DatapathIndex::const_iterator d;
+    for (d = portsByDatapath.lower_bound(DatapathKey(ct_id, 0));
+         d != portsByDatapath.end() && d->first.first == ct_id; d++)
+        datapaths.insert(d->first);
+    map<string, LinkEntry>::const_iterator l;
+    for (l = links.begin(); l != links.end(); l++)
+        if (l->second.ct_id == ct_id && l->second.status == RFISL_ACTIVE)
+            datapaths.insert(DatapathKey(l->second.rem_ct, l->second.rem_id));
+
+    set<DatapathKey>::const_iterator dp;
+    for (dp = datapaths.begin(); dp != datapaths.end(); dp++) {
+        DatapathIndex::const_iterator it = portsByDatapath.find(*dp);
+        if (it == portsByDatapath.end())
+            continue;
+
+        set<string>::const_iterator id;
+        for (id = it->second.begin(); id != it->second.end(); id++) {
+            const PortEntry &e = ports.find(*id)->second;
+            if (e.status == RFENTRY_ASSOCIATED || e.status == RFENTRY_ACTIVE)
+                vm_ids.insert(e.vm_id);
+        }
+    }
+}
+
+void PortTable::unindex(DatapathIndex &index, const DatapathKey &key,
+                        const string &id) {
+    DatapathIndex::iterator it = index.find(key);
+    if (it == index.end())
+        return;
+    it->second.erase(id);
+    if (it->second.empty())
+        index.erase(it);
+}
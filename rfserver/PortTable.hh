@@ -0,0 +1,102 @@
+#ifndef PORTTABLE_HH
+#define PORTTABLE_HH
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <mongo/client/dbclient.h>
+
+using namespace std;
+
+/* Entry states, as in rftable.py */
+#define RFENTRY_IDLE_VM_PORT 1
+#define RFENTRY_IDLE_DP_PORT 2
+#define RFENTRY_ASSOCIATED 3
+#define RFENTRY_ACTIVE 4
+#define RFISL_IDLE_DP_PORT 5
+#define RFISL_IDLE_REMOTE 6
+#define RFISL_ACTIVE 7
+
+/** An RFTable entry, associating a VM port with a datapath port. */
+struct PortEntry {
+    uint64_t vm_id;
+    uint32_t vm_port;
+    uint64_t ct_id;
+    uint64_t dp_id;
+    uint32_t dp_port;
+    string eth_addr;
+    int status;
+};
+
+/** An ISL table entry, joining ports of two datapaths. */
+struct LinkEntry {
+    uint64_t ct_id;
+    uint64_t dp_id;
+    uint32_t dp_port;
+    string eth_addr;
+    uint64_t rem_ct;
+    uint64_t rem_id;
+    uint32_t rem_port;
+    string rem_eth_addr;
+    int status;
+};
+
+/** A port traffic for a route may come in through. */
+struct Ingress {
+    uint64_t ct_id;
+    uint32_t dp_port;
+    string eth_addr;
+};
+
+/** A copy of the RFTable and ISL table of rfserver, indexed for the lookups
+made to translate RouteMods.
+
+Entries are keyed by their MongoDB IDs. The table is loaded from MongoDB and
+then kept up to date by the updates rfserver sends on every change. */
+class PortTable {
+    public:
+        /** Load the tables from MongoDB, replacing the current contents.
+        @return the number of entries loaded */
+        size_t load(mongo::DBClientConnection &connection, const string &db);
+
+        void setPort(const string &id, const PortEntry &entry);
+        void removePort(const string &id);
+        void setLink(const string &id, const LinkEntry &entry);
+        void removeLink(const string &id);
+
+        /** Find the entry of a VM port, or NULL if there is none. */
+        const PortEntry* findVmPort(uint64_t vm_id, uint32_t vm_port) const;
+
+        /** Get the active ports of a datapath.
+        @param links whether to include active ISL ports */
+        void getIngress(uint64_t ct_id, uint64_t dp_id, bool links,
+                        vector<Ingress> &ingress) const;
+
+        /** Get the active ISLs whose remote end is on a datapath. */
+        void getRemoteLinks(uint64_t ct_id, uint64_t dp_id,
+                            vector<const LinkEntry*> &links) const;
+
+        /** Get the VMs whose routes go to the datapaths of a controller,
+        through their own ports or over ISLs. */
+        void getVms(uint64_t ct_id, set<uint64_t> &vm_ids) const;
+
+    private:
+        typedef pair<uint64_t, uint32_t> PortKey;
+        typedef pair<uint64_t, uint64_t> DatapathKey;
+        typedef map<DatapathKey, set<string> > DatapathIndex;
+
+        map<string, PortEntry> ports;
+        map<PortKey, set<string> > portsByVmPort;
+        DatapathIndex portsByDatapath;
+
+        map<string, LinkEntry> links;
+        DatapathIndex linksByDatapath;
+        DatapathIndex linksByRemote;
+
+        static void unindex(DatapathIndex &index, const DatapathKey &key,
+                            const string &id);
+};
+
+#endif /* PORTTABLE_HH */
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "RFServerCore.hh"
+#include "converter.h"
+#include "defs.h"
+#include "log/Log.h"
+#include "metrics/Metrics.h"
+
+using namespace std;
+
+static Counter& routeModsIn = Metrics::counter(
+    "rfserver_route_mods_received_total", "RouteMods received from RFClients");
+static Counter& routeModsDropped = Metrics::counter(
+    "rfserver_route_mods_dropped_total",
+    "RouteMods dropped for lack of a datapath or output port");
+static Counter& routeModsOut = Metrics::counter(
+    "rfserver_route_mods_sent_total", "RouteMods sent to RFProxies");
+static Histogram& routeModTime = Metrics::histogram(
+    "rfserver_route_mod_seconds", "Time to translate and send a RouteMod");
+
+RFServerCore::RFServerCore(const string &address, bool pipeline)
+    : pipeline(pipeline) {
+    mongo::DBClientConnection connection;
+    try {
+        connection.connect(address);
+        size_t n = table.load(connection, MONGO_DB_NAME);
+        RFLOG_INFO("Loaded RFTable and ISL table (entries=%zu)", n);
+    }
+    catch (mongo::DBException &e) {
+        RFLOG_ERR("Failed to load tables: %s", e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    ipc = createIPCMessageService(defaultIPCAddress(address), MONGO_DB_NAME,
+                                  RFSERVER_ID);
+    ipc->set_resync_handler(this);
+    ipc->listen(RFCLIENT_RFSERVER_CHANNEL, this, this, true);
+}
+
+RFServerCore::RFServerCore(IPCMessageService *ipc, const PortTable &table,
+                           bool pipeline)
+    : ipc(ipc), table(table), pipeline(pipeline) {
+}
+
+bool RFServerCore::process(const string &, const string &, const string &,
+                           IPCMessage& msg) {
+    int type = msg.get_type();
+    if (type == ROUTE_MOD) {
+        ScopedTimer timer(routeModTime);
+        routeModsIn.inc();
+        routeMod(static_cast<RouteMod&>(msg));
+    }
+    else if (type == PORT_ENTRY_UPDATE) {
+        PortEntryUpdate &u = static_cast<PortEntryUpdate&>(msg);
+        if (u.get_removed()) {
+            table.removePort(u.get_entry_id());
+        } else {
+            PortEntry e;
+            e.vm_id = u.get_vm_id();
+            e.vm_port = u.get_vm_port();
+            e.ct_id = u.get_ct_id();
+            e.dp_id = u.get_dp_id();
+            e.dp_port = u.get_dp_port();
+            e.eth_addr = u.get_eth_addr();
+            e.status = u.get_status();
+            table.setPort(u.get_entry_id(), e);
+        }
+    }
+    else if (type == LINK_ENTRY_UPDATE) {
+        LinkEntryUpdate &u = static_cast<LinkEntryUpdate&>(msg);
+        if (u.get_removed()) {
+            table.removeLink(u.get_entry_id());
+        } else {
+            LinkEntry e;
+            e.ct_id = u.get_ct_id();
+            e.dp_id = u.get_dp_id();
+            e.dp_port = u.get_dp_port();
+            e.eth_addr = u.get_eth_addr();
+            e.rem_ct = u.get_rem_ct();
+            e.rem_id = u.get_rem_id();
+            e.rem_port = u.get_rem_port();
+            e.rem_eth_addr = u.get_rem_eth_addr();
+            e.status = u.get_status();
+            table.setLink(u.get_entry_id(), e);
+        }
+    }
+    else {
+        // Everything else is for rfserver.py
+        ipc->send(RFCLIENT_RFSERVER_CHANNEL, RFSERVER_CONTROL_ID, msg);
+    }
+    return true;
+}
+
+// The RouteMods an RFProxy lost came from RFClients, which can send their
+// routes again. Other messages pass through and cannot be made good here.
+void RFServerCore::resync(const string &channelId, const string &to) {
+    if (channelId != RFSERVER_RFPROXY_CHANNEL) {
+        RFLOG_WARN("Cannot resync messages passed on (channel=%s, to=%s)",
+                   channelId.c_str(), to.c_str());
+        return;
+    }
+
+    set<uint64_t> vm_ids;
+    table.getVms(string_to<uint64_t>(to), vm_ids);
+    set<uint64_t>::const_iterator it;
+    for (it = vm_ids.begin(); it != vm_ids.end(); it++)
+        ipc->request_resync(RFCLIENT_RFSERVER_CHANNEL, to_string<uint64_t>(*it));
+    RFLOG_INFO("Asked clients to resync routes (ct_id=%s, clients=%zu)",
+               to.c_str(), vm_ids.size());
+}
+
+// Follows RFServer.register_route_mod in rfserver.py: replaces the VM id and
+// port of the RouteMod with those of the associated datapath and sends it to
+// the datapath, and to the far end of any ISLs to it
+void RFServerCore::routeMod(RouteMod &rm) {
+    rm.trace.stamp(TRACE_RFSERVER_ROUTE_MOD);
+    uint64_t vm_id = rm.get_id();
+
+    // Each copy sent on gets a trace of its own, forked from this one
+    Trace trace = rm.trace;
+    unsigned copies = 0;
+
+    vector<Action> actions = rm.get_actions();
+    for (size_t i = 0; i < actions.size(); i++) {
+        if (actions[i].getType() != RFAT_OUTPUT)
+            continue;
+
+        uint32_t vm_port = actions[i].getUint32();
+        const PortEntry *entry = table.findVmPort(vm_id, vm_port);
+        if (entry == NULL || entry->status == RFENTRY_IDLE_VM_PORT) {
+            RFLOG_INFO("Received RouteMod destined for unknown datapath - "
+                       "Dropping (vm_id=%#llx)", (unsigned long long) vm_id);
+            routeModsDropped.inc();
+            return;
+        }
+
+        rm.set_id(entry->dp_id);
+        if (rm.get_mod() == RMT_DELETE) {
+            // When deleting a route, we don't need an output action
+            actions.erase(actions.begin() + i);
+        } else {
+            actions[i] = Action(RFAT_OUTPUT, entry->dp_port);
+        }
+        rm.set_actions(actions);
+
+        vector<Option> options = rm.get_options();
+        rm.add_option(Option(RFOT_CT_ID, entry->ct_id));
+
+        if (pipeline) {
+            sendToRouteTable(rm, entry->ct_id, trace, copies);
+        } else {
+            vector<Ingress> ingress;
+            table.getIngress(entry->ct_id, entry->dp_id, true, ingress);
+            sendWithMatches(rm, entry->dp_port, ingress, trace, copies);
+        }
+
+        vector<const LinkEntry*> remote;
+        table.getRemoteLinks(entry->ct_id, entry->dp_id, remote);
+        for (size_t j = 0; j < remote.size(); j++) {
+            const LinkEntry *r = remote[j];
+            vector<Option> remoteOptions = options;
+            remoteOptions.push_back(Option(RFOT_CT_ID, r->ct_id));
+            rm.set_options(remoteOptions);
+            rm.set_id(r->dp_id);
+
+            vector<Action> remoteActions;
+            remoteActions.push_back(Action(RFAT_SET_ETH_SRC,
+                                           MACAddress(r->eth_addr)));
+            remoteActions.push_back(Action(RFAT_SET_ETH_DST,
+                                           MACAddress(r->rem_eth_addr)));
+            remoteActions.push_back(Action(RFAT_OUTPUT, r->dp_port));
+            rm.set_actions(remoteActions);
+
+            if (pipeline) {
+                sendToRouteTable(rm, r->ct_id, trace, copies);
+                continue;
+            }
+            vector<Ingress> ingress;
+            table.getIngress(r->ct_id, r->dp_id, false, ingress);
+            sendWithMatches(rm, r->dp_port, ingress, trace, copies);
+        }
+        return;
+    }
+
+    // If no output action is found, don't forward the RouteMod
+    RFLOG_INFO("Received RouteMod with no Output Port - Dropping "
+               "(vm_id=%#llx)", (unsigned long long) vm_id);
+    routeModsDropped.inc();
+}
+
+// Sends a copy of the RouteMod for every port traffic may come in through,
+// other than the one it goes out of
+void RFServerCore::sendWithMatches(RouteMod &rm, uint32_t out_port,
+                                   const vector<Ingress> &ingress,
+                                   const Trace &trace, unsigned &copies) {
+    vector<Match> matches = rm.get_matches();
+    for (size_t i = 0; i < ingress.size(); i++) {
+        if (ingress[i].dp_port == out_port)
+            continue;
+
+        vector<Match> m = matches;
+        m.push_back(Match(RFMT_ETHERNET, MACAddress(ingress[i].eth_addr)));
+        m.push_back(Match(RFMT_IN_PORT, ingress[i].dp_port));
+        rm.set_matches(m);
+        sendCopy(rm, ingress[i].ct_id, trace, copies);
+    }
+    rm.set_matches(matches);
+}
+
+// Sends the RouteMod once, for the route table. The ingress rules rfserver.py
+// installs in the first table check the port and address traffic comes in by
+void RFServerCore::sendToRouteTable(RouteMod &rm, uint64_t ct_id,
+                                    const Trace &trace, unsigned &copies) {
+    vector<Option> options = rm.get_options();
+    rm.add_option(Option(RFOT_TABLE, (uint16_t) RF_ROUTE_TABLE));
+    sendCopy(rm, ct_id, trace, copies);
+    rm.set_options(options);
+}
+
+// Sends one copy of a RouteMod, with the next trace forked from 'trace', so
+// that the RFProxies finish the update's trace once and a child trace for
+// every other copy
+void RFServerCore::sendCopy(RouteMod &rm, uint64_t ct_id, const Trace &trace,
+                            unsigned &copies) {
+    rm.trace = trace.fork(copies++);
+    ipc->send(RFSERVER_RFPROXY_CHANNEL, to_string<uint64_t>(ct_id), rm);
+    routeModsOut.inc();
+}
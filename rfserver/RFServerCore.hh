@@ -0,0 +1,63 @@
+#ifndef RFSERVERCORE_HH
+#define RFSERVERCORE_HH
+
+#include <stdint.h>
+#include <vector>
+
+#include "ipc/IPC.h"
+#include "ipc/IPCService.h"
+#include "ipc/RFProtocol.h"
+#include "ipc/RFProtocolFactory.h"
+#include "PortTable.hh"
+
+/** Translates RouteMods from RFClients into RouteMods for datapaths, in
+place of rfserver.py, which is left to configuration and control.
+
+RFServerCore takes the place of rfserver on the RFClient channel. It handles
+RouteMods itself and passes every other message on to rfserver.py, which
+listens as RFSERVER_CONTROL_ID and sends back a PortEntryUpdate or
+LinkEntryUpdate for each change to its tables. Both kinds of message are
+handled by the same thread, but not in the order they were sent: updates
+are control messages and RouteMods bulk ones, and every pending control
+message is handled first. An update can thus overtake RouteMods sent before
+it, which are then translated with the newer table. One whose port has gone
+is dropped, and one whose port moved goes to where the port is now.
+
+When RouteMods to an RFProxy are lost for good, the RFClients whose routes it
+was sent are asked to send them all again. */
+class RFServerCore : private RFProtocolFactory, private IPCMessageProcessor,
+                     private IPCResyncHandler {
+    public:
+        /**
+        @param address the address of the MongoDB server with the tables, and
+        of the IPC too unless IPC_ADDRESS_ENV is set
+        @param pipeline whether to send each route once per datapath, for
+        the route table, instead of once per ingress port. rfserver.py must
+        be in pipeline mode as well, to install the ingress rules. */
+        RFServerCore(const string &address, bool pipeline);
+
+        /** Set up with a table and an IPC service given by the caller, which
+        is left to deliver the messages. Used by the tests. */
+        RFServerCore(IPCMessageService *ipc, const PortTable &table,
+                     bool pipeline);
+
+        bool process(const string &from, const string &to,
+                     const string &channel, IPCMessage& msg);
+        void resync(const string &channelId, const string &to);
+
+    private:
+        IPCMessageService* ipc;
+        PortTable table;
+        bool pipeline;
+
+        void routeMod(RouteMod &rm);
+        void sendWithMatches(RouteMod &rm, uint32_t out_port,
+                             const vector<Ingress> &ingress,
+                             const Trace &trace, unsigned &copies);
+        void sendToRouteTable(RouteMod &rm, uint64_t ct_id,
+                              const Trace &trace, unsigned &copies);
+        void sendCopy(RouteMod &rm, uint64_t ct_id, const Trace &trace,
+                      unsigned &copies);
+};
+
+#endif /* RFSERVERCORE_HH */
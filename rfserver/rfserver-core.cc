@@ -0,0 +1,55 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cctype>
+
+#include "RFServerCore.hh"
+#include "defs.h"
+#include "log/Log.h"
+#include "metrics/Metrics.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    char c;
+    string address = MONGO_ADDRESS;
+    LogLevel level = RFLL_INFO;
+    string metrics;
+    bool pipeline = false;
+
+    while ((c = getopt(argc, argv, "a:m:pv")) != -1)
+        switch (c) {
+            case 'a':
+                address = optarg;
+                break;
+            case 'm':
+                metrics = optarg;
+                break;
+            case 'p':
+                pipeline = true;
+                break;
+            case 'v':
+                level = RFLL_DEBUG;
+                break;
+            case '?':
+                if (optopt == 'a' || optopt == 'm')
+                    fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+                else if (isprint(optopt))
+                    fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+                else
+                    fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+                return EXIT_FAILURE;
+            default:
+                abort();
+        }
+
+    Log::init("rfserver-core", level, false);
+    if (!metrics.empty() && !Metrics::serve(metrics))
+        RFLOG_ERR("metrics_serve_failed address=%s error=\"%s\"",
+                  metrics.c_str(), strerror(errno));
+    RFServerCore s(address, pipeline);
+
+    return 0;
+}
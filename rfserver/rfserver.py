@@ -4,6 +4,7 @@
 import sys
 import logging
 import binascii
+import itertools
 import threading
 import time
 import argparse
@@ -12,6 +13,7 @@ from bson.binary import Binary
 
 import rflib.ipc.IPC as IPC
 import rflib.ipc.MongoIPC as MongoIPC
+import rflib.ipc.IPCService as IPCService
 from rflib.ipc.RFProtocol import *
 from rflib.ipc.RFProtocolFactory import RFProtocolFactory
 from rflib.defs import *
@@ -26,13 +28,18 @@ REGISTER_IDLE = 0
 REGISTER_ASSOCIATED = 1
 REGISTER_ISL = 2
 
-class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
-    def __init__(self, configfile, islconffile):
+class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor,
+               IPC.IPCResyncHandler):
+    def __init__(self, configfile, islconffile, core=False, pipeline=False):
         self.rftable = RFTable()
         self.isltable = RFISLTable()
         self.config = RFConfig(configfile)
         self.islconf = RFISLConf(islconffile)
         self.configured_rfvs = []
+        self.core = core
+        self.pipeline = pipeline
+        # Ingress rules installed in pipeline mode, by entry id
+        self.ingress_rules = {}
         # Logging
         self.log = logging.getLogger("rfserver")
         self.log.setLevel(logging.INFO)
@@ -41,12 +48,29 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
         ch.setFormatter(logging.Formatter(logging.BASIC_FORMAT))
         self.log.addHandler(ch)
 
-        self.ipc = MongoIPC.MongoIPCMessageService(MONGO_ADDRESS,
-                                                   MONGO_DB_NAME,
-                                                   RFSERVER_ID,
-                                                   threading.Thread,
-                                                   time.sleep)
-        self.ipc.listen(RFCLIENT_RFSERVER_CHANNEL, self, self, False)
+        address = IPCService.default_ipc_address()
+        self.ipc = IPCService.create_ipc_message_service(address,
+                                                         MONGO_DB_NAME,
+                                                         RFSERVER_ID,
+                                                         threading.Thread,
+                                                         time.sleep)
+        self.ipc.set_resync_handler(self)
+        if core:
+            # rfserver-core handles RouteMods, passes the other messages
+            # from clients on to us and needs to know of table changes
+            self.rftable.add_listener(self.update_core_port)
+            self.isltable.add_listener(self.update_core_link)
+            self.control_ipc = IPCService.create_ipc_message_service(
+                address, MONGO_DB_NAME, RFSERVER_CONTROL_ID,
+                threading.Thread, time.sleep)
+            self.control_ipc.listen(RFCLIENT_RFSERVER_CHANNEL, self, self,
+                                    False)
+        else:
+            self.ipc.listen(RFCLIENT_RFSERVER_CHANNEL, self, self, False)
+        if pipeline:
+            # Keep the ingress table in step with the active ports
+            self.rftable.add_listener(self.update_ingress_rule)
+            self.isltable.add_listener(self.update_ingress_rule)
         self.ipc.listen(RFSERVER_RFPROXY_CHANNEL, self, self, True)
 
     def process(self, from_, to, channel, msg):
@@ -69,6 +93,45 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
             return False
         return True
 
+    def resync(self, channel, to):
+        if channel == RFCLIENT_RFSERVER_CHANNEL and to == RFSERVER_ID:
+            # rfserver-core lost table updates
+            for entry in self.rftable.get_entries():
+                self.update_core_port(entry, False)
+            for entry in self.isltable.get_entries():
+                self.update_core_link(entry, False)
+            return
+        if channel == RFCLIENT_RFSERVER_CHANNEL:
+            # A client lost port configuration messages
+            for entry in self.rftable.get_entries(vm_id=to):
+                if entry.get_status() in (RFENTRY_ASSOCIATED, RFENTRY_ACTIVE):
+                    self.config_vm_port(entry.vm_id, entry.vm_port)
+            return
+
+        # An RFProxy lost RouteMods. Ingress rules are ours to send again;
+        # routes come from the clients, which are asked to send them again.
+        for rule in self.ingress_rules.values():
+            if str(rule[0]) == to:
+                self._send_ingress_rule(RMT_ADD, *rule)
+        if self.core:
+            # rfserver-core sends the routes and resyncs them itself
+            return
+
+        datapaths = set((e.ct_id, e.dp_id)
+                        for e in self.rftable.get_entries(ct_id=to))
+        datapaths.update((e.rem_ct, e.rem_id)
+                         for e in self.isltable.get_entries(ct_id=to)
+                         if e.get_status() == RFISL_ACTIVE)
+        vm_ids = set()
+        for (ct_id, dp_id) in datapaths:
+            for entry in self.rftable.get_dp_entries(ct_id, dp_id):
+                if entry.get_status() in (RFENTRY_ASSOCIATED, RFENTRY_ACTIVE):
+                    vm_ids.add(entry.vm_id)
+        for vm_id in vm_ids:
+            self.ipc.request_resync(RFCLIENT_RFSERVER_CHANNEL, str(vm_id))
+        self.log.info("Asked clients to resync routes (ct_id=%s, clients=%i)"
+                      % (to, len(vm_ids)))
+
     # Port register methods
     def register_vm_port(self, vm_id, vm_port, eth_addr):
         action = None
@@ -115,8 +178,13 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
     # Takes a RouteMod, replaces its VM id,port with the associated DP id,port
     # and sends to the corresponding controller
     def register_route_mod(self, rm):
+        MongoIPC.stamp_trace(rm, TRACE_RFSERVER_ROUTE_MOD)
         vm_id = rm.get_id()
 
+        # Each copy sent on gets a trace of its own, forked from this one
+        trace = getattr(rm, "trace", None)
+        copies = itertools.count()
+
         # Find the output action
         for i, action in enumerate(rm.actions):
             if action['type'] is RFAT_OUTPUT:
@@ -152,7 +220,12 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
                                                          ct_id=entry.ct_id))
                 rm.add_option(Option.CT_ID(entry.ct_id))
 
-                self._send_rm_with_matches(rm, entry.dp_port, entries)
+                if self.pipeline:
+                    self._send_rm_to_route_table(rm, entry.ct_id, trace,
+                                                 copies)
+                else:
+                    self._send_rm_with_matches(rm, entry.dp_port, entries,
+                                               trace, copies)
 
                 remote_dps = self.isltable.get_entries(rem_ct=entry.ct_id,
                                                        rem_id=entry.dp_id)
@@ -165,9 +238,14 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
                         rm.add_action(Action.SET_ETH_SRC(r.eth_addr))
                         rm.add_action(Action.SET_ETH_DST(r.rem_eth_addr))
                         rm.add_action(Action.OUTPUT(r.dp_port))
+                        if self.pipeline:
+                            self._send_rm_to_route_table(rm, r.ct_id, trace,
+                                                         copies)
+                            continue
                         entries = self.rftable.get_entries(dp_id=r.dp_id,
                                                            ct_id=r.ct_id)
-                        self._send_rm_with_matches(rm, r.dp_port, entries)
+                        self._send_rm_with_matches(rm, r.dp_port, entries,
+                                                   trace, copies)
 
                 return
 
@@ -175,7 +253,7 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
         self.log.info("Received RouteMod with no Output Port - Dropping "
                       "(vm_id=%s)" % (format_id(vm_id)))
 
-    def _send_rm_with_matches(self, rm, out_port, entries):
+    def _send_rm_with_matches(self, rm, out_port, entries, trace, copies):
         #send entries matching external ports
         for entry in entries:
             if out_port != entry.dp_port:
@@ -183,10 +261,77 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
                    entry.get_status() == RFISL_ACTIVE:
                     rm.add_match(Match.ETHERNET(entry.eth_addr))
                     rm.add_match(Match.IN_PORT(entry.dp_port))
-                    self.ipc.send(RFSERVER_RFPROXY_CHANNEL,
-                                  str(entry.ct_id), rm)
+                    self._send_rm_copy(rm, entry.ct_id, trace, copies)
                     rm.set_matches(rm.get_matches()[:-2])
 
+    # Pipeline mode: the route goes in the route table once per datapath.
+    # Which ports and addresses may reach it is checked by the ingress rules
+    # in the first table, one per active port.
+    def _send_rm_to_route_table(self, rm, ct_id, trace, copies):
+        rm.add_option(Option.TABLE(RF_ROUTE_TABLE))
+        self._send_rm_copy(rm, ct_id, trace, copies)
+        rm.set_options(rm.get_options()[:-1])
+
+    # Send one copy of a RouteMod, with the next trace forked from 'trace', so
+    # that the proxies finish the update's trace once and a child trace for
+    # every other copy.
+    def _send_rm_copy(self, rm, ct_id, trace, copies):
+        rm.trace = MongoIPC.fork_trace(trace, next(copies))
+        self.ipc.send(RFSERVER_RFPROXY_CHANNEL, str(ct_id), rm)
+
+    def _send_ingress_rule(self, mod, ct_id, dp_id, dp_port, eth_addr):
+        rm = RouteMod(mod, dp_id)
+        rm.add_match(Match.ETHERNET(eth_addr))
+        rm.add_match(Match.IN_PORT(dp_port))
+        if mod == RMT_ADD:
+            rm.add_action(Action.GOTO_TABLE(RF_ROUTE_TABLE))
+        rm.add_option(Option.PRIORITY(PRIORITY_LOW))
+        rm.add_option(Option.CT_ID(ct_id))
+        self.ipc.send(RFSERVER_RFPROXY_CHANNEL, str(ct_id), rm)
+
+    def update_ingress_rule(self, entry, removed):
+        rule = None
+        if not removed and entry.get_status() in (RFENTRY_ACTIVE,
+                                                  RFISL_ACTIVE):
+            rule = (entry.ct_id, entry.dp_id, entry.dp_port, entry.eth_addr)
+
+        old = self.ingress_rules.get(entry.id)
+        if old == rule:
+            return
+        if old is not None:
+            del self.ingress_rules[entry.id]
+            self._send_ingress_rule(RMT_DELETE, *old)
+        if rule is not None:
+            self.ingress_rules[entry.id] = rule
+            self._send_ingress_rule(RMT_ADD, *rule)
+
+    def install_ingress_rules(self, ct_id, dp_id):
+        entries = self.rftable.get_dp_entries(ct_id, dp_id)
+        entries.extend(self.isltable.get_dp_entries(ct_id, dp_id))
+        for entry in entries:
+            rule = self.ingress_rules.get(entry.id)
+            if rule is not None:
+                self._send_ingress_rule(RMT_ADD, *rule)
+
+    # rfserver-core table updates
+    def update_core_port(self, entry, removed):
+        msg = PortEntryUpdate(entry_id=str(entry.id), removed=removed,
+                              vm_id=entry.vm_id, vm_port=entry.vm_port,
+                              ct_id=entry.ct_id, dp_id=entry.dp_id,
+                              dp_port=entry.dp_port, eth_addr=entry.eth_addr,
+                              status=entry.get_status())
+        self.ipc.send(RFCLIENT_RFSERVER_CHANNEL, RFSERVER_ID, msg)
+
+    def update_core_link(self, entry, removed):
+        msg = LinkEntryUpdate(entry_id=str(entry.id), removed=removed,
+                              ct_id=entry.ct_id, dp_id=entry.dp_id,
+                              dp_port=entry.dp_port, eth_addr=entry.eth_addr,
+                              rem_ct=entry.rem_ct, rem_id=entry.rem_id,
+                              rem_port=entry.rem_port,
+                              rem_eth_addr=entry.rem_eth_addr,
+                              status=entry.get_status())
+        self.ipc.send(RFCLIENT_RFSERVER_CHANNEL, RFSERVER_ID, msg)
+
     # DatapathPortRegister methods
     def register_dp_port(self, ct_id, dp_id, dp_port):
         stop = self.config_dp(ct_id, dp_id)
@@ -284,8 +429,11 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
                                                 format_id(entry.dp_id),
                                                 entry.dp_port))
 
-    def send_datapath_config_message(self, ct_id, dp_id, operation_id):
+    def send_datapath_config_message(self, ct_id, dp_id, operation_id,
+                                     table=None):
         rm = RouteMod(RMT_ADD, dp_id)
+        if table is not None:
+            rm.add_option(Option.TABLE(table))
 
         if operation_id == DC_CLEAR_FLOW_TABLE:
             rm.set_mod(RMT_DELETE)
@@ -349,6 +497,14 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
                                               DC_CLEAR_FLOW_TABLE)
             # TODO: enforce order: clear should always be executed first
             self.send_datapath_config_message(ct_id, dp_id, DC_DROP_ALL)
+            if self.pipeline:
+                self.send_datapath_config_message(ct_id, dp_id,
+                                                  DC_CLEAR_FLOW_TABLE,
+                                                  RF_ROUTE_TABLE)
+                self.send_datapath_config_message(ct_id, dp_id, DC_DROP_ALL,
+                                                  RF_ROUTE_TABLE)
+                # Clearing the tables took the ingress rules with it
+                self.install_ingress_rules(ct_id, dp_id)
             self.send_datapath_config_message(ct_id, dp_id, DC_OSPF)
             self.send_datapath_config_message(ct_id, dp_id, DC_BGP_PASSIVE)
             self.send_datapath_config_message(ct_id, dp_id, DC_BGP_ACTIVE)
@@ -363,6 +519,9 @@ class RFServer(RFProtocolFactory, IPC.IPCMessageProcessor):
 
     # DatapathDown methods
     def set_dp_down(self, ct_id, dp_id):
+        # RouteMods still waiting for the proxy would only fail now
+        self.ipc.discard(RFSERVER_RFPROXY_CHANNEL, str(ct_id), ROUTE_MOD,
+                         "id", str(dp_id))
         for entry in self.rftable.get_dp_entries(ct_id, dp_id):
             # For every port registered in that datapath, put it down
             self.set_dp_port_down(entry.ct_id, entry.dp_id, entry.dp_port)
@@ -423,9 +582,14 @@ if __name__ == "__main__":
                         help='VM-VS-DP mapping configuration file')
     parser.add_argument('-i', '--islconfig',
                         help='ISL mapping configuration file')
+    parser.add_argument('-c', '--core', action='store_true',
+                        help='leave RouteMods to rfserver-core')
+    parser.add_argument('-p', '--pipeline', action='store_true',
+                        help='install routes once per datapath, in a second '
+                             'flow table (needs OpenFlow 1.2)')
 
     args = parser.parse_args()
     try:
-        RFServer(args.configfile, args.islconfig)
+        RFServer(args.configfile, args.islconfig, args.core, args.pipeline)
     except IOError:
         sys.exit("Error opening file: {}".format(args.configfile))
@@ -1,3 +1,8 @@
+import copy
+import logging
+import threading
+import Queue
+
 import pymongo as mongo
 import bson
 
@@ -64,9 +69,153 @@ class MongoTable:
         return s.strip("\n")
 
 
-class RFTable(MongoTable):
+class CachedMongoTable(MongoTable):
+    """A MongoTable held in memory, with hash indexes on sets of fields.
+
+    The table is loaded from MongoDB when created. Lookups never leave
+    memory, and changes are written through to MongoDB by a thread of its
+    own, in order, so that other components can still see the table there.
+
+    Lookups return copies of the entries, which have to be passed to
+    set_entry for changes to them to take effect.
+
+    Memory holds the table, so a write that MongoDB fails only leaves the copy
+    there behind. Failed writes are counted in write_errors and logged, and
+    once writes succeed again the whole table is written back.
+    """
+    def __init__(self, address, name, entry_type, indexes):
+        MongoTable.__init__(self, address, name, entry_type)
+        self._lock = threading.Lock()
+        self._entries = {}
+        self._keys = {}
+        self._listeners = []
+        self._indexes = {}
+        for fields in indexes:
+            self._indexes[frozenset(fields)] = (tuple(fields), {})
+
+        for result in self.data.find():
+            entry = MongoTableEntryFactory.make(self.entry_type)
+            entry.from_dict(result)
+            self._insert(entry)
+
+        self.log = logging.getLogger("rfserver.rftable")
+        self.write_errors = 0
+        self._failing = 0
+        self._writes = Queue.Queue()
+        writer = threading.Thread(target=self._write_worker)
+        writer.daemon = True
+        writer.start()
+
+    def get_entries(self, **kwargs):
+        for (k, v) in kwargs.items():
+            kwargs[k] = str(v)
+        with self._lock:
+            index = self._indexes.get(frozenset(kwargs))
+            if index is not None:
+                (fields, buckets) = index
+                key = tuple(kwargs[f] for f in fields)
+                ids = buckets.get(key, ())
+                return [copy.copy(self._entries[id_]) for id_ in ids]
+
+            entries = []
+            for (id_, entry) in self._entries.items():
+                data = self._keys[id_]
+                if all(data.get(k) == v for (k, v) in kwargs.items()):
+                    entries.append(copy.copy(entry))
+            return entries
+
+    def set_entry(self, entry):
+        if entry.id is None:
+            entry.id = bson.ObjectId()
+        with self._lock:
+            self._delete(entry.id)
+            self._insert(copy.copy(entry))
+        self._writes.put((self.data.save, entry.to_dict()))
+        for listener in self._listeners:
+            listener(entry, False)
+
+    def remove_entry(self, entry):
+        with self._lock:
+            self._delete(entry.id)
+        self._writes.put((self.data.remove, entry.id))
+        for listener in self._listeners:
+            listener(entry, True)
+
+    def clear(self):
+        with self._lock:
+            self._entries.clear()
+            self._keys.clear()
+            for (fields, buckets) in self._indexes.values():
+                buckets.clear()
+        self._writes.put((self.data.remove, None))
+
+    def add_listener(self, listener):
+        """Call listener(entry, removed) after every change to an entry."""
+        self._listeners.append(listener)
+
+    def flush(self):
+        """Wait for all changes to be written to MongoDB."""
+        self._writes.join()
+
+    def _insert(self, entry):
+        data = entry.to_dict()
+        self._entries[entry.id] = entry
+        self._keys[entry.id] = data
+        for (fields, buckets) in self._indexes.values():
+            key = tuple(data[f] for f in fields)
+            buckets.setdefault(key, []).append(entry.id)
+
+    def _delete(self, id_):
+        data = self._keys.pop(id_, None)
+        if data is None:
+            return
+        del self._entries[id_]
+        for (fields, buckets) in self._indexes.values():
+            key = tuple(data[f] for f in fields)
+            ids = buckets[key]
+            ids.remove(id_)
+            if not ids:
+                del buckets[key]
+
+    def _write_worker(self):
+        while True:
+            (write, arg) = self._writes.get()
+            try:
+                write(arg)
+                if self._failing:
+                    self._rewrite()
+            except mongo.errors.PyMongoError as e:
+                self.write_errors += 1
+                self._failing += 1
+                if self._failing == 1:
+                    self.log.warning("Failed to write table %s to MongoDB, "
+                                     "it is out of date there until writes "
+                                     "succeed again: %s" % (self.data.name, e))
+            else:
+                if self._failing:
+                    self.log.info("Wrote table %s to MongoDB again, after %d "
+                                  "failed writes" %
+                                  (self.data.name, self._failing))
+                    self._failing = 0
+            self._writes.task_done()
+
+    def _rewrite(self):
+        """Write the whole table to MongoDB, making good any failed writes.
+        Writes queued since are written again after, which does no harm."""
+        with self._lock:
+            entries = [entry.to_dict() for entry in self._entries.values()]
+        for data in entries:
+            self.data.save(data)
+        self.data.remove({"_id": {"$nin": [data["_id"] for data in entries]}})
+
+
+class RFTable(CachedMongoTable):
     def __init__(self, address=MONGO_ADDRESS):
-        MongoTable.__init__(self, address, RFTABLE_NAME, RFENTRY)
+        CachedMongoTable.__init__(self, address, RFTABLE_NAME, RFENTRY,
+                                  [("vm_id", "vm_port"),
+                                   ("ct_id", "dp_id", "dp_port"),
+                                   ("dp_id", "ct_id"),
+                                   ("vs_id", "vs_port")])
 
     def get_entry_by_vm_port(self, vm_id, vm_port):
         result = self.get_entries(vm_id=vm_id,
@@ -124,9 +273,14 @@ class RFConfig(MongoTable):
             return None
         return result[0]
 
-class RFISLTable(MongoTable):
+class RFISLTable(CachedMongoTable):
     def __init__(self, address=MONGO_ADDRESS):
-        MongoTable.__init__(self, address, RFISL_NAME, RFISLENTRY)
+        CachedMongoTable.__init__(self, address, RFISL_NAME, RFISLENTRY,
+                                  [("dp_id", "ct_id"),
+                                   ("rem_id", "rem_ct"),
+                                   ("ct_id", "dp_id", "dp_port", "eth_addr"),
+                                   ("rem_ct", "rem_id", "rem_port",
+                                    "rem_eth_addr")])
 
     def get_entry_by_addr(self, ct_id, dp_id, dp_port, eth_addr):
         result = self.get_entries(ct_id=ct_id, dp_id=dp_id, dp_port=dp_port,
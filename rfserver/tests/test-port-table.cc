@@ -0,0 +1,157 @@
+/* Tests the copy of the RFTable and ISL table kept by RFServerCore: that VM
+ * ports are found only once associated with a datapath or waiting for one,
+ * that only active ports and ISLs are ingress ports, that an entry moved or
+ * removed is indexed where it is now, and the VMs a controller's routes come
+ * from, as rftable.py and rfserver.py find them. */
+
+#include "PortTable.hh"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+static PortEntry port(uint64_t vm_id, uint32_t vm_port, uint64_t ct_id,
+                      uint64_t dp_id, uint32_t dp_port, int status) {
+    PortEntry e = {vm_id, vm_port, ct_id, dp_id, dp_port,
+                   "02:00:00:00:00:01", status};
+    return e;
+}
+
+static LinkEntry link(uint64_t ct_id, uint64_t dp_id, uint32_t dp_port,
+                      uint64_t rem_ct, uint64_t rem_id, uint32_t rem_port,
+                      int status) {
+    LinkEntry e = {ct_id, dp_id, dp_port, "02:00:00:00:00:0a",
+                   rem_ct, rem_id, rem_port, "02:00:00:00:00:0b", status};
+    return e;
+}
+
+/* The ingress ports of a datapath, in the order given, as a string of port
+ * numbers. */
+static string ingress(const PortTable &table, uint64_t ct_id, uint64_t dp_id,
+                      bool links) {
+    vector<Ingress> in;
+    table.getIngress(ct_id, dp_id, links, in);
+    string s;
+    for (size_t i = 0; i < in.size(); i++) {
+        MUST_SUCCEED(in[i].ct_id == ct_id);
+        s += (char) ('0' + in[i].dp_port);
+    }
+    return s;
+}
+
+static void testVmPorts() {
+    PortTable table;
+    table.setPort("a", port(1, 1, 0, 0, 0, RFENTRY_IDLE_VM_PORT));
+    table.setPort("b", port(0, 0, 0, 10, 2, RFENTRY_IDLE_DP_PORT));
+    table.setPort("c", port(1, 2, 0, 10, 3, RFENTRY_ACTIVE));
+    table.setPort("d", port(1, 3, 0, 10, 4, RFENTRY_ASSOCIATED));
+
+    /* An idle VM port is found, for the caller to drop its routes; an idle
+     * datapath port has no VM port to be found by. */
+    const PortEntry *e = table.findVmPort(1, 1);
+    MUST_SUCCEED(e != NULL && e->status == RFENTRY_IDLE_VM_PORT);
+    MUST_SUCCEED(table.findVmPort(0, 0) == NULL);
+    e = table.findVmPort(1, 2);
+    MUST_SUCCEED(e != NULL && e->dp_id == 10 && e->dp_port == 3);
+    MUST_SUCCEED(table.findVmPort(1, 3)->status == RFENTRY_ASSOCIATED);
+    MUST_SUCCEED(table.findVmPort(2, 2) == NULL);
+
+    /* A port that moves is found where it is now, and not where it was. */
+    table.setPort("c", port(1, 5, 0, 11, 7, RFENTRY_ACTIVE));
+    MUST_SUCCEED(table.findVmPort(1, 2) == NULL);
+    e = table.findVmPort(1, 5);
+    MUST_SUCCEED(e != NULL && e->dp_id == 11 && e->dp_port == 7);
+
+    table.removePort("c");
+    MUST_SUCCEED(table.findVmPort(1, 5) == NULL);
+    table.removePort("c");
+    table.removePort("z");
+    MUST_SUCCEED(table.findVmPort(1, 3) != NULL);
+}
+
+static void testIngress() {
+    PortTable table;
+    table.setPort("a", port(1, 1, 0, 10, 1, RFENTRY_ACTIVE));
+    table.setPort("b", port(1, 2, 0, 10, 2, RFENTRY_ASSOCIATED));
+    table.setPort("c", port(0, 0, 0, 10, 3, RFENTRY_IDLE_DP_PORT));
+    table.setPort("d", port(2, 1, 0, 10, 4, RFENTRY_ACTIVE));
+    table.setPort("e", port(3, 1, 1, 10, 5, RFENTRY_ACTIVE));
+    table.setLink("x", link(0, 10, 6, 0, 20, 1, RFISL_ACTIVE));
+    table.setLink("y", link(0, 10, 7, 0, 0, 0, RFISL_IDLE_DP_PORT));
+
+    /* Only active ports, of this controller's datapath, and active ISLs if
+     * asked for. */
+    MUST_SUCCEED(ingress(table, 0, 10, false) == "14");
+    MUST_SUCCEED(ingress(table, 0, 10, true) == "146");
+    MUST_SUCCEED(ingress(table, 1, 10, true) == "5");
+    MUST_SUCCEED(ingress(table, 0, 11, true) == "");
+
+    table.setPort("d", port(2, 1, 0, 10, 4, RFENTRY_ASSOCIATED));
+    table.removeLink("x");
+    MUST_SUCCEED(ingress(table, 0, 10, true) == "1");
+    table.setLink("y", link(0, 10, 7, 0, 20, 2, RFISL_ACTIVE));
+    MUST_SUCCEED(ingress(table, 0, 10, true) == "17");
+}
+
+static void testRemoteLinks() {
+    PortTable table;
+    table.setLink("x", link(0, 20, 1, 0, 10, 6, RFISL_ACTIVE));
+    table.setLink("y", link(1, 30, 2, 0, 10, 7, RFISL_ACTIVE));
+    table.setLink("z", link(0, 0, 0, 0, 10, 8, RFISL_IDLE_REMOTE));
+    table.setLink("w", link(0, 40, 3, 0, 11, 1, RFISL_ACTIVE));
+
+    /* The active ISLs whose far end is the datapath, from any controller. */
+    vector<const LinkEntry*> remote;
+    table.getRemoteLinks(0, 10, remote);
+    MUST_SUCCEED(remote.size() == 2);
+    MUST_SUCCEED(remote[0]->dp_id == 20 && remote[0]->dp_port == 1);
+    MUST_SUCCEED(remote[1]->ct_id == 1 && remote[1]->dp_id == 30);
+
+    remote.clear();
+    table.getRemoteLinks(1, 10, remote);
+    MUST_SUCCEED(remote.empty());
+
+    /* A link that is taken down goes. */
+    table.setLink("x", link(0, 20, 1, 0, 0, 0, RFISL_IDLE_DP_PORT));
+    table.removeLink("y");
+    table.getRemoteLinks(0, 10, remote);
+    MUST_SUCCEED(remote.empty());
+}
+
+static void testVms() {
+    PortTable table;
+    table.setPort("a", port(1, 1, 0, 10, 1, RFENTRY_ACTIVE));
+    table.setPort("b", port(2, 1, 0, 10, 2, RFENTRY_ASSOCIATED));
+    table.setPort("c", port(3, 1, 0, 0, 0, RFENTRY_IDLE_VM_PORT));
+    table.setPort("d", port(4, 1, 1, 20, 1, RFENTRY_ACTIVE));
+    table.setPort("e", port(5, 1, 1, 30, 1, RFENTRY_ACTIVE));
+
+    /* The VMs of the controller's own datapaths... */
+    set<uint64_t> vms;
+    table.getVms(0, vms);
+    MUST_SUCCEED(vms.size() == 2 && vms.count(1) && vms.count(2));
+
+    /* ...and of those its active ISLs lead to. */
+    table.setLink("x", link(0, 10, 6, 1, 20, 2, RFISL_ACTIVE));
+    table.setLink("y", link(0, 10, 7, 1, 30, 2, RFISL_IDLE_DP_PORT));
+    vms.clear();
+    table.getVms(0, vms);
+    MUST_SUCCEED(vms.size() == 3 && vms.count(4) && !vms.count(5));
+
+    vms.clear();
+    table.getVms(2, vms);
+    MUST_SUCCEED(vms.empty());
+}
+
+int main() {
+    testVmPorts();
+    testIngress();
+    testRemoteLinks();
+    testVms();
+    return 0;
+}
@@ -0,0 +1,339 @@
+/* Tests the translation of RouteMods by RFServerCore against rfserver.py's
+ * register_route_mod: that a RouteMod for a VM port goes to its datapath
+ * once for every other active port, or once for the route table in pipeline
+ * mode, and to the far end of every active ISL to the datapath, that one
+ * with no datapath or output port is dropped, that table updates change
+ * where later RouteMods go, that other messages are passed on to
+ * rfserver.py, and which clients are asked to resync. */
+
+#include "RFServerCore.hh"
+#include "converter.h"
+#include "defs.h"
+#include "log/Log.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+static const string MAC1 = "02:00:00:00:00:01";
+static const string MAC2 = "02:00:00:00:00:02";
+static const string MAC3 = "02:00:00:00:00:03";
+static const string ISL_MAC = "02:00:00:00:00:0a";
+static const string REM_MAC = "02:00:00:00:00:0b";
+
+/* A message sent, with a copy of the RouteMod as it was when sent. */
+struct Sent {
+    string channel;
+    string to;
+    int type;
+    RouteMod rm;
+};
+
+/* Keeps what RFServerCore sends, and the clients it asks to resync. */
+class FakeIPC : public IPCMessageService {
+    public:
+        vector<Sent> sent;
+        vector<string> resyncs;
+
+        virtual void listen(const string &, IPCMessageFactory *,
+                            IPCMessageProcessor *, bool) {}
+        virtual bool send(const string &channelId, const string &to,
+                          IPCMessage& msg) {
+            Sent s;
+            s.channel = channelId;
+            s.to = to;
+            s.type = msg.get_type();
+            if (s.type == ROUTE_MOD)
+                s.rm = static_cast<RouteMod&>(msg);
+            sent.push_back(s);
+            return true;
+        }
+        virtual void discard(const string &, const string &, int,
+                             const string &, const string &) {}
+        virtual void request_resync(const string &channelId,
+                                    const string &to) {
+            MUST_SUCCEED(channelId == RFCLIENT_RFSERVER_CHANNEL);
+            resyncs.push_back(to);
+        }
+};
+
+static PortEntry port(uint64_t vm_id, uint32_t vm_port, uint64_t ct_id,
+                      uint64_t dp_id, uint32_t dp_port, const string &mac,
+                      int status) {
+    PortEntry e = {vm_id, vm_port, ct_id, dp_id, dp_port, mac, status};
+    return e;
+}
+
+/* VM 1 has ports 1 and 2 on ports 1 and 2 of datapath 10 of controller 0,
+ * and VM 2 port 1 on port 3 of it. Port 4 of datapath 10 has no VM and port
+ * 3 of VM 1 none of datapath. Datapath 20 of controller 1 has VM 3 on its
+ * port 1, and an ISL from its port 5 to port 6 of datapath 10, with an entry
+ * for each end. */
+static PortTable table() {
+    PortTable t;
+    t.setPort("a", port(1, 1, 0, 10, 1, MAC1, RFENTRY_ACTIVE));
+    t.setPort("b", port(1, 2, 0, 10, 2, MAC2, RFENTRY_ACTIVE));
+    t.setPort("c", port(2, 1, 0, 10, 3, MAC3, RFENTRY_ASSOCIATED));
+    t.setPort("d", port(0, 0, 0, 10, 4, MAC3, RFENTRY_IDLE_DP_PORT));
+    t.setPort("e", port(1, 3, 0, 0, 0, "", RFENTRY_IDLE_VM_PORT));
+    t.setPort("f", port(3, 1, 1, 20, 1, MAC3, RFENTRY_ACTIVE));
+    LinkEntry x = {1, 20, 5, ISL_MAC, 0, 10, 6, REM_MAC, RFISL_ACTIVE};
+    LinkEntry y = {0, 10, 6, REM_MAC, 1, 20, 5, ISL_MAC, RFISL_ACTIVE};
+    t.setLink("x", x);
+    t.setLink("y", y);
+    return t;
+}
+
+static RouteMod routeMod(uint8_t mod, uint64_t vm_id, uint32_t vm_port) {
+    RouteMod rm;
+    rm.set_mod(mod);
+    rm.set_id(vm_id);
+    rm.add_match(Match(RFMT_IPV4, IPAddress(IPV4, "10.0.0.0"),
+                       IPAddress(IPV4, "255.0.0.0")));
+    rm.add_action(Action(RFAT_SET_ETH_DST, MACAddress(MAC2)));
+    rm.add_action(Action(RFAT_OUTPUT, vm_port));
+    return rm;
+}
+
+static bool process(RFServerCore &core, IPCMessage &msg) {
+    return core.process("client", RFSERVER_ID, RFCLIENT_RFSERVER_CHANNEL, msg);
+}
+
+/* The value of the last option of a type, or -1 if there is none. */
+static long long option(RouteMod &rm, OptionType type) {
+    vector<Option> options = rm.get_options();
+    long long value = -1;
+    for (size_t i = 0; i < options.size(); i++)
+        if (options[i].getType() == type)
+            value = (type == RFOT_TABLE ? options[i].getUint16()
+                                        : options[i].getUint64());
+    return value;
+}
+
+static int count(RouteMod &rm, OptionType type) {
+    vector<Option> options = rm.get_options();
+    int n = 0;
+    for (size_t i = 0; i < options.size(); i++)
+        n += options[i].getType() == type;
+    return n;
+}
+
+/* Whether a RouteMod was sent to controller 'ct_id' for datapath 'dp_id'
+ * and matches on the route and then, unless 'in_port' is 0, on coming in
+ * through 'in_port' from 'mac'. */
+static bool sentTo(Sent &s, uint64_t ct_id, uint64_t dp_id, uint32_t in_port,
+                   const string &mac) {
+    if (s.channel != RFSERVER_RFPROXY_CHANNEL || s.type != ROUTE_MOD
+        || s.to != to_string<uint64_t>(ct_id) || s.rm.get_id() != dp_id
+        || option(s.rm, RFOT_CT_ID) != (long long) ct_id
+        || count(s.rm, RFOT_CT_ID) != 1)
+        return false;
+
+    vector<Match> m = s.rm.get_matches();
+    if (in_port == 0)
+        return m.size() == 1 && m[0].getType() == RFMT_IPV4;
+    return (m.size() == 3 && m[0].getType() == RFMT_IPV4
+            && m[1].getType() == RFMT_ETHERNET
+            && m[1] == Match(RFMT_ETHERNET, MACAddress(mac))
+            && m[2].getType() == RFMT_IN_PORT && m[2].getUint32() == in_port);
+}
+
+/* Whether the actions are the RouteMod's own, going out of 'out_port'. */
+static bool outputTo(RouteMod &rm, uint32_t out_port) {
+    vector<Action> a = rm.get_actions();
+    return (a.size() == 2 && a[0] == Action(RFAT_SET_ETH_DST, MACAddress(MAC2))
+            && a[1].getType() == RFAT_OUTPUT && a[1].getUint32() == out_port);
+}
+
+/* Whether the actions send traffic over the ISL to datapath 10. */
+static bool outputOverLink(RouteMod &rm) {
+    vector<Action> a = rm.get_actions();
+    return (a.size() == 3
+            && a[0] == Action(RFAT_SET_ETH_SRC, MACAddress(ISL_MAC))
+            && a[1] == Action(RFAT_SET_ETH_DST, MACAddress(REM_MAC))
+            && a[2].getType() == RFAT_OUTPUT && a[2].getUint32() == 5);
+}
+
+static void testMatches() {
+    FakeIPC ipc;
+    RFServerCore core(&ipc, table(), false);
+    RouteMod rm = routeMod(RMT_ADD, 1, 2);
+    MUST_SUCCEED(process(core, rm));
+
+    /* Out of port 2 of datapath 10, for traffic in through its other active
+     * port and its ISL, then out of the ISL at datapath 20, for traffic in
+     * through its active port. */
+    vector<Sent> &sent = ipc.sent;
+    MUST_SUCCEED(sent.size() == 3);
+    MUST_SUCCEED(sentTo(sent[0], 0, 10, 1, MAC1));
+    MUST_SUCCEED(outputTo(sent[0].rm, 2));
+    MUST_SUCCEED(sentTo(sent[1], 0, 10, 6, REM_MAC));
+    MUST_SUCCEED(outputTo(sent[1].rm, 2));
+    MUST_SUCCEED(sentTo(sent[2], 1, 20, 1, MAC3));
+    MUST_SUCCEED(outputOverLink(sent[2].rm));
+    for (size_t i = 0; i < sent.size(); i++)
+        MUST_SUCCEED(option(sent[i].rm, RFOT_TABLE) == -1);
+
+    /* A delete has no output action. */
+    ipc.sent.clear();
+    rm = routeMod(RMT_DELETE, 1, 1);
+    MUST_SUCCEED(process(core, rm));
+    MUST_SUCCEED(sent.size() == 3);
+    MUST_SUCCEED(sentTo(sent[0], 0, 10, 2, MAC2));
+    MUST_SUCCEED(sent[0].rm.get_mod() == RMT_DELETE);
+    vector<Action> a = sent[0].rm.get_actions();
+    MUST_SUCCEED(a.size() == 1 && a[0].getType() == RFAT_SET_ETH_DST);
+    MUST_SUCCEED(sentTo(sent[1], 0, 10, 6, REM_MAC));
+    MUST_SUCCEED(sentTo(sent[2], 1, 20, 1, MAC3));
+    MUST_SUCCEED(outputOverLink(sent[2].rm));
+}
+
+static void testPipeline() {
+    FakeIPC ipc;
+    RFServerCore core(&ipc, table(), true);
+    RouteMod rm = routeMod(RMT_ADD, 1, 2);
+    MUST_SUCCEED(process(core, rm));
+
+    /* Once for the route table of each datapath, matching on the route. */
+    vector<Sent> &sent = ipc.sent;
+    MUST_SUCCEED(sent.size() == 2);
+    MUST_SUCCEED(sentTo(sent[0], 0, 10, 0, ""));
+    MUST_SUCCEED(outputTo(sent[0].rm, 2));
+    MUST_SUCCEED(sentTo(sent[1], 1, 20, 0, ""));
+    MUST_SUCCEED(outputOverLink(sent[1].rm));
+    for (size_t i = 0; i < sent.size(); i++) {
+        MUST_SUCCEED(option(sent[i].rm, RFOT_TABLE) == RF_ROUTE_TABLE);
+        MUST_SUCCEED(count(sent[i].rm, RFOT_TABLE) == 1);
+    }
+}
+
+static void testDropped() {
+    FakeIPC ipc;
+    RFServerCore core(&ipc, table(), false);
+
+    /* A VM port that is unknown, or not associated with a datapath. */
+    RouteMod rm = routeMod(RMT_ADD, 1, 4);
+    MUST_SUCCEED(process(core, rm));
+    rm = routeMod(RMT_ADD, 1, 3);
+    MUST_SUCCEED(process(core, rm));
+    rm = routeMod(RMT_ADD, 4, 1);
+    MUST_SUCCEED(process(core, rm));
+
+    /* No output action. */
+    rm = routeMod(RMT_ADD, 1, 2);
+    vector<Action> a = rm.get_actions();
+    a.pop_back();
+    rm.set_actions(a);
+    MUST_SUCCEED(process(core, rm));
+    MUST_SUCCEED(ipc.sent.empty());
+
+    /* A datapath with no other active port nor ISL sends nowhere. */
+    LinkEntryUpdate lu("x", true, 0, 0, 0, "", 0, 0, 0, "", 0);
+    MUST_SUCCEED(process(core, lu));
+    lu.set_entry_id("y");
+    MUST_SUCCEED(process(core, lu));
+    rm = routeMod(RMT_ADD, 3, 1);
+    MUST_SUCCEED(process(core, rm));
+    MUST_SUCCEED(ipc.sent.empty());
+}
+
+static void testUpdates() {
+    FakeIPC ipc;
+    RFServerCore core(&ipc, table(), false);
+
+    /* VM 1 port 2 moves to port 7 of datapath 10, and the ISL goes down. */
+    PortEntryUpdate pu("b", false, 1, 2, 0, 10, 7, MAC2, RFENTRY_ACTIVE);
+    MUST_SUCCEED(process(core, pu));
+    LinkEntryUpdate lu("x", false, 1, 20, 5, ISL_MAC, 0, 0, 0, "",
+                       RFISL_IDLE_DP_PORT);
+    MUST_SUCCEED(process(core, lu));
+    lu.set_entry_id("y");
+    lu.set_removed(true);
+    MUST_SUCCEED(process(core, lu));
+    MUST_SUCCEED(ipc.sent.empty());
+
+    RouteMod rm = routeMod(RMT_ADD, 1, 2);
+    MUST_SUCCEED(process(core, rm));
+    MUST_SUCCEED(ipc.sent.size() == 1);
+    MUST_SUCCEED(sentTo(ipc.sent[0], 0, 10, 1, MAC1));
+    MUST_SUCCEED(outputTo(ipc.sent[0].rm, 7));
+
+    /* Once removed, its routes are dropped. */
+    ipc.sent.clear();
+    pu.set_removed(true);
+    MUST_SUCCEED(process(core, pu));
+    rm = routeMod(RMT_ADD, 1, 2);
+    MUST_SUCCEED(process(core, rm));
+    MUST_SUCCEED(ipc.sent.empty());
+}
+
+static void testPassedOn() {
+    FakeIPC ipc;
+    RFServerCore core(&ipc, table(), false);
+    PortRegister pr(5, 1, MACAddress(MAC1));
+    MUST_SUCCEED(process(core, pr));
+    MUST_SUCCEED(ipc.sent.size() == 1);
+    MUST_SUCCEED(ipc.sent[0].channel == RFCLIENT_RFSERVER_CHANNEL);
+    MUST_SUCCEED(ipc.sent[0].to == RFSERVER_CONTROL_ID);
+    MUST_SUCCEED(ipc.sent[0].type == PORT_REGISTER);
+}
+
+static void testTraces() {
+    Trace::setSample(1);
+    FakeIPC ipc;
+    RFServerCore core(&ipc, table(), false);
+    RouteMod rm = routeMod(RMT_ADD, 1, 2);
+    rm.trace.start(TRACE_NETLINK_RECEIVE);
+    uint64_t id = rm.trace.id;
+    MUST_SUCCEED(process(core, rm));
+
+    /* The first copy carries the trace on, the others child traces. */
+    vector<Sent> &sent = ipc.sent;
+    MUST_SUCCEED(sent.size() == 3);
+    MUST_SUCCEED(sent[0].rm.trace.id == id && sent[0].rm.trace.parent == 0);
+    MUST_SUCCEED(sent[1].rm.trace.parent == id);
+    MUST_SUCCEED(sent[2].rm.trace.parent == id);
+    MUST_SUCCEED(sent[1].rm.trace.id != id);
+    MUST_SUCCEED(sent[2].rm.trace.id != id);
+    MUST_SUCCEED(sent[1].rm.trace.id != sent[2].rm.trace.id);
+}
+
+static void testResync() {
+    FakeIPC ipc;
+    RFServerCore core(&ipc, table(), false);
+
+    /* The clients whose routes go to a controller's datapaths, through
+     * their own ports or over its ISLs. */
+    core.resync(RFSERVER_RFPROXY_CHANNEL, "1");
+    MUST_SUCCEED(ipc.resyncs.size() == 3);
+    MUST_SUCCEED(ipc.resyncs[0] == "1" && ipc.resyncs[2] == "3");
+
+    LinkEntryUpdate lu("y", true, 0, 0, 0, "", 0, 0, 0, "", 0);
+    MUST_SUCCEED(process(core, lu));
+    ipc.resyncs.clear();
+    core.resync(RFSERVER_RFPROXY_CHANNEL, "0");
+    MUST_SUCCEED(ipc.resyncs.size() == 2);
+    MUST_SUCCEED(ipc.resyncs[0] == "1" && ipc.resyncs[1] == "2");
+
+    /* Messages passed on to rfserver.py cannot be resent from here. */
+    ipc.resyncs.clear();
+    core.resync(RFCLIENT_RFSERVER_CHANNEL, RFSERVER_CONTROL_ID);
+    MUST_SUCCEED(ipc.resyncs.empty());
+}
+
+int main() {
+    Log::init("test-rfserver-core", RFLL_ERR, false);
+    testMatches();
+    testPipeline();
+    testDropped();
+    testUpdates();
+    testPassedOn();
+    testTraces();
+    testResync();
+    return 0;
+}
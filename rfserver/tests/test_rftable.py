@@ -0,0 +1,201 @@
+"""Tests the in-memory tables of rfserver: that a table is loaded from
+MongoDB, that lookups by index and by scan find the entries as they were last
+set and hand out copies, that changes are written through to MongoDB in
+order, and that writes MongoDB fails are counted and made good once it takes
+writes again. MongoDB is replaced by a collection held in memory."""
+
+import logging
+import os
+import sys
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "..", ".."))
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+
+import pymongo as mongo
+import bson
+
+import rftable
+from rftable import RFTable, RFEntry
+
+
+class FakeCollection:
+    """Just enough of a pymongo collection for CachedMongoTable."""
+    def __init__(self, name):
+        self.name = name
+        self.docs = {}
+        self.failing = False
+
+    def find(self):
+        return [dict(doc) for doc in self.docs.values()]
+
+    def save(self, data):
+        self._check()
+        self.docs[data["_id"]] = dict(data)
+        return data["_id"]
+
+    def remove(self, spec=None):
+        self._check()
+        if spec is None:
+            self.docs.clear()
+        elif isinstance(spec, dict):
+            kept = spec["_id"]["$nin"]
+            for id_ in list(self.docs):
+                if id_ not in kept:
+                    del self.docs[id_]
+        else:
+            self.docs.pop(spec, None)
+
+    def _check(self):
+        if self.failing:
+            raise mongo.errors.PyMongoError("not master")
+
+
+collections = {}
+
+class FakeConnection:
+    def __init__(self, *address):
+        pass
+
+    def __getitem__(self, db):
+        return collections
+
+
+class Records(logging.Handler):
+    def __init__(self):
+        logging.Handler.__init__(self)
+        self.records = []
+
+    def emit(self, record):
+        self.records.append(record)
+
+
+class CachedMongoTableTest(unittest.TestCase):
+    def setUp(self):
+        self.log = Records()
+        logging.getLogger("rfserver.rftable").addHandler(self.log)
+        logging.getLogger("rfserver.rftable").setLevel(logging.INFO)
+        collections.clear()
+        self.collection = collections.setdefault(
+            rftable.RFTABLE_NAME, FakeCollection(rftable.RFTABLE_NAME))
+        self.connection = mongo.Connection
+        mongo.Connection = FakeConnection
+
+    def tearDown(self):
+        mongo.Connection = self.connection
+        logging.getLogger("rfserver.rftable").removeHandler(self.log)
+
+    def saved(self, entry):
+        """Get the entry with the id of 'entry' as MongoDB has it."""
+        data = self.collection.docs.get(entry.id)
+        if data is None:
+            return None
+        saved = RFEntry()
+        saved.from_dict(dict(data))
+        return saved
+
+    def test_load(self):
+        entry = RFEntry(vm_id=1, vm_port=2, eth_addr="00:00:00:00:00:01")
+        entry.id = bson.ObjectId()
+        self.collection.save(entry.to_dict())
+
+        table = RFTable()
+        found = table.get_entry_by_vm_port(1, 2)
+        self.assertEqual(found.id, entry.id)
+        self.assertEqual(found.eth_addr, "00:00:00:00:00:01")
+        self.assertEqual(table.get_entries(eth_addr="00:00:00:00:00:01")[0].id,
+                         entry.id)
+
+    def test_lookups(self):
+        table = RFTable()
+        changes = []
+        table.add_listener(lambda entry, removed:
+                           changes.append((entry.vm_port, removed)))
+        entry = RFEntry(vm_id=1, vm_port=2)
+        table.set_entry(entry)
+        other = RFEntry(vm_id=1, vm_port=3)
+        table.set_entry(other)
+        self.assertTrue(entry.id is not None)
+
+        # Lookups by index and by scan, which hand out copies
+        found = table.get_entry_by_vm_port(1, 2)
+        self.assertEqual(found.id, entry.id)
+        found.vm_port = 4
+        self.assertEqual(table.get_entry_by_vm_port(1, 4), None)
+        self.assertEqual(table.get_entry_by_vm_port(1, 2).vm_port, 2)
+        self.assertEqual(len(table.get_entries(vm_id=1)), 2)
+
+        # Changes to indexed fields move the entry in the index
+        entry.ct_id, entry.dp_id, entry.dp_port = 0, 5, 6
+        table.set_entry(entry)
+        self.assertEqual(table.get_entry_by_dp_port(0, 5, 6).id, entry.id)
+        self.assertEqual(len(table.get_dp_entries(0, 5)), 1)
+        self.assertEqual(table.get_entry_by_vm_port(1, 2).dp_port, 6)
+
+        table.remove_entry(other)
+        self.assertEqual(table.get_entry_by_vm_port(1, 3), None)
+        self.assertEqual(len(table.get_entries(vm_id=1)), 1)
+        self.assertEqual(changes, [(2, False), (3, False), (2, False),
+                                   (3, True)])
+
+    def test_write_through(self):
+        table = RFTable()
+        entry = RFEntry(vm_id=1, vm_port=2)
+        table.set_entry(entry)
+        other = RFEntry(vm_id=1, vm_port=3)
+        table.set_entry(other)
+        entry.dp_id = 5
+        table.set_entry(entry)
+        table.remove_entry(other)
+        table.flush()
+        self.assertEqual(self.saved(entry).dp_id, 5)
+        self.assertEqual(self.saved(other), None)
+        self.assertEqual(len(self.collection.docs), 1)
+
+        table.clear()
+        table.flush()
+        self.assertEqual(self.collection.docs, {})
+        self.assertEqual(table.get_entries(), [])
+        self.assertEqual(table.write_errors, 0)
+
+    def test_write_errors(self):
+        table = RFTable()
+        entry = RFEntry(vm_id=1, vm_port=2)
+        table.set_entry(entry)
+        other = RFEntry(vm_id=1, vm_port=3)
+        table.set_entry(other)
+        table.flush()
+
+        # Writes that fail are counted and logged once, and memory still has
+        # the changes
+        self.collection.failing = True
+        entry.dp_id = 5
+        table.set_entry(entry)
+        table.remove_entry(other)
+        added = RFEntry(vm_id=1, vm_port=4)
+        table.set_entry(added)
+        table.flush()
+        self.assertEqual(table.write_errors, 3)
+        self.assertEqual(self.saved(entry).dp_id, None)
+        self.assertEqual(table.get_entry_by_vm_port(1, 2).dp_id, 5)
+        self.assertEqual(table.get_entry_by_vm_port(1, 3), None)
+        self.assertEqual([r.levelno for r in self.log.records],
+                         [logging.WARNING])
+
+        # The next write that succeeds brings MongoDB up to date
+        self.collection.failing = False
+        last = RFEntry(vm_id=1, vm_port=5)
+        table.set_entry(last)
+        table.flush()
+        self.assertEqual(table.write_errors, 3)
+        self.assertEqual(self.saved(entry).dp_id, 5)
+        self.assertEqual(self.saved(other), None)
+        self.assertEqual(self.saved(added).vm_port, 4)
+        self.assertEqual(self.saved(last).vm_port, 5)
+        self.assertEqual(len(self.collection.docs), 3)
+        self.assertEqual([r.levelno for r in self.log.records],
+                         [logging.WARNING, logging.INFO])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -94,6 +94,7 @@ def add_actions(flow_mod, action_tlvs):
   parser = flow_mod.datapath.ofproto_parser
   ofproto = flow_mod.datapath.ofproto
   actions = []
+  goto = []
   for a in action_tlvs:
     action = Action.from_dict(a)
     if action._type == RFAT_OUTPUT:
@@ -108,13 +109,15 @@ def add_actions(flow_mod, action_tlvs):
       dstMac = action._value
       dst = parser.OFPMatchField.make(ofproto.OXM_OF_ETH_DST, dstMac)
       actions.append(parser.OFPActionSetField(dst))
+    elif action._type == RFAT_GOTO_TABLE:
+      goto = [parser.OFPInstructionGotoTable(bin_to_int(action._value))]
     elif action.optional():
         log.info("Dropping unsupported Action (type: %s)" % action._type)
     else:
         log.warning("Failed to serialise Action (type: %s)" % action._type)
         return
   inst = parser.OFPInstructionActions(ofproto.OFPIT_APPLY_ACTIONS, actions)
-  flow_mod.instructions = [inst]
+  flow_mod.instructions = [inst] + goto
 
 def add_options(flow_mod, options):
   for o in options:
@@ -125,6 +128,8 @@ def add_options(flow_mod, options):
       flow_mod.idle_timeout = bin_to_int(option._value)
     elif option._type == RFOT_HARD_TIMEOUT:
       flow_mod.hard_timeout = bin_to_int(option._value)
+    elif option._type == RFOT_TABLE:
+      flow_mod.table_id = bin_to_int(option._value)
     elif option._type == RFOT_CT_ID:
       pass
     elif option.optional():
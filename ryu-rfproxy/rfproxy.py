@@ -6,7 +6,7 @@ import pymongo as mongo
 from ofinterface import *
 
 import rflib.ipc.IPC as IPC
-import rflib.ipc.MongoIPC as MongoIPC
+import rflib.ipc.IPCService as IPCService
 from rflib.ipc.RFProtocol import *
 from rflib.ipc.RFProtocolFactory import RFProtocolFactory
 from rflib.defs import *
@@ -127,8 +127,9 @@ class RFProxy(app_manager.RyuApp):
     super(RFProxy, self).__init__(*args, **kwargs)
 
     ID = 0
-    self.ipc = MongoIPC.MongoIPCMessageService(MONGO_ADDRESS, MONGO_DB_NAME, str(ID),
-                                      hub_thread_wrapper, hub.sleep)
+    self.ipc = IPCService.create_ipc_message_service(
+        IPCService.default_ipc_address(), MONGO_DB_NAME, str(ID),
+        hub_thread_wrapper, hub.sleep)
     self.ipc.listen(RFSERVER_RFPROXY_CHANNEL, RFProtocolFactory(), RFProcessor(),
                False)
     log.info("RFProxy running.")
@@ -153,6 +154,9 @@ class RFProxy(app_manager.RyuApp):
       table.delete_dp(dpid)
       msg = DatapathDown(dp_id=dpid)
       self.ipc.send(RFSERVER_RFPROXY_CHANNEL, RFSERVER_ID, msg)
+      # Drop the RouteMods still queued for it, they would only fail
+      self.ipc.discard(RFSERVER_RFPROXY_CHANNEL, self.ipc.get_id(), ROUTE_MOD,
+                       "id", str(dpid))
 
 
   @set_ev_cls(ofp_event.EventOFPPacketIn, MAIN_DISPATCHER)